@@ -0,0 +1,184 @@
+/*
+ * file:        bitmap.c
+ * description: allocation bitmaps for CS492 file system
+ *
+ * Bitmaps are scanned a 64-bit word at a time, finding clear bits
+ * with count-trailing-zeros; with AVX2, runs of full words are
+ * skipped 256 bits at a time. Free bits are counted once when the
+ * bitmap is loaded and then kept up to date as bits change.
+ *
+ * Reserved bits are kept in a second, in-core only bitmap so that
+ * reservations never reach the disk.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "bitmap.h"
+
+/**
+ * Get the mask of bits in a word that are within the bitmap.
+ */
+static uint64_t word_mask(const struct bitmap *bm, int w)
+{
+	int rem = bm->nbits - w * 64;
+	return rem >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << rem) - 1;
+}
+
+/**
+ * Get the bits of a word that are clear and not reserved.
+ */
+static uint64_t free_bits(const struct bitmap *bm, int w)
+{
+	uint64_t used = bm->words[w];
+	if (bm->resv != NULL)
+		used |= bm->resv[w];
+	return ~used & word_mask(bm, w);
+}
+
+void bitmap_init(struct bitmap *bm, void *map, int nbits)
+{
+	bm->words = map;
+	bm->resv = NULL;
+	bm->nresv = 0;
+	bm->nbits = nbits;
+	bm->nwords = (nbits + 63) / 64;
+	bm->cursor = 0;
+	bm->nfree = 0;
+	for (int w = 0; w < bm->nwords; w++)
+		bm->nfree += __builtin_popcountll(~bm->words[w] & word_mask(bm, w));
+}
+
+int bitmap_test(const struct bitmap *bm, int bit)
+{
+	return (bm->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+void bitmap_set(struct bitmap *bm, int bit)
+{
+	uint64_t m = (uint64_t)1 << (bit % 64);
+	if (!(bm->words[bit / 64] & m))
+	{
+		bm->words[bit / 64] |= m;
+		bm->nfree--;
+	}
+}
+
+void bitmap_clear(struct bitmap *bm, int bit)
+{
+	uint64_t m = (uint64_t)1 << (bit % 64);
+	if (bm->words[bit / 64] & m)
+	{
+		bm->words[bit / 64] &= ~m;
+		bm->nfree++;
+	}
+}
+
+int bitmap_reserve(struct bitmap *bm, int bit)
+{
+	if (bm->resv == NULL && (bm->resv = calloc(bm->nwords, sizeof(uint64_t))) == NULL)
+		return -1;
+	uint64_t m = (uint64_t)1 << (bit % 64);
+	if (!(bm->resv[bit / 64] & m))
+	{
+		bm->resv[bit / 64] |= m;
+		bm->nresv++;
+	}
+	return 0;
+}
+
+void bitmap_unreserve(struct bitmap *bm, int bit)
+{
+	uint64_t m = (uint64_t)1 << (bit % 64);
+	if (bm->resv != NULL && (bm->resv[bit / 64] & m))
+	{
+		bm->resv[bit / 64] &= ~m;
+		bm->nresv--;
+	}
+}
+
+/**
+ * Find the first word at or after w and before end with a clear bit.
+ *
+ * @return the word, or end if none
+ */
+static int find_word(const struct bitmap *bm, int w, int end)
+{
+#ifdef __AVX2__
+	// skip groups of four full words
+	const __m256i ones = _mm256_set1_epi64x(-1);
+	while (w + 4 <= end)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)&bm->words[w]);
+		if (bm->resv != NULL)
+			v = _mm256_or_si256(v, _mm256_loadu_si256((const __m256i *)&bm->resv[w]));
+		if (!_mm256_testc_si256(v, ones))
+			break;
+		w += 4;
+	}
+#endif
+	for (; w < end; w++)
+	{
+		if (free_bits(bm, w))
+			return w;
+	}
+	return end;
+}
+
+int bitmap_alloc(struct bitmap *bm)
+{
+	if (bm->nfree == 0)
+		return -1;
+
+	// next fit: search from the cursor to the end, then from the start
+	int w = find_word(bm, bm->cursor, bm->nwords);
+	if (w == bm->nwords)
+	{
+		w = find_word(bm, 0, bm->cursor);
+		if (w == bm->cursor)
+			return -1;
+	}
+
+	int bit = w * 64 + __builtin_ctzll(free_bits(bm, w));
+	bm->cursor = w;
+	bitmap_set(bm, bit);
+	return bit;
+}
+
+int bitmap_find(struct bitmap *bm, int goal, int maxlen, int *len)
+{
+	if (goal < 0 || goal >= bm->nbits)
+		goal = bm->cursor * 64;
+
+	// first free bit at or after the goal, wrapping around once
+	int w = goal / 64, bit;
+	uint64_t f = free_bits(bm, w) & (~(uint64_t)0 << (goal % 64));
+	if (f)
+		bit = w * 64 + __builtin_ctzll(f);
+	else
+	{
+		int x = find_word(bm, w + 1, bm->nwords);
+		if (x == bm->nwords && (x = find_word(bm, 0, w + 1)) == w + 1)
+			return -1;
+		bit = x * 64 + __builtin_ctzll(free_bits(bm, x));
+	}
+	bm->cursor = bit / 64;
+
+	// measure the run of free bits, a word at a time
+	int n = 0;
+	for (int b = bit; n < maxlen && b < bm->nbits;)
+	{
+		f = free_bits(bm, b / 64) >> (b % 64);
+		int run = (~f == 0) ? 64 : __builtin_ctzll(~f);
+		n += run;
+		b += run;
+		if (run == 0 || b % 64 != 0)
+			break;
+	}
+	*len = n < maxlen ? n : maxlen;
+	return bit;
+}
@@ -0,0 +1,97 @@
+/*
+ * file:        bitmap.h
+ * description: allocation bitmaps for CS492 file system
+ */
+
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+#include <stdint.h>
+
+/** an in-core allocation bitmap; a set bit is in use */
+struct bitmap {
+	uint64_t *words; /* bitmap words, in on-disk bit order */
+	uint64_t *resv;	 /* reserved bits, or NULL if none reserved yet */
+	int nbits;		 /* number of bits in use */
+	int nwords;		 /* number of words covering nbits */
+	int nfree;		 /* number of clear bits, including reserved ones */
+	int nresv;		 /* number of reserved bits */
+	int cursor;		 /* word where the next-fit search starts */
+};
+
+/*
+ * Initialize a bitmap over an in-core copy of an on-disk map and
+ * count its clear bits. Bits past nbits are ignored.
+ *
+ * @param bm: the bitmap
+ * @param map: the map, a whole number of 64-bit words
+ * @param nbits: the number of bits in the map
+ */
+extern void bitmap_init(struct bitmap *bm, void *map, int nbits);
+
+/*
+ * Test a bit.
+ *
+ * @param bm: the bitmap
+ * @param bit: the bit
+ * @return: nonzero if the bit is set
+ */
+extern int bitmap_test(const struct bitmap *bm, int bit);
+
+/*
+ * Set a bit, marking it in use.
+ *
+ * @param bm: the bitmap
+ * @param bit: the bit
+ */
+extern void bitmap_set(struct bitmap *bm, int bit);
+
+/*
+ * Clear a bit, marking it free.
+ *
+ * @param bm: the bitmap
+ * @param bit: the bit
+ */
+extern void bitmap_clear(struct bitmap *bm, int bit);
+
+/*
+ * Reserve a clear bit. Reserved bits stay clear in the map, but
+ * are skipped by bitmap_alloc and bitmap_find.
+ *
+ * @param bm: the bitmap
+ * @param bit: the bit
+ * @return: 0, or -1 if cannot allocate the reserved bits
+ */
+extern int bitmap_reserve(struct bitmap *bm, int bit);
+
+/*
+ * Release a reserved bit.
+ *
+ * @param bm: the bitmap
+ * @param bit: the bit
+ */
+extern void bitmap_unreserve(struct bitmap *bm, int bit);
+
+/*
+ * Find and set a clear bit, searching from where the previous
+ * allocation left off and wrapping around once.
+ *
+ * @param bm: the bitmap
+ * @return: the bit, or -1 if all bits are set
+ */
+extern int bitmap_alloc(struct bitmap *bm);
+
+/*
+ * Find the first clear, unreserved bit at or after a goal, wrapping
+ * around once, and the length of the run of such bits starting
+ * there. No bits are changed.
+ *
+ * @param bm: the bitmap
+ * @param goal: the bit to start at, or -1 to continue the next-fit search
+ * @param maxlen: the maximum run length to measure
+ * @param len: holder for the run length, at most maxlen
+ * @return: the first bit of the run, or -1 if none
+ */
+extern int bitmap_find(struct bitmap *bm, int goal, int maxlen, int *len);
+
+#endif /* BITMAP_H_ */
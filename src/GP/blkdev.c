@@ -0,0 +1,30 @@
+/*
+ * file:        blkdev.c
+ * description: helpers for block devices stacked on other devices
+ */
+
+#include <stddef.h>
+
+#include "blkdev.h"
+
+/*
+ * submit and complete are only useful together, so both are cleared
+ * if the lower device lacks either.
+ */
+void blkdev_mask_ops(const struct blkdev_ops *lower, struct blkdev_ops *ops)
+{
+	if (lower->map == NULL)
+		ops->map = NULL;
+	if (lower->readv == NULL)
+		ops->readv = NULL;
+	if (lower->writev == NULL)
+		ops->writev = NULL;
+	if (lower->submit == NULL || lower->complete == NULL)
+		ops->submit = ops->complete = NULL;
+	if (lower->prefetch == NULL)
+		ops->prefetch = NULL;
+	if (lower->fd == NULL)
+		ops->fd = NULL;
+	if (lower->sync == NULL)
+		ops->sync = NULL;
+}
@@ -15,6 +15,23 @@ enum { BLOCK_SIZE = 1024};
 /** block device operation status */
 enum { SUCCESS = 0, E_BADADDR = -1, E_UNAVAIL = -2, E_SIZE = -3};
 
+/** One block of a vectored transfer */
+struct blkvec {
+	int blk; /* block number */
+	void *buf; /* BLOCK_SIZE buffer for the block */
+};
+
+/** An asynchronous block request */
+struct blkreq {
+	int write; /* nonzero to write, zero to read */
+	int first_blk; /* first block to transfer */
+	int num_blks; /* number of blocks to transfer */
+	void *buf; /* buffer for num_blks blocks */
+	int status; /* operation status once done */
+	int done; /* nonzero once complete */
+	struct blkreq *next; /* used by device while request is queued */
+};
+
 /** Definition of a block device */
 struct blkdev {
 	struct blkdev_ops *ops; /* operations on block device */
@@ -28,6 +45,39 @@ struct blkdev_ops {
 	int  (*write)(struct blkdev *dev, int first_blk, int num_blks, void *buf);
 	int  (*flush)(struct blkdev *dev, int first_blk, int num_blks);
 	void (*close)(struct blkdev *dev);
+	/* optional: address of block in place, valid until device is closed,
+	 * or NULL if it cannot be mapped; contents must not be modified */
+	void *(*map)(struct blkdev *dev, int blk);
+	/* optional: transfer a list of blocks, adjacent entries for
+	 * consecutive blocks may be combined into a single transfer */
+	int  (*readv)(struct blkdev *dev, struct blkvec *vec, int nvec);
+	int  (*writev)(struct blkdev *dev, struct blkvec *vec, int nvec);
+	/* optional: start requests without waiting for them, and wait
+	 * until requests started by submit are complete */
+	int  (*submit)(struct blkdev *dev, struct blkreq *reqs, int nreqs);
+	int  (*complete)(struct blkdev *dev, struct blkreq *reqs, int nreqs);
+	/* optional: hint that blocks will be read soon; the device may
+	 * start reading them without waiting for them. Returns the number
+	 * of leading blocks accepted, fewer if the device has no room */
+	int  (*prefetch)(struct blkdev *dev, const int *blks, int nblks);
+	/* optional: file descriptor of a file holding the device, block n
+	 * at offset n * BLOCK_SIZE, that data may be moved to and from
+	 * directly; -1 if the blocks are not all in the file */
+	int  (*fd)(struct blkdev *dev);
+	/* optional: write back the listed blocks, in increasing order, and
+	 * wait until they are durable, leaving other blocks as they are;
+	 * devices without it are flushed whole instead */
+	int  (*sync)(struct blkdev *dev, const int *blks, int nblks);
 };
 
+/**
+ * Clear the optional operations of a device stacked on another that
+ * the lower device does not have, so that a device passing requests
+ * down offers only what the device below it can do.
+ *
+ * @param lower: the operations of the lower device
+ * @param ops: the operations of the stacked device, a modifiable copy
+ */
+extern void blkdev_mask_ops(const struct blkdev_ops *lower, struct blkdev_ops *ops);
+
 #endif
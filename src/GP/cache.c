@@ -0,0 +1,821 @@
+/*
+ * file:        cache.c
+ * description: write-back LRU buffer cache for CS492 block devices
+ *
+ * The cache is itself a block device which sits in front of another
+ * block device (usually an image device) and keeps recently used
+ * blocks in a hash table threaded on an LRU list.
+ *
+ * Blocks can be prefetched for read-ahead. If the lower device can
+ * start requests without waiting, prefetched blocks are read in the
+ * background and waited for only when they are used or evicted.
+ *
+ * Every operation holds the cache lock, so the cache may be shared by
+ * file system threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "blkdev.h"
+#include "cache.h"
+
+/** a cached block */
+struct cache_buf
+{
+	int blk;				   // block number, or -1 if unused
+	bool dirty;				   // modified since read from lower device
+	bool pending;			   // allocated, waiting to be filled by readv
+	bool inflight;			   // prefetch read started on lower device
+	bool ra;				   // prefetched and not yet read
+	struct blkreq req;		   // prefetch read request
+	struct cache_buf *hnext;   // next buffer in hash chain
+	struct cache_buf *prev;	   // LRU list links, most recent first
+	struct cache_buf *next;
+	char data[BLOCK_SIZE];
+};
+
+/** definition of cache block device */
+struct cache_dev
+{
+	struct blkdev *lower;	  // cached block device
+	int nbufs;				  // number of buffers
+	struct cache_buf *bufs;	  // buffer pool
+	int nbuckets;			  // number of hash buckets (power of 2)
+	struct cache_buf **hash;  // hash buckets
+	struct cache_buf lru;	  // LRU list head
+	struct cache_stats stats; // counters
+	pthread_mutex_t lock;	  // protects all of the above
+};
+
+/**
+ * Hash a block number into a bucket index.
+ * @param cd: the cache
+ * @param blk: the block number
+ * @return: the bucket index
+ */
+static int cache_hash(struct cache_dev *cd, int blk)
+{
+	return (int)(((unsigned)blk * 2654435761u) & (cd->nbuckets - 1));
+}
+
+/**
+ * Find a cached block.
+ * @param cd: the cache
+ * @param blk: the block number
+ * @return: the buffer, or NULL if block is not cached
+ */
+static struct cache_buf *cache_find(struct cache_dev *cd, int blk)
+{
+	struct cache_buf *b;
+	for (b = cd->hash[cache_hash(cd, blk)]; b != NULL; b = b->hnext)
+	{
+		if (b->blk == blk)
+		{
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static void lru_unlink(struct cache_buf *b)
+{
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+}
+
+/**
+ * Move buffer to the most recently used end of the LRU list.
+ */
+static void lru_touch(struct cache_dev *cd, struct cache_buf *b)
+{
+	lru_unlink(b);
+	b->next = cd->lru.next;
+	b->prev = &cd->lru;
+	cd->lru.next->prev = b;
+	cd->lru.next = b;
+}
+
+/**
+ * Remove buffer from its hash chain.
+ */
+static void hash_remove(struct cache_dev *cd, struct cache_buf *b)
+{
+	struct cache_buf **pp = &cd->hash[cache_hash(cd, b->blk)];
+	while (*pp != b)
+	{
+		pp = &(*pp)->hnext;
+	}
+	*pp = b->hnext;
+	b->hnext = NULL;
+}
+
+/**
+ * Discard a buffer whose contents could not be filled.
+ */
+static void cache_discard(struct cache_dev *cd, struct cache_buf *b)
+{
+	hash_remove(cd, b);
+	b->blk = -1;
+	// least recently used end is reclaimed first
+	lru_unlink(b);
+	b->prev = cd->lru.prev;
+	b->next = &cd->lru;
+	cd->lru.prev->next = b;
+	cd->lru.prev = b;
+}
+
+/**
+ * Wait for the prefetch read of a buffer to complete. A buffer whose
+ * read failed is discarded.
+ * @param cd: the cache
+ * @param b: the buffer
+ * @return: SUCCESS, or error from lower device
+ */
+static int cache_wait(struct cache_dev *cd, struct cache_buf *b)
+{
+	if (!b->inflight)
+	{
+		return SUCCESS;
+	}
+	int result = cd->lower->ops->complete(cd->lower, &b->req, 1);
+	b->inflight = false;
+	if (result != SUCCESS)
+	{
+		cache_discard(cd, b);
+	}
+	return result;
+}
+
+/**
+ * Find a cached block, waiting for it if it is being prefetched.
+ * A prefetched block is counted as a read-ahead hit the first time
+ * it is found.
+ * @param cd: the cache
+ * @param blk: the block number
+ * @return: the buffer, or NULL if block is not cached
+ */
+static struct cache_buf *cache_lookup(struct cache_dev *cd, int blk)
+{
+	struct cache_buf *b = cache_find(cd, blk);
+	if (b == NULL || cache_wait(cd, b) != SUCCESS)
+	{
+		return NULL;
+	}
+	if (b->ra)
+	{
+		b->ra = false;
+		cd->stats.ra_hits++;
+	}
+	return b;
+}
+
+/**
+ * Read a list of blocks from the lower device, using its vectored
+ * read if it has one.
+ * @return: SUCCESS, or error from lower device
+ */
+static int lower_readv(struct cache_dev *cd, struct blkvec *vec, int nvec)
+{
+	struct blkdev *lower = cd->lower;
+	if (lower->ops->readv != NULL)
+	{
+		return lower->ops->readv(lower, vec, nvec);
+	}
+	for (int i = 0; i < nvec; i++)
+	{
+		int result = lower->ops->read(lower, vec[i].blk, 1, vec[i].buf);
+		if (result != SUCCESS)
+		{
+			return result;
+		}
+	}
+	return SUCCESS;
+}
+
+/**
+ * Write a list of blocks to the lower device, using its vectored
+ * write if it has one.
+ * @return: SUCCESS, or error from lower device
+ */
+static int lower_writev(struct cache_dev *cd, struct blkvec *vec, int nvec)
+{
+	struct blkdev *lower = cd->lower;
+	if (lower->ops->writev != NULL)
+	{
+		return lower->ops->writev(lower, vec, nvec);
+	}
+	for (int i = 0; i < nvec; i++)
+	{
+		int result = lower->ops->write(lower, vec[i].blk, 1, vec[i].buf);
+		if (result != SUCCESS)
+		{
+			return result;
+		}
+	}
+	return SUCCESS;
+}
+
+/**
+ * Write a dirty buffer back to the lower device.
+ * @return: SUCCESS, or error from lower device
+ */
+static int cache_writeback(struct cache_dev *cd, struct cache_buf *b)
+{
+	int result = cd->lower->ops->write(cd->lower, b->blk, 1, b->data);
+	if (result == SUCCESS)
+	{
+		b->dirty = false;
+		cd->stats.writebacks++;
+	}
+	return result;
+}
+
+/**
+ * Get a buffer for a block that is not cached. The least recently
+ * used buffer is reclaimed, writing it back first if it is dirty.
+ *
+ * @param cd: the cache
+ * @param blk: the block number
+ * @return: the buffer, or NULL if the victim could not be written back
+ */
+static struct cache_buf *cache_alloc(struct cache_dev *cd, int blk)
+{
+	struct cache_buf *b = cd->lru.prev;
+	if (b->blk >= 0)
+	{
+		if (b->inflight && cache_wait(cd, b) != SUCCESS)
+		{
+			// discarded buffer is still the least recently used
+			b = cd->lru.prev;
+		}
+	}
+	if (b->blk >= 0)
+	{
+		if (b->dirty && cache_writeback(cd, b) != SUCCESS)
+		{
+			return NULL;
+		}
+		hash_remove(cd, b);
+		cd->stats.evictions++;
+		if (b->ra)
+		{
+			cd->stats.ra_unused++;
+		}
+	}
+	b->blk = blk;
+	b->dirty = false;
+	b->ra = false;
+	int h = cache_hash(cd, blk);
+	b->hnext = cd->hash[h];
+	cd->hash[h] = b;
+	lru_touch(cd, b);
+	return b;
+}
+
+/**
+ * To count the number of blocks on the device
+ * @param dev: the block device
+ * @return: the number of blocks in the lower block device
+ */
+static int cache_num_blocks(struct blkdev *dev)
+{
+	struct cache_dev *cd = dev->private;
+	return cd->lower->ops->num_blocks(cd->lower);
+}
+
+/**
+ * To read blocks through the cache starting at given block index
+ * @param dev: the block device
+ * @param first_blk: index of the block to start reading from
+ * @param nblks: number of blocks to read from the device
+ * @param buf: buffer to store the data
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int cache_read(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct cache_dev *cd = dev->private;
+	char *p = buf;
+	int result = SUCCESS;
+	pthread_mutex_lock(&cd->lock);
+	for (int i = 0; i < nblks && result == SUCCESS; i++, p += BLOCK_SIZE)
+	{
+		int blk = first_blk + i;
+		struct cache_buf *b = cache_lookup(cd, blk);
+		if (b != NULL)
+		{
+			cd->stats.hits++;
+			lru_touch(cd, b);
+		}
+		else
+		{
+			cd->stats.misses++;
+			if ((b = cache_alloc(cd, blk)) == NULL)
+			{
+				result = E_UNAVAIL;
+				break;
+			}
+			result = cd->lower->ops->read(cd->lower, blk, 1, b->data);
+			if (result != SUCCESS)
+			{
+				cache_discard(cd, b);
+				break;
+			}
+		}
+		memcpy(p, b->data, BLOCK_SIZE);
+	}
+	pthread_mutex_unlock(&cd->lock);
+	return result;
+}
+
+/**
+ * Copy one block into the cache and mark it dirty.
+ * @param cd: the cache
+ * @param blk: the block number
+ * @param data: the block contents
+ * @return SUCCESS if successful, or E_UNAVAIL if no buffer is available
+ */
+static int cache_put(struct cache_dev *cd, int blk, const void *data)
+{
+	struct cache_buf *b = cache_lookup(cd, blk);
+	if (b != NULL)
+	{
+		lru_touch(cd, b);
+	}
+	else if ((b = cache_alloc(cd, blk)) == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	memcpy(b->data, data, BLOCK_SIZE);
+	b->dirty = true;
+	return SUCCESS;
+}
+
+/**
+ * To write blocks into the cache starting at given block index. The
+ * blocks are written to the lower device when evicted or flushed.
+ * @param dev: the block device
+ * @param first_blk: index of the block to start writing to
+ * @param nblks: number of blocks to write to the device
+ * @param buf: buffer where data comes from
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int cache_write(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct cache_dev *cd = dev->private;
+	char *p = buf;
+	int result = SUCCESS;
+	pthread_mutex_lock(&cd->lock);
+	for (int i = 0; i < nblks && result == SUCCESS; i++, p += BLOCK_SIZE)
+	{
+		result = cache_put(cd, first_blk + i, p);
+	}
+	pthread_mutex_unlock(&cd->lock);
+	return result;
+}
+
+/**
+ * Fill buffers allocated by cache_readv with one lower vectored read
+ * and copy them to their destinations.
+ * @param cd: the cache
+ * @param fill: lower device blocks and cache buffer data
+ * @param dest: destination for each block
+ * @param nfill: number of pending blocks
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int cache_fill(struct cache_dev *cd, struct blkvec *fill, void **dest, int nfill)
+{
+	int result = lower_readv(cd, fill, nfill);
+	for (int i = 0; i < nfill; i++)
+	{
+		struct cache_buf *b = (struct cache_buf *)((char *)fill[i].buf - offsetof(struct cache_buf, data));
+		b->pending = false;
+		if (result == SUCCESS)
+		{
+			memcpy(dest[i], b->data, BLOCK_SIZE);
+		}
+		else
+		{
+			cache_discard(cd, b);
+		}
+	}
+	return result;
+}
+
+/**
+ * To read a list of blocks through the cache. Blocks that miss are
+ * read from the lower device with a single vectored read where possible.
+ * @param dev: the block device
+ * @param vec: the blocks and buffers to store the data
+ * @param nvec: number of entries in vec
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int cache_readv(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct cache_dev *cd = dev->private;
+	struct blkvec *fill = malloc(nvec * sizeof(*fill));
+	void **dest = malloc(nvec * sizeof(*dest));
+	if (fill == NULL || dest == NULL)
+	{
+		free(fill);
+		free(dest);
+		return E_UNAVAIL;
+	}
+
+	int nfill = 0, result = SUCCESS;
+	pthread_mutex_lock(&cd->lock);
+	for (int i = 0; i < nvec && result == SUCCESS; i++)
+	{
+		struct cache_buf *b = cache_find(cd, vec[i].blk);
+		if (b != NULL && !b->pending)
+		{
+			if ((b = cache_lookup(cd, vec[i].blk)) == NULL)
+			{
+				// prefetch failed: read it again
+				i--;
+				continue;
+			}
+			cd->stats.hits++;
+			lru_touch(cd, b);
+			memcpy(vec[i].buf, b->data, BLOCK_SIZE);
+			continue;
+		}
+		if (b != NULL || cd->lru.prev->pending)
+		{
+			// block repeated in vec, or cache cannot hold all pending blocks
+			result = cache_fill(cd, fill, dest, nfill);
+			nfill = 0;
+			i--;
+			continue;
+		}
+		cd->stats.misses++;
+		if ((b = cache_alloc(cd, vec[i].blk)) == NULL)
+		{
+			result = E_UNAVAIL;
+			break;
+		}
+		b->pending = true;
+		fill[nfill].blk = vec[i].blk;
+		fill[nfill].buf = b->data;
+		dest[nfill++] = vec[i].buf;
+	}
+	if (nfill > 0)
+	{
+		int fill_result = cache_fill(cd, fill, dest, nfill);
+		if (result == SUCCESS)
+		{
+			result = fill_result;
+		}
+	}
+	pthread_mutex_unlock(&cd->lock);
+	free(fill);
+	free(dest);
+	return result;
+}
+
+/**
+ * To write a list of blocks into the cache.
+ * @param dev: the block device
+ * @param vec: the blocks and buffers where data comes from
+ * @param nvec: number of entries in vec
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int cache_writev(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct cache_dev *cd = dev->private;
+	int result = SUCCESS;
+	pthread_mutex_lock(&cd->lock);
+	for (int i = 0; i < nvec && result == SUCCESS; i++)
+	{
+		result = cache_put(cd, vec[i].blk, vec[i].buf);
+	}
+	pthread_mutex_unlock(&cd->lock);
+	return result;
+}
+
+/**
+ * Order buffers by block number.
+ */
+static int cmp_buf_blk(const void *a, const void *b)
+{
+	const struct cache_buf *x = *(struct cache_buf *const *)a;
+	const struct cache_buf *y = *(struct cache_buf *const *)b;
+	return (x->blk > y->blk) - (x->blk < y->blk);
+}
+
+/**
+ * Write back dirty buffers in block order with one vectored write,
+ * which combines adjacent blocks. The caller holds the cache lock.
+ * @param cd: the cache
+ * @param dirty: the dirty buffers, reordered by block number
+ * @param ndirty: the number of dirty buffers
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int cache_write_dirty(struct cache_dev *cd, struct cache_buf **dirty, int ndirty)
+{
+	if (ndirty == 0)
+	{
+		return SUCCESS;
+	}
+	qsort(dirty, ndirty, sizeof(*dirty), cmp_buf_blk);
+	struct blkvec *vec = malloc(ndirty * sizeof(*vec));
+	if (vec == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	for (int i = 0; i < ndirty; i++)
+	{
+		vec[i].blk = dirty[i]->blk;
+		vec[i].buf = dirty[i]->data;
+	}
+	int result = lower_writev(cd, vec, ndirty);
+	if (result == SUCCESS)
+	{
+		for (int i = 0; i < ndirty; i++)
+		{
+			dirty[i]->dirty = false;
+		}
+		cd->stats.writebacks += ndirty;
+	}
+	free(vec);
+	return result;
+}
+
+/**
+ * Flush the block device. Dirty blocks in the range are written back
+ * in block order with a vectored write, and then the lower device is
+ * flushed.
+ * @param dev: the block device
+ * @param first_blk: index of the block to start flushing
+ * @param nblks: number of blocks to flush
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int cache_flush(struct blkdev *dev, int first_blk, int nblks)
+{
+	struct cache_dev *cd = dev->private;
+
+	// collect dirty buffers in range
+	struct cache_buf **dirty = malloc(cd->nbufs * sizeof(*dirty));
+	if (dirty == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	pthread_mutex_lock(&cd->lock);
+	int ndirty = 0;
+	for (int i = 0; i < cd->nbufs; i++)
+	{
+		struct cache_buf *b = &cd->bufs[i];
+		if (b->blk >= first_blk && b->blk < first_blk + nblks && b->dirty)
+		{
+			dirty[ndirty++] = b;
+		}
+	}
+	int result = cache_write_dirty(cd, dirty, ndirty);
+	pthread_mutex_unlock(&cd->lock);
+	free(dirty);
+
+	if (result != SUCCESS)
+	{
+		return result;
+	}
+	return cd->lower->ops->flush(cd->lower, first_blk, nblks);
+}
+
+/**
+ * Make a list of blocks durable. Only the dirty buffers of the listed
+ * blocks are written back, and then the lower device syncs the list,
+ * or is flushed whole if it cannot.
+ * @param dev: the block device
+ * @param blks: the block numbers, in increasing order
+ * @param nblks: the number of blocks
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int cache_sync(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct cache_dev *cd = dev->private;
+	struct blkdev *lower = cd->lower;
+
+	struct cache_buf **dirty = malloc((nblks + 1) * sizeof(*dirty));
+	if (dirty == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	pthread_mutex_lock(&cd->lock);
+	int ndirty = 0;
+	for (int i = 0; i < nblks; i++)
+	{
+		struct cache_buf *b = cache_find(cd, blks[i]);
+		if (b != NULL && b->dirty)
+		{
+			dirty[ndirty++] = b;
+		}
+	}
+	int result = cache_write_dirty(cd, dirty, ndirty);
+	pthread_mutex_unlock(&cd->lock);
+	free(dirty);
+
+	if (result != SUCCESS)
+	{
+		return result;
+	}
+	if (lower->ops->sync != NULL)
+	{
+		return lower->ops->sync(lower, blks, nblks);
+	}
+	return lower->ops->flush(lower, 0, lower->ops->num_blocks(lower));
+}
+
+/**
+ * Close the cache, writing back all dirty blocks, and close the
+ * lower device.
+ * @param dev: the block device
+ */
+static void cache_close(struct blkdev *dev)
+{
+	struct cache_dev *cd = dev->private;
+	for (int i = 0; i < cd->nbufs; i++)
+	{
+		cache_wait(cd, &cd->bufs[i]);
+	}
+	int nblks = cache_num_blocks(dev);
+	if (nblks > 0 && cache_flush(dev, 0, nblks) != SUCCESS)
+	{
+		fprintf(stderr, "cache: cannot write back dirty blocks\n");
+	}
+	cd->lower->ops->close(cd->lower);
+	pthread_mutex_destroy(&cd->lock);
+	free(cd->hash);
+	free(cd->bufs);
+	free(cd);
+	free(dev);
+}
+
+/**
+ * Start reading blocks into the cache ahead of their use. Blocks
+ * already cached are skipped, and prefetching stops rather than evict
+ * blocks that were prefetched but not yet read.
+ * @param dev: the block device
+ * @param blks: the block numbers
+ * @param nblks: the number of blocks
+ * @return: the number of leading blocks cached or being read
+ */
+static int cache_prefetch(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct cache_dev *cd = dev->private;
+	struct blkdev *lower = cd->lower;
+	bool async = lower->ops->submit != NULL && lower->ops->complete != NULL;
+	struct blkvec *fill = malloc(nblks * sizeof(*fill));
+	if (fill == NULL)
+	{
+		return 0;
+	}
+
+	int i, nfill = 0;
+	pthread_mutex_lock(&cd->lock);
+	for (i = 0; i < nblks; i++)
+	{
+		if (cache_find(cd, blks[i]) != NULL)
+		{
+			continue;
+		}
+		struct cache_buf *victim = cd->lru.prev;
+		if (victim->pending || victim->inflight || victim->ra)
+		{
+			break;
+		}
+		struct cache_buf *b = cache_alloc(cd, blks[i]);
+		if (b == NULL)
+		{
+			break;
+		}
+		b->ra = true;
+		cd->stats.ra_blocks++;
+		if (async)
+		{
+			b->req = (struct blkreq){.write = 0, .first_blk = blks[i], .num_blks = 1, .buf = b->data};
+			if (lower->ops->submit(lower, &b->req, 1) != SUCCESS)
+			{
+				cache_discard(cd, b);
+				break;
+			}
+			b->inflight = true;
+		}
+		else
+		{
+			b->pending = true;
+			fill[nfill].blk = blks[i];
+			fill[nfill++].buf = b->data;
+		}
+	}
+
+	// without asynchronous requests, read with one vectored read
+	if (nfill > 0)
+	{
+		int result = lower_readv(cd, fill, nfill);
+		for (int i = 0; i < nfill; i++)
+		{
+			struct cache_buf *b = (struct cache_buf *)((char *)fill[i].buf - offsetof(struct cache_buf, data));
+			b->pending = false;
+			if (result != SUCCESS)
+			{
+				cache_discard(cd, b);
+			}
+		}
+	}
+	pthread_mutex_unlock(&cd->lock);
+	free(fill);
+	return i;
+}
+
+/** Operations on this block device */
+static struct blkdev_ops cache_ops = {
+	.num_blocks = cache_num_blocks,
+	.read = cache_read,
+	.write = cache_write,
+	.flush = cache_flush,
+	.close = cache_close,
+	.readv = cache_readv,
+	.writev = cache_writev,
+	.prefetch = cache_prefetch,
+	.sync = cache_sync};
+
+/**
+ * Create a caching block device in front of another block device.
+ *
+ * @param lower: the block device to cache
+ * @param nblks: the number of blocks to cache
+ * @return: the block device or NULL if cannot allocate the cache
+ */
+struct blkdev *cache_create(struct blkdev *lower, int nblks)
+{
+	if (lower == NULL || nblks <= 0)
+	{
+		return NULL;
+	}
+
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct cache_dev *cd = calloc(1, sizeof(*cd));
+	if (dev == NULL || cd == NULL)
+	{
+		free(dev);
+		free(cd);
+		return NULL;
+	}
+
+	cd->lower = lower;
+	cd->nbufs = nblks;
+	for (cd->nbuckets = 1; cd->nbuckets < nblks; cd->nbuckets <<= 1)
+		;
+	cd->bufs = calloc(nblks, sizeof(struct cache_buf));
+	cd->hash = calloc(cd->nbuckets, sizeof(struct cache_buf *));
+	if (cd->bufs == NULL || cd->hash == NULL)
+	{
+		free(cd->bufs);
+		free(cd->hash);
+		free(cd);
+		free(dev);
+		return NULL;
+	}
+
+	pthread_mutex_init(&cd->lock, NULL);
+
+	// all buffers start unused on the LRU list
+	cd->lru.next = cd->lru.prev = &cd->lru;
+	for (int i = 0; i < nblks; i++)
+	{
+		struct cache_buf *b = &cd->bufs[i];
+		b->blk = -1;
+		b->next = cd->lru.next;
+		b->prev = &cd->lru;
+		cd->lru.next->prev = b;
+		cd->lru.next = b;
+	}
+
+	dev->private = cd;
+	dev->ops = &cache_ops;
+	return dev;
+}
+
+/**
+ * Get the counters of a caching block device.
+ *
+ * @param dev: the block device
+ * @param stats: holder for the counters
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a caching device
+ */
+int cache_stats(struct blkdev *dev, struct cache_stats *stats)
+{
+	if (dev == NULL || dev->ops != &cache_ops)
+	{
+		return E_UNAVAIL;
+	}
+	struct cache_dev *cd = dev->private;
+	pthread_mutex_lock(&cd->lock);
+	*stats = cd->stats;
+	pthread_mutex_unlock(&cd->lock);
+	return SUCCESS;
+}
@@ -0,0 +1,43 @@
+/*
+ * file:        cache.h
+ * description: write-back LRU buffer cache stacked on another block device
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include "blkdev.h"
+
+/** buffer cache counters */
+struct cache_stats {
+	long hits;		 /* blocks served from the cache */
+	long misses;	 /* blocks read from the lower device */
+	long evictions;	 /* buffers reclaimed for other blocks */
+	long writebacks; /* dirty blocks written to the lower device */
+	long ra_blocks;	 /* blocks prefetched for read-ahead */
+	long ra_hits;	 /* prefetched blocks later read */
+	long ra_unused;	 /* prefetched blocks evicted without being read */
+};
+
+/*
+ * Create a caching block device that keeps up to nblks blocks of
+ * the lower device in memory. Writes are held in the cache until the
+ * block is evicted or the device is flushed or closed. Closing the
+ * cache also closes the lower device.
+ *
+ * @param lower: the block device to cache
+ * @param nblks: the number of blocks to cache
+ * @return: the block device or NULL if cannot allocate the cache
+ */
+extern struct blkdev *cache_create(struct blkdev *lower, int nblks);
+
+/*
+ * Get the counters of a caching block device.
+ *
+ * @param dev: the block device
+ * @param stats: holder for the counters
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a caching device
+ */
+extern int cache_stats(struct blkdev *dev, struct cache_stats *stats);
+
+#endif /* CACHE_H_ */
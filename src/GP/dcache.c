@@ -0,0 +1,257 @@
+/*
+ * file:        dcache.c
+ * description: directory entry cache for CS492 file system
+ *
+ * Maps (directory inode, name) to the entry inode, including
+ * entries recorded as not present. Entries are kept in a hash
+ * table threaded on an LRU list, like the buffer cache. All
+ * operations hold the cache lock.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fsx492.h"
+#include "dcache.h"
+
+/** a cached directory entry */
+struct dentry
+{
+	int parent;				   // directory inode, or 0 if unused
+	int inum;				   // entry inode, or 0 if not present
+	char name[FS_FILENAME_SIZE]; // entry name
+	struct dentry *hnext;	   // next entry in hash chain
+	struct dentry *prev;	   // LRU list links, most recent first
+	struct dentry *next;
+};
+
+/** definition of directory entry cache */
+struct dcache
+{
+	int size;				  // number of entries
+	struct dentry *entries;	  // entry pool
+	int nbuckets;			  // number of hash buckets (power of 2)
+	struct dentry **hash;	  // hash buckets
+	struct dentry lru;		  // LRU list head
+	struct dcache_stats stats; // counters
+	pthread_mutex_t lock;	  // protects all of the above
+};
+
+/**
+ * Hash a directory entry into a bucket index.
+ * @param dc: the cache
+ * @param parent: the directory inode
+ * @param name: the entry name
+ * @return: the bucket index
+ */
+static int dcache_hash(struct dcache *dc, int parent, const char *name)
+{
+	// FNV-1a over the parent inode and the name
+	uint32_t h = 2166136261u ^ (uint32_t)parent;
+	h *= 16777619u;
+	for (; *name; name++)
+	{
+		h ^= (unsigned char)*name;
+		h *= 16777619u;
+	}
+	return (int)(h & (dc->nbuckets - 1));
+}
+
+/**
+ * Find a cached entry.
+ * @return: the entry or NULL if not cached
+ */
+static struct dentry *dcache_find(struct dcache *dc, int parent, const char *name)
+{
+	struct dentry *d;
+	for (d = dc->hash[dcache_hash(dc, parent, name)]; d != NULL; d = d->hnext)
+	{
+		if (d->parent == parent && strcmp(d->name, name) == 0)
+		{
+			return d;
+		}
+	}
+	return NULL;
+}
+
+static void lru_unlink(struct dentry *d)
+{
+	d->prev->next = d->next;
+	d->next->prev = d->prev;
+}
+
+/**
+ * Move entry to the most recently used end of the LRU list.
+ */
+static void lru_touch(struct dcache *dc, struct dentry *d)
+{
+	lru_unlink(d);
+	d->next = dc->lru.next;
+	d->prev = &dc->lru;
+	dc->lru.next->prev = d;
+	dc->lru.next = d;
+}
+
+/**
+ * Remove an entry from its hash chain and move it to the least
+ * recently used end of the LRU list for reuse.
+ */
+static void dcache_remove(struct dcache *dc, struct dentry *d)
+{
+	struct dentry **pp = &dc->hash[dcache_hash(dc, d->parent, d->name)];
+	while (*pp != d)
+	{
+		pp = &(*pp)->hnext;
+	}
+	*pp = d->hnext;
+	d->hnext = NULL;
+	d->parent = 0;
+	dc->stats.entries--;
+
+	lru_unlink(d);
+	d->prev = dc->lru.prev;
+	d->next = &dc->lru;
+	dc->lru.prev->next = d;
+	dc->lru.prev = d;
+}
+
+/**
+ * Create a directory entry cache.
+ *
+ * @param size: the maximum number of entries
+ * @return: the cache or NULL if cannot allocate it
+ */
+struct dcache *dcache_create(int size)
+{
+	struct dcache *dc = calloc(1, sizeof(*dc));
+	if (dc == NULL || size <= 0)
+	{
+		free(dc);
+		return NULL;
+	}
+	dc->size = size;
+	for (dc->nbuckets = 1; dc->nbuckets < size; dc->nbuckets <<= 1)
+		;
+	dc->entries = calloc(size, sizeof(struct dentry));
+	dc->hash = calloc(dc->nbuckets, sizeof(struct dentry *));
+	if (dc->entries == NULL || dc->hash == NULL)
+	{
+		free(dc->entries);
+		free(dc->hash);
+		free(dc);
+		return NULL;
+	}
+
+	pthread_mutex_init(&dc->lock, NULL);
+
+	// all entries start unused on the LRU list
+	dc->lru.next = dc->lru.prev = &dc->lru;
+	for (int i = 0; i < size; i++)
+	{
+		struct dentry *d = &dc->entries[i];
+		d->next = dc->lru.next;
+		d->prev = &dc->lru;
+		dc->lru.next->prev = d;
+		dc->lru.next = d;
+	}
+	dc->stats.size = size;
+	return dc;
+}
+
+/**
+ * Look up a name in a directory.
+ *
+ * @param dc: the cache
+ * @param parent: the directory inode
+ * @param name: the entry name
+ * @return: the entry inode, 0 if cached as not present,
+ *   or -1 if not cached
+ */
+int dcache_lookup(struct dcache *dc, int parent, const char *name)
+{
+	pthread_mutex_lock(&dc->lock);
+	struct dentry *d = dcache_find(dc, parent, name);
+	int inum = -1;
+	if (d == NULL)
+	{
+		dc->stats.misses++;
+	}
+	else
+	{
+		if (d->inum)
+			dc->stats.hits++;
+		else
+			dc->stats.neg_hits++;
+		lru_touch(dc, d);
+		inum = d->inum;
+	}
+	pthread_mutex_unlock(&dc->lock);
+	return inum;
+}
+
+/**
+ * Add or replace the cached entry for a name in a directory.
+ *
+ * @param dc: the cache
+ * @param parent: the directory inode
+ * @param name: the entry name
+ * @param inum: the entry inode, or 0 if name is not present
+ */
+void dcache_insert(struct dcache *dc, int parent, const char *name, int inum)
+{
+	pthread_mutex_lock(&dc->lock);
+	struct dentry *d = dcache_find(dc, parent, name);
+	if (d == NULL)
+	{
+		// reuse least recently used entry
+		d = dc->lru.prev;
+		if (d->parent)
+		{
+			dcache_remove(dc, d);
+		}
+		d->parent = parent;
+		strncpy(d->name, name, FS_FILENAME_SIZE - 1);
+		d->name[FS_FILENAME_SIZE - 1] = '\0';
+		int h = dcache_hash(dc, parent, d->name);
+		d->hnext = dc->hash[h];
+		dc->hash[h] = d;
+		dc->stats.entries++;
+	}
+	d->inum = inum;
+	lru_touch(dc, d);
+	pthread_mutex_unlock(&dc->lock);
+}
+
+/**
+ * Remove all cached entries of a directory.
+ *
+ * @param dc: the cache
+ * @param parent: the directory inode
+ */
+void dcache_purge(struct dcache *dc, int parent)
+{
+	pthread_mutex_lock(&dc->lock);
+	for (int i = 0; i < dc->size; i++)
+	{
+		if (dc->entries[i].parent == parent)
+		{
+			dcache_remove(dc, &dc->entries[i]);
+		}
+	}
+	pthread_mutex_unlock(&dc->lock);
+}
+
+/**
+ * Get the cache counters.
+ *
+ * @param dc: the cache
+ * @param stats: holder for the counters
+ */
+void dcache_stats(struct dcache *dc, struct dcache_stats *stats)
+{
+	pthread_mutex_lock(&dc->lock);
+	*stats = dc->stats;
+	pthread_mutex_unlock(&dc->lock);
+}
@@ -0,0 +1,66 @@
+/*
+ * file:        dcache.h
+ * description: directory entry cache for CS492 file system
+ */
+
+#ifndef DCACHE_H_
+#define DCACHE_H_
+
+/** directory entry cache counters */
+struct dcache_stats {
+	long hits;	   /* lookups answered with an inode */
+	long neg_hits; /* lookups answered as not present */
+	long misses;   /* lookups not in the cache */
+	int entries;   /* entries currently cached */
+	int size;	   /* maximum number of entries */
+};
+
+/** a directory entry cache */
+struct dcache;
+
+/*
+ * Create a directory entry cache.
+ *
+ * @param size: the maximum number of entries
+ * @return: the cache or NULL if cannot allocate it
+ */
+extern struct dcache *dcache_create(int size);
+
+/*
+ * Look up a name in a directory.
+ *
+ * @param dc: the cache
+ * @param parent: the directory inode
+ * @param name: the entry name
+ * @return: the entry inode, 0 if cached as not present,
+ *   or -1 if not cached
+ */
+extern int dcache_lookup(struct dcache *dc, int parent, const char *name);
+
+/*
+ * Add or replace the cached entry for a name in a directory.
+ *
+ * @param dc: the cache
+ * @param parent: the directory inode
+ * @param name: the entry name
+ * @param inum: the entry inode, or 0 if name is not present
+ */
+extern void dcache_insert(struct dcache *dc, int parent, const char *name, int inum);
+
+/*
+ * Remove all cached entries of a directory.
+ *
+ * @param dc: the cache
+ * @param parent: the directory inode
+ */
+extern void dcache_purge(struct dcache *dc, int parent);
+
+/*
+ * Get the cache counters.
+ *
+ * @param dc: the cache
+ * @param stats: holder for the counters
+ */
+extern void dcache_stats(struct dcache *dc, struct dcache_stats *stats);
+
+#endif /* DCACHE_H_ */
@@ -11,16 +11,28 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "fsx492.h"
 #include "blkdev.h"
+#include "dcache.h"
+#include "bitmap.h"
+#include "journal.h"
+
+/* fallocate mode, from linux/falloc.h where available */
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
 
 /*
  * disk access - the global variable 'disk' points to a blkdev
@@ -30,26 +42,28 @@
  */
 extern struct blkdev *disk; // see main.c
 
-/* by defining bitmaps as 'fd_set' pointers, you can use existing
- * macros to handle them.
- *   FD_ISSET(##, inode_map);
- *   FD_CLR(##, block_map);
- *   FD_SET(##, block_map);
+/* the inode and block maps are kept in core as bitmaps, which
+ * also count their free bits (see bitmap.h).
+ *   bitmap_test(&inode_map, ##);
+ *   bitmap_clear(&block_map, ##);
+ *   bitmap_set(&block_map, ##);
  */
 
-/** pointer to inode bitmap to determine free inodes */
-static fd_set *inode_map;
+/** inode bitmap to determine free inodes */
+static struct bitmap inode_map;
 static int inode_map_base;
 
 /** pointer to inode blocks */
 static struct fs_inode *inodes;
+/** copy of inode blocks as of the last update of each inode */
+static struct fs_inode *inode_copy;
 /** number of inodes from superblock */
 static int n_inodes;
 /** number of first inode block */
 static int inode_base;
 
-/** pointer to block bitmap to determine free blocks */
-fd_set *block_map;
+/** block bitmap to determine free blocks */
+static struct bitmap block_map;
 /** number of first data block */
 static int block_map_base;
 
@@ -59,43 +73,179 @@ static int n_blocks;
 /** number of root inode from superblock */
 static int root_inode;
 
-/** array of dirty metadata blocks to write  -- optional */
+/** true if metadata is written through a journal (see journal.h) */
+static bool journaled;
+
+/** size in blocks of a journal to add to an image without one, see main.c */
+int fs_journal_blocks;
+
+/**
+ * Blocks freed on a journaled disk. A freed block must not be reused
+ * before the transaction freeing it is committed: file data is written
+ * in place, and would land in a block its old owner still has if the
+ * system crashed first.
+ */
+struct freed_blks
+{
+	int *blks; // block numbers
+	int n;	   // number of blocks
+	int cap;   // allocated size of blks
+};
+
+/** blocks freed since the last commit, and before it */
+static struct freed_blks freed[2];
+
+/** number of entries in the directory entry cache */
+enum { DCACHE_SIZE = 4096 };
+
+/** cache of directory entries looked up by translate */
+static struct dcache *dcache;
+
+/** largest file size: the blocks mapped by the direct and indirect pointers */
+static const off_t MAX_FILE_SIZE =
+	(off_t)(N_DIRECT + PTRS_PER_BLK + PTRS_PER_BLK * PTRS_PER_BLK) * BLOCK_SIZE;
+
+/** number of blocks reserved ahead of a file's last allocated block */
+enum { PREALLOC_BLKS = 32 };
+
+/** blocks reserved for the next allocations of an inode */
+struct prealloc
+{
+	uint32_t start; // first reserved block
+	int len;		// number of reserved blocks
+};
+
+/** preallocation windows, indexed by inode number */
+static struct prealloc *prealloc;
+
+/** data and indirect blocks of each inode, or -1 if not yet counted */
+static int *blk_count;
+
+/** where to allocate the next block of a file */
+struct alloc_hint
+{
+	int inum; // the file inode
+	int goal; // preferred block number, or -1 for none
+};
+
+/** array of dirty metadata blocks to write, indexed by block number */
 static void **dirty;
 
-/** length of dirty array -- optional */
+/** length of dirty array: number of metadata blocks */
 static int dirty_len;
 
-/** total size of direct blocks */
-static int DIR_SIZE = BLOCK_SIZE * N_DIRECT;
-static int INDIR1_SIZE = (BLOCK_SIZE / sizeof(uint32_t)) * BLOCK_SIZE;
-static int INDIR2_SIZE = (BLOCK_SIZE / sizeof(uint32_t)) * (BLOCK_SIZE / sizeof(uint32_t)) * BLOCK_SIZE;
+/*
+ * Locking. Each inode has a reader/writer lock protecting its inode,
+ * its data and, for a directory, its entries. Locks are taken from a
+ * directory to the entries in it, so paths are walked by locking each
+ * entry before unlocking its directory. The allocator lock protects
+ * the bitmaps and preallocation windows, the metadata lock protects the
+ * dirty array and inode_copy, and the flush lock orders metadata writes.
+ * An inode lock is taken before the allocator lock, which is taken
+ * before the metadata lock.
+ */
+
+/** reader/writer locks of inodes, indexed by inode number */
+static pthread_rwlock_t *inode_locks;
+
+/** protects inode_map, block_map and prealloc */
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** protects dirty and inode_copy */
+static pthread_mutex_t meta_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** held while writing metadata blocks */
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** references to an inode held by the kernel through the low-level API */
+struct inode_ref
+{
+	unsigned long nlookup; // lookups not yet forgotten
+	bool unlinked;		   // removed from its directory: free when forgotten
+};
+
+/** inode references, indexed by inode number */
+static struct inode_ref *refs;
+
+/** protects refs */
+static pthread_mutex_t ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int bmap_range(int inode_idx, int first, int n, uint32_t *blks, bool alloc, bool *fresh);
+static void zero_gap(int inode_idx, off_t end);
+static int dir_lookup(int dir, const char *name);
 
 /* Suggested functions to implement -- you are free to ignore these
  * and implement your own instead
  */
 
 /**
- * Find inode for existing directory entry.
+ * Lock an inode.
  *
- * @param fs_dirent: pointer to first dirent in directory
- * @param name: the name of the directory entry
- * @return the entry inode, or 0 if not found.
+ * @param inum: the inode number
+ * @param write: true to lock for writing, false for reading
  */
-static int find_in_dir(struct fs_dirent *de, char *name)
+static void inode_lock(int inum, bool write)
 {
-	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+	if (write)
+		pthread_rwlock_wrlock(&inode_locks[inum]);
+	else
+		pthread_rwlock_rdlock(&inode_locks[inum]);
+}
+
+/**
+ * Unlock an inode.
+ *
+ * @param inum: the inode number
+ */
+static void inode_unlock(int inum)
+{
+	pthread_rwlock_unlock(&inode_locks[inum]);
+}
+
+/**
+ * Get a read-only view of a block. If the device can map blocks in
+ * place the mapped block is returned without copying; otherwise the
+ * block is read into buf.
+ *
+ * @param blk_num: the block number
+ * @param buf: BLOCK_SIZE buffer used if block cannot be mapped
+ * @return pointer to the block contents
+ */
+static const void *map_blk(int blk_num, void *buf)
+{
+	if (disk->ops->map != NULL)
 	{
-		// found, return its inode
-		if (de[i].valid && strcmp(de[i].name, name) == 0)
-		{
-			return de[i].inode;
-		}
+		const void *p = disk->ops->map(disk, blk_num);
+		if (p != NULL)
+			return p;
 	}
-	return 0;
+	if (disk->ops->read(disk, blk_num, 1, buf) < 0)
+		exit(1);
+	return buf;
+}
+
+/**
+ * Write a metadata block. If the disk has a journal, the block joins
+ * the running transaction and reaches its home location only after
+ * the transaction commits.
+ *
+ * @param blk_num: the block number
+ * @param buf: the block contents
+ */
+static void write_meta(int blk_num, const void *buf)
+{
+	int res = journal_write(disk, blk_num, buf);
+	if (res == E_UNAVAIL)
+		res = disk->ops->write(disk, blk_num, 1, (void *)buf);
+	if (res < 0)
+		exit(1);
 }
 
 /**
- * Look up a single directory entry in a directory.
+ * Look up a single directory entry in a directory. Entries
+ * found, or found not to be present, are kept in the dentry
+ * cache so repeated lookups do not read the directory. The
+ * caller holds the directory lock.
  *
  * Errors
  *   -EIO     - error reading block
@@ -103,16 +253,17 @@ static int find_in_dir(struct fs_dirent *de, char *name)
  *   -ENOTDIR - intermediate component of path not a directory
  *
  */
-static int lookup(int inum, char *name)
+static int lookup(int inum, const char *name)
 {
-	// get corresponding directory
-	struct fs_inode cur_dir = inodes[inum];
-	// init buff entries
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, cur_dir.direct[0], 1, &entries) < 0)
-		exit(1);
-	int inode = find_in_dir(entries, name);
+	int inode = dcache_lookup(dcache, inum, name);
+	if (inode >= 0)
+		return inode == 0 ? -ENOENT : inode;
+
+	// search the directory
+	inode = dir_lookup(inum, name);
+	if (inode < 0)
+		return inode;
+	dcache_insert(dcache, inum, name, inode);
 	return inode == 0 ? -ENOENT : inode;
 }
 
@@ -132,98 +283,139 @@ static int lookup(int inum, char *name)
  */
 static int parse(char *path, char *names[], int nnames)
 {
-	char *_path = strdup(path);
 	int count = 0;
-	char *token = strtok(_path, "/");
-	while (token != NULL)
+	char *lasts = NULL;
+	const char *p = path;
+	if (names == NULL)
 	{
-		int len = strlen(token);
-		if (len > FS_FILENAME_SIZE - 1)
-			return -EINVAL;
-		if (strcmp(token, "..") == 0 && count > 0)
-			count--;
-		else if (strcmp(token, ".") != 0)
+		// count names without altering path
+		while (*p)
 		{
-			if (names != NULL && count < nnames)
+			while (*p == '/')
+				p++;
+			if (!*p)
+				break;
+			const char *token = p;
+			while (*p && *p != '/')
+				p++;
+			int len = p - token;
+			if (len > FS_FILENAME_SIZE - 1)
+				return -EINVAL;
+			if (len == 2 && token[0] == '.' && token[1] == '.')
 			{
-				names[count] = (char *)malloc(len + 1);
-				memset(names[count], 0, len + 1);
-				strcpy(names[count], token);
+				if (count > 0)
+					count--;
 			}
-			count++;
+			else if (!(len == 1 && token[0] == '.'))
+				count++;
 		}
-		token = strtok(NULL, "/");
+		return count;
 	}
-	// if the number of names in the path exceed the maximum
-	if (nnames != 0 && count > nnames)
-		return -1;
-	return count;
-}
 
-/**
- * free allocated char pointer array
- * @param arr: array to be freed
- */
-static void free_char_ptr_array(char *arr[], int len)
-{
-	for (int i = 0; i < len; i++)
+	for (char *token = strtok_r(path, "/", &lasts); token != NULL;
+		 token = strtok_r(NULL, "/", &lasts))
 	{
-		free(arr[i]);
+		if (strlen(token) > FS_FILENAME_SIZE - 1)
+			return -EINVAL;
+		if (strcmp(token, "..") == 0)
+		{
+			if (count > 0)
+				count--;
+		}
+		else if (strcmp(token, ".") != 0)
+		{
+			// if the number of names in the path exceed the maximum
+			if (nnames != 0 && count >= nnames)
+				return -1;
+			names[count++] = token;
+		}
 	}
+	return count;
 }
 
 /**
- * Return inode number for specified file or
- * directory.
+ * Walk a path from the root directory, looking up all names,
+ * or all but the last name if leaf is not NULL. Each directory is
+ * read locked while its entry is looked up and locked, and the inode
+ * found is returned locked.
  *
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
  *
  * @param path: the file path
+ * @param leaf: pointer to space for FS_FILENAME_SIZE leaf name, or NULL
+ * @param write: lock the inode found for writing rather than reading
  * @return inode of path node or error
  */
-static int translate(char *path)
+static int walk_path(const char *path, char *leaf, bool write)
 {
-	if (strcmp(path, "/") == 0 || strlen(path) == 0)
-		return root_inode;
-	int inode_idx = root_inode;
 	// get number of names
-	int num_names = parse(path, NULL, 0);
+	int num_names = parse((char *)path, NULL, 0);
 	// if the number of names in the path exceed the maximum, return an error, error type to be fixed if necessary
 	if (num_names < 0)
 		return -ENOTDIR;
 	if (num_names == 0)
+	{
+		inode_lock(root_inode, write);
 		return root_inode;
-	// copy all the names
+	}
+
+	// split a copy of the path into names
+	char _path[strlen(path) + 1];
 	char *names[num_names];
-	parse(path, names, num_names);
-	// lookup inode
+	strcpy(_path, path);
+	parse(_path, names, num_names);
 
-	for (int i = 0; i < num_names; i++)
+	// lookup inode
+	int inode_idx = root_inode;
+	int depth = (leaf != NULL) ? num_names - 1 : num_names;
+	inode_lock(inode_idx, write && depth == 0);
+	for (int i = 0; i < depth; i++)
 	{
 		// if token is not a directory return error
 		if (!S_ISDIR(inodes[inode_idx].mode))
 		{
-			free_char_ptr_array(names, num_names);
+			inode_unlock(inode_idx);
 			return -ENOTDIR;
 		}
-		// lookup and record inode
-		inode_idx = lookup(inode_idx, names[i]);
-		if (inode_idx < 0)
-		{
-			free_char_ptr_array(names, num_names);
+		// lookup and lock the entry before unlocking its directory
+		int next = lookup(inode_idx, names[i]);
+		if (next >= 0)
+			inode_lock(next, write && i == depth - 1);
+		inode_unlock(inode_idx);
+		if (next < 0)
 			return -ENOENT;
-		}
+		inode_idx = next;
 	}
-	free_char_ptr_array(names, num_names);
+	if (leaf != NULL)
+		strcpy(leaf, names[num_names - 1]);
 	return inode_idx;
 }
 
+/**
+ * Return inode number for specified file or
+ * directory. The inode is not locked.
+ *
+ * Errors
+ *   -ENOENT  - a component of the path is not present.
+ *   -ENOTDIR - an intermediate component of path not a directory
+ *
+ * @param path: the file path
+ * @return inode of path node or error
+ */
+static int translate(char *path)
+{
+	int inum = walk_path(path, NULL, false);
+	if (inum >= 0)
+		inode_unlock(inum);
+	return inum;
+}
+
 /**
  *  Return inode number for path to specified file
  *  or directory, and a leaf name that may not yet
- *  exist.
+ *  exist. The inode is not locked.
  *
  * Errors
  *   -ENOENT  - a component of the path is not present.
@@ -235,56 +427,104 @@ static int translate(char *path)
  */
 static int translate_1(char *path, char *leaf)
 {
-	if (strcmp(path, "/") == 0 || strlen(path) == 0)
-		return root_inode;
-	int inode_idx = root_inode;
-	// get number of names
-	int num_names = parse(path, NULL, 0);
-	// if the number of names in the path exceed the maximum, return an error, error type to be fixed if necessary
-	if (num_names < 0)
-		return -ENOTDIR;
-	if (num_names == 0)
-		return root_inode;
-	// copy all the names
-	char *names[num_names];
-	parse(path, names, num_names);
-	// lookup inode
+	int inum = walk_path(path, leaf, false);
+	if (inum >= 0)
+		inode_unlock(inum);
+	return inum;
+}
 
-	for (int i = 0; i < num_names - 1; i++)
-	{
-		// if token is not a directory return error
-		if (!S_ISDIR(inodes[inode_idx].mode))
-		{
-			free_char_ptr_array(names, num_names);
-			return -ENOTDIR;
-		}
-		// lookup and record inode
-		inode_idx = lookup(inode_idx, names[i]);
-		if (inode_idx < 0)
-		{
-			free_char_ptr_array(names, num_names);
-			return -ENOENT;
-		}
-	}
-	strcpy(leaf, names[num_names - 1]);
-	free_char_ptr_array(names, num_names);
-	return inode_idx;
+/**
+ * Record that an in-core metadata block was modified. The
+ * block is written by the next flush_metadata.
+ *
+ * @param blk_num: the metadata block number
+ * @param buf: the in-core copy of the block
+ */
+static void mark_dirty(int blk_num, void *buf)
+{
+	pthread_mutex_lock(&meta_lock);
+	dirty[blk_num] = buf;
+	pthread_mutex_unlock(&meta_lock);
+}
+
+/**
+ * Record that the bitmap block holding a bit was modified.
+ *
+ * @param map_base: number of first block of the bitmap
+ * @param map: the in-core bitmap
+ * @param bit: the bit that was modified
+ */
+static void mark_map_dirty(int map_base, void *map, int bit)
+{
+	int blk = bit / BITS_PER_BLK;
+	mark_dirty(map_base + blk, (char *)map + blk * BLOCK_SIZE);
 }
 
 /**
- * Flush dirty metadata blocks to disk.
+ * Flush dirty metadata blocks to disk. If the device supports
+ * asynchronous requests, all the writes are started before waiting
+ * for any of them.
+ *
+ * The dirty blocks are copied under the allocator and metadata locks,
+ * so the copies are written while other threads go on modifying
+ * metadata. Inode blocks are copied from inode_copy, which holds each
+ * inode as of its last update_inode, so an inode being modified by
+ * another thread is not written half done.
+ *
+ * If the disk has a journal, the blocks join the running transaction
+ * instead. This is also done before each commit, once no operation is
+ * in progress, so each commit holds the metadata of the operations it
+ * covers (see commit_prepare).
  */
 void flush_metadata(void)
 {
-	int i;
+	pthread_mutex_lock(&flush_lock);
+	pthread_mutex_lock(&alloc_lock);
+	pthread_mutex_lock(&meta_lock);
+	int i, nreqs = 0;
 	for (i = 0; i < dirty_len; i++)
+	{
+		if (dirty[i])
+			nreqs++;
+	}
+	struct blkreq *reqs = malloc(nreqs * sizeof(struct blkreq));
+	char *copy = malloc(nreqs * BLOCK_SIZE);
+	if (nreqs > 0 && (reqs == NULL || copy == NULL))
+		exit(1);
+	for (i = 0, nreqs = 0; i < dirty_len; i++)
 	{
 		if (dirty[i])
 		{
-			disk->ops->write(disk, i, 1, dirty[i]);
+			char *buf = copy + nreqs * BLOCK_SIZE;
+			memcpy(buf, dirty[i], BLOCK_SIZE);
+			reqs[nreqs++] = (struct blkreq){.write = 1, .first_blk = i, .num_blks = 1, .buf = buf};
 			dirty[i] = NULL;
 		}
 	}
+	pthread_mutex_unlock(&meta_lock);
+	pthread_mutex_unlock(&alloc_lock);
+
+	if (journaled)
+	{
+		for (i = 0; i < nreqs; i++)
+			write_meta(reqs[i].first_blk, reqs[i].buf);
+	}
+	else if (disk->ops->submit != NULL)
+	{
+		if (disk->ops->submit(disk, reqs, nreqs) < 0 || disk->ops->complete(disk, reqs, nreqs) < 0)
+			exit(1);
+	}
+	else
+	{
+		for (i = 0; i < nreqs; i++)
+		{
+			if (disk->ops->write(disk, reqs[i].first_blk, 1, reqs[i].buf) < 0)
+				exit(1);
+		}
+	}
+	free(reqs);
+	free(copy);
+	pthread_mutex_unlock(&flush_lock);
 }
 
 /**
@@ -293,53 +533,188 @@ void flush_metadata(void)
  */
 int num_free_blk()
 {
-	int count = 0;
-	for (int i = 0; i < n_blocks; i++)
+	pthread_mutex_lock(&alloc_lock);
+	int nfree = block_map.nfree;
+	pthread_mutex_unlock(&alloc_lock);
+	return nfree;
+}
+
+/**
+ * Release the blocks of a preallocation window. The caller holds
+ * the allocator lock.
+ *
+ * @param pa the preallocation window
+ */
+static void prealloc_release(struct prealloc *pa)
+{
+	for (int i = 0; i < pa->len; i++)
+		bitmap_unreserve(&block_map, pa->start + i);
+	pa->len = 0;
+}
+
+/**
+ * Release the blocks preallocated for an inode.
+ *
+ * @param inum the inode number
+ */
+static void prealloc_trim(int inum)
+{
+	pthread_mutex_lock(&alloc_lock);
+	prealloc_release(&prealloc[inum]);
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+/**
+ * Release the preallocated blocks of all inodes. The caller holds
+ * the allocator lock.
+ */
+static void prealloc_trim_all(void)
+{
+	for (int i = 0; i < n_inodes; i++)
 	{
-		if (!FD_ISSET(i, block_map))
-		{
-			count++;
-		}
+		if (prealloc[i].len > 0)
+			prealloc_release(&prealloc[i]);
 	}
-	return count;
 }
 
 /**
- * Returns a free block number or -ENOSPC if none available.
+ * Get where the preallocation window of a file starts, to continue
+ * allocating from it.
+ *
+ * @param inum the inode number
+ * @return the first block of the window, or -1 if it has none
+ */
+static int prealloc_goal(int inum)
+{
+	pthread_mutex_lock(&alloc_lock);
+	int goal = prealloc[inum].len > 0 ? (int)prealloc[inum].start : -1;
+	pthread_mutex_unlock(&alloc_lock);
+	return goal;
+}
+
+/**
+ * Allocate a block as for get_free_blk. The caller holds the
+ * allocator lock.
  *
+ * @param hint where to allocate, or NULL for the next free block
  * @return free block number or -ENOSPC if none available
  */
-static int get_free_blk(void)
+static int alloc_blk(struct alloc_hint *hint)
 {
-	for (int i = 0; i < n_blocks; i++)
+	int i;
+	if (hint == NULL)
 	{
-		if (!FD_ISSET(i, block_map))
+		i = bitmap_alloc(&block_map);
+		if (i < 0 && block_map.nresv > 0)
 		{
-			char buff[BLOCK_SIZE];
-			memset(buff, 0, BLOCK_SIZE);
-			if (disk->ops->write(disk, i, 1, buff) < 0)
-				exit(1);
-			FD_SET(i, block_map);
-			return i;
+			prealloc_trim_all();
+			i = bitmap_alloc(&block_map);
+		}
+		if (i < 0)
+			return -ENOSPC;
+	}
+	else
+	{
+		struct prealloc *pa = &prealloc[hint->inum];
+		if (pa->len > 0 && pa->start == hint->goal)
+		{
+			// next block of the window
+			i = pa->start++;
+			pa->len--;
+			bitmap_unreserve(&block_map, i);
 		}
+		else
+		{
+			// start a new window at the first free run after the goal
+			prealloc_release(pa);
+			int len, max = S_ISREG(inodes[hint->inum].mode) ? PREALLOC_BLKS : 1;
+			i = bitmap_find(&block_map, hint->goal, max, &len);
+			if (i < 0 && block_map.nresv > 0)
+			{
+				prealloc_trim_all();
+				i = bitmap_find(&block_map, hint->goal, max, &len);
+			}
+			if (i < 0)
+				return -ENOSPC;
+			pa->start = i + 1;
+			for (pa->len = 0; pa->len < len - 1; pa->len++)
+			{
+				if (bitmap_reserve(&block_map, pa->start + pa->len) < 0)
+					break;
+			}
+		}
+		hint->goal = i + 1;
+		bitmap_set(&block_map, i);
 	}
-	return -ENOSPC;
+	mark_map_dirty(block_map_base, block_map.words, i);
+	return i;
+}
+
+/**
+ * Returns a free block number or -ENOSPC if none available.
+ *
+ * For a regular file the block is taken from the file's
+ * preallocation window if the window starts at the goal. Otherwise
+ * the first free run at or after the goal is found, and the blocks
+ * following the allocated one are reserved as the file's new window
+ * so its next blocks are contiguous even with interleaved writers.
+ *
+ * The block is not cleared: callers write all of it, or zero the
+ * parts they do not write.
+ *
+ * @param hint where to allocate, or NULL for the next free block
+ * @return free block number or -ENOSPC if none available
+ */
+static int get_free_blk(struct alloc_hint *hint)
+{
+	pthread_mutex_lock(&alloc_lock);
+	int i = alloc_blk(hint);
+	pthread_mutex_unlock(&alloc_lock);
+	return i;
 }
 
 /**
- * Return a block to the free list
+ * Return a block to the free list. If the disk has a journal, the
+ * block stays reserved until the transaction freeing it is committed
+ * (see commit_prepare).
  *
  * @param  blkno the block number
  */
 static void return_blk(int blkno)
 {
-	FD_CLR(blkno, block_map);
+	pthread_mutex_lock(&alloc_lock);
+	bitmap_clear(&block_map, blkno);
+	mark_map_dirty(block_map_base, block_map.words, blkno);
+	struct freed_blks *fb = &freed[0];
+	if (journaled && bitmap_reserve(&block_map, blkno) == 0)
+	{
+		if (fb->n == fb->cap)
+		{
+			fb->cap = fb->cap ? 2 * fb->cap : 256;
+			if ((fb->blks = realloc(fb->blks, fb->cap * sizeof(int))) == NULL)
+				exit(1);
+		}
+		fb->blks[fb->n++] = blkno;
+	}
+	pthread_mutex_unlock(&alloc_lock);
 }
 
-static void update_blk(void)
+/**
+ * Prepare for a journal commit. Blocks freed before the previous
+ * commit may be reused now that it is on disk, and metadata held in
+ * core joins the running transaction.
+ */
+static void commit_prepare(void)
 {
-	if (disk->ops->write(disk, block_map_base, inode_base - block_map_base, block_map) < 0)
-		exit(1);
+	pthread_mutex_lock(&alloc_lock);
+	struct freed_blks fb = freed[1];
+	for (int i = 0; i < fb.n; i++)
+		bitmap_unreserve(&block_map, fb.blks[i]);
+	fb.n = 0;
+	freed[1] = freed[0];
+	freed[0] = fb;
+	pthread_mutex_unlock(&alloc_lock);
+	flush_metadata();
 }
 
 /**
@@ -349,15 +724,12 @@ static void update_blk(void)
  */
 static int get_free_inode(void)
 {
-	for (int i = 2; i < n_inodes; i++)
-	{
-		if (!FD_ISSET(i, inode_map))
-		{
-			FD_SET(i, inode_map);
-			return i;
-		}
-	}
-	return -ENOSPC;
+	pthread_mutex_lock(&alloc_lock);
+	int i = bitmap_alloc(&inode_map);
+	if (i >= 0)
+		mark_map_dirty(inode_map_base, inode_map.words, i);
+	pthread_mutex_unlock(&alloc_lock);
+	return i < 0 ? -ENOSPC : i;
 }
 
 /**
@@ -367,1261 +739,3950 @@ static int get_free_inode(void)
  */
 static void return_inode(int inum)
 {
-	FD_CLR(inum, inode_map);
+	pthread_mutex_lock(&alloc_lock);
+	bitmap_clear(&inode_map, inum);
+	mark_map_dirty(inode_map_base, inode_map.words, inum);
+	pthread_mutex_unlock(&alloc_lock);
 }
 
+/**
+ * Record that an inode was modified. Only the inode block holding
+ * it is written by the next flush_metadata. The caller holds the
+ * inode write lock.
+ *
+ * @param inum the inode number
+ */
 static void update_inode(int inum)
 {
-	if (disk->ops->write(disk, inode_base + inum / INODES_PER_BLK, 1, &inodes[inum - (inum % INODES_PER_BLK)]) < 0)
-		exit(1);
-	if (disk->ops->write(disk, inode_map_base, block_map_base - inode_map_base, inode_map) < 0)
-		exit(1);
+	pthread_mutex_lock(&meta_lock);
+	inode_copy[inum] = inodes[inum];
+	dirty[inode_base + inum / INODES_PER_BLK] = &inode_copy[inum - (inum % INODES_PER_BLK)];
+	pthread_mutex_unlock(&meta_lock);
 }
 
 /**
- * Find free directory entry.
+ * Get the block number of a logical block of a directory.
  *
- * @return index of directory free entry or -ENOSPC
- *   if no space for new entry in directory
+ * @param dir: the directory inode
+ * @param lblk: the logical block
+ * @return the block number, or 0 if not allocated
  */
-static int find_free_dir(struct fs_dirent *de)
+static uint32_t dir_blk(int dir, uint32_t lblk)
 {
-	for (int i = 0; i < DIRENTS_PER_BLK; i++)
-	{
-		if (!de[i].valid)
-		{
-			return i;
-		}
-	}
-	return -ENOSPC;
+	uint32_t blk = 0;
+	bmap_range(dir, lblk, 1, &blk, false, NULL);
+	return blk;
 }
 
 /**
- * Determines whether directory is empty.
+ * Allocate a block at the end of an indexed directory.
  *
- * @param de ptr to first entry in directory
- * @return 1 if empty 0 if has entries
+ * @param dir: the directory inode
+ * @param lblk: holder for the logical block
+ * @return the block number, or -ENOSPC
  */
-static int is_empty_dir(struct fs_dirent *de)
+static int dir_new_blk(int dir, uint32_t *lblk)
 {
-	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+	struct fs_inode *inode = &inodes[dir];
+	uint32_t blk;
+	*lblk = inode->size / BLOCK_SIZE;
+	if (bmap_range(dir, *lblk, 1, &blk, true, NULL) < 1)
+		return -ENOSPC;
+	inode->size += BLOCK_SIZE;
+	update_inode(dir);
+	return blk;
+}
+
+/**
+ * Hash a name for a directory index (32-bit FNV-1a).
+ *
+ * @param name: the name
+ * @return the hash
+ */
+static uint32_t dx_hash(const char *name)
+{
+	uint32_t h = 2166136261u;
+	for (const char *p = name; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	return h;
+}
+
+/**
+ * Find the index entry covering a hash.
+ *
+ * @param node: the index node
+ * @param hash: the name hash
+ * @return the position of the last entry whose hash is <= hash;
+ *   the first entry covers all lower hashes
+ */
+static int dx_find(const struct fs_dx_node *node, uint32_t hash)
+{
+	int at = 0, lo = 1, hi = node->count - 1;
+	while (lo <= hi)
 	{
-		if (de[i].valid)
+		int mid = (lo + hi) / 2;
+		if (node->entries[mid].hash <= hash)
 		{
-			return 0;
+			at = mid;
+			lo = mid + 1;
 		}
+		else
+			hi = mid - 1;
 	}
-	return 1;
+	return at;
 }
 
 /**
- * Copy stat from inode to sb
- * @param inode inode to be copied from
- * @param sb holder to hold copied stat
- * @param inode_idx inode_idx
+ * Insert an entry into an index node after a position.
+ * The node must have room for the entry.
+ *
+ * @param node: the index node
+ * @param at: the position of the entry to insert after
+ * @param hash: the hash of the new entry
+ * @param lblk: the logical block of the new entry
  */
-static void cpy_stat(struct fs_inode *inode, struct stat *sb)
+static void dx_insert(struct fs_dx_node *node, int at, uint32_t hash, uint32_t lblk)
 {
-	memset(sb, 0, sizeof(*sb));
-	sb->st_uid = inode->uid;
-	sb->st_gid = inode->gid;
-	sb->st_mode = (mode_t)inode->mode;
-	sb->st_atime = inode->mtime;
-	sb->st_ctime = inode->ctime;
-	sb->st_mtime = inode->mtime;
-	sb->st_size = inode->size;
-	sb->st_blksize = FS_BLOCK_SIZE;
-	sb->st_nlink = 1;
-	sb->st_blocks = (inode->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+	memmove(&node->entries[at + 2], &node->entries[at + 1],
+			(node->count - at - 1) * sizeof(struct fs_dx_entry));
+	node->entries[at + 1] = (struct fs_dx_entry){hash, lblk};
+	node->count++;
 }
 
-/*
- * CS492: FUSE functions to implement are below.
- */
+/** path from the root of a directory index to a leaf block */
+struct dx_path
+{
+	int levels;		  // index levels below the root
+	uint32_t node[2]; // block numbers of root and lower index node
+	int at[2];		  // entry followed in root and lower index node
+	uint32_t leaf;	  // block number of the leaf block
+};
 
 /**
- * init - this is called once by the FUSE framework at startup.
- *
- * This is a good place to read in the super-block and set up any
- * global variables you need. You don't need to worry about the
- * argument or the return value.
+ * Follow the index of a directory to the leaf block for a hash.
  *
- * @param conn: fuse connection information - unused
- * @return: unused - returns NULL
+ * @param dir: the indexed directory inode
+ * @param hash: the name hash
+ * @param p: holder for the path to the leaf
+ * @return SUCCESS or -EIO if the index is damaged
+ */
+static int dx_locate(int dir, uint32_t hash, struct dx_path *p)
+{
+	char buf[BLOCK_SIZE];
+	p->node[0] = inodes[dir].direct[0];
+	const struct fs_dx_node *node = map_blk(p->node[0], buf);
+	if (node->magic != FS_DX_MAGIC || node->count == 0 || node->levels > 1)
+		return -EIO;
+	p->levels = node->levels;
+	p->at[0] = dx_find(node, hash);
+	uint32_t lblk = node->entries[p->at[0]].block;
+	if (p->levels > 0)
+	{
+		if (!(p->node[1] = dir_blk(dir, lblk)))
+			return -EIO;
+		node = map_blk(p->node[1], buf);
+		if (node->magic != FS_DX_MAGIC || node->count == 0)
+			return -EIO;
+		p->at[1] = dx_find(node, hash);
+		lblk = node->entries[p->at[1]].block;
+	}
+	if (!(p->leaf = dir_blk(dir, lblk)))
+		return -EIO;
+	return SUCCESS;
+}
+
+/**
+ * Make room in the index node above a full leaf, either by moving
+ * the root entries down to a new level or by splitting the lower
+ * index node.
  *
- * Note: if any block read operation fails, just exit(1) immediately.
+ * @param dir: the directory inode
+ * @param p: the path to the full leaf
+ * @return SUCCESS, or -ENOSPC if the index is full
  */
-void *fs_init(struct fuse_conn_info *conn)
+static int dx_split_node(int dir, struct dx_path *p)
 {
-	// read the superblock
-	// CS492: your code below
-	struct fs_super sb;
-	if (disk->ops->read(disk, 0, 1, &sb) != SUCCESS)
-	{ // read from index 0 (first block = sb)
+	struct fs_dx_node root, node;
+	uint32_t lblk;
+	if (disk->ops->read(disk, p->node[0], 1, &root) < 0)
 		exit(1);
+	if (p->levels == 0)
+	{
+		// move the root entries to a new node below the root
+		int blk = dir_new_blk(dir, &lblk);
+		if (blk < 0)
+			return blk;
+		node = root;
+		node.levels = 0;
+		write_meta(blk, &node);
+		root.count = 1;
+		root.levels = 1;
+		root.entries[0] = (struct fs_dx_entry){0, lblk};
 	}
-	root_inode = sb.root_inode; // set the root inode with info from superblock
-
-	/* The inode map and block map are directly after the superblock */
-	// read inode map
-	// CS492: your code below
-	inode_map_base = 1; // This is correct.
-	inode_map = malloc(sb.inode_map_sz * FS_BLOCK_SIZE); // allocate space for inode map blocks (* block size to convert to bytes)
-	if (disk->ops->read(disk, inode_map_base, sb.inode_map_sz, inode_map) != SUCCESS)
+	else
 	{
-		// starting from inode_map_base, read inode_map_sz blocks into inode_map
-		exit(1);
+		// split the lower node in half
+		if (root.count == DX_ENTRIES_PER_BLK)
+			return -ENOSPC;
+		if (disk->ops->read(disk, p->node[1], 1, &node) < 0)
+			exit(1);
+		int blk = dir_new_blk(dir, &lblk);
+		if (blk < 0)
+			return blk;
+		struct fs_dx_node upper = {.magic = FS_DX_MAGIC};
+		int k = node.count / 2;
+		upper.count = node.count - k;
+		memcpy(upper.entries, &node.entries[k], upper.count * sizeof(struct fs_dx_entry));
+		node.count = k;
+		write_meta(blk, &upper);
+		write_meta(p->node[1], &node);
+		dx_insert(&root, p->at[0], upper.entries[0].hash, lblk);
 	}
+	write_meta(p->node[0], &root);
+	return SUCCESS;
+}
 
-	// read block map
-	// CS492: your code below
-	block_map_base = 1 + sb.inode_map_sz; // block map base is directly after inode map (end of inode map = inode_base + sz)
-	block_map = malloc(sb.block_map_sz * FS_BLOCK_SIZE); // allocate space for block map
-	if (disk->ops->read(disk, block_map_base, sb.block_map_sz, block_map) != SUCCESS)
-	{
-		// starting from block_map_base, read block_map_sz into block_map
+/** name hash and position of a directory entry, for sorting */
+struct dx_sort
+{
+	uint32_t hash;
+	int idx;
+};
+
+static int dx_sort_cmp(const void *a, const void *b)
+{
+	uint32_t ha = ((const struct dx_sort *)a)->hash;
+	uint32_t hb = ((const struct dx_sort *)b)->hash;
+	return (ha > hb) - (ha < hb);
+}
+
+/**
+ * Split a full leaf block, moving the entries with the higher half
+ * of the hashes to a new leaf. Entries with the same hash are kept
+ * in the same leaf.
+ *
+ * @param dir: the directory inode
+ * @param p: the path to the leaf
+ * @param de: the entries of the leaf
+ * @return SUCCESS, or -ENOSPC if no space or all names hash alike
+ */
+static int dx_split_leaf(int dir, struct dx_path *p, struct fs_dirent *de)
+{
+	// the index node above must have room for the new leaf
+	struct fs_dx_node node;
+	int lvl = p->levels;
+	if (disk->ops->read(disk, p->node[lvl], 1, &node) < 0)
 		exit(1);
-	}
+	if (node.count == DX_ENTRIES_PER_BLK)
+		return dx_split_node(dir, p);
 
-	/* The inode data is in the next set of blocks */
-	// CS492: your code below
-	inode_base = 1 + sb.inode_map_sz + sb.block_map_sz;	// inode base is directly after the end of the block map
-	n_inodes = sb.inode_region_sz * INODES_PER_BLK; // num blocks * inodes per block = num inodes
-	inodes = malloc(sb.inode_region_sz * FS_BLOCK_SIZE); // allocate space for inode blocks
-	if (disk->ops->read(disk, inode_base, sb.inode_region_sz, inodes) != SUCCESS)
+	// split between different hashes closest to the middle
+	struct dx_sort s[DIRENTS_PER_BLK];
+	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+		s[i] = (struct dx_sort){dx_hash(de[i].name), i};
+	qsort(s, DIRENTS_PER_BLK, sizeof(struct dx_sort), dx_sort_cmp);
+	int k = -1;
+	for (int d = 0; d < DIRENTS_PER_BLK / 2 && k < 0; d++)
 	{
-		// read in inode blocks... you get the drill
-		exit(1);
+		int lo = DIRENTS_PER_BLK / 2 - d, hi = DIRENTS_PER_BLK / 2 + d;
+		if (s[lo - 1].hash != s[lo].hash)
+			k = lo;
+		else if (hi < DIRENTS_PER_BLK && s[hi - 1].hash != s[hi].hash)
+			k = hi;
 	}
+	if (k < 0)
+		return -ENOSPC;
 
-	// number of blocks on device
-	n_blocks = sb.num_blocks;
+	uint32_t lblk;
+	int blk = dir_new_blk(dir, &lblk);
+	if (blk < 0)
+		return blk;
+	struct fs_dirent upper[DIRENTS_PER_BLK];
+	memset(upper, 0, sizeof(upper));
+	for (int i = k; i < DIRENTS_PER_BLK; i++)
+	{
+		upper[i - k] = de[s[i].idx];
+		memset(&de[s[i].idx], 0, sizeof(struct fs_dirent));
+	}
+	write_meta(blk, upper);
+	write_meta(p->leaf, de);
+	dx_insert(&node, p->at[lvl], s[k].hash, lblk);
+	write_meta(p->node[lvl], &node);
+	return SUCCESS;
+}
 
-	// dirty metadata blocks
-	dirty_len = inode_base + sb.inode_region_sz;
-	dirty = calloc(dirty_len * sizeof(void *), 1);
+/**
+ * Convert a full single-block directory to an indexed directory.
+ * The entries move to a new leaf block and block 0 becomes the root
+ * of the index.
+ *
+ * @param dir: the directory inode
+ * @param de: the entries of the directory block
+ * @return SUCCESS or -ENOSPC
+ */
+static int dx_convert(int dir, struct fs_dirent *de)
+{
+	struct fs_inode *inode = &inodes[dir];
+	int32_t size = inode->size;
+	uint32_t lblk;
+	inode->size = BLOCK_SIZE;
+	int blk = dir_new_blk(dir, &lblk);
+	if (blk < 0)
+	{
+		inode->size = size;
+		return blk;
+	}
+	write_meta(blk, de);
 
-	return NULL;
+	struct fs_dx_node root = {.magic = FS_DX_MAGIC, .count = 1, .levels = 0};
+	root.entries[0] = (struct fs_dx_entry){0, lblk};
+	write_meta(inode->direct[0], &root);
+	inode->flags |= FS_INODE_INDEXED;
+	update_inode(dir);
+	return SUCCESS;
 }
 
-/* Note on path translation errors:
- * In addition to the method-specific errors listed below, almost
- * every method can return one of the following errors if it fails to
- * locate a file or directory corresponding to a specified path.
+/**
+ * Get the block holding the entries for a name: the single block
+ * of an unindexed directory, or the leaf found with the index.
  *
- * ENOENT - a component of the path is not present.
- * ENOTDIR - an intermediate component of the path (e.g. 'b' in
- *           /a/b/c) is not a directory
+ * @param dir: the directory inode
+ * @param name: the entry name
+ * @param p: holder for the index path, or NULL
+ * @return the block number, or -EIO if the index is damaged
  */
+static int dir_leaf(int dir, const char *name, struct dx_path *p)
+{
+	struct dx_path path;
+	if (!(inodes[dir].flags & FS_INODE_INDEXED))
+		return inodes[dir].direct[0];
+	if (p == NULL)
+		p = &path;
+	int res = dx_locate(dir, dx_hash(name), p);
+	return res < 0 ? res : (int)p->leaf;
+}
 
-/* note on splitting the 'path' variable:
- * the value passed in by the FUSE framework is declared as 'const',
- * which means you can't modify it. The standard mechanisms for
- * splitting strings in C (strtok, strsep) modify the string in place,
- * so you have to copy the string and then free the copy when you're
- * done. One way of doing this:
+/**
+ * Find inode for existing directory entry.
  *
- *    char *_path = strdup(path);
- *    int inum = translate(_path);
- *    free(_path);
+ * @param dir: the directory inode
+ * @param name: the name of the directory entry
+ * @return the entry inode, 0 if not found, or -EIO
  */
+static int dir_lookup(int dir, const char *name)
+{
+	int blk = dir_leaf(dir, name, NULL);
+	if (blk < 0)
+		return blk;
+	struct fs_dirent buf[DIRENTS_PER_BLK];
+	const struct fs_dirent *de = map_blk(blk, buf);
+	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+	{
+		// found, return its inode
+		if (de[i].valid && strcmp(de[i].name, name) == 0)
+			return de[i].inode;
+	}
+	return 0;
+}
 
 /**
- * getattr - get file or directory attributes. For a description of
- * the fields in 'struct stat', see 'man lstat'.
- *
- * Note: you can handle some fields as follows:
- * st_nlink: always set to 1
- * st_atime, st_ctime: set to same value as st_mtime
- *
- * @param path: the file path
- * @param sb: pointer to stat struct
+ * Add an entry to a directory. A full single-block directory is
+ * converted to an indexed directory, and full leaf blocks of an
+ * indexed directory are split.
  *
- * @return: 0 if successful, or -error number
- * 	-ENOENT  - a component of the path is not present
- *	-ENOTDIR - an intermediate component of path not a directory
+ * @param dir: the directory inode
+ * @param name: the entry name
+ * @param inum: the entry inode
+ * @return SUCCESS, or -ENOSPC if no space for the entry, or -EIO
  */
-static int fs_getattr(const char *path, struct stat *sb)
+static int dir_add(int dir, const char *name, int inum)
 {
-	fs_init(NULL);
+	struct fs_dirent de[DIRENTS_PER_BLK];
+	int res;
+	for (;;)
+	{
+		struct dx_path p;
+		int blk = dir_leaf(dir, name, &p);
+		if (blk < 0)
+			return blk;
+		if (disk->ops->read(disk, blk, 1, de) < 0)
+			exit(1);
+		for (int i = 0; i < DIRENTS_PER_BLK; i++)
+		{
+			if (!de[i].valid)
+			{
+				memset(&de[i], 0, sizeof(struct fs_dirent));
+				strcpy(de[i].name, name);
+				de[i].inode = inum;
+				de[i].valid = true;
+				write_meta(blk, de);
+				return SUCCESS;
+			}
+		}
 
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	cpy_stat(inode, sb);
-	return SUCCESS;
+		// no free entry: make room and try again
+		if (!(inodes[dir].flags & FS_INODE_INDEXED))
+			res = dx_convert(dir, de);
+		else
+			res = dx_split_leaf(dir, &p, de);
+		if (res < 0)
+			return res;
+	}
 }
 
 /**
- * opendir - open file directory
- *
- * You can save information about the open directory in fi->fh.
- * If you allocate memory, free it in fs_releasedir.
- *
- * @param path: the file path
- * @param fi: fuse file system information
+ * Remove an entry from a directory.
  *
- * @return: 0 if successful, or -error number
- *	-ENOENT  - a component of the path is not present
- *	-ENOTDIR - an intermediate component of path not a directory
+ * @param dir: the directory inode
+ * @param name: the entry name
+ * @return SUCCESS, -ENOENT if not found, or -EIO
  */
-static int fs_opendir(const char *path, struct fuse_file_info *fi)
+static int dir_remove(int dir, const char *name)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	if (!S_ISDIR(inodes[inode_idx].mode))
-		return -ENOTDIR;
-	fi->fh = (uint64_t)inode_idx;
-	return SUCCESS;
+	struct fs_dirent de[DIRENTS_PER_BLK];
+	int blk = dir_leaf(dir, name, NULL);
+	if (blk < 0)
+		return blk;
+	if (disk->ops->read(disk, blk, 1, de) < 0)
+		exit(1);
+	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+	{
+		if (de[i].valid && strcmp(de[i].name, name) == 0)
+		{
+			memset(&de[i], 0, sizeof(struct fs_dirent));
+			write_meta(blk, de);
+			return SUCCESS;
+		}
+	}
+	return -ENOENT;
 }
 
+/** function called for each entry by dir_iterate */
+typedef int (*dir_fn)(void *arg, const struct fs_dirent *de);
+
 /**
- * readdir - get directory contents
- *
- * For each entry in the directory, invoke the 'filler' function,
- * which is passed as a function pointer, as follows:
- * filler(buf, <name>, <statbuf>, 0)
- * where <statbuf> is a struct stat, just like in getattr.
- *
- * @param path: the directory path
- * @param ptr: filler buf pointer
- * @param filler filler function to call for each entry
- * @param offset: the file offset -- unused
- * @param fi: the fuse file information -- you do not have to use it
+ * Call a function for each entry of a leaf block.
  *
- * @return: 0 if successful, or -error number
- * 	-ENOENT  - a component of the path is not present
- * 	-ENOTDIR - an intermediate component of path not a directory
+ * @return the first nonzero result of fn, or 0
  */
-static int fs_readdir(const char *path, void *ptr, fuse_fill_dir_t filler,
-					  off_t offset, struct fuse_file_info *fi)
+static int dir_iterate_blk(uint32_t blk, dir_fn fn, void *arg)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	if (!S_ISDIR(inode->mode))
-		return -ENOTDIR;
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	struct stat sb;
-	if (disk->ops->read(disk, inode->direct[0], 1, entries) < 0)
-		exit(1);
+	struct fs_dirent buf[DIRENTS_PER_BLK];
+	const struct fs_dirent *de = map_blk(blk, buf);
 	for (int i = 0; i < DIRENTS_PER_BLK; i++)
 	{
-		if (entries[i].valid)
+		if (de[i].valid)
 		{
-			cpy_stat(&inodes[entries[i].inode], &sb);
-			filler(ptr, entries[i].name, &sb, 0);
+			int res = fn(arg, &de[i]);
+			if (res != 0)
+				return res;
 		}
 	}
-	return SUCCESS;
+	return 0;
 }
 
 /**
- * Release resources when directory is closed.
- * If you allocate memory in fs_opendir, free it here.
- *
- * @param path: the directory path
- * @param fi: fuse file system information -- you do not have to use it
+ * Call a function for each entry of a directory, in hash order
+ * for an indexed directory, until the function returns nonzero.
  *
- * @return: 0 if successful, or -error number
- *	-ENOENT  - a component of the path is not present
- *	-ENOTDIR - an intermediate component of path not a directory
+ * @param dir: the directory inode
+ * @param fn: the function to call
+ * @param arg: the first argument to fn
+ * @return the first nonzero result of fn, 0, or -EIO
  */
-static int fs_releasedir(const char *path, struct fuse_file_info *fi)
+static int dir_iterate(int dir, dir_fn fn, void *arg)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	if (!S_ISDIR(inodes[inode_idx].mode))
-		return -ENOTDIR;
-	fi->fh = (uint64_t)-1;
-	return SUCCESS;
+	if (!(inodes[dir].flags & FS_INODE_INDEXED))
+		return dir_iterate_blk(inodes[dir].direct[0], fn, arg);
+
+	// copy the index nodes: leaves may be mapped into the same buffer
+	struct fs_dx_node root, node;
+	if (disk->ops->read(disk, inodes[dir].direct[0], 1, &root) < 0)
+		exit(1);
+	if (root.magic != FS_DX_MAGIC)
+		return -EIO;
+	for (int i = 0; i < root.count; i++)
+	{
+		uint32_t blk = dir_blk(dir, root.entries[i].block);
+		if (!blk)
+			return -EIO;
+		if (root.levels == 0)
+		{
+			int res = dir_iterate_blk(blk, fn, arg);
+			if (res != 0)
+				return res;
+			continue;
+		}
+		if (disk->ops->read(disk, blk, 1, &node) < 0)
+			exit(1);
+		if (node.magic != FS_DX_MAGIC)
+			return -EIO;
+		for (int j = 0; j < node.count; j++)
+		{
+			uint32_t leaf = dir_blk(dir, node.entries[j].block);
+			int res = leaf ? dir_iterate_blk(leaf, fn, arg) : -EIO;
+			if (res != 0)
+				return res;
+		}
+	}
+	return 0;
 }
 
-static int set_attributes_and_update(struct fs_dirent *de, char *name, mode_t mode, bool isDir)
+static int dir_has_entry(void *arg, const struct fs_dirent *de)
 {
-	// get free directory and inode
-	int freed = find_free_dir(de);
-	int freei = get_free_inode();
-	int freeb = isDir ? get_free_blk() : 0;
-	if (freed < 0 || freei < 0 || freeb < 0)
-		return -ENOSPC;
-	struct fs_dirent *dir = &de[freed];
-	struct fs_inode *inode = &inodes[freei];
-	strcpy(dir->name, name);
-	dir->inode = freei;
-	dir->valid = true;
-	inode->uid = getuid();
-	inode->gid = getgid();
-	inode->mode = mode;
-	inode->ctime = inode->mtime = time(NULL);
-	inode->size = 0;
-	inode->direct[0] = freeb;
-	// update map and inode
-	update_inode(freei);
-	update_blk();
-	return SUCCESS;
+	return 1;
 }
 
 /**
- * mknod - create a new regular file with permissions (mode & 01777).
- * Behavior undefined when mode bits other than the low 9 bits are used.
+ * Determines whether directory is empty.
  *
- * @param path: the file path
- * @param mode: indicating block or character-special file
- * @param dev: the character or block I/O device specification - you do not have to use it
+ * @param dir: the directory inode
+ * @return 1 if empty 0 if has entries
+ */
+static int is_empty_dir(int dir)
+{
+	return dir_iterate(dir, dir_has_entry, NULL) == 0;
+}
+
+/**
+ * Count the data and indirect blocks allocated to an inode, walking
+ * its block map the first time and using the count kept up to date
+ * by bmap_range after that. The caller holds the inode lock.
  *
- * @return: 0 if successful, or -error number
- * 	-ENOTDIR  - component of path not a directory
- * 	-EEXIST   - file already exists
- * 	-ENOSPC   - free inode not available
- * 	-ENOSPC   - results in >32 entries in directory
+ * @param inum the inode number
+ * @return the number of blocks
  */
-static int fs_mknod(const char *path, mode_t mode, dev_t dev)
+static int count_blocks(int inum)
 {
-	// get current and parent inodes
-	mode |= S_IFREG;
-	if (!S_ISREG(mode) || strcmp(path, "/") == 0)
-		return -EINVAL;
-	char *_path = strdup(path);
-	char name[FS_FILENAME_SIZE];
-	int inode_idx = translate(_path);
-	int parent_inode_idx = translate_1(_path, name);
-	if (inode_idx >= 0)
-		return -EEXIST;
-	if (parent_inode_idx < 0)
-		return parent_inode_idx;
-	// read parent info
-	struct fs_inode *parent_inode = &inodes[parent_inode_idx];
-	if (!S_ISDIR(parent_inode->mode))
-		return -ENOTDIR;
-
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
-	// assign inode and directory and update
-	int res = set_attributes_and_update(entries, name, mode, false);
-	if (res < 0)
-		return res;
+	int n = __atomic_load_n(&blk_count[inum], __ATOMIC_RELAXED);
+	if (n >= 0)
+		return n;
+	struct fs_inode *inode = &inodes[inum];
+	uint32_t buf[PTRS_PER_BLK], buf2[PTRS_PER_BLK];
+	n = 0;
+	for (int i = 0; i < N_DIRECT; i++)
+		n += inode->direct[i] != 0;
+	if (inode->indir_1)
+	{
+		const uint32_t *ptrs = map_blk(inode->indir_1, buf);
+		n++;
+		for (int i = 0; i < PTRS_PER_BLK; i++)
+			n += ptrs[i] != 0;
+	}
+	if (inode->indir_2)
+	{
+		const uint32_t *mids = map_blk(inode->indir_2, buf);
+		n++;
+		for (int i = 0; i < PTRS_PER_BLK; i++)
+		{
+			if (mids[i] == 0)
+				continue;
+			const uint32_t *ptrs = map_blk(mids[i], buf2);
+			n++;
+			for (int j = 0; j < PTRS_PER_BLK; j++)
+				n += ptrs[j] != 0;
+		}
+	}
+	// readers sharing the inode lock store the same count
+	__atomic_store_n(&blk_count[inum], n, __ATOMIC_RELAXED);
+	return n;
+}
 
-	// write entries buffer into disk
-	if (disk->ops->write(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
-	return SUCCESS;
+/**
+ * Copy stat from inode to sb. The caller holds the inode lock.
+ *
+ * @param inum inode to be copied from
+ * @param sb holder to hold copied stat
+ */
+static void cpy_stat(int inum, struct stat *sb)
+{
+	struct fs_inode *inode = &inodes[inum];
+	memset(sb, 0, sizeof(*sb));
+	sb->st_uid = inode->uid;
+	sb->st_gid = inode->gid;
+	sb->st_mode = (mode_t)inode->mode;
+	sb->st_atime = inode->mtime;
+	sb->st_ctime = inode->ctime;
+	sb->st_mtime = inode->mtime;
+	sb->st_size = inode->size;
+	sb->st_blksize = FS_BLOCK_SIZE;
+	sb->st_nlink = 1;
+	sb->st_blocks = (blkcnt_t)count_blocks(inum) * (FS_BLOCK_SIZE / 512);
 }
 
+/** state of an open file, protected by the inode lock and, for readers
+ * sharing the inode lock, by the file lock */
+struct fs_file
+{
+	int inum;			   // file inode
+	pthread_mutex_t lock;  // serializes readers of the open file
+	uint32_t *map;		   // cached block numbers by logical block, 0 if not cached
+	int map_len;		   // number of entries in map
+	off_t next_offset;	   // offset following the previous read or write
+	int seq_count;		   // number of consecutive sequential accesses
+	int ra_size;		   // read-ahead window in blocks, 0 if none
+	int ra_next;		   // first logical block not yet read ahead
+	bool wpending;		   // wbuf holds data not yet written
+	uint32_t wblk;		   // block number of pending write
+	char wbuf[BLOCK_SIZE]; // contents of pending write block
+};
+
+/** smallest and largest read-ahead windows, in blocks */
+enum { RA_MIN_BLKS = 4, RA_MAX_BLKS = 64 };
+
+/** open file table, indexed by file handle */
+static struct fs_file **files;
+
+/** length of open file table */
+static int files_len;
+
+/** protects files and files_len */
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
- * mkdir - create a directory with the given mode. Behavior undefined
- * when mode bits other than the low 9 bits are used.
+ * Allocate an open file table entry for a file.
  *
- * @param path: path to directory
- * @param mode: the mode for the new directory
+ * @param inum: the file inode
+ * @return the file handle, or -ENOMEM
+ */
+static int new_file(int inum)
+{
+	struct fs_file *file = calloc(1, sizeof(struct fs_file));
+	if (file == NULL)
+		return -ENOMEM;
+	file->inum = inum;
+	pthread_mutex_init(&file->lock, NULL);
+
+	pthread_mutex_lock(&files_lock);
+	int fh;
+	for (fh = 0; fh < files_len && files[fh] != NULL; fh++)
+		;
+	if (fh == files_len)
+	{
+		// grow the table
+		int len = files_len ? 2 * files_len : 16;
+		struct fs_file **f = realloc(files, len * sizeof(struct fs_file *));
+		if (f == NULL)
+		{
+			pthread_mutex_unlock(&files_lock);
+			free(file);
+			return -ENOMEM;
+		}
+		memset(f + files_len, 0, (len - files_len) * sizeof(struct fs_file *));
+		files = f;
+		files_len = len;
+	}
+	files[fh] = file;
+	pthread_mutex_unlock(&files_lock);
+	return fh;
+}
+
+/**
+ * Get the open file for a FUSE file handle.
  *
- * @return: 0 if successful, or -error number
- * 	-ENOTDIR  - component of path not a directory
- * 	-EEXIST   - file already exists
- * 	-ENOSPC   - free inode not available
- * 	-ENOSPC   - results in >32 entries in directory
+ * @param fi: the fuse file info, or NULL
+ * @return the open file or NULL if fi has no valid handle
+ */
+static struct fs_file *get_file(struct fuse_file_info *fi)
+{
+	struct fs_file *f = NULL;
+	pthread_mutex_lock(&files_lock);
+	if (fi != NULL && fi->fh < (uint64_t)files_len)
+		f = files[fi->fh];
+	pthread_mutex_unlock(&files_lock);
+	return f;
+}
+
+/**
+ * Remove an open file from the open file table and free it.
  *
- * Note: fs_mkdir is the same as fs_mknod except that fs_mknod creates
- * a regular file while fs_mkdir creates a directory.  See also the
- * last argument of set_attributes_and_update.
+ * @param fi: the fuse file info holding its handle
  */
-static int fs_mkdir(const char *path, mode_t mode)
+static void free_file(struct fuse_file_info *fi)
 {
-	// CS492: your code here
-	// get current and parent inodes
-	mode |= S_IFDIR;
-	if (!S_ISDIR(mode) || strcmp(path, "/") == 0)
-		return -EINVAL;
-	char *_path = strdup(path);
-	char name[FS_FILENAME_SIZE];
-	int inode_idx = translate(_path);
-	int parent_inode_idx = translate_1(_path, name);
-	if (inode_idx >= 0)
-		return -EEXIST;
-	if (parent_inode_idx < 0)
-		return parent_inode_idx;
-	// read parent info
-	struct fs_inode *parent_inode = &inodes[parent_inode_idx];
-	if (!S_ISDIR(parent_inode->mode))
-		return -ENOTDIR;
+	pthread_mutex_lock(&files_lock);
+	struct fs_file *f = files[fi->fh];
+	files[fi->fh] = NULL;
+	pthread_mutex_unlock(&files_lock);
+	fi->fh = (uint64_t)-1;
+	pthread_mutex_destroy(&f->lock);
+	free(f->map);
+	free(f);
+}
 
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, parent_inode->direct[0], 1, entries) < 0)
+/**
+ * Write the pending block of an open file.
+ *
+ * @param f: the open file
+ */
+static void file_flush_write(struct fs_file *f)
+{
+	if (!f->wpending)
+		return;
+	if (disk->ops->write(disk, f->wblk, 1, f->wbuf) < 0)
 		exit(1);
-	// assign inode and directory and update
-	int res = set_attributes_and_update(entries, name, mode, true);
-	if (res < 0)
-		return res;
+	f->wpending = false;
+}
 
-	// write entries buffer into disk
-	if (disk->ops->write(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
-	return SUCCESS;
-	return -1;
+/**
+ * Write the pending blocks of all open files of an inode. The caller
+ * holds the inode lock but not the lock of any of its open files.
+ *
+ * @param inum: the file inode
+ * @param except: open file to skip, or NULL
+ */
+static void file_sync_inode(int inum, struct fs_file *except)
+{
+	pthread_mutex_lock(&files_lock);
+	for (int fh = 0; fh < files_len; fh++)
+	{
+		struct fs_file *f = files[fh];
+		if (f != NULL && f != except && f->inum == inum)
+		{
+			pthread_mutex_lock(&f->lock);
+			file_flush_write(f);
+			pthread_mutex_unlock(&f->lock);
+		}
+	}
+	pthread_mutex_unlock(&files_lock);
 }
 
-static void fs_truncate_dir(uint32_t *de)
+/**
+ * Drop the cached block maps of all open files of an inode
+ * after its blocks are freed.
+ *
+ * @param inum: the file inode
+ */
+static void file_invalidate(int inum)
 {
-	for (int i = 0; i < N_DIRECT; i++)
+	pthread_mutex_lock(&files_lock);
+	for (int fh = 0; fh < files_len; fh++)
 	{
-		if (de[i])
-			return_blk(de[i]);
-		de[i] = 0;
+		struct fs_file *f = files[fh];
+		if (f != NULL && f->inum == inum)
+		{
+			pthread_mutex_lock(&f->lock);
+			free(f->map);
+			f->map = NULL;
+			f->map_len = 0;
+			f->wpending = false;
+			pthread_mutex_unlock(&f->lock);
+		}
 	}
+	pthread_mutex_unlock(&files_lock);
 }
 
-static void fs_truncate_indir1(int blk_num)
+/**
+ * Record an access to an open file to detect sequential access.
+ *
+ * @param f: the open file
+ * @param offset: the offset of the access
+ * @param len: the length of the access
+ */
+static void file_access(struct fs_file *f, off_t offset, size_t len)
 {
-	uint32_t entries[PTRS_PER_BLK];
-	memset(entries, 0, PTRS_PER_BLK * sizeof(uint32_t));
-	if (disk->ops->read(disk, blk_num, 1, entries) < 0)
-		exit(1);
-	// clear each blk and wipe from blk_map
-	for (int i = 0; i < PTRS_PER_BLK; i++)
+	if (offset == f->next_offset)
+		f->seq_count++;
+	else
+		f->seq_count = 0;
+	f->next_offset = offset + len;
+}
+
+/*
+ * CS492: FUSE functions to implement are below.
+ */
+
+/**
+ * Stack the journal of the file system on the disk, replaying the
+ * transactions committed in it.
+ *
+ * @param sb: the superblock
+ */
+static void open_journal(const struct fs_super *sb)
+{
+	struct blkdev *jdev = journal_create(disk, sb->journal_start, sb->journal_len, commit_prepare);
+	if (jdev == NULL)
 	{
-		if (entries[i])
-			return_blk(entries[i]);
-		entries[i] = 0;
+		fprintf(stderr, "cannot open journal at block %u\n", sb->journal_start);
+		exit(1);
 	}
+	disk = jdev;
+	journaled = true;
 }
 
-static void fs_truncate_indir2(int blk_num)
+/**
+ * Add a journal to a file system without one. The journal takes a run
+ * of free blocks, which are marked in use, and the superblock records
+ * where it is.
+ *
+ * @param sb: the superblock, updated with the journal region
+ * @param nblks: the size of the journal in blocks
+ */
+static void add_journal(struct fs_super *sb, int nblks)
 {
-	uint32_t entries[PTRS_PER_BLK];
-	memset(entries, 0, PTRS_PER_BLK * sizeof(uint32_t));
-	if (disk->ops->read(disk, blk_num, 1, entries) < 0)
+	int start = -1, len, goal = 0;
+	while (start < 0 && goal < n_blocks)
+	{
+		int bit = bitmap_find(&block_map, goal, nblks, &len);
+		if (bit < goal)
+			break;
+		if (len == nblks)
+			start = bit;
+		goal = bit + len + 1;
+	}
+	if (start < 0)
+	{
+		fprintf(stderr, "no run of %d free blocks for journal\n", nblks);
 		exit(1);
-	// clear each double link
-	for (int i = 0; i < PTRS_PER_BLK; i++)
+	}
+	for (int i = 0; i < nblks; i++)
 	{
-		if (entries[i])
-			fs_truncate_indir1(entries[i]);
-		entries[i] = 0;
+		bitmap_set(&block_map, start + i);
+		mark_map_dirty(block_map_base, block_map.words, start + i);
 	}
+	flush_metadata();
+
+	// the region holds no journal yet
+	char buf[BLOCK_SIZE] = {0};
+	sb->journal_start = start;
+	sb->journal_len = nblks;
+	if (disk->ops->write(disk, start, 1, buf) < 0 ||
+		disk->ops->write(disk, 0, 1, sb) < 0 ||
+		disk->ops->flush(disk, 0, n_blocks) < 0)
+		exit(1);
 }
 
 /**
- * truncate - truncate file to exactly 'len' bytes.
+ * init - this is called once by the FUSE framework at startup.
  *
- * Errors:
- *   ENOENT  - file does not exist
- *   ENOTDIR - component of path not a directory
- *   EINVAL  - length invalid (only supports 0)
- *   EISDIR	 - path is a directory (only files)
+ * This is a good place to read in the super-block and set up any
+ * global variables you need. You don't need to worry about the
+ * argument or the return value.
  *
- * @param path the file path
- * @param len the length
- * @return 0 if successful, or error value
+ * @param conn: fuse connection information - unused
+ * @return: unused - returns NULL
+ *
+ * Note: if any block read operation fails, just exit(1) immediately.
  */
-static int fs_truncate(const char *path, off_t len)
+void *fs_init(struct fuse_conn_info *conn)
 {
-	if (len != 0)
-		return -EINVAL; /* invalid argument */
+	// read the superblock
+	// CS492: your code below
+	struct fs_super sb;
+	if (disk->ops->read(disk, 0, 1, &sb) != SUCCESS)
+	{ // read from index 0 (first block = sb)
+		exit(1);
+	}
+	root_inode = sb.root_inode; // set the root inode with info from superblock
 
-	// get inode
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	if (S_ISDIR(inode->mode))
-		return -EISDIR;
+	// replay the journal before reading metadata, which is then written through it
+	if (sb.journal_len > 0)
+		open_journal(&sb);
 
-	// clear direct
-	fs_truncate_dir(inode->direct);
+	/* The inode map and block map are directly after the superblock */
+	// read inode map
+	// CS492: your code below
+	inode_map_base = 1; // This is correct.
+	void *map = malloc(sb.inode_map_sz * FS_BLOCK_SIZE); // allocate space for inode map blocks (* block size to convert to bytes)
+	if (disk->ops->read(disk, inode_map_base, sb.inode_map_sz, map) != SUCCESS)
+	{
+		// starting from inode_map_base, read inode_map_sz blocks into inode_map
+		exit(1);
+	}
+	bitmap_init(&inode_map, map, sb.inode_region_sz * INODES_PER_BLK);
+	// inode 0 is unused and inode 1 is the root: never allocate them
+	bitmap_set(&inode_map, 0);
+	bitmap_set(&inode_map, 1);
 
-	// clear indirect1
-	if (inode->indir_1)
+	// read block map
+	// CS492: your code below
+	block_map_base = 1 + sb.inode_map_sz; // block map base is directly after inode map (end of inode map = inode_base + sz)
+	map = malloc(sb.block_map_sz * FS_BLOCK_SIZE); // allocate space for block map
+	if (disk->ops->read(disk, block_map_base, sb.block_map_sz, map) != SUCCESS)
 	{
-		fs_truncate_indir1(inode->indir_1);
-		return_blk(inode->indir_1);
+		// starting from block_map_base, read block_map_sz into block_map
+		exit(1);
 	}
-	inode->indir_1 = 0;
+	bitmap_init(&block_map, map, sb.num_blocks);
 
-	// clear indirect2
-	if (inode->indir_2)
+	/* The inode data is in the next set of blocks */
+	// CS492: your code below
+	inode_base = 1 + sb.inode_map_sz + sb.block_map_sz;	// inode base is directly after the end of the block map
+	n_inodes = sb.inode_region_sz * INODES_PER_BLK; // num blocks * inodes per block = num inodes
+	inodes = malloc(sb.inode_region_sz * FS_BLOCK_SIZE); // allocate space for inode blocks
+	if (disk->ops->read(disk, inode_base, sb.inode_region_sz, inodes) != SUCCESS)
 	{
-		fs_truncate_indir2(inode->indir_2);
-		return_blk(inode->indir_2);
+		// read in inode blocks... you get the drill
+		exit(1);
 	}
-	inode->indir_2 = 0;
+	inode_copy = malloc(sb.inode_region_sz * FS_BLOCK_SIZE);
+	memcpy(inode_copy, inodes, sb.inode_region_sz * FS_BLOCK_SIZE);
 
-	inode->size = 0;
+	// number of blocks on device
+	n_blocks = sb.num_blocks;
 
-	// update at the end for efficiency
-	update_inode(inode_idx);
-	update_blk();
+	// dirty metadata blocks
+	dirty_len = inode_base + sb.inode_region_sz;
+	dirty = calloc(dirty_len * sizeof(void *), 1);
+
+	// preallocation windows
+	prealloc = calloc(n_inodes, sizeof(struct prealloc));
+
+	// allocated block counts, counted when first needed
+	blk_count = malloc(n_inodes * sizeof(int));
+	if (blk_count == NULL)
+		exit(1);
+	for (int i = 0; i < n_inodes; i++)
+		blk_count[i] = -1;
+
+	// inode locks
+	inode_locks = malloc(n_inodes * sizeof(pthread_rwlock_t));
+	if (inode_locks == NULL)
+		exit(1);
+	for (int i = 0; i < n_inodes; i++)
+		pthread_rwlock_init(&inode_locks[i], NULL);
+
+	// kernel references through the low-level API
+	refs = calloc(n_inodes, sizeof(struct inode_ref));
+
+	// directory entry cache
+	dcache = dcache_create(DCACHE_SIZE);
+	if (dcache == NULL)
+		exit(1);
+
+	if (!journaled && fs_journal_blocks > 0)
+	{
+		add_journal(&sb, fs_journal_blocks);
+		open_journal(&sb);
+	}
+
+	// move file data through pipes instead of copying it when possible
+	if (conn != NULL)
+		conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
+	return NULL;
+}
+
+/* Note on path translation errors:
+ * In addition to the method-specific errors listed below, almost
+ * every method can return one of the following errors if it fails to
+ * locate a file or directory corresponding to a specified path.
+ *
+ * ENOENT - a component of the path is not present.
+ * ENOTDIR - an intermediate component of the path (e.g. 'b' in
+ *           /a/b/c) is not a directory
+ */
+
+/* note on splitting the 'path' variable:
+ * the value passed in by the FUSE framework is declared as 'const',
+ * which means you can't modify it. The standard mechanisms for
+ * splitting strings in C (strtok, strsep) modify the string in place,
+ * so you have to copy the string and then free the copy when you're
+ * done. One way of doing this:
+ *
+ *    char *_path = strdup(path);
+ *    int inum = translate(_path);
+ *    free(_path);
+ */
+
+/**
+ * getattr - get file or directory attributes. For a description of
+ * the fields in 'struct stat', see 'man lstat'.
+ *
+ * Note: you can handle some fields as follows:
+ * st_nlink: always set to 1
+ * st_atime, st_ctime: set to same value as st_mtime
+ *
+ * @param path: the file path
+ * @param sb: pointer to stat struct
+ *
+ * @return: 0 if successful, or -error number
+ * 	-ENOENT  - a component of the path is not present
+ *	-ENOTDIR - an intermediate component of path not a directory
+ */
+static int fs_getattr(const char *path, struct stat *sb)
+{
+	char *_path = strdup(path);
+	int inode_idx = walk_path(_path, NULL, false);
+	free(_path);
+	if (inode_idx < 0)
+		return inode_idx;
+	cpy_stat(inode_idx, sb);
+	inode_unlock(inode_idx);
+	return SUCCESS;
+}
+
+/**
+ * opendir - open file directory
+ *
+ * You can save information about the open directory in fi->fh.
+ * If you allocate memory, free it in fs_releasedir.
+ *
+ * @param path: the file path
+ * @param fi: fuse file system information
+ *
+ * @return: 0 if successful, or -error number
+ *	-ENOENT  - a component of the path is not present
+ *	-ENOTDIR - an intermediate component of path not a directory
+ */
+static int fs_opendir(const char *path, struct fuse_file_info *fi)
+{
+	int inode_idx = walk_path(path, NULL, false);
+	if (inode_idx < 0)
+		return inode_idx;
+	bool isdir = S_ISDIR(inodes[inode_idx].mode);
+	inode_unlock(inode_idx);
+	if (!isdir)
+		return -ENOTDIR;
+	fi->fh = (uint64_t)inode_idx;
+	return SUCCESS;
+}
+
+/** filler state for readdir_entry */
+struct readdir_arg
+{
+	void *ptr;
+	fuse_fill_dir_t filler;
+};
+
+static int readdir_entry(void *arg, const struct fs_dirent *de)
+{
+	struct readdir_arg *ra = arg;
+	struct stat sb;
+	inode_lock(de->inode, false);
+	cpy_stat(de->inode, &sb);
+	inode_unlock(de->inode);
+	ra->filler(ra->ptr, de->name, &sb, 0);
+	return 0;
+}
+
+/**
+ * readdir - get directory contents
+ *
+ * For each entry in the directory, invoke the 'filler' function,
+ * which is passed as a function pointer, as follows:
+ * filler(buf, <name>, <statbuf>, 0)
+ * where <statbuf> is a struct stat, just like in getattr.
+ *
+ * @param path: the directory path
+ * @param ptr: filler buf pointer
+ * @param filler filler function to call for each entry
+ * @param offset: the file offset -- unused
+ * @param fi: the fuse file information -- you do not have to use it
+ *
+ * @return: 0 if successful, or -error number
+ * 	-ENOENT  - a component of the path is not present
+ * 	-ENOTDIR - an intermediate component of path not a directory
+ */
+static int fs_readdir(const char *path, void *ptr, fuse_fill_dir_t filler,
+					  off_t offset, struct fuse_file_info *fi)
+{
+	int inode_idx = walk_path(path, NULL, false);
+	if (inode_idx < 0)
+		return inode_idx;
+	struct fs_inode *inode = &inodes[inode_idx];
+	int res = -ENOTDIR;
+	if (S_ISDIR(inode->mode))
+	{
+		struct readdir_arg arg = {ptr, filler};
+		res = dir_iterate(inode_idx, readdir_entry, &arg);
+	}
+	inode_unlock(inode_idx);
+	return res < 0 ? res : SUCCESS;
+}
+
+/**
+ * Release resources when directory is closed.
+ * If you allocate memory in fs_opendir, free it here.
+ *
+ * @param path: the directory path
+ * @param fi: fuse file system information -- you do not have to use it
+ *
+ * @return: 0 if successful, or -error number
+ *	-ENOENT  - a component of the path is not present
+ *	-ENOTDIR - an intermediate component of path not a directory
+ */
+static int fs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	int inode_idx = walk_path(path, NULL, false);
+	if (inode_idx < 0)
+		return inode_idx;
+	bool isdir = S_ISDIR(inodes[inode_idx].mode);
+	inode_unlock(inode_idx);
+	if (!isdir)
+		return -ENOTDIR;
+	fi->fh = (uint64_t)-1;
+	return SUCCESS;
+}
+
+/**
+ * Create a file or directory in a directory. The caller holds the
+ * directory write lock.
+ *
+ * @param parent: the directory inode
+ * @param name: the new entry name
+ * @param mode: the mode of the new inode
+ * @param isDir: whether to create a directory
+ * @return the new inode, or -error number
+ */
+static int set_attributes_and_update(int parent, const char *name, mode_t mode, bool isDir)
+{
+	// get free inode and directory block
+	int freei = get_free_inode();
+	if (freei < 0)
+		return -ENOSPC;
+	int freeb = isDir ? get_free_blk(NULL) : 0;
+	if (freeb < 0)
+	{
+		return_inode(freei);
+		return -ENOSPC;
+	}
+	int res = dir_add(parent, name, freei);
+	if (res < 0)
+	{
+		if (freeb)
+			return_blk(freeb);
+		return_inode(freei);
+		return res;
+	}
+	if (freeb)
+	{
+		// new directory block has no entries
+		char buff[BLOCK_SIZE];
+		memset(buff, 0, BLOCK_SIZE);
+		write_meta(freeb, buff);
+	}
+	struct fs_inode *inode = &inodes[freei];
+	memset(inode, 0, sizeof(struct fs_inode));
+	inode->uid = getuid();
+	inode->gid = getgid();
+	inode->mode = mode;
+	inode->ctime = inode->mtime = time(NULL);
+	inode->size = 0;
+	inode->direct[0] = freeb;
+	blk_count[freei] = freeb ? 1 : 0;
+	// update map and inode
+	update_inode(freei);
+	return freei;
+}
+
+/**
+ * Walk a path to the directory holding its last name, which is
+ * returned write locked.
+ *
+ * @param path: the path
+ * @param name: pointer to space for FS_FILENAME_SIZE leaf name
+ * @return: the directory inode, or -error number
+ *	-ENOENT   - a component of the path is not present
+ *	-ENOTDIR  - component of path not a directory
+ */
+static int walk_parent(const char *path, char *name)
+{
+	char *_path = strdup(path);
+	int parent_inode_idx = walk_path(_path, name, true);
+	free(_path);
+	if (parent_inode_idx >= 0 && !S_ISDIR(inodes[parent_inode_idx].mode))
+	{
+		inode_unlock(parent_inode_idx);
+		return -ENOTDIR;
+	}
+	return parent_inode_idx;
+}
+
+/**
+ * Create a file or directory with a name that is not yet in a
+ * directory. The caller holds the directory write lock.
+ *
+ * @param parent: the directory inode
+ * @param name: the new name
+ * @param mode: the mode of the new inode
+ * @param isDir: whether to create a directory
+ * @return: the new inode, or -error number
+ * 	-EEXIST   - file already exists
+ * 	-ENOSPC   - free inode or block not available
+ */
+static int create_entry(int parent, const char *name, mode_t mode, bool isDir)
+{
+	int res = lookup(parent, name);
+	if (res >= 0)
+		return -EEXIST;
+	if (res != -ENOENT)
+		return res;
+	// assign inode and directory entry and update
+	res = set_attributes_and_update(parent, name, mode, isDir);
+	if (res >= 0)
+		dcache_insert(dcache, parent, name, res);
+	return res;
+}
+
+/**
+ * mknod - create a new regular file with permissions (mode & 01777).
+ * Behavior undefined when mode bits other than the low 9 bits are used.
+ *
+ * @param path: the file path
+ * @param mode: indicating block or character-special file
+ * @param dev: the character or block I/O device specification - you do not have to use it
+ *
+ * @return: 0 if successful, or -error number
+ * 	-ENOTDIR  - component of path not a directory
+ * 	-EEXIST   - file already exists
+ * 	-ENOSPC   - free inode not available
+ * 	-ENOSPC   - no space for entry in directory
+ */
+static int fs_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	// get current and parent inodes
+	mode |= S_IFREG;
+	if (!S_ISREG(mode) || strcmp(path, "/") == 0)
+		return -EINVAL;
+	char name[FS_FILENAME_SIZE];
+	journal_begin(disk);
+	int parent_inode_idx = walk_parent(path, name);
+	int res = parent_inode_idx;
+	if (parent_inode_idx >= 0)
+	{
+		res = create_entry(parent_inode_idx, name, mode, false);
+		inode_unlock(parent_inode_idx);
+	}
+	journal_end(disk);
+	return res < 0 ? res : SUCCESS;
+}
+
+/**
+ * mkdir - create a directory with the given mode. Behavior undefined
+ * when mode bits other than the low 9 bits are used.
+ *
+ * @param path: path to directory
+ * @param mode: the mode for the new directory
+ *
+ * @return: 0 if successful, or -error number
+ * 	-ENOTDIR  - component of path not a directory
+ * 	-EEXIST   - file already exists
+ * 	-ENOSPC   - free inode not available
+ * 	-ENOSPC   - no space for entry in directory
+ *
+ * Note: fs_mkdir is the same as fs_mknod except that fs_mknod creates
+ * a regular file while fs_mkdir creates a directory.  See also the
+ * last argument of set_attributes_and_update.
+ */
+static int fs_mkdir(const char *path, mode_t mode)
+{
+	// CS492: your code here
+	// get current and parent inodes
+	mode |= S_IFDIR;
+	if (!S_ISDIR(mode) || strcmp(path, "/") == 0)
+		return -EINVAL;
+	char name[FS_FILENAME_SIZE];
+	journal_begin(disk);
+	int parent_inode_idx = walk_parent(path, name);
+	int res = parent_inode_idx;
+	if (parent_inode_idx >= 0)
+	{
+		res = create_entry(parent_inode_idx, name, mode, true);
+		inode_unlock(parent_inode_idx);
+	}
+	journal_end(disk);
+	return res < 0 ? res : SUCCESS;
+}
+
+/**
+ * Free the direct blocks of an inode from an entry on.
+ *
+ * @param de: the direct block pointers
+ * @param from: the first entry to free
+ */
+static void fs_truncate_dir(uint32_t *de, int from)
+{
+	for (int i = from; i < N_DIRECT; i++)
+	{
+		if (de[i])
+			return_blk(de[i]);
+		de[i] = 0;
+	}
+}
+
+/**
+ * Check whether an indirect block has no entries.
+ *
+ * @param entries: the indirect block entries
+ * @return: true if all entries are 0
+ */
+static bool indir_empty(const uint32_t *entries)
+{
+	for (int i = 0; i < PTRS_PER_BLK; i++)
+	{
+		if (entries[i])
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Free the blocks of a single indirect block from an entry on. The
+ * indirect block is written back if it keeps entries.
+ *
+ * @param blk_num: the indirect block
+ * @param from: the first entry to free
+ * @return: true if the indirect block has no entries left
+ */
+static bool fs_truncate_indir1(int blk_num, int from)
+{
+	uint32_t entries[PTRS_PER_BLK];
+	if (disk->ops->read(disk, blk_num, 1, entries) < 0)
+		exit(1);
+	// clear each blk and wipe from blk_map
+	bool changed = false;
+	for (int i = from; i < PTRS_PER_BLK; i++)
+	{
+		if (entries[i])
+		{
+			return_blk(entries[i]);
+			entries[i] = 0;
+			changed = true;
+		}
+	}
+	if (indir_empty(entries))
+		return true;
+	if (changed)
+		write_meta(blk_num, entries);
+	return false;
+}
+
+/**
+ * Free the blocks of a double indirect block from a logical block
+ * on. The indirect blocks are written back if they keep entries.
+ *
+ * @param blk_num: the double indirect block
+ * @param from: the first logical block to free, relative to the
+ *   first one the block maps
+ * @return: true if the double indirect block has no entries left
+ */
+static bool fs_truncate_indir2(int blk_num, int from)
+{
+	uint32_t entries[PTRS_PER_BLK];
+	if (disk->ops->read(disk, blk_num, 1, entries) < 0)
+		exit(1);
+	// clear each double link
+	int first = from / PTRS_PER_BLK;
+	bool changed = false;
+	for (int i = first; i < PTRS_PER_BLK; i++)
+	{
+		int from1 = (i == first) ? from % PTRS_PER_BLK : 0;
+		if (entries[i] && fs_truncate_indir1(entries[i], from1))
+		{
+			return_blk(entries[i]);
+			entries[i] = 0;
+			changed = true;
+		}
+	}
+	if (indir_empty(entries))
+		return true;
+	if (changed)
+		write_meta(blk_num, entries);
+	return false;
+}
+
+/**
+ * Free the data and indirect blocks of an inode from a logical
+ * block on. Only the indirect blocks covering the freed range are
+ * read.
+ *
+ * @param inode: the inode
+ * @param first: the first logical block to free
+ */
+static void free_blocks(struct fs_inode *inode, int first)
+{
+	// clear direct
+	if (first < N_DIRECT)
+		fs_truncate_dir(inode->direct, first);
+
+	// clear indirect1
+	int from = first - N_DIRECT;
+	if (inode->indir_1 && from < PTRS_PER_BLK &&
+		fs_truncate_indir1(inode->indir_1, (from > 0) ? from : 0))
+	{
+		return_blk(inode->indir_1);
+		inode->indir_1 = 0;
+	}
+
+	// clear indirect2
+	from -= PTRS_PER_BLK;
+	if (inode->indir_2 && fs_truncate_indir2(inode->indir_2, (from > 0) ? from : 0))
+	{
+		return_blk(inode->indir_2);
+		inode->indir_2 = 0;
+	}
+}
+
+/**
+ * Change the size of a file. When it shrinks, the blocks past the
+ * new end are freed and the tail of the new last block is zeroed;
+ * when it grows, the new range is a hole. The caller holds the inode
+ * write lock.
+ *
+ * @param inode_idx: the file inode
+ * @param len: the new size
+ */
+static void truncate_inode(int inode_idx, off_t len)
+{
+	struct fs_inode *inode = &inodes[inode_idx];
+	if (len > inode->size)
+	{
+		zero_gap(inode_idx, len);
+		inode->size = len;
+		update_inode(inode_idx);
+		return;
+	}
+
+	// pending writes of open files must not reach freed blocks
+	file_sync_inode(inode_idx, NULL);
+	prealloc_trim(inode_idx);
+	int keep = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	free_blocks(inode, keep);
+	blk_count[inode_idx] = -1;
+
+	// the tail of the last block must read as zeros if the file grows
+	size_t tail = len % BLOCK_SIZE;
+	uint32_t blk = 0;
+	if (tail != 0)
+		bmap_range(inode_idx, keep - 1, 1, &blk, false, NULL);
+	if (blk != 0)
+	{
+		char buf[BLOCK_SIZE];
+		if (disk->ops->read(disk, blk, 1, buf) < 0)
+			exit(1);
+		memset(buf + tail, 0, BLOCK_SIZE - tail);
+		if (disk->ops->write(disk, blk, 1, buf) < 0)
+			exit(1);
+	}
+	inode->size = len;
+	inode->flags &= ~FS_INODE_PREALLOC;
+	file_invalidate(inode_idx);
+
+	// update at the end for efficiency
+	update_inode(inode_idx);
+}
+
+/**
+ * Free an inode and all its blocks. The caller holds the inode
+ * write lock.
+ *
+ * @param inode_idx: the inode
+ */
+static void free_inode(int inode_idx)
+{
+	struct fs_inode *inode = &inodes[inode_idx];
+	if (S_ISDIR(inode->mode))
+	{
+		dcache_purge(dcache, inode_idx);
+		free_blocks(inode, 0);
+		blk_count[inode_idx] = -1;
+	}
+	else
+	{
+		truncate_inode(inode_idx, 0);
+	}
+	memset(inode, 0, sizeof(struct fs_inode));
+	return_inode(inode_idx);
+	update_inode(inode_idx);
+}
+
+/**
+ * Free an inode that was removed from its directory, unless the
+ * kernel still holds references to it through the low-level API;
+ * it is then freed by the forget that drops the last one. The caller
+ * holds the inode write lock.
+ *
+ * @param inode_idx: the inode
+ */
+static void unlinked_inode(int inode_idx)
+{
+	pthread_mutex_lock(&ref_lock);
+	bool referenced = refs[inode_idx].nlookup > 0;
+	refs[inode_idx].unlinked = referenced;
+	pthread_mutex_unlock(&ref_lock);
+	if (!referenced)
+		free_inode(inode_idx);
+}
+
+/**
+ * truncate - truncate file to exactly 'len' bytes.
+ *
+ * Errors:
+ *   ENOENT  - file does not exist
+ *   ENOTDIR - component of path not a directory
+ *   EINVAL  - length negative
+ *   EFBIG   - length larger than the largest file
+ *   EISDIR	 - path is a directory (only files)
+ *
+ * @param path the file path
+ * @param len the length
+ * @return 0 if successful, or error value
+ */
+static int fs_truncate(const char *path, off_t len)
+{
+	if (len < 0)
+		return -EINVAL; /* invalid argument */
+	if (len > MAX_FILE_SIZE)
+		return -EFBIG;
+
+	// get inode
+	journal_begin(disk);
+	char *_path = strdup(path);
+	int inode_idx = walk_path(_path, NULL, true);
+	free(_path);
+	int res = inode_idx;
+	if (inode_idx >= 0)
+	{
+		res = -EISDIR;
+		if (!S_ISDIR(inodes[inode_idx].mode))
+		{
+			truncate_inode(inode_idx, len);
+			res = SUCCESS;
+		}
+		inode_unlock(inode_idx);
+	}
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * Remove a file from a directory. The caller holds the directory
+ * write lock.
+ *
+ * @param parent: the directory inode
+ * @param name: the file name
+ * @return 0 if successful, or error value
+ *	-ENOENT   - file does not exist
+ * 	-EISDIR   - cannot unlink a directory
+ */
+static int unlink_entry(int parent, const char *name)
+{
+	int inode_idx = lookup(parent, name);
+	if (inode_idx < 0)
+		return inode_idx;
+	inode_lock(inode_idx, true);
+	int res = -EISDIR;
+	if (!S_ISDIR(inodes[inode_idx].mode))
+	{
+		// remove entire entry from parent dir
+		res = dir_remove(parent, name);
+	}
+	if (res == SUCCESS)
+	{
+		dcache_insert(dcache, parent, name, 0);
+		unlinked_inode(inode_idx);
+	}
+	inode_unlock(inode_idx);
+	return res;
+}
+
+/**
+ * unlink - delete a file
+ *
+ * @param path: path to file
+ *
+ * @return 0 if successful, or error value
+ *	-ENOENT   - file does not exist
+ * 	-ENOTDIR  - component of path not a directory
+ * 	-EISDIR   - cannot unlink a directory
+ */
+static int fs_unlink(const char *path)
+{
+	// get inodes and check
+	char name[FS_FILENAME_SIZE];
+	journal_begin(disk);
+	int parent_inode_idx = walk_parent(path, name);
+	int res = parent_inode_idx;
+	if (parent_inode_idx >= 0)
+	{
+		res = unlink_entry(parent_inode_idx, name);
+		inode_unlock(parent_inode_idx);
+	}
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * Remove an empty directory from its parent directory. The caller
+ * holds the parent write lock.
+ *
+ * @param parent: the parent directory inode
+ * @param name: the directory name
+ * @return: 0 if successful, or -error number
+ * 	-ENOENT   - directory does not exist
+ *  	-ENOTDIR  - name not a directory
+ *  	-ENOEMPTY - directory not empty
+ */
+static int rmdir_entry(int parent, const char *name)
+{
+	int inode_idx = lookup(parent, name);
+	if (inode_idx < 0)
+		return inode_idx;
+	inode_lock(inode_idx, true);
+
+	// check if dir if empty
+	int res;
+	if (!S_ISDIR(inodes[inode_idx].mode))
+		res = -ENOTDIR;
+	else if (is_empty_dir(inode_idx) == 0)
+		res = -ENOTEMPTY;
+	else
+	{
+		// remove entry from parent dir
+		res = dir_remove(parent, name);
+	}
+	if (res == SUCCESS)
+	{
+		dcache_insert(dcache, parent, name, 0);
+		unlinked_inode(inode_idx);
+	}
+	inode_unlock(inode_idx);
+	return res;
+}
+
+/**
+ * rmdir - remove a directory
+ *
+ * @param path: the path of the directory
+ *
+ * @return: 0 if successful, or -error number
+ * 	-ENOENT   - file does not exist
+ *  	-ENOTDIR  - component of path not a directory
+ *  	-ENOTDIR  - path not a directory
+ *  	-ENOEMPTY - directory not empty
+ *
+ * Note: this is similar to deleting a file, except that we delete
+ * a directory.
+ */
+static int fs_rmdir(const char *path)
+{
+	// can not remove root
+	if (strcmp(path, "/") == 0)
+		return -EINVAL;
+
+	// get inodes and check
+	// CS492: your code below
+	char name[FS_FILENAME_SIZE];
+	journal_begin(disk);
+	int parent_inode_idx = walk_parent(path, name);
+	int res = parent_inode_idx;
+	if (parent_inode_idx >= 0)
+	{
+		res = rmdir_entry(parent_inode_idx, name);
+		inode_unlock(parent_inode_idx);
+	}
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * Rename an entry of a directory. The caller holds the directory
+ * write lock.
+ *
+ * @param parent: the directory inode
+ * @param src_name: the current name
+ * @param dst_name: the new name
+ * @return: 0 if successful, or -error number
+ * 	-ENOENT   - source file or directory does not exist
+ * 	-EEXIST   - destination already exists
+ */
+static int rename_entry(int parent, const char *src_name, const char *dst_name)
+{
+	// src must exist and dst must not
+	int src_inode_idx = lookup(parent, src_name);
+	if (src_inode_idx < 0)
+		return src_inode_idx;
+	if (lookup(parent, dst_name) >= 0)
+		return -EEXIST;
+
+	// the new name may hash to another block: remove and add again
+	int res = dir_remove(parent, src_name);
+	if (res < 0)
+		return res;
+	res = dir_add(parent, dst_name, src_inode_idx);
+	if (res < 0)
+	{
+		dir_add(parent, src_name, src_inode_idx);
+		return res;
+	}
+	dcache_insert(dcache, parent, src_name, 0);
+	dcache_insert(dcache, parent, dst_name, src_inode_idx);
+	return SUCCESS;
+}
+
+/**
+ * rename - rename a file or directory. You can assume the destination
+ * and the source share the same path-prefix so the renaming changes
+ * the name without moving the file or directory into another file or
+ * directory.
+ *
+ * Note that this is a simplified version of the UNIX rename
+ * functionality - see 'man 2 rename' for full semantics. In
+ * particular, the full version can move across directories, replace a
+ * destination file, and replace an empty directory with a full one.
+ *
+ * @param src_path: the source path
+ * @param dst_path: the destination path
+ *
+ * @return: 0 if successful, or -error number
+ * 	-ENOENT   - source file or directory does not exist
+ * 	-ENOTDIR  - component of source or target path not a directory
+ * 	-EEXIST   - destination already exists
+ * 	-EINVAL   - source and destination not in the same directory
+ */
+static int fs_rename(const char *src_path, const char *dst_path)
+{
+	// get parent directory inode
+	char *_dst_path = strdup(dst_path);
+	char src_name[FS_FILENAME_SIZE];
+	char dst_name[FS_FILENAME_SIZE];
+	int dst_parent_inode_idx = translate_1(_dst_path, dst_name);
+	free(_dst_path);
+	journal_begin(disk);
+	int parent_inode_idx = walk_parent(src_path, src_name);
+	int res = parent_inode_idx;
+	if (parent_inode_idx >= 0)
+	{
+		// src and dst should be in the same directory (same parent)
+		res = -EINVAL;
+		if (parent_inode_idx == dst_parent_inode_idx)
+			res = rename_entry(parent_inode_idx, src_name, dst_name);
+		inode_unlock(parent_inode_idx);
+	}
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * chmod - change file permissions
+ *
+ * @param path: the file or directory path
+ * @param mode: the mode_t mode value -- see man 'chmod'
+ * for description
+ *
+ *  @return: 0 if successful, or -error number
+ *  	-ENOENT   - file does not exist
+ *  	-ENOTDIR  - component of path not a directory
+ */
+static int fs_chmod(const char *path, mode_t mode)
+{
+	journal_begin(disk);
+	char *_path = strdup(path);
+	int inode_idx = walk_path(_path, NULL, true);
+	free(_path);
+	if (inode_idx < 0)
+	{
+		journal_end(disk);
+		return inode_idx;
+	}
+	struct fs_inode *inode = &inodes[inode_idx];
+	// protect system from other modes
+	mode |= S_ISDIR(inode->mode) ? S_IFDIR : S_IFREG;
+	// change through reference
+	inode->mode = mode;
+	update_inode(inode_idx);
+	inode_unlock(inode_idx);
+	journal_end(disk);
+	return SUCCESS;
+}
+
+/**
+ * utime - change modification time.
+ *
+ * @param path the file or directory path.
+ * @param ut utimbuf - see man 'utime' for description.
+ * @return 0 if successful, or error value
+ *   -ENOENT   - file does not exist
+ *   -ENOTDIR  - component of path not a directory
+ */
+int fs_utime(const char *path, struct utimbuf *ut)
+{
+	// CS492: your code here
+	char *_path = strdup(path);
+	char name[FS_FILENAME_SIZE];
+	int inode_idx = translate(_path);
+	int parent_inode_idx = translate_1(_path, name);
+	// struct fs_inode *inode = &inodes[inode_idx];
+	if (inode_idx < 0 || parent_inode_idx < 0)
+		return -ENOENT;
+	/*if (!S_ISDIR(parent_inode_idx->mode))
+		return -ENOTDIR;
+	*/
+	int time = utime(_path, ut);
+	if (time == -1)
+	{
+		return -1;
+	}
+	return time;
+}
+
+/**
+ * Read a list of blocks, using the vectored read of the device
+ * if it has one.
+ *
+ * @param vec: the blocks and buffers to read them into
+ * @param nvec: the number of blocks
+ */
+static void read_blkv(struct blkvec *vec, int nvec)
+{
+	if (nvec == 0)
+		return;
+	if (disk->ops->readv != NULL)
+	{
+		if (disk->ops->readv(disk, vec, nvec) < 0)
+			exit(1);
+		return;
+	}
+	for (int i = 0; i < nvec; i++)
+	{
+		if (disk->ops->read(disk, vec[i].blk, 1, vec[i].buf) < 0)
+			exit(1);
+	}
+}
+
+/**
+ * Write a list of blocks, using the vectored write of the device
+ * if it has one.
+ *
+ * @param vec: the blocks and buffers to write them from
+ * @param nvec: the number of blocks
+ */
+static void write_blkv(struct blkvec *vec, int nvec)
+{
+	if (nvec == 0)
+		return;
+	if (disk->ops->writev != NULL)
+	{
+		if (disk->ops->writev(disk, vec, nvec) < 0)
+			exit(1);
+		return;
+	}
+	for (int i = 0; i < nvec; i++)
+	{
+		if (disk->ops->write(disk, vec[i].blk, 1, vec[i].buf) < 0)
+			exit(1);
+	}
+}
+
+/** an indirect block loaded while mapping file blocks */
+struct ind_blk
+{
+	uint32_t blk;				// block number, or 0 if none loaded
+	bool dirty;					// modified and must be written back
+	const uint32_t *ptrs;		// block contents, mapped or in buf
+	uint32_t buf[PTRS_PER_BLK]; // copy of block contents
+};
+
+/**
+ * Write back an indirect block if it was modified.
+ *
+ * @param ind: the indirect block
+ */
+static void put_ind(struct ind_blk *ind)
+{
+	if (ind->dirty)
+		write_meta(ind->blk, ind->buf);
+	ind->dirty = false;
+}
+
+/**
+ * Load an indirect block, writing back the one previously loaded.
+ * A block that will be modified is copied, otherwise it is mapped.
+ *
+ * @param ind: the indirect block holder
+ * @param blk_num: the block number to load
+ * @param alloc: whether the block will be modified
+ */
+static void get_ind(struct ind_blk *ind, uint32_t blk_num, bool alloc)
+{
+	if (ind->blk == blk_num)
+		return;
+	put_ind(ind);
+	ind->blk = blk_num;
+	if (alloc)
+	{
+		if (disk->ops->read(disk, blk_num, 1, ind->buf) < 0)
+			exit(1);
+		ind->ptrs = ind->buf;
+	}
+	else
+	{
+		ind->ptrs = map_blk(blk_num, ind->buf);
+	}
+}
+
+/**
+ * Allocate a new, empty indirect block and load it.
+ *
+ * @param ind: the indirect block holder
+ * @param hint: where to allocate the block
+ * @return the new block number or 0 if no space
+ */
+static uint32_t new_ind(struct ind_blk *ind, struct alloc_hint *hint)
+{
+	int freeb = get_free_blk(hint);
+	if (freeb < 0)
+		return 0;
+	put_ind(ind);
+	ind->blk = freeb;
+	memset(ind->buf, 0, BLOCK_SIZE);
+	ind->ptrs = ind->buf;
+	ind->dirty = true;
+	return freeb;
+}
+
+/**
+ * Get the block number in an entry of a loaded indirect block,
+ * allocating a data block for an empty entry if requested.
+ *
+ * @param ind: the indirect block
+ * @param i: the entry index
+ * @param hint: where to allocate a block for an empty entry,
+ *   or NULL to not allocate
+ * @return the block number, or 0 if none
+ */
+static uint32_t ind_entry(struct ind_blk *ind, int i, struct alloc_hint *hint)
+{
+	if (ind->ptrs[i] == 0 && hint != NULL)
+	{
+		int freeb = get_free_blk(hint);
+		if (freeb < 0)
+			return 0;
+		ind->buf[i] = freeb;
+		ind->dirty = true;
+	}
+	return ind->ptrs[i];
+}
+
+/**
+ * Map a range of logical blocks of a file to block numbers.
+ * Indirect blocks are read once for the whole range rather than
+ * once per block.
+ *
+ * @param inode_idx: the file inode
+ * @param first: the first logical block
+ * @param n: the number of logical blocks
+ * @param blks: holder for n block numbers, 0 for an unallocated block
+ * @param alloc: whether to allocate unallocated blocks
+ * @param fresh: holder for n flags, set for the blocks this call
+ *   allocated, or NULL
+ * @return the number of blocks mapped, less than n only if allocation
+ *   runs out of space or the range exceeds the maximum file size
+ */
+static int bmap_range(int inode_idx, int first, int n, uint32_t *blks, bool alloc, bool *fresh)
+{
+	struct fs_inode *inode = &inodes[inode_idx];
+	struct ind_blk ind1 = {0}, ind2 = {0}, ind21 = {0};
+	bool inode_dirty = false;
+	int i, nalloc = 0;
+
+	// allocate after the block preceding the range: a direct block is
+	// at hand, an indirect entry is taken when its block is loaded
+	// below, and until then the file's window is continued
+	struct alloc_hint hint = {inode_idx, -1}, *h = alloc ? &hint : NULL;
+	if (alloc && first > 0)
+	{
+		if (first - 1 < N_DIRECT && inode->direct[first - 1])
+			hint.goal = inode->direct[first - 1] + 1;
+		else
+			hint.goal = prealloc_goal(inode_idx);
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		int lblk = first + i;
+		bool hole = false;
+		if (lblk < N_DIRECT)
+		{
+			// direct block
+			hole = !inode->direct[lblk];
+			if (hole && alloc)
+			{
+				int freeb = get_free_blk(&hint);
+				if (freeb < 0)
+					break;
+				inode->direct[lblk] = freeb;
+				inode_dirty = true;
+			}
+			blks[i] = inode->direct[lblk];
+		}
+		else if (lblk < N_DIRECT + PTRS_PER_BLK)
+		{
+			// single indirect block
+			if (!inode->indir_1)
+			{
+				if (!alloc || !(inode->indir_1 = new_ind(&ind1, &hint)))
+				{
+					blks[i] = 0;
+					if (alloc)
+						break;
+					continue;
+				}
+				inode_dirty = true;
+				nalloc++;
+			}
+			get_ind(&ind1, inode->indir_1, alloc);
+			int idx = lblk - N_DIRECT;
+			if (i == 0 && alloc && idx > 0 && ind1.ptrs[idx - 1])
+				hint.goal = ind1.ptrs[idx - 1] + 1;
+			hole = !ind1.ptrs[idx];
+			blks[i] = ind_entry(&ind1, idx, h);
+		}
+		else if (lblk < N_DIRECT + PTRS_PER_BLK + PTRS_PER_BLK * PTRS_PER_BLK)
+		{
+			// double indirect block
+			int idx = lblk - N_DIRECT - PTRS_PER_BLK;
+			if (!inode->indir_2)
+			{
+				if (!alloc || !(inode->indir_2 = new_ind(&ind2, &hint)))
+				{
+					blks[i] = 0;
+					if (alloc)
+						break;
+					continue;
+				}
+				inode_dirty = true;
+				nalloc++;
+			}
+			get_ind(&ind2, inode->indir_2, alloc);
+			uint32_t mid = ind2.ptrs[idx / PTRS_PER_BLK];
+			if (!mid)
+			{
+				if (!alloc || !(mid = new_ind(&ind21, &hint)))
+				{
+					blks[i] = 0;
+					if (alloc)
+						break;
+					continue;
+				}
+				ind2.buf[idx / PTRS_PER_BLK] = mid;
+				ind2.dirty = true;
+				nalloc++;
+			}
+			get_ind(&ind21, mid, alloc);
+			int k = idx % PTRS_PER_BLK;
+			if (i == 0 && alloc && k > 0 && ind21.ptrs[k - 1])
+				hint.goal = ind21.ptrs[k - 1] + 1;
+			hole = !ind21.ptrs[k];
+			blks[i] = ind_entry(&ind21, k, h);
+		}
+		else
+		{
+			// beyond maximum file size
+			break;
+		}
+		if (alloc && !blks[i])
+			break;
+		if (alloc && hole)
+			nalloc++;
+		if (fresh != NULL)
+			fresh[i] = alloc && hole;
+		hint.goal = blks[i] ? blks[i] + 1 : hint.goal;
+	}
+	put_ind(&ind1);
+	put_ind(&ind2);
+	put_ind(&ind21);
+	if (nalloc > 0 && blk_count[inode_idx] >= 0)
+		blk_count[inode_idx] += nalloc;
+	if (inode_dirty)
+		update_inode(inode_idx);
+	return i;
+}
+
+/**
+ * Map a range of logical blocks of an open file to block numbers,
+ * using and updating the block map cached in the open file.
+ *
+ * @param f: the open file
+ * @param first: the first logical block
+ * @param n: the number of logical blocks
+ * @param blks: holder for n block numbers, 0 for an unallocated block
+ * @param alloc: whether to allocate unallocated blocks
+ * @param fresh: holder for n flags, set for the blocks this call
+ *   allocated, or NULL
+ * @return the number of blocks mapped, as for bmap_range
+ */
+static int file_bmap(struct fs_file *f, int first, int n, uint32_t *blks, bool alloc, bool *fresh)
+{
+	// use cached block numbers if all are present
+	int i = 0;
+	if (first + n <= f->map_len)
+	{
+		for (i = 0; i < n && f->map[first + i]; i++)
+			blks[i] = f->map[first + i];
+		if (i == n)
+		{
+			if (fresh != NULL)
+				memset(fresh, 0, n * sizeof(bool));
+			return n;
+		}
+	}
+
+	int mapped = bmap_range(f->inum, first, n, blks, alloc, fresh);
+
+	// remember block numbers for later requests
+	if (first + mapped > f->map_len)
+	{
+		int len = f->map_len ? f->map_len : 64;
+		while (len < first + mapped)
+			len *= 2;
+		uint32_t *map = realloc(f->map, len * sizeof(uint32_t));
+		if (map == NULL)
+			return mapped;
+		memset(map + f->map_len, 0, (len - f->map_len) * sizeof(uint32_t));
+		f->map = map;
+		f->map_len = len;
+	}
+	memcpy(f->map + first, blks, mapped * sizeof(uint32_t));
+	return mapped;
+}
+
+/** a block of zeros */
+static const char zero_blk[BLOCK_SIZE];
+
+/**
+ * Write zeros to a list of blocks.
+ *
+ * @param blks: the block numbers, 0 for none
+ * @param n: the number of block numbers
+ */
+static void zero_blks(const uint32_t *blks, int n)
+{
+	struct blkvec vec[64];
+	int nvec = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (blks[i] == 0)
+			continue;
+		vec[nvec++] = (struct blkvec){blks[i], (void *)zero_blk};
+		if (nvec == 64)
+		{
+			write_blkv(vec, nvec);
+			nvec = 0;
+		}
+	}
+	write_blkv(vec, nvec);
+}
+
+/**
+ * Make a file read as zeros from its end up to an offset, before it
+ * grows to the offset without data written there. The bytes past the
+ * end of the last block are zeros already and missing blocks are holes,
+ * so only blocks reserved past the end by fallocate are zeroed. The
+ * caller holds the inode write lock.
+ *
+ * @param inode_idx: the file inode
+ * @param end: the offset the file grows to
+ */
+static void zero_gap(int inode_idx, off_t end)
+{
+	struct fs_inode *inode = &inodes[inode_idx];
+	if (!(inode->flags & FS_INODE_PREALLOC) || end <= inode->size)
+		return;
+	int first = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int n = (end + BLOCK_SIZE - 1) / BLOCK_SIZE - first;
+	uint32_t blks[1024];
+	while (n > 0)
+	{
+		int len = (n < 1024) ? n : 1024;
+		int mapped = bmap_range(inode_idx, first, len, blks, false, NULL);
+		zero_blks(blks, mapped);
+		if (mapped < len)
+			break;
+		first += len;
+		n -= len;
+	}
+}
+
+/**
+ * Get the indirect block holding the block number of a logical
+ * block, without allocating anything.
+ *
+ * @param inode_idx: the file inode
+ * @param lblk: the logical block
+ * @return the indirect block number, or 0 if none
+ */
+static uint32_t ind_for(int inode_idx, int lblk)
+{
+	struct fs_inode *inode = &inodes[inode_idx];
+	if (lblk < N_DIRECT)
+		return 0;
+	lblk -= N_DIRECT;
+	if (lblk < PTRS_PER_BLK)
+		return inode->indir_1;
+	lblk -= PTRS_PER_BLK;
+	if (!inode->indir_2 || lblk >= PTRS_PER_BLK * PTRS_PER_BLK)
+		return 0;
+	uint32_t buf[PTRS_PER_BLK];
+	const uint32_t *ptrs = map_blk(inode->indir_2, buf);
+	return ptrs[lblk / PTRS_PER_BLK];
+}
+
+/**
+ * Read ahead of a read from an open file. Sequential reads open a
+ * window of blocks past the read that doubles, up to RA_MAX_BLKS,
+ * each time the reader gets within half a window of its end. A
+ * non-sequential read closes the window. The window's blocks and
+ * the indirect block needed to map the next window are prefetched
+ * by the device, which reads them in the background if it can, and
+ * the window shrinks to what the device accepts.
+ *
+ * @param f: the open file
+ * @param offset: the offset of the read
+ * @param len: the length of the read
+ */
+static void file_readahead(struct fs_file *f, off_t offset, size_t len)
+{
+	if (disk->ops->prefetch == NULL)
+		return;
+	int last = (offset + len - 1) / BLOCK_SIZE;
+	if (f->seq_count == 0)
+	{
+		// random access: collapse the window
+		f->ra_size = 0;
+		f->ra_next = last + 1;
+		return;
+	}
+	if (f->ra_size > 0 && f->ra_next - last > f->ra_size / 2)
+		return;
+
+	// grow the window and read ahead from where the last one ended
+	f->ra_size = f->ra_size ? f->ra_size * 2 : RA_MIN_BLKS;
+	if (f->ra_size > RA_MAX_BLKS)
+		f->ra_size = RA_MAX_BLKS;
+	int first = (f->ra_next > last) ? f->ra_next : last + 1;
+	int eof = (inodes[f->inum].size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int n = (first + f->ra_size > eof) ? eof - first : f->ra_size;
+	if (n <= 0)
+		return;
+	uint32_t blks[RA_MAX_BLKS + 1];
+	int pblks[RA_MAX_BLKS + 1], lblks[RA_MAX_BLKS + 1];
+	n = file_bmap(f, first, n, blks, false, NULL);
+	int np = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (blks[i])
+		{
+			lblks[np] = first + i;
+			pblks[np++] = blks[i];
+		}
+	}
+	uint32_t ind = ind_for(f->inum, first + n + f->ra_size);
+	if (ind && ind != ind_for(f->inum, first + n - 1))
+	{
+		lblks[np] = first + n - 1;
+		pblks[np++] = ind;
+	}
+	f->ra_next = first + n;
+	if (np == 0)
+		return;
+
+	// a device without room for the whole window limits it
+	int done = disk->ops->prefetch(disk, pblks, np);
+	if (done < np)
+	{
+		f->ra_next = done > 0 ? lblks[done - 1] + 1 : first;
+		f->ra_size = (f->ra_next - last > RA_MIN_BLKS) ? f->ra_next - last : RA_MIN_BLKS;
+	}
+}
+
+/**
+ * Open a file by inode. An open file table entry is allocated and
+ * its handle is saved in fi->fh. The caller holds the inode lock.
+ *
+ * @param inode_idx: the file inode
+ * @param fi: file info data
+ * @return: 0 if successful, or -error number
+ *	-EISDIR   - inode is a directory
+ */
+static int open_inode(int inode_idx, struct fuse_file_info *fi)
+{
+	if (S_ISDIR(inodes[inode_idx].mode))
+		return -EISDIR;
+	int fh = new_file(inode_idx);
+	if (fh < 0)
+		return fh;
+	fi->fh = (uint64_t)fh;
+	return SUCCESS;
+}
+
+/**
+ * Open a filesystem file or directory path. An open file table
+ * entry is allocated and its handle is saved in fi->fh.
+ *
+ * @param path: the path
+ * @param fuse: file info data
+ *
+ * @return: 0 if successful, or -error number
+ *	-ENOENT   - file does not exist
+ *	-ENOTDIR  - component of path not a directory
+ */
+static int fs_open(const char *path, struct fuse_file_info *fi)
+{
+	int inode_idx = walk_path(path, NULL, false);
+	if (inode_idx < 0)
+		return inode_idx;
+	int res = open_inode(inode_idx, fi);
+	inode_unlock(inode_idx);
+	return res;
+}
+
+/**
+ * Read data from an open file, as for fs_read. The caller holds the
+ * inode lock.
+ *
+ * @param f: the open file
+ * @param buf: the buffer to keep the data
+ * @param len: the number of bytes to read
+ * @param offset: the location to start reading at
+ * @return: the number of bytes read, or -error number
+ */
+static int file_read(struct fs_file *f, char *buf, size_t len, off_t offset)
+{
+	struct fs_inode *inode = &inodes[f->inum];
+	if (S_ISDIR(inode->mode))
+		return -EISDIR;
+	if (offset >= inode->size)
+		return 0;
+
+	// pending writes of this file must reach the disk first
+	file_sync_inode(f->inum, NULL);
+
+	// cannot read past the end of the file
+	if (offset + len > inode->size)
+		len = inode->size - offset;
+	if (len == 0)
+		return 0;
+
+	pthread_mutex_lock(&f->lock);
+	file_access(f, offset, len);
+	file_readahead(f, offset, len);
+
+	// map the logical blocks of the request to block numbers
+	int first = offset / BLOCK_SIZE;
+	int n = (offset + len - 1) / BLOCK_SIZE - first + 1;
+	uint32_t *blks = malloc(n * sizeof(uint32_t));
+	struct blkvec *vec = malloc(n * sizeof(struct blkvec));
+	char head[BLOCK_SIZE], tail[BLOCK_SIZE];
+	n = file_bmap(f, first, n, blks, false, NULL);
+
+	// full blocks are read directly into buf, partial ones into head/tail
+	int nvec = 0;
+	size_t pos = 0;
+	for (int i = 0; i < n; i++)
+	{
+		size_t blk_offset = (i == 0) ? offset % BLOCK_SIZE : 0;
+		size_t blk_len = BLOCK_SIZE - blk_offset;
+		if (blk_len > len - pos)
+			blk_len = len - pos;
+		if (!blks[i])
+			memset(buf + pos, 0, blk_len); // unallocated block reads as zeros
+		else if (blk_len == BLOCK_SIZE)
+			vec[nvec++] = (struct blkvec){blks[i], buf + pos};
+		else
+			vec[nvec++] = (struct blkvec){blks[i], (i == 0) ? head : tail};
+		pos += blk_len;
+	}
+	read_blkv(vec, nvec);
+
+	// copy partial blocks
+	pos = 0;
+	for (int i = 0; i < n; i++)
+	{
+		size_t blk_offset = (i == 0) ? offset % BLOCK_SIZE : 0;
+		size_t blk_len = BLOCK_SIZE - blk_offset;
+		if (blk_len > len - pos)
+			blk_len = len - pos;
+		if (blks[i] && blk_len != BLOCK_SIZE)
+			memcpy(buf + pos, ((i == 0) ? head : tail) + blk_offset, blk_len);
+		pos += blk_len;
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	free(blks);
+	free(vec);
+	return (int)pos;
+}
+
+/**
+ * read - read data from an open file.
+ *
+ * @param path: the path to the file
+ * @param buf: the buffer to keep the data
+ * @param len: the number of bytes to read
+ * @param offset: the location to start reading at
+ * @param fi: fuse file info
+ *
+ * @return: return exactly the number of bytes requested, except:
+ * - if offset >= file len, return 0
+ * - if offset+len > file len, return bytes from offset to EOF
+ * - on error, return <0
+ * 	-ENOENT  - file does not exist
+ * 	-EISDIR  - file is in fact a directory
+ * 	-ENOTDIR - component of path not a directory
+ * 	-EIO     - error reading block
+ *
+ * Note: similar to fs_write, except that:
+ * 1) we cannot read past the end of the file (so you need to add a test
+ *    for that, that limits the len to be read in this case)
+ * 2) there's no need to allocate or update anything since we are only
+ *    reading the file.
+ */
+static int fs_read(const char *path, char *buf, size_t len, off_t offset,
+				   struct fuse_file_info *fi)
+{
+	// CS492: your code here
+	struct fs_file *f = get_file(fi);
+	int res;
+	if (f != NULL)
+	{
+		inode_lock(f->inum, false);
+		res = file_read(f, buf, len, offset);
+		inode_unlock(f->inum);
+		return res;
+	}
+
+	// not opened through fs_open: use a temporary open file
+	char *_path = strdup(path);
+	int inode_idx = walk_path(_path, NULL, false);
+	free(_path);
+	if (inode_idx < 0)
+		return inode_idx;
+	struct fs_file tmp = {.inum = inode_idx, .lock = PTHREAD_MUTEX_INITIALIZER};
+	res = file_read(&tmp, buf, len, offset);
+	inode_unlock(inode_idx);
+	free(tmp.map);
+	return res;
+}
+
+/**
+ * Write data to an open file, as for fs_write. Writes smaller than
+ * a block are gathered in the pending block of the open file. The
+ * caller holds the inode write lock.
+ *
+ * @param f: the open file
+ * @param buf: the buffer to write
+ * @param len: the number of bytes to write
+ * @param offset: the offset to starting writing at
+ * @return: the number of bytes written, or -error number
+ */
+static int file_write(struct fs_file *f, const char *buf, size_t len, off_t offset)
+{
+	int inode_idx = f->inum;
+	struct fs_inode *inode = &inodes[inode_idx];
+	if (S_ISDIR(inode->mode))
+		return -EISDIR;
+	if (len == 0)
+		return 0;
+
+	// writing past the end leaves a hole
+	zero_gap(inode_idx, offset);
+
+	// pending writes of other opens of this file go first
+	file_sync_inode(inode_idx, f);
+	file_access(f, offset, len);
+
+	// small writes within a block are gathered in the pending block
+	size_t blk_offset = offset % BLOCK_SIZE;
+	if (blk_offset + len <= BLOCK_SIZE && len < BLOCK_SIZE)
+	{
+		// a hole or a block past EOF has no data yet: zero instead of reading it
+		uint32_t blk;
+		bool fresh;
+		if (file_bmap(f, offset / BLOCK_SIZE, 1, &blk, true, &fresh) < 1)
+			return -ENOSPC;
+		bool no_data = fresh || offset - (off_t)blk_offset >= inode->size;
+		if (f->wpending && f->wblk != blk)
+			file_flush_write(f);
+		if (!f->wpending)
+		{
+			if (no_data)
+				memset(f->wbuf, 0, BLOCK_SIZE);
+			else if (disk->ops->read(disk, blk, 1, f->wbuf) < 0)
+				exit(1);
+			f->wblk = blk;
+			f->wpending = true;
+		}
+		memcpy(f->wbuf + blk_offset, buf, len);
+
+		// a sequential writer has finished with a filled block
+		if (blk_offset + len == BLOCK_SIZE)
+			file_flush_write(f);
+
+		if (offset + len > inode->size)
+		{
+			inode->size = offset + len;
+			update_inode(inode_idx);
+		}
+		return (int)len;
+	}
+	file_flush_write(f);
+
+	// map the logical blocks of the request, allocating missing ones
+	int first = offset / BLOCK_SIZE;
+	int n = (offset + len - 1) / BLOCK_SIZE - first + 1;
+	uint32_t *blks = malloc(n * sizeof(uint32_t));
+	bool *fresh = malloc(n * sizeof(bool));
+	struct blkvec *vec = malloc(n * sizeof(struct blkvec));
+	int mapped = file_bmap(f, first, n, blks, true, fresh);
+	if (mapped == 0)
+	{
+		free(blks);
+		free(fresh);
+		free(vec);
+		return -ENOSPC;
+	}
+	if (mapped < n)
+	{
+		// write as much as fits
+		len = (size_t)(first + mapped) * BLOCK_SIZE - offset;
+		n = mapped;
+	}
+
+	// merge partial first and last blocks with their current contents;
+	// holes and blocks past EOF have no data yet and are zeroed instead
+	char head[BLOCK_SIZE], tail[BLOCK_SIZE];
+	size_t head_offset = offset % BLOCK_SIZE;
+	size_t tail_len = (offset + len) % BLOCK_SIZE;
+	bool head_partial = head_offset != 0 || len < BLOCK_SIZE;
+	bool tail_partial = n > 1 && tail_len != 0;
+	struct blkvec rmw[2];
+	int nrmw = 0;
+	if (head_partial)
+	{
+		if (fresh[0] || offset - (off_t)head_offset >= inode->size)
+			memset(head, 0, BLOCK_SIZE);
+		else
+			rmw[nrmw++] = (struct blkvec){blks[0], head};
+	}
+	if (tail_partial)
+	{
+		if (fresh[n - 1] || (off_t)(first + n - 1) * BLOCK_SIZE >= inode->size)
+			memset(tail, 0, BLOCK_SIZE);
+		else
+			rmw[nrmw++] = (struct blkvec){blks[n - 1], tail};
+	}
+	read_blkv(rmw, nrmw);
+	if (head_partial)
+		memcpy(head + head_offset, buf, (n == 1) ? len : BLOCK_SIZE - head_offset);
+	if (tail_partial)
+		memcpy(tail, buf + len - tail_len, tail_len);
+
+	// full blocks are written directly from buf
+	for (int i = 0; i < n; i++)
+	{
+		if (i == 0 && head_partial)
+			vec[i] = (struct blkvec){blks[i], head};
+		else if (i == n - 1 && tail_partial)
+			vec[i] = (struct blkvec){blks[i], tail};
+		else
+			vec[i] = (struct blkvec){blks[i], (char *)buf + i * BLOCK_SIZE - head_offset};
+	}
+	write_blkv(vec, n);
+	free(blks);
+	free(fresh);
+	free(vec);
+
+	if (offset + len > inode->size)
+		inode->size = offset + len;
+
+	// update inode; metadata is written on release
+	update_inode(inode_idx);
+
+	return (int)len;
+}
+
+/**
+ * Get the file descriptor of the disk to move file data to and from
+ * without copying it through a buffer.
+ *
+ * @return: the file descriptor, or -1 if the disk has none
+ */
+static int disk_fd(void)
+{
+	return (disk->ops->fd != NULL) ? disk->ops->fd(disk) : -1;
+}
+
+/**
+ * Free a buffer vector built by file_read_buf.
+ *
+ * @param bufv: the buffer vector, or NULL
+ */
+static void free_bufvec(struct fuse_bufvec *bufv)
+{
+	if (bufv == NULL)
+		return;
+	for (size_t i = 0; i < bufv->count; i++)
+		free(bufv->buf[i].mem);
+	free(bufv);
+}
+
+/**
+ * Read data from an open file as a buffer vector that refers to the
+ * file's blocks in the disk file, so it can be spliced to its
+ * destination instead of being copied. Unallocated blocks are read
+ * as zeros from memory. The caller holds the inode lock until the
+ * data has been moved, and frees the vector with free_bufvec.
+ *
+ * @param f: the open file
+ * @param len: the number of bytes to read
+ * @param offset: the location to start reading at
+ * @param bufp: holder for the buffer vector
+ * @return: the number of bytes read, or -error number
+ */
+static int file_read_buf(struct fs_file *f, size_t len, off_t offset, struct fuse_bufvec **bufp)
+{
+	struct fs_inode *inode = &inodes[f->inum];
+	*bufp = NULL;
+	if (S_ISDIR(inode->mode))
+		return -EISDIR;
+
+	// pending writes of this file must reach the disk first
+	file_sync_inode(f->inum, NULL);
+
+	// cannot read past the end of the file
+	if (offset >= inode->size)
+		len = 0;
+	else if (offset + len > inode->size)
+		len = inode->size - offset;
+
+	int first = offset / BLOCK_SIZE;
+	int n = (len == 0) ? 0 : (offset + len - 1) / BLOCK_SIZE - first + 1;
+	uint32_t *blks = malloc((n + 1) * sizeof(uint32_t));
+	if (n > 0)
+	{
+		pthread_mutex_lock(&f->lock);
+		file_access(f, offset, len);
+		file_readahead(f, offset, len);
+		n = file_bmap(f, first, n, blks, false, NULL);
+		pthread_mutex_unlock(&f->lock);
+	}
+
+	// one buffer for each run of consecutive blocks or of holes
+	struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec) + n * sizeof(struct fuse_buf));
+	*bufv = FUSE_BUFVEC_INIT(0);
+	bufv->count = 0;
+	int fd = disk_fd();
+	size_t pos = 0;
+	for (int i = 0; i < n; i++)
+	{
+		size_t blk_offset = (i == 0) ? offset % BLOCK_SIZE : 0;
+		size_t blk_len = BLOCK_SIZE - blk_offset;
+		if (blk_len > len - pos)
+			blk_len = len - pos;
+		struct fuse_buf *b = &bufv->buf[bufv->count - 1];
+		if (i > 0 && blks[i] == 0 && blks[i - 1] == 0)
+			b->size += blk_len;
+		else if (i > 0 && blks[i] != 0 && blks[i] == blks[i - 1] + 1)
+			b->size += blk_len;
+		else if (blks[i] == 0)
+			bufv->buf[bufv->count++] = (struct fuse_buf){.size = blk_len, .fd = -1};
+		else
+			bufv->buf[bufv->count++] = (struct fuse_buf){
+				.size = blk_len,
+				.flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK,
+				.fd = fd,
+				.pos = (off_t)blks[i] * BLOCK_SIZE + blk_offset};
+		pos += blk_len;
+	}
+	free(blks);
+
+	// holes read as zeros
+	for (size_t i = 0; i < bufv->count; i++)
+	{
+		if (!(bufv->buf[i].flags & FUSE_BUF_IS_FD))
+			bufv->buf[i].mem = calloc(1, bufv->buf[i].size);
+	}
+	*bufp = bufv;
+	return (int)pos;
+}
+
+/**
+ * Write the next bytes of a buffer vector to an open file through
+ * a memory buffer, as file_write.
+ *
+ * @param f: the open file
+ * @param src: the buffer vector, advanced past the bytes written
+ * @param len: the number of bytes to write
+ * @param offset: the offset to starting writing at
+ * @return: the number of bytes written, or -error number
+ */
+static int file_write_copy(struct fs_file *f, struct fuse_bufvec *src, size_t len, off_t offset)
+{
+	char *buf = malloc(len);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(len);
+	dst.buf[0].mem = buf;
+	ssize_t n = fuse_buf_copy(&dst, src, 0);
+	int res = (n < 0) ? (int)n : file_write(f, buf, n, offset);
+	free(buf);
+	return res;
+}
+
+/**
+ * Write a buffer vector to an open file. Whole blocks are moved
+ * straight from the buffers to the file's blocks in the disk file,
+ * spliced when the buffers are a pipe; partial blocks at either end
+ * go through file_write. The caller holds the inode write lock.
+ *
+ * @param f: the open file
+ * @param src: the buffer vector
+ * @param offset: the offset to starting writing at
+ * @return: the number of bytes written, or -error number
+ */
+static int file_write_buf(struct fs_file *f, struct fuse_bufvec *src, off_t offset)
+{
+	struct fs_inode *inode = &inodes[f->inum];
+	size_t len = fuse_buf_size(src);
+	if (S_ISDIR(inode->mode))
+		return -EISDIR;
+	if (len == 0)
+		return 0;
+
+	// without a disk file or whole blocks, write through memory
+	int fd = disk_fd();
+	size_t head = (BLOCK_SIZE - offset % BLOCK_SIZE) % BLOCK_SIZE;
+	if (head > len)
+		head = len;
+	int nfull = (len - head) / BLOCK_SIZE;
+	if (fd < 0 || nfull == 0)
+		return file_write_copy(f, src, len, offset);
+
+	// partial first block; writing past the end leaves a hole
+	size_t done = 0;
+	if (head == 0)
+		zero_gap(f->inum, offset);
+	else
+	{
+		int res = file_write_copy(f, src, head, offset);
+		if (res < (int)head)
+			return res;
+		done = head;
+	}
+
+	// whole blocks: pending writes of any open go first
+	file_sync_inode(f->inum, f);
+	file_flush_write(f);
+	file_access(f, offset + done, (size_t)nfull * BLOCK_SIZE);
+	int first = (offset + done) / BLOCK_SIZE;
+	uint32_t *blks = malloc(nfull * sizeof(uint32_t));
+	int mapped = file_bmap(f, first, nfull, blks, true, NULL);
+	if (mapped == 0)
+	{
+		free(blks);
+		return (done > 0) ? (int)done : -ENOSPC;
+	}
+
+	// one buffer for each run of consecutive blocks
+	struct fuse_bufvec *dst = malloc(sizeof(struct fuse_bufvec) + mapped * sizeof(struct fuse_buf));
+	*dst = FUSE_BUFVEC_INIT(0);
+	dst->count = 0;
+	for (int i = 0; i < mapped; i++)
+	{
+		if (i > 0 && blks[i] == blks[i - 1] + 1)
+			dst->buf[dst->count - 1].size += BLOCK_SIZE;
+		else
+			dst->buf[dst->count++] = (struct fuse_buf){
+				.size = BLOCK_SIZE,
+				.flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK,
+				.fd = fd,
+				.pos = (off_t)blks[i] * BLOCK_SIZE};
+	}
+	ssize_t n = fuse_buf_copy(dst, src, 0);
+	free(dst);
+	free(blks);
+	if (n < 0)
+		return (done > 0) ? (int)done : (int)n;
+	done += n;
+	if (offset + (off_t)done > inode->size)
+	{
+		inode->size = offset + done;
+		update_inode(f->inum);
+	}
+	if (n < (ssize_t)mapped * BLOCK_SIZE || mapped < nfull)
+		return (int)done;
+
+	// partial last block
+	if (done < len)
+	{
+		int res = file_write_copy(f, src, len - done, offset + done);
+		if (res > 0)
+			done += res;
+	}
+	return (int)done;
+}
+
+/**
+ * write - write data to a file
+ *
+ * @param path: the file path
+ * @param buf: the buffer to write
+ * @param len: the number of bytes to write
+ * @param offset: the offset to starting writing at
+ * @param fi: the Fuse file info for writing
+ *
+ * @return: It should return exactly the number of bytes requested, except on error.
+ *
+ * 	-ENOENT  - file does not exist
+ * 	-EISDIR  - file is in fact a directory
+ *	-ENOTDIR - component of path not a directory
+ *	-ENOSPC  - no free blocks for the data
+ *
+ * Writing at an offset past the end of the file leaves a hole:
+ * blocks that have no data are not allocated and read as zeros.
+ */
+static int fs_write(const char *path, const char *buf, size_t len,
+					off_t offset, struct fuse_file_info *fi)
+{
+	struct fs_file *f = get_file(fi);
+	int res;
+	journal_begin(disk);
+	if (f != NULL)
+	{
+		inode_lock(f->inum, true);
+		res = file_write(f, buf, len, offset);
+		inode_unlock(f->inum);
+		journal_end(disk);
+		return res;
+	}
+
+	// not opened through fs_open: use a temporary open file
+	char *_path = strdup(path);
+	int inode_idx = walk_path(_path, NULL, true);
+	free(_path);
+	if (inode_idx < 0)
+	{
+		journal_end(disk);
+		return inode_idx;
+	}
+	struct fs_file tmp = {.inum = inode_idx, .lock = PTHREAD_MUTEX_INITIALIZER};
+	res = file_write(&tmp, buf, len, offset);
+	file_flush_write(&tmp);
+	inode_unlock(inode_idx);
+	free(tmp.map);
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * write_buf - write data to a file from a buffer vector, as fs_write.
+ * Data arriving in a pipe is spliced to the image file.
+ *
+ * @param path: the file path
+ * @param buf: the buffer vector holding the data
+ * @param offset: the offset to starting writing at
+ * @param fi: the Fuse file info for writing
+ * @return: number of bytes written, or -error number
+ */
+static int fs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+						struct fuse_file_info *fi)
+{
+	struct fs_file *f = get_file(fi);
+	if (f == NULL)
+	{
+		// not opened through fs_open: write a copy by path
+		size_t len = fuse_buf_size(buf);
+		struct fuse_bufvec mem = FUSE_BUFVEC_INIT(len);
+		mem.buf[0].mem = malloc(len);
+		ssize_t n = fuse_buf_copy(&mem, buf, 0);
+		int res = (n < 0) ? (int)n : fs_write(path, mem.buf[0].mem, n, offset, fi);
+		free(mem.buf[0].mem);
+		return res;
+	}
+	journal_begin(disk);
+	inode_lock(f->inum, true);
+	int res = file_write_buf(f, buf, offset);
+	inode_unlock(f->inum);
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * Reserve blocks for a range of a file. Blocks are allocated together,
+ * so they are contiguous when free space allows. Blocks allocated
+ * within the end of the file are zeroed, since they read as zeros;
+ * blocks past it hold no data until written. The caller holds the
+ * inode write lock.
+ *
+ * @param inode_idx: the file inode
+ * @param mode: 0, or FALLOC_FL_KEEP_SIZE not to extend the file
+ * @param offset: the start of the range
+ * @param len: the length of the range
+ * @return: 0 if successful, or -error number
+ *	-EISDIR     - inode is a directory
+ *	-EINVAL     - offset or len invalid
+ *	-EFBIG      - range past the largest file
+ *	-EOPNOTSUPP - mode not supported
+ *	-ENOSPC     - not enough free blocks
+ */
+static int file_fallocate(int inode_idx, int mode, off_t offset, off_t len)
+{
+	struct fs_inode *inode = &inodes[inode_idx];
+	if (S_ISDIR(inode->mode))
+		return -EISDIR;
+	if (mode & ~FALLOC_FL_KEEP_SIZE)
+		return -EOPNOTSUPP;
+	if (offset < 0 || len <= 0)
+		return -EINVAL;
+	if (offset + len > MAX_FILE_SIZE)
+		return -EFBIG;
+
+	// reserved blocks past the old end must read as zeros once inside it
+	off_t end = offset + len;
+	off_t size = (mode & FALLOC_FL_KEEP_SIZE || end < inode->size) ? inode->size : end;
+	zero_gap(inode_idx, size);
+
+	// allocate the holes of the range
+	int first = offset / BLOCK_SIZE;
+	int n = (end - 1) / BLOCK_SIZE - first + 1;
+	uint32_t *blks = malloc(n * sizeof(uint32_t));
+	bool *fresh = malloc(n * sizeof(bool));
+	int res = SUCCESS;
+	int mapped = bmap_range(inode_idx, first, n, blks, true, fresh);
+	if (mapped < n)
+		res = -ENOSPC;
+
+	// zero the new blocks within the end of the file
+	int nzero = 0;
+	for (int i = 0; i < mapped; i++)
+	{
+		if (fresh[i] && (off_t)(first + i) * BLOCK_SIZE < size)
+			blks[nzero++] = blks[i];
+	}
+	zero_blks(blks, nzero);
+	free(blks);
+	free(fresh);
+
+	if (res == SUCCESS)
+		inode->size = size;
+	if (inode->size < (off_t)(first + n) * BLOCK_SIZE)
+		inode->flags |= FS_INODE_PREALLOC;
+	update_inode(inode_idx);
+	return res;
+}
+
+/**
+ * fallocate - reserve blocks for a range of a file, so that writes
+ * to it do not run out of space.
+ *
+ * @param path: the file path
+ * @param mode: 0, or FALLOC_FL_KEEP_SIZE not to extend the file
+ * @param offset: the start of the range
+ * @param len: the length of the range
+ * @param fi: the fuse file info
+ * @return: 0 if successful, or -error number
+ *	-ENOENT     - file does not exist
+ *	-ENOTDIR    - component of path not a directory
+ *	-EISDIR     - path is a directory
+ *	-EINVAL     - offset or len invalid
+ *	-EFBIG      - range past the largest file
+ *	-EOPNOTSUPP - mode not supported
+ *	-ENOSPC     - not enough free blocks
+ */
+static int fs_fallocate(const char *path, int mode, off_t offset, off_t len,
+						struct fuse_file_info *fi)
+{
+	struct fs_file *f = get_file(fi);
+	int inode_idx;
+	journal_begin(disk);
+	if (f != NULL)
+	{
+		inode_idx = f->inum;
+		inode_lock(inode_idx, true);
+	}
+	else
+	{
+		char *_path = strdup(path);
+		inode_idx = walk_path(_path, NULL, true);
+		free(_path);
+		if (inode_idx < 0)
+		{
+			journal_end(disk);
+			return inode_idx;
+		}
+	}
+	int res = file_fallocate(inode_idx, mode, offset, len);
+	inode_unlock(inode_idx);
+	journal_end(disk);
+	return res;
+}
+
+/**
+ * Release resources created by pending open call. Pending data
+ * of the open file is written and its table entry is freed.
+ *
+ * @param path: path to the file
+ * @param fi: the fuse file info
+ *
+ * @return: 0 if successful, or -error number
+ *	-EBADF    - fi has no open file
+ */
+static int fs_release(const char *path, struct fuse_file_info *fi)
+{
+	struct fs_file *f = get_file(fi);
+	if (f == NULL)
+		return -EBADF;
+
+	// write pending data and free the open file
+	inode_lock(f->inum, true);
+	file_flush_write(f);
+	prealloc_trim(f->inum);
+	inode_unlock(f->inum);
+	free_file(fi);
+
+	// write back metadata modified while file was open
+	flush_metadata();
+	return SUCCESS;
+}
+
+/**
+ * flush - called on each close of an open file. Writes the pending
+ * block of the open file, so write errors reach the close. Data is
+ * not made durable: that is fsync's job.
+ *
+ * @param path: path to the file
+ * @param fi: the fuse file info
+ *
+ * @return: 0 if successful, or -error number
+ *	-EBADF    - fi has no open file
+ */
+static int fs_flush(const char *path, struct fuse_file_info *fi)
+{
+	struct fs_file *f = get_file(fi);
+	if (f == NULL)
+		return -EBADF;
+	inode_lock(f->inum, false);
+	pthread_mutex_lock(&f->lock);
+	file_flush_write(f);
+	pthread_mutex_unlock(&f->lock);
+	inode_unlock(f->inum);
+	return SUCCESS;
+}
+
+/** number of fsync latency buckets: bucket i counts syncs under 2^i us */
+enum { SYNC_BUCKETS = 24 };
+
+/** fsync and fsyncdir counters */
+static struct
+{
+	long syncs;				// calls
+	long blocks;			// blocks listed for the device to sync
+	long total_us;			// total latency
+	long max_us;			// largest latency
+	long hist[SYNC_BUCKETS]; // latency histogram
+} sync_stats;
+
+/** protects sync_stats */
+static pthread_mutex_t sync_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Order block numbers */
+static int cmp_blk(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Make a file or directory durable. The pending blocks of its open
+ * files are written, and then the device writes back and syncs the
+ * blocks of the inode and the metadata that locates them, leaving the
+ * rest of the disk alone.
+ *
+ * Without a journal, metadata is written by flush_metadata and listed
+ * with the data: the inode's block, the bitmaps and the indirect
+ * blocks. With a journal, only file data is listed, and the device
+ * commits the metadata once the data is durable. The caller must not
+ * be in a transaction.
+ *
+ * @param inum: the inode
+ * @return: 0 if successful, or -EIO if the device cannot sync
+ */
+static int sync_inode(int inum)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	inode_lock(inum, false);
+	file_sync_inode(inum, NULL);
+	struct fs_inode *inode = &inodes[inum];
+
+	// a directory's blocks are metadata, committed by the journal
+	int nlblks = (S_ISDIR(inode->mode) && journaled) ? 0 : (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int *blks = malloc((nlblks + PTRS_PER_BLK + inode_base + 3) * sizeof(int));
+	uint32_t *map = malloc((nlblks + 1) * sizeof(uint32_t));
+	if (blks == NULL || map == NULL)
+		exit(1);
+	int n = 0, mapped = bmap_range(inum, 0, nlblks, map, false, NULL);
+	for (int i = 0; i < mapped; i++)
+	{
+		if (map[i])
+			blks[n++] = map[i];
+	}
+	if (!journaled)
+	{
+		if (inode->indir_1)
+			blks[n++] = inode->indir_1;
+		if (inode->indir_2)
+			blks[n++] = inode->indir_2;
+		for (int lblk = N_DIRECT + PTRS_PER_BLK; lblk < nlblks; lblk += PTRS_PER_BLK)
+		{
+			uint32_t ind = ind_for(inum, lblk);
+			if (ind)
+				blks[n++] = ind;
+		}
+		blks[n++] = inode_base + inum / INODES_PER_BLK;
+		for (int blk = 1; blk < inode_base; blk++)
+			blks[n++] = blk;
+	}
+	inode_unlock(inum);
+	free(map);
+
+	if (!journaled)
+		flush_metadata();
+	qsort(blks, n, sizeof(int), cmp_blk);
+	int res = (disk->ops->sync != NULL) ? disk->ops->sync(disk, blks, n)
+										: disk->ops->flush(disk, 0, disk->ops->num_blocks(disk));
+	free(blks);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+	int bucket = 0;
+	while (bucket < SYNC_BUCKETS - 1 && us >= (1L << bucket))
+		bucket++;
+	pthread_mutex_lock(&sync_stats_lock);
+	sync_stats.syncs++;
+	sync_stats.blocks += n;
+	sync_stats.total_us += us;
+	if (us > sync_stats.max_us)
+		sync_stats.max_us = us;
+	sync_stats.hist[bucket]++;
+	pthread_mutex_unlock(&sync_stats_lock);
+	return (res < 0) ? -EIO : SUCCESS;
+}
+
+/**
+ * fsync - make the data and metadata of a file durable.
+ *
+ * @param path: path to the file
+ * @param datasync: nonzero if only data is needed (treated as a full sync)
+ * @param fi: the fuse file info, or NULL
+ *
+ * @return: 0 if successful, or -error number
+ *	-ENOENT  - a component of the path is not present
+ *	-ENOTDIR - an intermediate component of path not a directory
+ *	-EIO     - the device cannot sync
+ */
+static int fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	struct fs_file *f = get_file(fi);
+	int inode_idx;
+	if (f != NULL)
+		inode_idx = f->inum;
+	else
+	{
+		char *_path = strdup(path);
+		inode_idx = translate(_path);
+		free(_path);
+		if (inode_idx < 0)
+			return inode_idx;
+	}
+	return sync_inode(inode_idx);
+}
+
+/**
+ * fsyncdir - make a directory's entries and metadata durable.
+ *
+ * @param path: path to the directory
+ * @param datasync: nonzero if only data is needed (treated as a full sync)
+ * @param fi: the fuse file info (unused)
+ *
+ * @return: 0 if successful, or -error number
+ *	-ENOENT  - a component of the path is not present
+ *	-ENOTDIR - path or an intermediate component not a directory
+ *	-EIO     - the device cannot sync
+ */
+static int fs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	char *_path = strdup(path);
+	int inode_idx = walk_path(_path, NULL, false);
+	free(_path);
+	if (inode_idx < 0)
+		return inode_idx;
+	bool isdir = S_ISDIR(inodes[inode_idx].mode);
+	inode_unlock(inode_idx);
+	if (!isdir)
+		return -ENOTDIR;
+	return sync_inode(inode_idx);
+}
+
+/**
+ * statfs - get file system statistics. See 'man 2 statfs' for
+ * description of 'struct statvfs'.
+ *
+ * @param path: the path to the file (ignored)
+ * @param st: pointer to the destination statvfs struct
+ *
+ * @return: 0 if successful
+ *
+ * Errors
+ *   none -  Needs to work
+ */
+static int fs_statfs(const char *path, struct statvfs *st)
+{
+	/* needs to return the following fields (set others to zero):
+	 *   f_bsize = BLOCK_SIZE
+	 *   f_blocks = total image - metadata
+	 *   f_bfree = f_blocks - blocks used
+	 *   f_bavail = f_bfree
+	 *   f_namelen = <whatever your max namelength is>
+	 */
 
-	return SUCCESS;
+	// clear original stats
+	memset(st, 0, sizeof(*st));
+	st->f_bsize = FS_BLOCK_SIZE;
+	st->f_blocks = (fsblkcnt_t)(n_blocks - root_inode - inode_base);
+	st->f_bfree = (fsblkcnt_t)num_free_blk();
+	st->f_bavail = st->f_bfree;
+	st->f_namemax = FS_FILENAME_SIZE - 1;
+
+	return 0;
 }
 
 /**
- * unlink - delete a file
- *
- * @param path: path to file
+ * Get the directory entry cache counters.
  *
- * @return 0 if successful, or error value
- *	-ENOENT   - file does not exist
- * 	-ENOTDIR  - component of path not a directory
- * 	-EISDIR   - cannot unlink a directory
+ * @param stats: holder for the counters
  */
-static int fs_unlink(const char *path)
+void fs_dcache_stats(struct dcache_stats *stats)
 {
-	// truncate first
-	int res = fs_truncate(path, 0);
-	if (res < 0)
-		return res;
+	dcache_stats(dcache, stats);
+}
 
-	// get inodes and check
-	char *_path = strdup(path);
-	char name[FS_FILENAME_SIZE];
-	int inode_idx = translate(_path);
-	int parent_inode_idx = translate_1(_path, name);
-	struct fs_inode *inode = &inodes[inode_idx];
-	struct fs_inode *parent_inode = &inodes[parent_inode_idx];
-	if (inode_idx < 0 || parent_inode_idx < 0)
-		return -ENOENT;
-	if (S_ISDIR(inode->mode))
-		return -EISDIR;
-	if (!S_ISDIR(parent_inode->mode))
-		return -ENOTDIR;
+/**
+ * Get the fsync and fsyncdir counters. The latency percentiles are
+ * upper bounds, the powers of 2 limiting their histogram buckets.
+ *
+ * @param syncs: holder for the number of syncs
+ * @param blocks: holder for the number of blocks listed for syncing
+ * @param avg_us: holder for the average latency in microseconds
+ * @param p50_us: holder for the median latency
+ * @param p99_us: holder for the 99th percentile latency
+ * @param max_us: holder for the largest latency
+ */
+void fs_sync_stats(long *syncs, long *blocks, long *avg_us, long *p50_us, long *p99_us, long *max_us)
+{
+	pthread_mutex_lock(&sync_stats_lock);
+	*syncs = sync_stats.syncs;
+	*blocks = sync_stats.blocks;
+	*avg_us = sync_stats.syncs ? sync_stats.total_us / sync_stats.syncs : 0;
+	*max_us = sync_stats.max_us;
+	*p50_us = *p99_us = 0;
+	long count = 0;
+	for (int i = 0; i < SYNC_BUCKETS && sync_stats.syncs > 0; i++)
+	{
+		count += sync_stats.hist[i];
+		if (*p50_us == 0 && count * 2 >= sync_stats.syncs)
+			*p50_us = 1L << i;
+		if (*p99_us == 0 && count * 100 >= sync_stats.syncs * 99)
+			*p99_us = 1L << i;
+	}
+	pthread_mutex_unlock(&sync_stats_lock);
+}
 
-	// remove entire entry from parent dir
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
-	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+/**
+ * Measure the layout of regular files: the number of extents,
+ * runs of consecutive blocks, that their blocks form.
+ *
+ * @param files: holder for the number of non-empty files
+ * @param blocks: holder for the number of data blocks
+ * @param extents: holder for the number of extents
+ */
+void fs_layout(long *files, long *blocks, long *extents)
+{
+	*files = *blocks = *extents = 0;
+	for (int inum = 0; inum < n_inodes; inum++)
 	{
-		if (entries[i].valid && strcmp(entries[i].name, name) == 0)
+		struct fs_inode *inode = &inodes[inum];
+		inode_lock(inum, false);
+		if (!S_ISREG(inode->mode) || inode->size == 0)
+		{
+			inode_unlock(inum);
+			continue;
+		}
+		int n = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		uint32_t *blks = malloc(n * sizeof(uint32_t));
+		n = bmap_range(inum, 0, n, blks, false, NULL);
+		inode_unlock(inum);
+		uint32_t prev = 0;
+		for (int i = 0; i < n; i++)
 		{
-			memset(&entries[i], 0, sizeof(struct fs_dirent));
+			if (!blks[i])
+				continue;
+			if (blks[i] != prev + 1)
+				(*extents)++;
+			(*blocks)++;
+			prev = blks[i];
 		}
+		(*files)++;
+		free(blks);
 	}
-	if (disk->ops->write(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
-
-	// clear inode
-	memset(inode, 0, sizeof(struct fs_inode));
-	return_inode(inode_idx);
-
-	// update
-	update_inode(inode_idx);
-	update_blk();
-
-	return SUCCESS;
 }
 
 /**
- * rmdir - remove a directory
- *
- * @param path: the path of the directory
- *
- * @return: 0 if successful, or -error number
- * 	-ENOENT   - file does not exist
- *  	-ENOTDIR  - component of path not a directory
- *  	-ENOTDIR  - path not a directory
- *  	-ENOEMPTY - directory not empty
+ * destroy - this is called once by the FUSE framework when the
+ * file system is unmounted. Writes back modified metadata.
  *
- * Note: this is similar to deleting a file, except that we delete
- * a directory.
+ * @param private_data: unused
  */
-static int fs_rmdir(const char *path)
+static void fs_destroy(void *private_data)
 {
-	// can not remove root
-	if (strcmp(path, "/") == 0)
-		return -EINVAL;
-
-	// get inodes and check
-	// CS492: your code below
-	char *_path = strdup(path);
-	char name[FS_FILENAME_SIZE];
-	int inode_idx = translate(_path);
-	int parent_inode_idx = translate_1(_path, name);
-	if (inode_idx < 0)
-		return -inode_idx; // return error
-	if (parent_inode_idx < 0)
-		return parent_inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	struct fs_inode *parent_inode = &inodes[parent_inode_idx];
-
-	// check if dir if empty
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, inode->direct[0], 1, entries) < 0)
-		exit(1);
-	int res = is_empty_dir(entries);
-	if (res == 0)
-		return -ENOTEMPTY;
-
-	// remove entry from parent dir
-	// CS492: your code below
-	// struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
-	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+	for (int fh = 0; fh < files_len; fh++)
 	{
-		if (entries[i].valid && strcmp(entries[i].name, name) == 0)
-		{
-			memset(&entries[i], 0, sizeof(struct fs_dirent));
-		}
+		if (files[fh] != NULL)
+			file_flush_write(files[fh]);
 	}
-	if (disk->ops->write(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
+	flush_metadata();
+}
 
-	// return blk and clear inode
-	return_blk(inode->direct[0]);
-	memset(inode, 0, sizeof(struct fs_inode));
-	return_inode(inode_idx);
+/**
+ * Operations vector. Please don't rename it, as the
+ * skeleton code in main.c assumes it is named 'fs_ops'.
+ */
+struct fuse_operations fs_ops = {
+	.init = fs_init,
+	.destroy = fs_destroy,
+	.getattr = fs_getattr,
+	.opendir = fs_opendir,
+	.readdir = fs_readdir,
+	.releasedir = fs_releasedir,
+	.mknod = fs_mknod,
+	.mkdir = fs_mkdir,
+	.unlink = fs_unlink,
+	.rmdir = fs_rmdir,
+	.rename = fs_rename,
+	.chmod = fs_chmod,
+	.utime = fs_utime,
+	.truncate = fs_truncate,
+	.open = fs_open,
+	.read = fs_read,
+	.write = fs_write,
+	.write_buf = fs_write_buf,
+	.fallocate = fs_fallocate,
+	.flush = fs_flush,
+	.release = fs_release,
+	.fsync = fs_fsync,
+	.fsyncdir = fs_fsyncdir,
+	.statfs = fs_statfs,
+};
 
-	// update
-	update_inode(inode_idx);
-	update_blk();
+/*
+ * Low-level (inode-based) interface. The kernel resolves paths one
+ * name at a time through lookup and caches the results, so each
+ * operation gets its inode directly. Inode numbers are those of the
+ * file system, except that the root is always FUSE_ROOT_ID.
+ *
+ * Each inode returned by lookup, mknod or mkdir holds a reference
+ * until the kernel forgets it. An inode unlinked while referenced is
+ * freed by the forget that drops its last reference.
+ */
 
-	return SUCCESS;
-}
+/** seconds the kernel may cache entries and attributes */
+static const double LL_TIMEOUT = 1.0;
 
 /**
- * rename - rename a file or directory. You can assume the destination
- * and the source share the same path-prefix so the renaming changes
- * the name without moving the file or directory into another file or
- * directory.
+ * Get the file system inode of a FUSE inode.
  *
- * Note that this is a simplified version of the UNIX rename
- * functionality - see 'man 2 rename' for full semantics. In
- * particular, the full version can move across directories, replace a
- * destination file, and replace an empty directory with a full one.
+ * @param ino: the FUSE inode
+ * @return: the inode number, or -ENOENT if out of range
+ */
+static int ll_inum(fuse_ino_t ino)
+{
+	if (ino == FUSE_ROOT_ID)
+		return root_inode;
+	if (ino == (fuse_ino_t)root_inode)
+		return FUSE_ROOT_ID;
+	return (ino < (fuse_ino_t)n_inodes) ? (int)ino : -ENOENT;
+}
+
+/**
+ * Get the FUSE inode of a file system inode.
  *
- * @param src_path: the source path
- * @param dst_path: the destination path
+ * @param inum: the inode number
+ * @return: the FUSE inode
+ */
+static fuse_ino_t ll_ino(int inum)
+{
+	if (inum == root_inode)
+		return FUSE_ROOT_ID;
+	if (inum == FUSE_ROOT_ID)
+		return (fuse_ino_t)root_inode;
+	return (fuse_ino_t)inum;
+}
+
+/**
+ * Reply with an entry for an inode and count the lookup. The caller
+ * holds the lock of the directory the entry was found in, so it
+ * cannot be unlinked first.
  *
- * @return: 0 if successful, or -error number
- * 	-ENOENT   - source file or directory does not exist
- * 	-ENOTDIR  - component of source or target path not a directory
- * 	-EEXIST   - destination already exists
- * 	-EINVAL   - source and destination not in the same directory
+ * @param req: the request
+ * @param inum: the inode number
  */
-static int fs_rename(const char *src_path, const char *dst_path)
+static void ll_reply_entry(fuse_req_t req, int inum)
 {
-	// deep copy both path
-	char *_src_path = strdup(src_path);
-	char *_dst_path = strdup(dst_path);
-	// get inodes
-	int src_inode_idx = translate(_src_path);
-	int dst_inode_idx = translate(_dst_path);
-	// if src inode does not exist return error
-	if (src_inode_idx < 0)
-		return src_inode_idx;
-	// if dst already exist return error
-	if (dst_inode_idx >= 0)
-		return -EEXIST;
+	struct fuse_entry_param e;
+	memset(&e, 0, sizeof(e));
+	e.ino = ll_ino(inum);
+	e.attr_timeout = LL_TIMEOUT;
+	e.entry_timeout = LL_TIMEOUT;
+	inode_lock(inum, false);
+	cpy_stat(inum, &e.attr);
+	inode_unlock(inum);
+	e.attr.st_ino = e.ino;
+
+	pthread_mutex_lock(&ref_lock);
+	refs[inum].nlookup++;
+	pthread_mutex_unlock(&ref_lock);
+	fuse_reply_entry(req, &e);
+}
 
-	// get parent directory inode
-	char src_name[FS_FILENAME_SIZE];
-	char dst_name[FS_FILENAME_SIZE];
-	int src_parent_inode_idx = translate_1(_src_path, src_name);
-	int dst_parent_inode_idx = translate_1(_dst_path, dst_name);
-	// src and dst should be in the same directory (same parent)
-	if (src_parent_inode_idx != dst_parent_inode_idx)
-		return -EINVAL;
-	int parent_inode_idx = src_parent_inode_idx;
-	if (parent_inode_idx < 0)
-		return parent_inode_idx;
+/**
+ * Reply with the attributes of an inode. The caller holds the inode
+ * lock.
+ *
+ * @param req: the request
+ * @param inum: the inode number
+ */
+static void ll_reply_attr(fuse_req_t req, int inum)
+{
+	struct stat sb;
+	cpy_stat(inum, &sb);
+	sb.st_ino = ll_ino(inum);
+	fuse_reply_attr(req, &sb, LL_TIMEOUT);
+}
 
-	// read parent dir inode
-	struct fs_inode *parent_inode = &inodes[parent_inode_idx];
-	if (!S_ISDIR(parent_inode->mode))
+/**
+ * Lock a directory for a request on one of its entries.
+ *
+ * @param parent: the FUSE inode of the directory
+ * @param name: the entry name
+ * @param write: whether to lock for writing
+ * @return: the directory inode, or -error number
+ *	-ENOENT       - no such inode
+ *	-ENOTDIR      - inode not a directory
+ *	-ENAMETOOLONG - name too long
+ */
+static int ll_lock_dir(fuse_ino_t parent, const char *name, bool write)
+{
+	int inum = ll_inum(parent);
+	if (inum < 0)
+		return inum;
+	if (strlen(name) > FS_FILENAME_SIZE - 1)
+		return -ENAMETOOLONG;
+	inode_lock(inum, write);
+	if (!S_ISDIR(inodes[inum].mode))
+	{
+		inode_unlock(inum);
 		return -ENOTDIR;
+	}
+	return inum;
+}
 
-	struct fs_dirent entries[DIRENTS_PER_BLK];
-	memset(entries, 0, DIRENTS_PER_BLK * sizeof(struct fs_dirent));
-	if (disk->ops->read(disk, parent_inode->direct[0], 1, entries) < 0)
-		exit(1);
+/**
+ * init - as fs_init, for the low-level interface.
+ */
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	fs_init(conn);
+}
 
-	// make change to buff
-	for (int i = 0; i < DIRENTS_PER_BLK; i++)
+/**
+ * destroy - as fs_destroy, for the low-level interface.
+ */
+static void ll_destroy(void *userdata)
+{
+	fs_destroy(userdata);
+}
+
+/**
+ * lookup - look up a directory entry and reference its inode.
+ *
+ * @param req: the request
+ * @param parent: the directory
+ * @param name: the entry name
+ */
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	int dir = ll_lock_dir(parent, name, false);
+	if (dir < 0)
 	{
-		if (entries[i].valid && strcmp(entries[i].name, src_name) == 0)
-		{
-			memset(entries[i].name, 0, sizeof(entries[i].name));
-			strcpy(entries[i].name, dst_name);
-		}
+		fuse_reply_err(req, -dir);
+		return;
 	}
-
-	// write buff to inode
-	if (disk->ops->write(disk, parent_inode->direct[0], 1, entries))
-		exit(1);
-	return SUCCESS;
+	int inum = lookup(dir, name);
+	if (inum < 0)
+		fuse_reply_err(req, -inum);
+	else
+		ll_reply_entry(req, inum);
+	inode_unlock(dir);
 }
 
 /**
- * chmod - change file permissions
- *
- * @param path: the file or directory path
- * @param mode: the mode_t mode value -- see man 'chmod'
- * for description
+ * forget - drop references to an inode, freeing it if it was
+ * unlinked and this was the last reference.
  *
- *  @return: 0 if successful, or -error number
- *  	-ENOENT   - file does not exist
- *  	-ENOTDIR  - component of path not a directory
+ * @param req: the request
+ * @param ino: the inode
+ * @param nlookup: the number of references dropped
  */
-static int fs_chmod(const char *path, mode_t mode)
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	// protect system from other modes
-	mode |= S_ISDIR(inode->mode) ? S_IFDIR : S_IFREG;
-	// change through reference
-	inode->mode = mode;
-	update_inode(inode_idx);
-	return SUCCESS;
+	int inum = ll_inum(ino);
+	if (inum >= 0)
+	{
+		journal_begin(disk);
+		inode_lock(inum, true);
+		pthread_mutex_lock(&ref_lock);
+		struct inode_ref *ref = &refs[inum];
+		ref->nlookup = (nlookup < ref->nlookup) ? ref->nlookup - nlookup : 0;
+		bool release = ref->nlookup == 0 && ref->unlinked;
+		if (release)
+			ref->unlinked = false;
+		pthread_mutex_unlock(&ref_lock);
+		if (release)
+			free_inode(inum);
+		inode_unlock(inum);
+		journal_end(disk);
+	}
+	fuse_reply_none(req);
 }
 
 /**
- * utime - change modification time.
+ * getattr - get the attributes of an inode.
  *
- * @param path the file or directory path.
- * @param ut utimbuf - see man 'utime' for description.
- * @return 0 if successful, or error value
- *   -ENOENT   - file does not exist
- *   -ENOTDIR  - component of path not a directory
+ * @param req: the request
+ * @param ino: the inode
+ * @param fi: unused
  */
-int fs_utime(const char *path, struct utimbuf *ut)
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	// CS492: your code here
-	char *_path = strdup(path);
-	char name[FS_FILENAME_SIZE];
-	int inode_idx = translate(_path);
-	int parent_inode_idx = translate_1(_path, name);
-	// struct fs_inode *inode = &inodes[inode_idx];
-	if (inode_idx < 0 || parent_inode_idx < 0)
-		return -ENOENT;
-	/*if (!S_ISDIR(parent_inode_idx->mode))
-		return -ENOTDIR;
-	*/
-	int time = utime(_path, ut);
-	if (time == -1)
+	int inum = ll_inum(ino);
+	if (inum < 0)
 	{
-		return -1;
+		fuse_reply_err(req, -inum);
+		return;
 	}
-	return time;
+	inode_lock(inum, false);
+	ll_reply_attr(req, inum);
+	inode_unlock(inum);
 }
 
 /**
- * Open a filesystem file or directory path.
+ * setattr - change the mode, size or modification time of an inode,
+ * as fs_chmod, fs_truncate and fs_utime.
  *
- * @param path: the path
- * @param fuse: file info data
- *
- * @return: 0 if successful, or -error number
- *	-ENOENT   - file does not exist
- *	-ENOTDIR  - component of path not a directory
+ * @param req: the request
+ * @param ino: the inode
+ * @param attr: the new attributes
+ * @param to_set: FUSE_SET_ATTR_* bits of the attributes to change
+ * @param fi: unused
  */
-static int fs_open(const char *path, struct fuse_file_info *fi)
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+					   int to_set, struct fuse_file_info *fi)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	if (S_ISDIR(inodes[inode_idx].mode))
-		return -EISDIR;
-	fi->fh = (uint64_t)inode_idx;
-	return SUCCESS;
-}
+	int inum = ll_inum(ino);
+	if (inum < 0)
+	{
+		fuse_reply_err(req, -inum);
+		return;
+	}
+	journal_begin(disk);
+	inode_lock(inum, true);
+	struct fs_inode *inode = &inodes[inum];
+	int res = SUCCESS;
+	if ((to_set & FUSE_SET_ATTR_SIZE) && S_ISDIR(inode->mode))
+		res = -EISDIR;
+	else if ((to_set & FUSE_SET_ATTR_SIZE) && attr->st_size < 0)
+		res = -EINVAL;
+	else if ((to_set & FUSE_SET_ATTR_SIZE) && attr->st_size > MAX_FILE_SIZE)
+		res = -EFBIG;
+	if (res < 0)
+	{
+		inode_unlock(inum);
+		journal_end(disk);
+		fuse_reply_err(req, -res);
+		return;
+	}
 
-static void fs_read_blk(int blk_num, char *buf, size_t len, size_t offset)
-{
-	// CS492: your code here
-	char entries[BLOCK_SIZE];
-	memset(entries, 0, BLOCK_SIZE);
-	if (disk->ops->read(disk, blk_num, 1, entries) < 0)
-		exit(1);
-	memcpy(buf, entries + offset, len); // start from offset in entries, copy len bytes from the block to the buffer
+	if (to_set & FUSE_SET_ATTR_SIZE)
+		truncate_inode(inum, attr->st_size);
+	if (to_set & FUSE_SET_ATTR_MODE)
+		inode->mode = (attr->st_mode & ~S_IFMT) | (inode->mode & S_IFMT);
+	if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+		inode->mtime = time(NULL);
+	else if (to_set & FUSE_SET_ATTR_MTIME)
+		inode->mtime = attr->st_mtime;
+	update_inode(inum);
+	ll_reply_attr(req, inum);
+	inode_unlock(inum);
+	journal_end(disk);
 }
 
-static size_t fs_read_dir(size_t inode_idx, char *buf, size_t len, size_t offset)
+/**
+ * Create a file or directory for mknod or mkdir.
+ *
+ * @param req: the request
+ * @param parent: the directory
+ * @param name: the entry name
+ * @param mode: the mode of the new inode
+ * @param isDir: whether to create a directory
+ */
+static void ll_create_entry(fuse_req_t req, fuse_ino_t parent, const char *name,
+							mode_t mode, bool isDir)
 {
-	struct fs_inode *inode = &inodes[inode_idx];
-	size_t blk_num = offset / BLOCK_SIZE;
-	size_t blk_offset = offset % BLOCK_SIZE;
-	size_t len_to_read = len;
-	while (blk_num < N_DIRECT && len_to_read > 0)
+	journal_begin(disk);
+	int dir = ll_lock_dir(parent, name, true);
+	if (dir < 0)
 	{
-		size_t cur_len_to_read = len_to_read > BLOCK_SIZE ? (size_t)BLOCK_SIZE - blk_offset : len_to_read;
-		size_t temp = blk_offset + cur_len_to_read;
-
-		if (!inode->direct[blk_num])
-		{
-			return len - len_to_read;
-		}
-
-		fs_read_blk(inode->direct[blk_num], buf, temp, blk_offset);
-
-		buf += temp;
-		len_to_read -= temp;
-		blk_num++;
-		blk_offset = 0;
+		journal_end(disk);
+		fuse_reply_err(req, -dir);
+		return;
 	}
-	return len - len_to_read;
+	int inum = create_entry(dir, name, mode, isDir);
+	if (inum < 0)
+		fuse_reply_err(req, -inum);
+	else
+		ll_reply_entry(req, inum);
+	inode_unlock(dir);
+	journal_end(disk);
 }
 
-static size_t fs_read_indir1(size_t blk, char *buf, size_t len, size_t offset)
+/**
+ * mknod - create a regular file, as fs_mknod.
+ */
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+					 mode_t mode, dev_t rdev)
 {
-	uint32_t blk_indices[PTRS_PER_BLK];
-	memset(blk_indices, 0, PTRS_PER_BLK * sizeof(uint32_t));
-	if (disk->ops->read(disk, (int)blk, 1, blk_indices) < 0)
-		exit(1);
-
-	size_t blk_num = offset / BLOCK_SIZE;
-	size_t blk_offset = offset % BLOCK_SIZE;
-	size_t len_to_read = len;
-	while (blk_num < PTRS_PER_BLK && len_to_read > 0)
+	mode |= S_IFREG;
+	if (!S_ISREG(mode))
 	{
-		size_t cur_len_to_read = len_to_read > BLOCK_SIZE ? (size_t)BLOCK_SIZE - blk_offset : len_to_read;
-		size_t temp = blk_offset + cur_len_to_read;
-
-		if (!blk_indices[blk_num])
-		{
-			return len - len_to_read;
-		}
-
-		fs_read_blk(blk_indices[blk_num], buf, temp, blk_offset);
-
-		buf += temp;
-		len_to_read -= temp;
-		blk_num++;
-		blk_offset = 0;
+		fuse_reply_err(req, EINVAL);
+		return;
 	}
-	return len - len_to_read;
+	ll_create_entry(req, parent, name, mode, false);
 }
 
-static size_t fs_read_indir2(size_t blk, char *buf, size_t len, size_t offset)
+/**
+ * mkdir - create a directory, as fs_mkdir.
+ */
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
-	uint32_t blk_indices[PTRS_PER_BLK];
-	memset(blk_indices, 0, PTRS_PER_BLK * sizeof(uint32_t));
-	if (disk->ops->read(disk, (int)blk, 1, blk_indices) < 0)
-		return 0;
-
-	size_t blk_num = offset / INDIR1_SIZE;
-	size_t blk_offset = offset % INDIR1_SIZE;
-	size_t len_to_read = len;
-	while (blk_num < PTRS_PER_BLK && len_to_read > 0)
-	{
-		size_t cur_len_to_read = len_to_read > INDIR1_SIZE ? (size_t)INDIR1_SIZE - blk_offset : len_to_read;
-		size_t temp = blk_offset + cur_len_to_read;
-
-		if (!blk_indices[blk_num])
-		{
-			return len - len_to_read;
-		}
-
-		temp = fs_read_indir1(blk_indices[blk_num], buf, temp, blk_offset);
-
-		buf += temp;
-		len_to_read -= temp;
-		blk_num++;
-		blk_offset = 0;
-	}
-	return len - len_to_read;
+	ll_create_entry(req, parent, name, mode | S_IFDIR, true);
 }
 
 /**
- * read - read data from an open file.
- *
- * @param path: the path to the file
- * @param buf: the buffer to keep the data
- * @param len: the number of bytes to read
- * @param offset: the location to start reading at
- * @param fi: fuse file info
- *
- * @return: return exactly the number of bytes requested, except:
- * - if offset >= file len, return 0
- * - if offset+len > file len, return bytes from offset to EOF
- * - on error, return <0
- * 	-ENOENT  - file does not exist
- * 	-EISDIR  - file is in fact a directory
- * 	-ENOTDIR - component of path not a directory
- * 	-EIO     - error reading block
- *
- * Note: similar to fs_write, except that:
- * 1) we cannot read past the end of the file (so you need to add a test
- *    for that, that limits the len to be read in this case)
- * 2) there's no need to allocate or update anything since we are only
- *    reading the file.
+ * unlink - remove a file, as fs_unlink.
  */
-static int fs_read(const char *path, char *buf, size_t len, off_t offset,
-				   struct fuse_file_info *fi)
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-	// CS492: your code here
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	if (S_ISDIR(inode->mode))
-		return -EISDIR;
-	if (offset > inode->size)
-		return 0;
+	journal_begin(disk);
+	int dir = ll_lock_dir(parent, name, true);
+	int res = (dir < 0) ? dir : unlink_entry(dir, name);
+	if (dir >= 0)
+		inode_unlock(dir);
+	journal_end(disk);
+	fuse_reply_err(req, -res);
+}
 
-	// len need to read
-	size_t len_to_read = len;
+/**
+ * rmdir - remove an empty directory, as fs_rmdir.
+ */
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	journal_begin(disk);
+	int dir = ll_lock_dir(parent, name, true);
+	int res = (dir < 0) ? dir : rmdir_entry(dir, name);
+	if (dir >= 0)
+		inode_unlock(dir);
+	journal_end(disk);
+	fuse_reply_err(req, -res);
+}
 
-	// reading direct blocks
-	if (len_to_read > 0 && offset < DIR_SIZE)
+/**
+ * rename - rename an entry within its directory, as fs_rename.
+ */
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+					  fuse_ino_t newparent, const char *newname)
+{
+	if (newparent != parent)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+	if (strlen(newname) > FS_FILENAME_SIZE - 1)
 	{
-		// len finished read
-		size_t temp = fs_read_dir(inode_idx, buf, len_to_read, (size_t)offset);
-		len_to_read -= temp;
-		offset += temp;
-		buf += temp;
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
 	}
+	journal_begin(disk);
+	int dir = ll_lock_dir(parent, name, true);
+	int res = (dir < 0) ? dir : rename_entry(dir, name, newname);
+	if (dir >= 0)
+		inode_unlock(dir);
+	journal_end(disk);
+	fuse_reply_err(req, -res);
+}
 
-	// read indirect 1 blocks
-	if (len_to_read > 0 && offset < DIR_SIZE + INDIR1_SIZE)
+/**
+ * open - open a file, as fs_open.
+ */
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int inum = ll_inum(ino);
+	int res = inum;
+	if (inum >= 0)
 	{
-		/*
-		// need to allocate indir_1
-		if (!inode->indir_1)
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			inode->indir_1 = freeb;
-			update_inode(inode_idx);
-		} */
-		size_t temp = fs_read_indir1(inode->indir_1, buf, len_to_read, (size_t)offset - DIR_SIZE);
-		len_to_read -= temp;
-		offset += temp;
-		buf += temp;
+		inode_lock(inum, false);
+		res = open_inode(inum, fi);
+		inode_unlock(inum);
 	}
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_open(req, fi);
+}
 
-	// read indirect 2 blocks
-	if (len_to_read > 0 && offset < DIR_SIZE + INDIR1_SIZE + INDIR2_SIZE)
+/**
+ * read - read from an open file, as fs_read. When the disk has an
+ * image file, the reply refers to the file's blocks in it, and FUSE
+ * splices them to the kernel.
+ */
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+					struct fuse_file_info *fi)
+{
+	// splice from the image file while the blocks cannot change
+	struct fs_file *f = get_file(fi);
+	if (f != NULL && disk_fd() >= 0)
 	{
-		/*
-		// need to allocate indir_2
-		if (!inode->indir_2)
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			inode->indir_2 = freeb;
-			update_inode(inode_idx);
-		} */
-		// len finshed read
-		size_t temp = fs_read_indir2(inode->indir_2, buf, len_to_read, (size_t)offset - DIR_SIZE - INDIR1_SIZE);
-		len_to_read -= temp;
-		offset += len_to_read;
+		struct fuse_bufvec *bufv;
+		inode_lock(f->inum, false);
+		int res = file_read_buf(f, size, off, &bufv);
+		if (res < 0)
+			fuse_reply_err(req, -res);
+		else
+			fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+		inode_unlock(f->inum);
+		free_bufvec(bufv);
+		return;
 	}
 
-	if (offset > inode->size)
-		inode->size = offset;
-	/*
-	// update inode and blk
-	update_inode(inode_idx);
-	update_blk();
-	*/
-	return (int)(len - len_to_read);
+	char *buf = malloc(size);
+	int res = fs_read(NULL, buf, size, off, fi);
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_buf(req, buf, res);
+	free(buf);
 }
 
-static void fs_write_blk(int blk_num, const char *buf, size_t len, size_t offset)
+/**
+ * write - write to an open file, as fs_write.
+ */
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+					 off_t off, struct fuse_file_info *fi)
 {
-	char entries[BLOCK_SIZE];
-	memset(entries, 0, BLOCK_SIZE);
-	if (disk->ops->read(disk, blk_num, 1, entries) < 0)
-		exit(1);
-	memcpy(entries + offset, buf, len);
-	if (disk->ops->write(disk, blk_num, 1, entries) < 0)
-		exit(1);
+	int res = fs_write(NULL, buf, size, off, fi);
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_write(req, res);
 }
 
-static size_t fs_write_dir(size_t inode_idx, const char *buf, size_t len, size_t offset)
+/**
+ * write_buf - write to an open file from a buffer vector, as
+ * fs_write_buf.
+ */
+static void ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
+						 off_t off, struct fuse_file_info *fi)
 {
-	struct fs_inode *inode = &inodes[inode_idx];
-	size_t blk_num = offset / BLOCK_SIZE;
-	size_t blk_offset = offset % BLOCK_SIZE;
-	size_t len_to_write = len;
-	while (blk_num < N_DIRECT && len_to_write > 0)
-	{
-		size_t cur_len_to_write = len_to_write > BLOCK_SIZE ? (size_t)BLOCK_SIZE - blk_offset : len_to_write;
-		// size_t temp = blk_offset + cur_len_to_write;
-		size_t temp = cur_len_to_write;
-
-		if (!inode->direct[blk_num])
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			inode->direct[blk_num] = freeb;
-			update_inode(inode_idx);
-		}
-
-		fs_write_blk(inode->direct[blk_num], buf, temp, blk_offset);
-
-		buf += temp;
-		len_to_write -= temp;
-		blk_num++;
-		blk_offset = 0;
-	}
-	return len - len_to_write;
+	int res = fs_write_buf(NULL, bufv, off, fi);
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_write(req, res);
 }
 
-static size_t fs_write_indir1(size_t blk, const char *buf, size_t len, size_t offset)
+/**
+ * fallocate - reserve blocks for a range of a file, as fs_fallocate.
+ */
+static void ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+						 off_t length, struct fuse_file_info *fi)
 {
-	uint32_t blk_indices[PTRS_PER_BLK];
-	memset(blk_indices, 0, PTRS_PER_BLK * sizeof(uint32_t));
-	if (disk->ops->read(disk, (int)blk, 1, blk_indices) < 0)
-		exit(1);
-
-	size_t blk_num = offset / BLOCK_SIZE;
-	size_t blk_offset = offset % BLOCK_SIZE;
-	size_t len_to_write = len;
-	while (blk_num < PTRS_PER_BLK && len_to_write > 0)
+	int inum = ll_inum(ino);
+	int res = inum;
+	if (inum >= 0)
 	{
-		size_t cur_len_to_write = len_to_write > BLOCK_SIZE ? (size_t)BLOCK_SIZE - blk_offset : len_to_write;
-		size_t temp = blk_offset + cur_len_to_write;
-
-		if (!blk_indices[blk_num])
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			blk_indices[blk_num] = freeb;
-			// write back
-			if (disk->ops->write(disk, blk, 1, blk_indices) < 0)
-				exit(1);
-		}
-
-		fs_write_blk(blk_indices[blk_num], buf, temp, blk_offset);
-
-		buf += temp;
-		len_to_write -= temp;
-		blk_num++;
-		blk_offset = 0;
+		journal_begin(disk);
+		inode_lock(inum, true);
+		res = file_fallocate(inum, mode, offset, length);
+		inode_unlock(inum);
+		journal_end(disk);
 	}
-	return len - len_to_write;
+	fuse_reply_err(req, -res);
 }
 
-static size_t fs_write_indir2(size_t blk, const char *buf, size_t len, size_t offset)
+/**
+ * release - close an open file, as fs_release.
+ */
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	uint32_t blk_indices[PTRS_PER_BLK];
-	memset(blk_indices, 0, PTRS_PER_BLK * sizeof(uint32_t));
-	if (disk->ops->read(disk, (int)blk, 1, blk_indices) < 0)
-		return 0;
-
-	size_t blk_num = offset / INDIR1_SIZE;
-	size_t blk_offset = offset % INDIR1_SIZE;
-	size_t len_to_write = len;
-	while (blk_num < PTRS_PER_BLK && len_to_write > 0)
-	{
-		size_t cur_len_to_write = len_to_write > INDIR1_SIZE ? (size_t)INDIR1_SIZE - blk_offset : len_to_write;
-		size_t temp = blk_offset + cur_len_to_write;
-		len_to_write -= temp;
-		if (!blk_indices[blk_num])
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			blk_indices[blk_num] = freeb;
-			// write back
-			if (disk->ops->write(disk, blk, 1, blk_indices) < 0)
-				exit(1);
-		}
+	fuse_reply_err(req, -fs_release(NULL, fi));
+}
 
-		temp = fs_write_indir1(blk_indices[blk_num], buf, temp, blk_offset);
-		if (temp == 0)
-			return len - len_to_write;
-		buf += temp;
-		blk_num++;
-		blk_offset = 0;
-	}
-	return len - len_to_write;
+/**
+ * flush - write the pending block of an open file, as fs_flush.
+ */
+static void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	fuse_reply_err(req, -fs_flush(NULL, fi));
 }
 
 /**
- * write - write data to a file
- *
- * @param path: the file path
- * @param buf: the buffer to write
- * @param len: the number of bytes to write
- * @param offset: the offset to starting writing at
- * @param fi: the Fuse file info for writing
- *
- * @return: It should return exactly the number of bytes requested, except on error.
- *
- * 	-ENOENT  - file does not exist
- * 	-EISDIR  - file is in fact a directory
- *	-ENOTDIR - component of path not a directory
- *	-EINVAL  - if 'offset' is greater than current file length.
- *  			(POSIX semantics support the creation of files with
- *  			"holes" in them, but we don't)
+ * fsync - make a file durable, as fs_fsync.
  */
-static int fs_write(const char *path, const char *buf, size_t len,
-					off_t offset, struct fuse_file_info *fi)
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	struct fs_inode *inode = &inodes[inode_idx];
-	if (S_ISDIR(inode->mode))
-		return -EISDIR;
-	if (offset > inode->size)
-		return 0;
+	int inum = ll_inum(ino);
+	fuse_reply_err(req, (inum < 0) ? -inum : -sync_inode(inum));
+}
 
-	// len need to write
-	size_t len_to_write = len;
+/** directory listing built by opendir, saved in fi->fh */
+struct ll_dir
+{
+	char *buf;	 // entries in fuse_add_direntry format
+	size_t size; // size of the entries
+	fuse_req_t req; // the opendir request, while building the listing
+};
 
-	// write direct blocks
-	if (len_to_write > 0 && offset < DIR_SIZE)
-	{
-		// len finished write
-		size_t temp = fs_write_dir(inode_idx, buf, len_to_write, (size_t)offset);
-		len_to_write -= temp;
-		offset += temp;
-		buf += temp;
-	}
+/** dir_iterate callback that adds an entry to a listing */
+static int ll_dir_entry(void *arg, const struct fs_dirent *de)
+{
+	struct ll_dir *d = arg;
+	struct stat sb;
+	memset(&sb, 0, sizeof(sb));
+	sb.st_ino = ll_ino(de->inode);
+	inode_lock(de->inode, false);
+	sb.st_mode = inodes[de->inode].mode;
+	inode_unlock(de->inode);
+
+	size_t len = fuse_add_direntry(d->req, NULL, 0, de->name, &sb, 0);
+	d->buf = realloc(d->buf, d->size + len);
+	fuse_add_direntry(d->req, d->buf + d->size, len, de->name, &sb, d->size + len);
+	d->size += len;
+	return 0;
+}
 
-	// write indirect 1 blocks
-	if (len_to_write > 0 && offset < DIR_SIZE + INDIR1_SIZE)
+/**
+ * opendir - open a directory. The listing is taken here, so a
+ * directory read in several requests is seen at one time.
+ */
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int inum = ll_inum(ino);
+	if (inum < 0)
 	{
-		// need to allocate indir_1
-		if (!inode->indir_1)
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			inode->indir_1 = freeb;
-			update_inode(inode_idx);
-		}
-		size_t temp = fs_write_indir1(inode->indir_1, buf, len_to_write, (size_t)offset - DIR_SIZE);
-		len_to_write -= temp;
-		offset += temp;
-		buf += temp;
+		fuse_reply_err(req, -inum);
+		return;
 	}
-
-	// write indirect 2 blocks
-	if (len_to_write > 0 && offset < DIR_SIZE + INDIR1_SIZE + INDIR2_SIZE)
+	inode_lock(inum, false);
+	int res = -ENOTDIR;
+	struct ll_dir *d = calloc(1, sizeof(struct ll_dir));
+	d->req = req;
+	if (S_ISDIR(inodes[inum].mode))
+		res = dir_iterate(inum, ll_dir_entry, d);
+	inode_unlock(inum);
+	if (res < 0)
 	{
-		// need to allocate indir_2
-		if (!inode->indir_2)
-		{
-			int freeb = get_free_blk();
-			if (freeb < 0)
-				return len - len_to_write;
-			inode->indir_2 = freeb;
-			update_inode(inode_idx);
-		}
-		// len finshed write
-		size_t temp = fs_write_indir2(inode->indir_2, buf, len_to_write, (size_t)offset - DIR_SIZE - INDIR1_SIZE);
-		len_to_write -= temp;
-		offset += len_to_write;
+		free(d->buf);
+		free(d);
+		fuse_reply_err(req, -res);
+		return;
 	}
+	fi->fh = (uint64_t)(uintptr_t)d;
+	fuse_reply_open(req, fi);
+}
 
-	if (offset > inode->size)
-		inode->size = offset;
-
-	// update inode and blk
-	update_inode(inode_idx);
-	update_blk();
-
-	return (int)(len - len_to_write);
+/**
+ * readdir - get the entries of an open directory from an offset.
+ */
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+					   struct fuse_file_info *fi)
+{
+	struct ll_dir *d = (struct ll_dir *)(uintptr_t)fi->fh;
+	if (off >= (off_t)d->size)
+		fuse_reply_buf(req, NULL, 0);
+	else
+		fuse_reply_buf(req, d->buf + off, (d->size - off < size) ? d->size - off : size);
 }
 
 /**
- * Release resources created by pending open call.
- *
- * @param path: path to the file
- * @param fi: the fuse file info
- *
- * @return: 0 if successful, or -error number
- *	-ENOENT   - file does not exist
- *	-ENOTDIR  - component of path not a directory
+ * releasedir - free the listing of an open directory.
  */
-static int fs_release(const char *path, struct fuse_file_info *fi)
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	char *_path = strdup(path);
-	int inode_idx = translate(_path);
-	if (inode_idx < 0)
-		return inode_idx;
-	if (S_ISDIR(inodes[inode_idx].mode))
-		return -EISDIR;
+	struct ll_dir *d = (struct ll_dir *)(uintptr_t)fi->fh;
+	free(d->buf);
+	free(d);
 	fi->fh = (uint64_t)-1;
-	return SUCCESS;
+	fuse_reply_err(req, 0);
 }
 
 /**
- * statfs - get file system statistics. See 'man 2 statfs' for
- * description of 'struct statvfs'.
- *
- * @param path: the path to the file (ignored)
- * @param st: pointer to the destination statvfs struct
- *
- * @return: 0 if successful
- *
- * Errors
- *   none -  Needs to work
+ * fsyncdir - make a directory durable, as fs_fsyncdir.
  */
-static int fs_statfs(const char *path, struct statvfs *st)
+static void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
-	/* needs to return the following fields (set others to zero):
-	 *   f_bsize = BLOCK_SIZE
-	 *   f_blocks = total image - metadata
-	 *   f_bfree = f_blocks - blocks used
-	 *   f_bavail = f_bfree
-	 *   f_namelen = <whatever your max namelength is>
-	 */
-
-	// clear original stats
-	memset(st, 0, sizeof(*st));
-	st->f_bsize = FS_BLOCK_SIZE;
-	st->f_blocks = (fsblkcnt_t)(n_blocks - root_inode - inode_base);
-	st->f_bfree = (fsblkcnt_t)num_free_blk();
-	st->f_bavail = st->f_bfree;
-	st->f_namemax = FS_FILENAME_SIZE - 1;
+	int inum = ll_inum(ino);
+	fuse_reply_err(req, (inum < 0) ? -inum : -sync_inode(inum));
+}
 
-	return 0;
+/**
+ * statfs - get file system statistics, as fs_statfs.
+ */
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs st;
+	fs_statfs(NULL, &st);
+	fuse_reply_statfs(req, &st);
 }
 
 /**
- * Operations vector. Please don't rename it, as the
- * skeleton code in main.c assumes it is named 'fs_ops'.
+ * Low-level operations vector, used by main.c with -lowlevel.
  */
-struct fuse_operations fs_ops = {
-	.init = fs_init,
-	.getattr = fs_getattr,
-	.opendir = fs_opendir,
-	.readdir = fs_readdir,
-	.releasedir = fs_releasedir,
-	.mknod = fs_mknod,
-	.mkdir = fs_mkdir,
-	.unlink = fs_unlink,
-	.rmdir = fs_rmdir,
-	.rename = fs_rename,
-	.chmod = fs_chmod,
-	.utime = fs_utime,
-	.truncate = fs_truncate,
-	.open = fs_open,
-	.read = fs_read,
-	.write = fs_write,
-	.release = fs_release,
-	.statfs = fs_statfs,
+struct fuse_lowlevel_ops fs_ll_ops = {
+	.init = ll_init,
+	.destroy = ll_destroy,
+	.lookup = ll_lookup,
+	.forget = ll_forget,
+	.getattr = ll_getattr,
+	.setattr = ll_setattr,
+	.mknod = ll_mknod,
+	.mkdir = ll_mkdir,
+	.unlink = ll_unlink,
+	.rmdir = ll_rmdir,
+	.rename = ll_rename,
+	.open = ll_open,
+	.read = ll_read,
+	.write = ll_write,
+	.write_buf = ll_write_buf,
+	.fallocate = ll_fallocate,
+	.flush = ll_flush,
+	.release = ll_release,
+	.fsync = ll_fsync,
+	.opendir = ll_opendir,
+	.readdir = ll_readdir,
+	.releasedir = ll_releasedir,
+	.fsyncdir = ll_fsyncdir,
+	.statfs = ll_statfs,
 };
 
 /*#pragma clang diagnostic pop*/
@@ -35,7 +35,9 @@ struct fs_super {
 	uint32_t block_map_sz; /* block map size in blocks */
 	uint32_t num_blocks; /* total blocks, including SB, bitmaps, inodes */
 	uint32_t root_inode; /* always inode 1 */
-	char pad[FS_BLOCK_SIZE - 6 * sizeof(uint32_t)]; /* pad out to an entire block */
+	uint32_t journal_start; /* first block of metadata journal */
+	uint32_t journal_len; /* journal size in blocks, 0 if none */
+	char pad[FS_BLOCK_SIZE - 8 * sizeof(uint32_t)]; /* pad out to an entire block */
 }; /* total FS_BLOCK_SIZE bytes */
 
 /**
@@ -52,21 +54,52 @@ struct fs_inode {
 	uint32_t direct[N_DIRECT]; /* direct block pointers */
 	uint32_t indir_1; /* single indirect block pointer */
 	uint32_t indir_2; /* double indirect block pointer */
-	uint32_t pad[3]; /* padding to make 64 bytes per inode */
+	uint32_t flags; /* FS_INODE_* flags */
+	uint32_t pad[2]; /* padding to make 64 bytes per inode */
 }; /* total 64 bytes */
 
+/**
+ * Inode flags
+ *   FS_INODE_INDEXED  - directory has a hash index in block 0
+ *   FS_INODE_PREALLOC - file may have blocks past its end, reserved
+ *                       by fallocate, that hold no data yet
+ */
+enum { FS_INODE_INDEXED = 0x1, FS_INODE_PREALLOC = 0x2 };
+
+/**
+ * Index node of an indexed directory. A directory without an index
+ * is a single block of entries. An indexed directory has its root
+ * index node in logical block 0; the root entries point either to
+ * leaf blocks of entries or, if levels is 1, to further index nodes
+ * that point to leaf blocks. Each index entry covers the names whose
+ * hash is at least its hash and less than the hash of the next entry.
+ */
+enum { FS_DX_MAGIC = 0x44583439 /* "DX49" */ };
+struct fs_dx_entry {
+	uint32_t hash; /* lowest name hash in block */
+	uint32_t block; /* logical block in directory */
+}; /* total 8 bytes */
+struct fs_dx_node {
+	uint32_t magic; /* magic number for index node */
+	uint16_t count; /* number of entries in use */
+	uint16_t levels; /* index levels below root (root only) */
+	struct fs_dx_entry entries[(FS_BLOCK_SIZE - 8) / sizeof(struct fs_dx_entry)];
+}; /* total FS_BLOCK_SIZE bytes */
+
 /**
  * Constants for blocks
  *   DIRENTS_PER_BLK   - number of directory entries per block
  *   INODES_PER_BLOCK  - number of inodes per block
  *   PTRS_PER_BLOCK    - number of inode pointers per block
  *   BITS_PER_BLOCK    - number of bits per block
+ *   DX_ENTRIES_PER_BLK - number of index entries per index node
  */
 enum {
 	DIRENTS_PER_BLK = FS_BLOCK_SIZE / sizeof(struct fs_dirent),
 	INODES_PER_BLK = FS_BLOCK_SIZE / sizeof(struct fs_inode),
 	PTRS_PER_BLK = FS_BLOCK_SIZE / sizeof(uint32_t),
-	BITS_PER_BLK = FS_BLOCK_SIZE * 8
+	BITS_PER_BLK = FS_BLOCK_SIZE * 8,
+	DX_ENTRIES_PER_BLK = (FS_BLOCK_SIZE - 8) / sizeof(struct fs_dx_entry)
 };
 
 #endif
@@ -7,6 +7,8 @@
  */
 
 #define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,9 +20,18 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include "blkdev.h"
 
+/** maximum number of blocks in one vectored transfer */
+enum { MAX_IOV = 256 };
+
 // should be defined in "string.h" but is not on macos
 extern char *strdup(const char *);
 
@@ -30,6 +41,8 @@ struct image_dev
 	char *path; // path to device file
 	int fd;		// file descriptor of open file
 	int nblks;	// number of blocks in device
+	char *map;	// mapped image, or NULL if not mapped
+	struct image_aio *aio; // asynchronous I/O state, or NULL
 };
 
 /**
@@ -112,7 +125,7 @@ static int image_write(struct blkdev *dev, int first_blk, int nblks, void *buf)
 	assert(first_blk >= 0 && first_blk + nblks <= im->nblks);
 	if (first_blk == 0)
 	{
-		printf("WARNING: writing to superblock (block 0)");
+		printf("WARNING: writing to superblock (block 0)\n");
 	}
 
 	int result = pwrite(im->fd, buf, nblks * BLOCK_SIZE, first_blk * BLOCK_SIZE);
@@ -130,15 +143,124 @@ static int image_write(struct blkdev *dev, int first_blk, int nblks, void *buf)
 	return SUCCESS;
 }
 
+/**
+ * Transfer a list of blocks. Entries for consecutive blocks are
+ * combined into a single preadv or pwritev call.
+ * @param dev: the block device
+ * @param vec: the blocks and their buffers
+ * @param nvec: number of entries in vec
+ * @param write: true to write blocks, false to read them
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_rwv(struct blkdev *dev, struct blkvec *vec, int nvec, int write)
+{
+	struct image_dev *im = dev->private;
+
+	/* Check whether the disk is unavailable */
+	if (im->fd == -1)
+	{
+		return E_UNAVAIL;
+	}
+
+	struct iovec iov[MAX_IOV];
+	for (int i = 0; i < nvec;)
+	{
+		int first_blk = vec[i].blk, nblks = 0;
+		do
+		{
+			iov[nblks].iov_base = vec[i + nblks].buf;
+			iov[nblks].iov_len = BLOCK_SIZE;
+			nblks++;
+		} while (i + nblks < nvec && nblks < MAX_IOV && vec[i + nblks].blk == first_blk + nblks);
+
+		assert(first_blk >= 0 && first_blk + nblks <= im->nblks);
+		if (write && first_blk == 0)
+		{
+			printf("WARNING: writing to superblock (block 0)\n");
+		}
+
+		off_t offset = (off_t)first_blk * BLOCK_SIZE;
+		ssize_t result = write ? pwritev(im->fd, iov, nblks, offset)
+							   : preadv(im->fd, iov, nblks, offset);
+		if (result < 0)
+		{
+			fprintf(stderr, "%s error on %s: %s\n", write ? "write" : "read",
+					im->path, strerror(errno));
+			assert(0);
+		}
+		if (result != nblks * BLOCK_SIZE)
+		{
+			fprintf(stderr, "short %s on %s: %s\n", write ? "write" : "read",
+					im->path, strerror(errno));
+			assert(0);
+		}
+		i += nblks;
+	}
+	return SUCCESS;
+}
+
+/**
+ * To read a list of blocks from block device
+ * @param dev: the block device
+ * @param vec: the blocks and buffers to store the data
+ * @param nvec: number of entries in vec
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_readv(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	return image_rwv(dev, vec, nvec, 0);
+}
+
+/**
+ * To write a list of blocks to block device
+ * @param dev: the block device
+ * @param vec: the blocks and buffers where data comes from
+ * @param nvec: number of entries in vec
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_writev(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	return image_rwv(dev, vec, nvec, 1);
+}
+
+/**
+ * Start writing back a range of the image file without waiting for
+ * it, where the system can (Linux sync_file_range).
+ * @param im: the image device
+ * @param first_blk: index of the first block of the range
+ * @param nblks: number of blocks in the range
+ */
+static void image_start_sync(struct image_dev *im, int first_blk, int nblks)
+{
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(im->fd, (off_t)first_blk * BLOCK_SIZE, (off_t)nblks * BLOCK_SIZE,
+					SYNC_FILE_RANGE_WRITE);
+#endif
+}
+
+/**
+ * Wait until the data written to the image file is durable.
+ * fdatasync waits for writeback started by image_start_sync and
+ * flushes the disk's write cache, which sync_file_range does not.
+ * @param im: the image device
+ * @return SUCCESS if successful, E_UNAVAIL if the sync failed
+ */
+static int image_datasync(struct image_dev *im)
+{
+	if (fdatasync(im->fd) < 0)
+	{
+		fprintf(stderr, "fdatasync error on %s: %s\n", im->path, strerror(errno));
+		return E_UNAVAIL;
+	}
+	return SUCCESS;
+}
+
 /**
  * Flush the block device.
  * @param dev: the block device
  * @aparam first_blk: index of the block to start flushing
  * @param nblks: number of blocks to flush
  * @return SUCCESS if successful, E_UNAVAIL if device unavailable
- *
- * Note: this function does not actually flush anything, it just returns
- * one or the other of the twp possible return values.
  */
 static int image_flush(struct blkdev *dev, int first_blk, int nblks)
 {
@@ -151,7 +273,70 @@ static int image_flush(struct blkdev *dev, int first_blk, int nblks)
 	}
 
 	assert(first_blk >= 0 && first_blk + nblks <= im->nblks);
-	return SUCCESS;
+	image_start_sync(im, first_blk, nblks);
+	return image_datasync(im);
+}
+
+/**
+ * Make a list of blocks durable. Writeback of each run of consecutive
+ * blocks is started first, so the runs are written together, and then
+ * one fdatasync waits for them.
+ * @param dev: the block device
+ * @param blks: the block numbers, in increasing order
+ * @param nblks: the number of blocks
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ *
+ * Note: fdatasync also writes any other dirty pages of the image file.
+ * Pages modified through a shared mapping of the image are written
+ * back the same way, so this also serves the memory-mapped device.
+ */
+static int image_sync(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct image_dev *im = dev->private;
+
+	/* Check whether the disk is unavailable */
+	if (im->fd == -1)
+	{
+		return E_UNAVAIL;
+	}
+	if (nblks == 0)
+	{
+		return SUCCESS;
+	}
+
+	for (int i = 0, n; i < nblks; i += n)
+	{
+		for (n = 1; i + n < nblks && blks[i + n] == blks[i] + n; n++)
+			;
+		assert(blks[i] >= 0 && blks[i] + n <= im->nblks);
+		image_start_sync(im, blks[i], n);
+	}
+	return image_datasync(im);
+}
+
+/**
+ * Advise the kernel to start reading blocks of the image file into
+ * the page cache. Runs of consecutive blocks are advised together.
+ * @param dev: the block device
+ * @param blks: the block numbers
+ * @param nblks: the number of blocks
+ * @return the number of blocks advised
+ */
+static int image_prefetch(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct image_dev *im = dev->private;
+	if (im->fd == -1)
+	{
+		return 0;
+	}
+	for (int i = 0, n; i < nblks; i += n)
+	{
+		for (n = 1; i + n < nblks && blks[i + n] == blks[i] + n; n++)
+			;
+		posix_fadvise(im->fd, (off_t)blks[i] * BLOCK_SIZE, (off_t)n * BLOCK_SIZE,
+					  POSIX_FADV_WILLNEED);
+	}
+	return nblks;
 }
 
 /**
@@ -170,29 +355,48 @@ static void image_close(struct blkdev *dev)
 	free(dev);
 }
 
+/**
+ * Get the image file descriptor, so data can be moved between the
+ * image and other files without copying it.
+ *
+ * @param dev: the block device
+ * @return: the file descriptor
+ */
+static int image_fd(struct blkdev *dev)
+{
+	struct image_dev *im = dev->private;
+	return im->fd;
+}
+
 /** Operations on this block device */
 static struct blkdev_ops image_ops = {
 	.num_blocks = image_num_blocks,
 	.read = image_read,
 	.write = image_write,
 	.flush = image_flush,
-	.close = image_close};
+	.close = image_close,
+	.readv = image_readv,
+	.writev = image_writev,
+	.prefetch = image_prefetch,
+	.fd = image_fd,
+	.sync = image_sync};
 
 /**
- * Create an image block device by reading from a specified image file.
+ * Open an image file and determine its size in blocks.
  *
  * @param path: the path to the image file
- * @return the block device or NULL if cannot open or read image file
+ * @return the image device state or NULL if cannot open or read image file
  */
-struct blkdev *image_create(char *path)
+static struct image_dev *image_open(char *path)
 {
-	struct blkdev *dev = malloc(sizeof(*dev));
 	struct image_dev *im = malloc(sizeof(*im));
 
-	if (dev == NULL || im == NULL)
+	if (im == NULL)
 		return NULL;
 
 	im->path = strdup(path); /* save a copy for error reporting */
+	im->map = NULL;
+	im->aio = NULL;
 
 	/* open image device */
 	im->fd = open(path, O_RDWR);
@@ -220,12 +424,710 @@ struct blkdev *image_create(char *path)
 				path, BLOCK_SIZE);
 	}
 	im->nblks = sb.st_size / BLOCK_SIZE;
+
+	return im;
+}
+
+/**
+ * Create an image block device by reading from a specified image file.
+ *
+ * @param path: the path to the image file
+ * @return the block device or NULL if cannot open or read image file
+ */
+struct blkdev *image_create(char *path)
+{
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct image_dev *im = image_open(path);
+
+	if (dev == NULL || im == NULL)
+		return NULL;
+
 	dev->private = im;
 	dev->ops = &image_ops;
 
 	return dev;
 }
 
+/**
+ * To read blocks from the mapped image starting at given block index
+ * @param dev: the block device
+ * @param first_blk: index of the block to start reading from
+ * @param nblks: number of blocks to read from the device
+ * @param buf: buffer to store the data
+ * @return: SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_mmap_read(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct image_dev *im = dev->private;
+
+	/* Check whether the disk is unavailable */
+	if (im->map == NULL)
+	{
+		return E_UNAVAIL;
+	}
+
+	assert(first_blk >= 0 && first_blk + nblks <= im->nblks);
+	memcpy(buf, im->map + (size_t)first_blk * BLOCK_SIZE, (size_t)nblks * BLOCK_SIZE);
+	return SUCCESS;
+}
+
+/**
+ * To write blocks to the mapped image starting at given block index.
+ * The data reaches the image file when the blocks are flushed.
+ * @param dev: the block device
+ * @param first_blk: index of the block to start writing to
+ * @param nblks: number of blocks to write to the device
+ * @param buf: buffer where data comes from
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_mmap_write(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct image_dev *im = dev->private;
+
+	/* Check whether the disk is unavailable */
+	if (im->map == NULL)
+	{
+		return E_UNAVAIL;
+	}
+
+	assert(first_blk >= 0 && first_blk + nblks <= im->nblks);
+	if (first_blk == 0)
+	{
+		printf("WARNING: writing to superblock (block 0)\n");
+	}
+
+	memcpy(im->map + (size_t)first_blk * BLOCK_SIZE, buf, (size_t)nblks * BLOCK_SIZE);
+	return SUCCESS;
+}
+
+/**
+ * Flush the mapped image by writing modified pages in the
+ * range back to the image file.
+ * @param dev: the block device
+ * @aparam first_blk: index of the block to start flushing
+ * @param nblks: number of blocks to flush
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_mmap_flush(struct blkdev *dev, int first_blk, int nblks)
+{
+	struct image_dev *im = dev->private;
+
+	/* Check whether the disk is unavailable */
+	if (im->map == NULL)
+	{
+		return E_UNAVAIL;
+	}
+
+	assert(first_blk >= 0 && first_blk + nblks <= im->nblks);
+
+	/* msync requires a page-aligned start address */
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t start = (size_t)first_blk * BLOCK_SIZE;
+	size_t end = (size_t)(first_blk + nblks) * BLOCK_SIZE;
+	start -= start % pagesz;
+	if (end > start && msync(im->map + start, end - start, MS_SYNC) < 0)
+	{
+		fprintf(stderr, "msync error on %s: %s\n", im->path, strerror(errno));
+		return E_UNAVAIL;
+	}
+	return SUCCESS;
+}
+
+/**
+ * Address of a block in the mapped image.
+ * @param dev: the block device
+ * @param blk: the block index
+ * @return address of the block, or NULL if device unavailable
+ */
+static void *image_mmap_map(struct blkdev *dev, int blk)
+{
+	struct image_dev *im = dev->private;
+
+	if (im->map == NULL)
+	{
+		return NULL;
+	}
+
+	assert(blk >= 0 && blk < im->nblks);
+	return im->map + (size_t)blk * BLOCK_SIZE;
+}
+
+/**
+ * Advise the kernel to start faulting in pages of mapped blocks.
+ * @param dev: the block device
+ * @param blks: the block numbers
+ * @param nblks: the number of blocks
+ * @return the number of blocks advised
+ */
+static int image_mmap_prefetch(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct image_dev *im = dev->private;
+	if (im->map == NULL)
+	{
+		return 0;
+	}
+
+	/* madvise requires a page-aligned start address */
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	for (int i = 0, n; i < nblks; i += n)
+	{
+		for (n = 1; i + n < nblks && blks[i + n] == blks[i] + n; n++)
+			;
+		size_t start = (size_t)blks[i] * BLOCK_SIZE;
+		size_t end = (size_t)(blks[i] + n) * BLOCK_SIZE;
+		start -= start % pagesz;
+		madvise(im->map + start, end - start, MADV_WILLNEED);
+	}
+	return nblks;
+}
+
+/**
+ * Close the mapped image, writing back all modified blocks.
+ * @param dev: the block device
+ */
+static void image_mmap_close(struct blkdev *dev)
+{
+	struct image_dev *im = dev->private;
+	if (im->map != NULL)
+	{
+		msync(im->map, (size_t)im->nblks * BLOCK_SIZE, MS_SYNC);
+		munmap(im->map, (size_t)im->nblks * BLOCK_SIZE);
+	}
+	close(im->fd);
+	free(im);
+	free(dev);
+}
+
+/** Operations on the memory-mapped block device */
+static struct blkdev_ops image_mmap_ops = {
+	.num_blocks = image_num_blocks,
+	.read = image_mmap_read,
+	.write = image_mmap_write,
+	.flush = image_mmap_flush,
+	.close = image_mmap_close,
+	.map = image_mmap_map,
+	.prefetch = image_mmap_prefetch,
+	.fd = image_fd,
+	.sync = image_sync};
+
+/**
+ * Create an image block device by memory-mapping a specified image file.
+ *
+ * @param path: the path to the image file
+ * @return the block device or NULL if cannot open or map image file
+ */
+struct blkdev *image_mmap_create(char *path)
+{
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct image_dev *im = image_open(path);
+
+	if (dev == NULL || im == NULL)
+		return NULL;
+
+	if (im->nblks == 0)
+	{
+		fprintf(stderr, "can't map empty image %s\n", path);
+		return NULL;
+	}
+
+	im->map = mmap(NULL, (size_t)im->nblks * BLOCK_SIZE, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, im->fd, 0);
+	if (im->map == MAP_FAILED)
+	{
+		fprintf(stderr, "can't map image %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	dev->private = im;
+	dev->ops = &image_mmap_ops;
+
+	return dev;
+}
+
+/** asynchronous I/O state of an image block device */
+struct image_aio
+{
+	pthread_mutex_t lock; // protects all fields
+	pthread_cond_t done;  // signalled when a request completes
+#ifdef HAVE_LIBURING
+	struct io_uring ring; // submission and completion rings
+	int depth;			  // ring size
+	int inflight;		  // requests submitted but not reaped
+#else
+	pthread_cond_t work;	// signalled when a request is queued
+	struct blkreq *head;	// queued requests
+	struct blkreq *tail;
+	int depth;				// number of I/O threads to start
+	int nthreads;			// number of I/O threads started
+	pthread_t *threads;		// the I/O threads
+	int stop;				// nonzero to stop I/O threads
+#endif
+};
+
+/**
+ * Record the result of a transfer in a request.
+ * @param im: the image
+ * @param req: the request
+ * @param result: bytes transferred, or -errno
+ */
+static void aio_finish(struct image_dev *im, struct blkreq *req, ssize_t result)
+{
+	if (result != (ssize_t)req->num_blks * BLOCK_SIZE)
+	{
+		fprintf(stderr, "%s %s on %s: %s\n", (result < 0) ? "async" : "short async",
+				req->write ? "write" : "read", im->path,
+				strerror((result < 0) ? (int)-result : errno));
+		req->status = E_UNAVAIL;
+	}
+	else
+	{
+		req->status = SUCCESS;
+	}
+	req->done = 1;
+}
+
+#ifdef HAVE_LIBURING
+
+/**
+ * Reap one completion from the ring. Called with the lock held.
+ * @param im: the image
+ */
+static void aio_reap(struct image_dev *im)
+{
+	struct image_aio *aio = im->aio;
+	struct io_uring_cqe *cqe;
+	int result = io_uring_wait_cqe(&aio->ring, &cqe);
+	if (result < 0)
+	{
+		fprintf(stderr, "io_uring wait error on %s: %s\n", im->path, strerror(-result));
+		assert(0);
+	}
+	struct blkreq *req = io_uring_cqe_get_data(cqe);
+	aio_finish(im, req, cqe->res);
+	io_uring_cqe_seen(&aio->ring, cqe);
+	aio->inflight--;
+}
+
+/**
+ * Start requests on the image by queueing them on the submission ring.
+ * @param dev: the block device
+ * @param reqs: the requests
+ * @param nreqs: number of requests
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_aio_submit(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct image_dev *im = dev->private;
+	struct image_aio *aio = im->aio;
+
+	/* Check whether the disk is unavailable */
+	if (im->fd == -1)
+	{
+		return E_UNAVAIL;
+	}
+
+	pthread_mutex_lock(&aio->lock);
+	for (int i = 0; i < nreqs; i++)
+	{
+		struct blkreq *req = &reqs[i];
+		assert(req->first_blk >= 0 && req->first_blk + req->num_blks <= im->nblks);
+		if (req->write && req->first_blk == 0)
+		{
+			printf("WARNING: writing to superblock (block 0)\n");
+		}
+		req->done = 0;
+
+		// make room on the ring
+		struct io_uring_sqe *sqe;
+		while (aio->inflight >= aio->depth || (sqe = io_uring_get_sqe(&aio->ring)) == NULL)
+		{
+			io_uring_submit(&aio->ring);
+			aio_reap(im);
+		}
+
+		off_t offset = (off_t)req->first_blk * BLOCK_SIZE;
+		unsigned len = req->num_blks * BLOCK_SIZE;
+		if (req->write)
+			io_uring_prep_write(sqe, im->fd, req->buf, len, offset);
+		else
+			io_uring_prep_read(sqe, im->fd, req->buf, len, offset);
+		io_uring_sqe_set_data(sqe, req);
+		aio->inflight++;
+	}
+	io_uring_submit(&aio->ring);
+	pthread_mutex_unlock(&aio->lock);
+	return SUCCESS;
+}
+
+/**
+ * Wait for requests to complete, reaping completions from the ring.
+ * @param dev: the block device
+ * @param reqs: the requests
+ * @param nreqs: number of requests
+ * @return SUCCESS if all requests succeeded, or the first error
+ */
+static int image_aio_complete(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct image_dev *im = dev->private;
+	struct image_aio *aio = im->aio;
+	int status = SUCCESS;
+
+	pthread_mutex_lock(&aio->lock);
+	for (int i = 0; i < nreqs; i++)
+	{
+		while (!reqs[i].done)
+		{
+			aio_reap(im);
+		}
+		if (status == SUCCESS)
+		{
+			status = reqs[i].status;
+		}
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return status;
+}
+
+/**
+ * Set up the submission and completion rings.
+ * @param im: the image
+ * @param depth: the maximum number of requests in flight
+ * @return SUCCESS if successful, E_UNAVAIL if io_uring unavailable
+ */
+static int aio_start(struct image_dev *im, int depth)
+{
+	struct image_aio *aio = im->aio;
+	int result = io_uring_queue_init(depth, &aio->ring, 0);
+	if (result < 0)
+	{
+		fprintf(stderr, "can't set up io_uring for %s: %s\n", im->path, strerror(-result));
+		return E_UNAVAIL;
+	}
+	aio->depth = depth;
+	aio->inflight = 0;
+	return SUCCESS;
+}
+
+/**
+ * Wait for requests in flight and tear down the rings.
+ * @param im: the image
+ */
+static void aio_stop(struct image_dev *im)
+{
+	struct image_aio *aio = im->aio;
+	while (aio->inflight > 0)
+	{
+		aio_reap(im);
+	}
+	io_uring_queue_exit(&aio->ring);
+}
+
+#else /* !HAVE_LIBURING */
+
+/**
+ * I/O thread: performs queued requests until stopped.
+ * @param arg: the image
+ * @return NULL
+ */
+static void *aio_thread(void *arg)
+{
+	struct image_dev *im = arg;
+	struct image_aio *aio = im->aio;
+
+	pthread_mutex_lock(&aio->lock);
+	while (1)
+	{
+		while (aio->head == NULL && !aio->stop)
+		{
+			pthread_cond_wait(&aio->work, &aio->lock);
+		}
+		if (aio->head == NULL)
+		{
+			break;
+		}
+		struct blkreq *req = aio->head;
+		aio->head = req->next;
+		if (aio->head == NULL)
+		{
+			aio->tail = NULL;
+		}
+		pthread_mutex_unlock(&aio->lock);
+
+		off_t offset = (off_t)req->first_blk * BLOCK_SIZE;
+		size_t len = (size_t)req->num_blks * BLOCK_SIZE;
+		ssize_t result = req->write ? pwrite(im->fd, req->buf, len, offset)
+									: pread(im->fd, req->buf, len, offset);
+		if (result < 0)
+		{
+			result = -errno;
+		}
+
+		pthread_mutex_lock(&aio->lock);
+		aio_finish(im, req, result);
+		pthread_cond_broadcast(&aio->done);
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return NULL;
+}
+
+/**
+ * Start the I/O threads. Called with aio->lock held on the first
+ * submit rather than when the device is created, because threads
+ * do not survive the fork when fuse_main daemonizes the process.
+ * @param im: the image
+ * @return SUCCESS if at least one thread started, E_UNAVAIL otherwise
+ */
+static int aio_spawn(struct image_dev *im)
+{
+	struct image_aio *aio = im->aio;
+	while (aio->nthreads < aio->depth)
+	{
+		if (pthread_create(&aio->threads[aio->nthreads], NULL, aio_thread, im) != 0)
+		{
+			break;
+		}
+		aio->nthreads++;
+	}
+	return (aio->nthreads > 0) ? SUCCESS : E_UNAVAIL;
+}
+
+/**
+ * Start requests on the image by queueing them for the I/O threads.
+ * @param dev: the block device
+ * @param reqs: the requests
+ * @param nreqs: number of requests
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_aio_submit(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct image_dev *im = dev->private;
+	struct image_aio *aio = im->aio;
+
+	/* Check whether the disk is unavailable */
+	if (im->fd == -1)
+	{
+		return E_UNAVAIL;
+	}
+
+	pthread_mutex_lock(&aio->lock);
+	if (aio->nthreads == 0 && aio_spawn(im) != SUCCESS)
+	{
+		pthread_mutex_unlock(&aio->lock);
+		return E_UNAVAIL;
+	}
+	for (int i = 0; i < nreqs; i++)
+	{
+		struct blkreq *req = &reqs[i];
+		assert(req->first_blk >= 0 && req->first_blk + req->num_blks <= im->nblks);
+		if (req->write && req->first_blk == 0)
+		{
+			printf("WARNING: writing to superblock (block 0)\n");
+		}
+		req->done = 0;
+		req->next = NULL;
+		if (aio->tail != NULL)
+			aio->tail->next = req;
+		else
+			aio->head = req;
+		aio->tail = req;
+	}
+	pthread_cond_broadcast(&aio->work);
+	pthread_mutex_unlock(&aio->lock);
+	return SUCCESS;
+}
+
+/**
+ * Wait for requests to complete.
+ * @param dev: the block device
+ * @param reqs: the requests
+ * @param nreqs: number of requests
+ * @return SUCCESS if all requests succeeded, or the first error
+ */
+static int image_aio_complete(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct image_dev *im = dev->private;
+	struct image_aio *aio = im->aio;
+	int status = SUCCESS;
+
+	pthread_mutex_lock(&aio->lock);
+	for (int i = 0; i < nreqs; i++)
+	{
+		while (!reqs[i].done)
+		{
+			pthread_cond_wait(&aio->done, &aio->lock);
+		}
+		if (status == SUCCESS)
+		{
+			status = reqs[i].status;
+		}
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return status;
+}
+
+/**
+ * Prepare the request queue. The I/O threads themselves are
+ * started by aio_spawn() on the first submit.
+ * @param im: the image
+ * @param depth: the number of I/O threads
+ * @return SUCCESS if successful, E_UNAVAIL if out of memory
+ */
+static int aio_start(struct image_dev *im, int depth)
+{
+	struct image_aio *aio = im->aio;
+	pthread_cond_init(&aio->work, NULL);
+	aio->head = aio->tail = NULL;
+	aio->stop = 0;
+	aio->depth = depth;
+	aio->nthreads = 0;
+	aio->threads = malloc(depth * sizeof(pthread_t));
+	return (aio->threads != NULL) ? SUCCESS : E_UNAVAIL;
+}
+
+/**
+ * Finish queued requests and stop the I/O threads.
+ * @param im: the image
+ */
+static void aio_stop(struct image_dev *im)
+{
+	struct image_aio *aio = im->aio;
+	pthread_mutex_lock(&aio->lock);
+	aio->stop = 1;
+	pthread_cond_broadcast(&aio->work);
+	pthread_mutex_unlock(&aio->lock);
+	for (int i = 0; i < aio->nthreads; i++)
+	{
+		pthread_join(aio->threads[i], NULL);
+	}
+	free(aio->threads);
+	pthread_cond_destroy(&aio->work);
+}
+
+#endif /* HAVE_LIBURING */
+
+/**
+ * Transfer a list of blocks with requests in flight at the same time.
+ * Entries for consecutive blocks in consecutive memory are combined
+ * into a single request.
+ * @param dev: the block device
+ * @param vec: the blocks and their buffers
+ * @param nvec: number of entries in vec
+ * @param write: true to write blocks, false to read them
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_aio_rwv(struct blkdev *dev, struct blkvec *vec, int nvec, int write)
+{
+	struct blkreq *reqs = malloc(nvec * sizeof(struct blkreq));
+	if (reqs == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	int nreqs = 0;
+	for (int i = 0; i < nvec;)
+	{
+		int n = 1;
+		while (i + n < nvec && vec[i + n].blk == vec[i].blk + n &&
+			   (char *)vec[i + n].buf == (char *)vec[i].buf + n * BLOCK_SIZE)
+		{
+			n++;
+		}
+		reqs[nreqs++] = (struct blkreq){.write = write, .first_blk = vec[i].blk,
+										.num_blks = n, .buf = vec[i].buf};
+		i += n;
+	}
+	int status = image_aio_submit(dev, reqs, nreqs);
+	if (status == SUCCESS)
+	{
+		status = image_aio_complete(dev, reqs, nreqs);
+	}
+	free(reqs);
+	return status;
+}
+
+/**
+ * To read a list of blocks with the reads in flight at the same time
+ * @param dev: the block device
+ * @param vec: the blocks and buffers to store the data
+ * @param nvec: number of entries in vec
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_aio_readv(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	return image_aio_rwv(dev, vec, nvec, 0);
+}
+
+/**
+ * To write a list of blocks with the writes in flight at the same time
+ * @param dev: the block device
+ * @param vec: the blocks and buffers where data comes from
+ * @param nvec: number of entries in vec
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_aio_writev(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	return image_aio_rwv(dev, vec, nvec, 1);
+}
+
+/**
+ * Close the asynchronous image after requests in flight finish.
+ * @param dev: the block device
+ */
+static void image_aio_close(struct blkdev *dev)
+{
+	struct image_dev *im = dev->private;
+	aio_stop(im);
+	pthread_cond_destroy(&im->aio->done);
+	pthread_mutex_destroy(&im->aio->lock);
+	free(im->aio);
+	close(im->fd);
+	free(im);
+	free(dev);
+}
+
+/** Operations on the asynchronous block device */
+static struct blkdev_ops image_aio_ops = {
+	.num_blocks = image_num_blocks,
+	.read = image_read,
+	.write = image_write,
+	.flush = image_flush,
+	.close = image_aio_close,
+	.readv = image_aio_readv,
+	.writev = image_aio_writev,
+	.submit = image_aio_submit,
+	.complete = image_aio_complete,
+	.prefetch = image_prefetch,
+	.fd = image_fd,
+	.sync = image_sync};
+
+/**
+ * Create an image block device that can have many requests in flight.
+ *
+ * @param path: the path to the image file
+ * @param depth: the maximum number of requests in flight
+ * @return the block device or NULL if cannot open image file
+ */
+struct blkdev *image_aio_create(char *path, int depth)
+{
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct image_dev *im = image_open(path);
+
+	if (dev == NULL || im == NULL || depth <= 0)
+		return NULL;
+
+	im->aio = malloc(sizeof(struct image_aio));
+	if (im->aio == NULL)
+		return NULL;
+	pthread_mutex_init(&im->aio->lock, NULL);
+	pthread_cond_init(&im->aio->done, NULL);
+	if (aio_start(im, depth) != SUCCESS)
+		return NULL;
+
+	dev->private = im;
+	dev->ops = &image_aio_ops;
+
+	return dev;
+}
+
 /**
  * Force an image blkdev into failure. After this any
  * further access to that device will return E_UNAVAIL.
@@ -234,6 +1136,11 @@ void image_fail(struct blkdev *dev)
 {
 	struct image_dev *im = dev->private;
 
+	if (im->map != NULL)
+	{
+		munmap(im->map, (size_t)im->nblks * BLOCK_SIZE);
+	}
+	im->map = NULL;
 	if (im->fd != -1)
 	{
 		close(im->fd);
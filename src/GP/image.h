@@ -20,4 +20,25 @@
 */
 extern struct blkdev *image_create(char *path);
 
+/*
+ * Create an image block device that memory-maps the specified image
+ * file. Blocks can be accessed in place through the map operation, and
+ * writes reach the image file when the device is flushed or closed.
+ *
+ * @param path: the path to the image file
+ * @return: the block device or NULL if cannot open or map image file
+*/
+extern struct blkdev *image_mmap_create(char *path);
+
+/*
+ * Create an image block device that can have many requests in flight.
+ * Requests are issued through io_uring when built with liburing, and
+ * otherwise through a pool of I/O threads.
+ *
+ * @param path: the path to the image file
+ * @param depth: the maximum number of requests in flight
+ * @return: the block device or NULL if cannot open image file
+*/
+extern struct blkdev *image_aio_create(char *path, int depth);
+
 #endif /* IMAGE_H_ */
@@ -0,0 +1,1182 @@
+/*
+ * file:        journal.c
+ * description: write-ahead metadata journal for CS492 block devices
+ *
+ * The journal is itself a block device which sits in front of another
+ * block device and logs metadata blocks to a region of it before they
+ * are written to their home locations. Only metadata is journaled:
+ * file data is written in place.
+ *
+ * Metadata written by a file system operation joins the running
+ * transaction. A background thread commits the running transaction
+ * once no operation is open in it, batching every operation that
+ * ended in the meantime into one sequential write of the log and a
+ * single flush of the lower device. Committed blocks are kept in
+ * memory, where reads find them, until the thread checkpoints the log
+ * by writing them home.
+ *
+ * Layout of the journal region: block 0 is the journal header, which
+ * holds the sequence number of the first transaction in the log, and
+ * the log starts at block 1. Each committed transaction is one or more
+ * descriptor blocks, each followed by the blocks it lists, then any
+ * revoke blocks, then a commit block with a checksum of the blocks of
+ * the transaction before it. A checkpoint empties the log by advancing
+ * the header's sequence number past the transactions in it.
+ *
+ * A block logged as metadata may later be freed and written in place
+ * as file data. The data write revokes the block: its logged copies
+ * are dropped, and the running transaction records the revoke so that
+ * replay does not write older copies over the data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "blkdev.h"
+#include "journal.h"
+
+/** magic numbers of journal blocks */
+enum {
+	JH_MAGIC = 0x4a483439, /* "JH49" journal header */
+	JD_MAGIC = 0x4a443439, /* "JD49" descriptor */
+	JR_MAGIC = 0x4a523439, /* "JR49" revoke */
+	JC_MAGIC = 0x4a433439  /* "JC49" commit */
+};
+
+/** number of blocks listed by a descriptor or revoke block */
+enum { JBLKS_PER_DESC = (BLOCK_SIZE - 3 * sizeof(uint32_t)) / sizeof(uint32_t) };
+
+/** journal header, descriptor and revoke blocks */
+struct jrec
+{
+	uint32_t magic;
+	uint32_t seq;	// transaction sequence number
+	uint32_t count; // number of blocks listed
+	uint32_t blks[JBLKS_PER_DESC];
+};
+
+/** commit block */
+struct jcommit
+{
+	uint32_t magic;
+	uint32_t seq;	// transaction sequence number
+	uint32_t nblks; // number of blocks of the transaction before this one
+	uint32_t sum;	// checksum of those blocks
+	char pad[BLOCK_SIZE - 4 * sizeof(uint32_t)];
+};
+
+/** longest time ended transactions wait for others to share their commit */
+enum { COMMIT_INTERVAL_MS = 5 };
+
+/** a metadata block not yet checkpointed */
+struct jblk
+{
+	int blk;			// block number
+	long id;			// distinguishes entries for the same block
+	bool running;		// modified by the running transaction
+	bool pending;		// taken by a commit not yet written
+	int run_idx;		// index in running transaction if running
+	char *data;			// latest contents
+	char *cdata;		// contents as last committed, if not yet checkpointed
+	struct jblk *hnext; // next entry in hash chain
+};
+
+/** definition of journal block device */
+struct journal_dev
+{
+	struct blkdev *lower;	// block device holding the journal
+	int first_blk;			// first block of journal region
+	int nblks;				// number of blocks in journal region
+	void (*prepare)(void);	// called before each commit
+	int nbuckets;			// number of hash buckets (power of 2)
+	struct jblk **hash;		// hash buckets
+	long next_id;			// id of next entry
+	long drops;				// number of times checkpointed entries were dropped
+	struct jblk **run;		// blocks of the running transaction
+	int nrun, run_cap;
+	int *rev;				// blocks revoked by the running transaction
+	int nrev, rev_cap;
+	int handles;			// open transactions
+	long ended;				// transactions ended since the last commit
+	bool committing;		// commit waiting for open transactions to end
+	bool commit_req;		// commit requested without waiting
+	long round;				// number of the running commit round
+	long done_round;		// last commit round durable
+	bool stop;				// commit thread should exit
+	pthread_t thread;		// commit thread
+	uint32_t seq;			// sequence number of next transaction logged
+	int pos;				// next free block of the log
+	struct journal_stats stats; // counters
+	pthread_mutex_t lock;	// protects all of the above except seq and pos,
+	pthread_cond_t cond;	// which belong to the commit thread
+	pthread_mutex_t ckpt_lock; // held while a checkpoint writes blocks home
+};
+
+static struct blkdev_ops journal_ops;
+
+/** depth of journal_begin calls of this thread */
+static __thread int handle_depth;
+
+/**
+ * Hash a block number into a bucket index.
+ * @param jd: the journal
+ * @param blk: the block number
+ * @return: the bucket index
+ */
+static int journal_hash(struct journal_dev *jd, int blk)
+{
+	return (int)(((unsigned)blk * 2654435761u) & (jd->nbuckets - 1));
+}
+
+/**
+ * Find the entry for a block.
+ * @param jd: the journal
+ * @param blk: the block number
+ * @return: the entry, or NULL if block has none
+ */
+static struct jblk *journal_find(struct journal_dev *jd, int blk)
+{
+	struct jblk *jb;
+	for (jb = jd->hash[journal_hash(jd, blk)]; jb != NULL; jb = jb->hnext)
+	{
+		if (jb->blk == blk)
+		{
+			return jb;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Remove an entry from the journal and free it.
+ */
+static void journal_drop(struct journal_dev *jd, struct jblk *jb)
+{
+	struct jblk **pp = &jd->hash[journal_hash(jd, jb->blk)];
+	while (*pp != jb)
+	{
+		pp = &(*pp)->hnext;
+	}
+	*pp = jb->hnext;
+	if (jb->running)
+	{
+		jd->run[jb->run_idx] = jd->run[--jd->nrun];
+		jd->run[jb->run_idx]->run_idx = jb->run_idx;
+	}
+	free(jb->data);
+	free(jb->cdata);
+	free(jb);
+}
+
+/**
+ * Checksum blocks of the log (32-bit FNV-1a).
+ * @param buf: the blocks
+ * @param nblks: the number of blocks
+ * @return: the checksum
+ */
+static uint32_t journal_sum(const void *buf, int nblks)
+{
+	const unsigned char *p = buf;
+	uint32_t h = 2166136261u;
+	for (long i = 0; i < (long)nblks * BLOCK_SIZE; i++)
+	{
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Write the journal header and flush it.
+ * @param jd: the journal
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_write_header(struct journal_dev *jd)
+{
+	struct jrec h = {.magic = JH_MAGIC, .seq = jd->seq};
+	int result = jd->lower->ops->write(jd->lower, jd->first_blk, 1, &h);
+	if (result == SUCCESS)
+	{
+		result = jd->lower->ops->flush(jd->lower, jd->first_blk, 1);
+	}
+	return result;
+}
+
+/**
+ * Order block vector entries by block number.
+ */
+static int cmp_vec_blk(const void *a, const void *b)
+{
+	const struct blkvec *x = a, *y = b;
+	return (x->blk > y->blk) - (x->blk < y->blk);
+}
+
+/**
+ * Write blocks to the lower device in block order.
+ * @param jd: the journal
+ * @param vec: the blocks and their buffers
+ * @param nvec: number of entries in vec
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int lower_writev(struct journal_dev *jd, struct blkvec *vec, int nvec)
+{
+	struct blkdev *lower = jd->lower;
+	qsort(vec, nvec, sizeof(*vec), cmp_vec_blk);
+	if (lower->ops->writev != NULL)
+	{
+		return lower->ops->writev(lower, vec, nvec);
+	}
+	for (int i = 0; i < nvec; i++)
+	{
+		int result = lower->ops->write(lower, vec[i].blk, 1, vec[i].buf);
+		if (result != SUCCESS)
+		{
+			return result;
+		}
+	}
+	return SUCCESS;
+}
+
+/**
+ * Checkpoint the journal: write every committed block home, flush the
+ * lower device, and empty the log. Blocks whose latest contents are
+ * now home are then dropped from memory. Called by the commit thread,
+ * or on close once it has exited.
+ * @param jd: the journal
+ */
+static void journal_checkpoint(struct journal_dev *jd)
+{
+	pthread_mutex_lock(&jd->ckpt_lock);
+	pthread_mutex_lock(&jd->lock);
+	int n = 0;
+	for (int i = 0; i < jd->nbuckets; i++)
+	{
+		for (struct jblk *jb = jd->hash[i]; jb != NULL; jb = jb->hnext)
+		{
+			n += (jb->cdata != NULL);
+		}
+	}
+	struct blkvec *vec = malloc((n + 1) * sizeof(*vec));
+	if (vec == NULL)
+	{
+		exit(1);
+	}
+	n = 0;
+	for (int i = 0; i < jd->nbuckets; i++)
+	{
+		for (struct jblk *jb = jd->hash[i]; jb != NULL; jb = jb->hnext)
+		{
+			if (jb->cdata != NULL)
+			{
+				vec[n].blk = jb->blk;
+				vec[n++].buf = jb->cdata;
+				jb->cdata = NULL;
+			}
+		}
+	}
+	pthread_mutex_unlock(&jd->lock);
+
+	int nblks = jd->lower->ops->num_blocks(jd->lower);
+	if ((n > 0 && lower_writev(jd, vec, n) != SUCCESS) ||
+		jd->lower->ops->flush(jd->lower, 0, nblks) != SUCCESS ||
+		journal_write_header(jd) != SUCCESS)
+	{
+		fprintf(stderr, "journal: cannot checkpoint\n");
+		exit(1);
+	}
+	jd->pos = 1;
+
+	pthread_mutex_lock(&jd->lock);
+	for (int i = 0; i < jd->nbuckets; i++)
+	{
+		struct jblk *jb = jd->hash[i];
+		while (jb != NULL)
+		{
+			struct jblk *next = jb->hnext;
+			if (!jb->running && !jb->pending && jb->cdata == NULL)
+			{
+				journal_drop(jd, jb);
+			}
+			jb = next;
+		}
+	}
+	jd->drops++;
+	jd->stats.checkpoints++;
+	pthread_mutex_unlock(&jd->lock);
+	pthread_mutex_unlock(&jd->ckpt_lock);
+
+	for (int i = 0; i < n; i++)
+	{
+		free(vec[i].buf);
+	}
+	free(vec);
+}
+
+/**
+ * Commit the running transaction. Waits for open transactions to end,
+ * lets the caller write back held metadata, and takes the blocks of
+ * the running transaction, which starts over. The blocks are written
+ * to the log with descriptors, revokes and a commit block in one write,
+ * and the log is flushed. A transaction too large for the log is
+ * written home directly once the log is checkpointed.
+ *
+ * Called with the journal lock held, which is released while waiting
+ * and writing.
+ * @param jd: the journal
+ */
+static void journal_commit(struct journal_dev *jd)
+{
+	jd->commit_req = false;
+	jd->committing = true;
+	while (jd->handles > 0)
+	{
+		pthread_cond_wait(&jd->cond, &jd->lock);
+	}
+	if (jd->prepare != NULL)
+	{
+		pthread_mutex_unlock(&jd->lock);
+		jd->prepare();
+		pthread_mutex_lock(&jd->lock);
+	}
+
+	// take the running transaction, copying its blocks behind descriptors
+	int n = jd->nrun, nrev = jd->nrev;
+	int ndesc = (n + JBLKS_PER_DESC - 1) / JBLKS_PER_DESC;
+	int nrevblk = (nrev + JBLKS_PER_DESC - 1) / JBLKS_PER_DESC;
+	int total = ndesc + n + nrevblk + 1;
+	char *log = calloc(total, BLOCK_SIZE);
+	struct
+	{
+		int blk; // block number
+		int at;	 // block of log holding its copy
+		long id; // its entry
+	} *snap = malloc((n + 1) * sizeof(*snap));
+	if (log == NULL || snap == NULL)
+	{
+		exit(1);
+	}
+	int p = 0;
+	struct jrec *r = NULL;
+	for (int i = 0; i < n; i++)
+	{
+		struct jblk *jb = jd->run[i];
+		if (i % JBLKS_PER_DESC == 0)
+		{
+			r = (struct jrec *)(log + p++ * BLOCK_SIZE);
+			r->magic = JD_MAGIC;
+			r->seq = jd->seq;
+		}
+		r->blks[r->count++] = jb->blk;
+		snap[i].blk = jb->blk;
+		snap[i].at = p;
+		snap[i].id = jb->id;
+		memcpy(log + p++ * BLOCK_SIZE, jb->data, BLOCK_SIZE);
+		jb->running = false;
+		jb->pending = true;
+	}
+	for (int i = 0; i < nrev; i++)
+	{
+		if (i % JBLKS_PER_DESC == 0)
+		{
+			r = (struct jrec *)(log + p++ * BLOCK_SIZE);
+			r->magic = JR_MAGIC;
+			r->seq = jd->seq;
+		}
+		r->blks[r->count++] = jd->rev[i];
+	}
+	long round = jd->round++;
+	jd->nrun = jd->nrev = 0;
+	jd->ended = 0;
+	jd->committing = false;
+	pthread_cond_broadcast(&jd->cond);
+	pthread_mutex_unlock(&jd->lock);
+
+	bool logged = true;
+	if (n + nrev > 0 && total > jd->nblks - 1)
+	{
+		// cannot fit: write home, after the log so it is not replayed over,
+		// skipping blocks revoked since they were taken
+		journal_checkpoint(jd);
+		pthread_mutex_lock(&jd->ckpt_lock);
+		pthread_mutex_lock(&jd->lock);
+		struct blkvec *vec = malloc((n + 1) * sizeof(*vec));
+		int nvec = 0;
+		for (int i = 0; vec != NULL && i < n; i++)
+		{
+			struct jblk *jb = journal_find(jd, snap[i].blk);
+			if (jb != NULL && jb->id == snap[i].id)
+			{
+				vec[nvec].blk = snap[i].blk;
+				vec[nvec++].buf = log + snap[i].at * BLOCK_SIZE;
+			}
+		}
+		pthread_mutex_unlock(&jd->lock);
+		if (vec == NULL || (nvec > 0 && lower_writev(jd, vec, nvec) != SUCCESS) ||
+			jd->lower->ops->flush(jd->lower, 0, jd->lower->ops->num_blocks(jd->lower)) != SUCCESS)
+		{
+			fprintf(stderr, "journal: cannot write transaction\n");
+			exit(1);
+		}
+		pthread_mutex_unlock(&jd->ckpt_lock);
+		free(vec);
+		logged = false;
+	}
+	else if (n + nrev > 0)
+	{
+		if (jd->pos + total > jd->nblks)
+		{
+			journal_checkpoint(jd);
+		}
+		struct jcommit *c = (struct jcommit *)(log + p * BLOCK_SIZE);
+		c->magic = JC_MAGIC;
+		c->seq = jd->seq;
+		c->nblks = p;
+		c->sum = journal_sum(log, p);
+		int first = jd->first_blk + jd->pos;
+		if (jd->lower->ops->write(jd->lower, first, total, log) != SUCCESS ||
+			jd->lower->ops->flush(jd->lower, first, total) != SUCCESS)
+		{
+			fprintf(stderr, "journal: cannot write log\n");
+			exit(1);
+		}
+		jd->pos += total;
+		jd->seq++;
+	}
+
+	// committed blocks are checkpointed from memory, unless revoked since
+	pthread_mutex_lock(&jd->lock);
+	for (int i = 0; i < n; i++)
+	{
+		struct jblk *jb = journal_find(jd, snap[i].blk);
+		if (jb == NULL || jb->id != snap[i].id)
+		{
+			continue;
+		}
+		jb->pending = false;
+		if (logged)
+		{
+			if (jb->cdata == NULL && (jb->cdata = malloc(BLOCK_SIZE)) == NULL)
+			{
+				exit(1);
+			}
+			memcpy(jb->cdata, log + snap[i].at * BLOCK_SIZE, BLOCK_SIZE);
+		}
+	}
+	if (n + nrev > 0)
+	{
+		jd->stats.commits++;
+		jd->stats.blocks += n;
+	}
+	jd->done_round = round;
+	pthread_cond_broadcast(&jd->cond);
+	free(log);
+	free(snap);
+
+	if (jd->pos > jd->nblks / 2)
+	{
+		pthread_mutex_unlock(&jd->lock);
+		journal_checkpoint(jd);
+		pthread_mutex_lock(&jd->lock);
+	}
+}
+
+/**
+ * Commit thread: commits the running transaction once transactions
+ * have ended and others have had a while to end too, or at once when
+ * a commit is requested.
+ * @param arg: the journal
+ */
+static void *journal_thread(void *arg)
+{
+	struct journal_dev *jd = arg;
+	pthread_mutex_lock(&jd->lock);
+	while (!jd->stop)
+	{
+		if (!jd->commit_req && jd->ended == 0 && jd->nrun == 0 && jd->nrev == 0)
+		{
+			pthread_cond_wait(&jd->cond, &jd->lock);
+			continue;
+		}
+		if (!jd->commit_req)
+		{
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += COMMIT_INTERVAL_MS * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+			deadline.tv_nsec %= 1000000000L;
+			while (!jd->commit_req && !jd->stop &&
+				   pthread_cond_timedwait(&jd->cond, &jd->lock, &deadline) != ETIMEDOUT)
+				;
+		}
+		if (!jd->stop)
+		{
+			journal_commit(jd);
+		}
+	}
+	pthread_mutex_unlock(&jd->lock);
+	return NULL;
+}
+
+/**
+ * Get the journal of a block device.
+ * @param dev: the block device
+ * @return: the journal, or NULL if dev is not a journaling device
+ */
+static struct journal_dev *journal_dev(struct blkdev *dev)
+{
+	return (dev != NULL && dev->ops == &journal_ops) ? dev->private : NULL;
+}
+
+/**
+ * Begin a transaction.
+ * @param dev: the block device
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+int journal_begin(struct blkdev *dev)
+{
+	struct journal_dev *jd = journal_dev(dev);
+	if (jd == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	if (handle_depth++ > 0)
+	{
+		return SUCCESS;
+	}
+	pthread_mutex_lock(&jd->lock);
+	while (jd->committing)
+	{
+		pthread_cond_wait(&jd->cond, &jd->lock);
+	}
+	jd->handles++;
+	pthread_mutex_unlock(&jd->lock);
+	return SUCCESS;
+}
+
+/**
+ * End a transaction. A commit is requested if the running transaction
+ * fills a quarter of the log.
+ * @param dev: the block device
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+int journal_end(struct blkdev *dev)
+{
+	struct journal_dev *jd = journal_dev(dev);
+	if (jd == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	if (--handle_depth > 0)
+	{
+		return SUCCESS;
+	}
+	pthread_mutex_lock(&jd->lock);
+	jd->handles--;
+	jd->stats.handles++;
+	if (jd->nrun >= jd->nblks / 4)
+	{
+		jd->commit_req = true;
+	}
+	if (jd->ended++ == 0 || jd->commit_req || (jd->committing && jd->handles == 0))
+	{
+		pthread_cond_broadcast(&jd->cond);
+	}
+	pthread_mutex_unlock(&jd->lock);
+	return SUCCESS;
+}
+
+/**
+ * Write a metadata block into the running transaction, cancelling a
+ * revoke of the block by it.
+ * @param dev: the block device
+ * @param blk: the block number
+ * @param buf: the block contents
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+int journal_write(struct blkdev *dev, int blk, const void *buf)
+{
+	struct journal_dev *jd = journal_dev(dev);
+	if (jd == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	pthread_mutex_lock(&jd->lock);
+	struct jblk *jb = journal_find(jd, blk);
+	if (jb == NULL)
+	{
+		if ((jb = calloc(1, sizeof(*jb))) == NULL || (jb->data = malloc(BLOCK_SIZE)) == NULL)
+		{
+			exit(1);
+		}
+		jb->blk = blk;
+		jb->id = jd->next_id++;
+		int h = journal_hash(jd, blk);
+		jb->hnext = jd->hash[h];
+		jd->hash[h] = jb;
+	}
+	memcpy(jb->data, buf, BLOCK_SIZE);
+	if (!jb->running)
+	{
+		if (jd->nrun == jd->run_cap)
+		{
+			jd->run_cap = jd->run_cap ? 2 * jd->run_cap : 64;
+			if ((jd->run = realloc(jd->run, jd->run_cap * sizeof(*jd->run))) == NULL)
+			{
+				exit(1);
+			}
+		}
+		jb->running = true;
+		jb->run_idx = jd->nrun;
+		jd->run[jd->nrun++] = jb;
+	}
+	for (int i = 0; i < jd->nrev; i++)
+	{
+		if (jd->rev[i] == blk)
+		{
+			jd->rev[i] = jd->rev[--jd->nrev];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&jd->lock);
+	return SUCCESS;
+}
+
+/** block i of a range, or of a vector if vec is not NULL */
+static int nth_blk(struct blkvec *vec, int first_blk, int i)
+{
+	return (vec != NULL) ? vec[i].blk : first_blk + i;
+}
+
+/**
+ * Revoke blocks about to be written as data. Their entries are
+ * dropped, after waiting for a checkpoint that might write them home
+ * over the data, and the running transaction records the revokes.
+ * @param jd: the journal
+ * @param vec: the blocks, or NULL for a range
+ * @param first_blk: the first block of the range
+ * @param nblks: the number of blocks
+ */
+static void journal_revoke(struct journal_dev *jd, struct blkvec *vec, int first_blk, int nblks)
+{
+	bool hit = false;
+	pthread_mutex_lock(&jd->lock);
+	for (int i = 0; i < nblks && !hit; i++)
+	{
+		hit = (journal_find(jd, nth_blk(vec, first_blk, i)) != NULL);
+	}
+	pthread_mutex_unlock(&jd->lock);
+	if (!hit)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&jd->ckpt_lock);
+	pthread_mutex_lock(&jd->lock);
+	for (int i = 0; i < nblks; i++)
+	{
+		int blk = nth_blk(vec, first_blk, i);
+		struct jblk *jb = journal_find(jd, blk);
+		if (jb == NULL)
+		{
+			continue;
+		}
+		journal_drop(jd, jb);
+		if (jd->nrev == jd->rev_cap)
+		{
+			jd->rev_cap = jd->rev_cap ? 2 * jd->rev_cap : 64;
+			if ((jd->rev = realloc(jd->rev, jd->rev_cap * sizeof(int))) == NULL)
+			{
+				exit(1);
+			}
+		}
+		jd->rev[jd->nrev++] = blk;
+		jd->stats.revokes++;
+	}
+	pthread_mutex_unlock(&jd->lock);
+	pthread_mutex_unlock(&jd->ckpt_lock);
+}
+
+/**
+ * Copy the latest metadata over blocks read from the lower device.
+ * The blocks are read again if a checkpoint dropped entries meanwhile,
+ * as the read may have missed blocks it wrote home.
+ * @param jd: the journal
+ * @param vec: the blocks and their buffers, or NULL for a range
+ * @param first_blk: the first block of the range
+ * @param nblks: the number of blocks
+ * @param buf: buffer for the range
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_read_blks(struct journal_dev *jd, struct blkvec *vec, int first_blk, int nblks, void *buf)
+{
+	struct blkdev *lower = jd->lower;
+	int result;
+	pthread_mutex_lock(&jd->lock);
+	long drops;
+	do
+	{
+		drops = jd->drops;
+		pthread_mutex_unlock(&jd->lock);
+		if (vec == NULL)
+		{
+			result = lower->ops->read(lower, first_blk, nblks, buf);
+		}
+		else if (lower->ops->readv != NULL)
+		{
+			result = lower->ops->readv(lower, vec, nblks);
+		}
+		else
+		{
+			result = SUCCESS;
+			for (int i = 0; i < nblks && result == SUCCESS; i++)
+			{
+				result = lower->ops->read(lower, vec[i].blk, 1, vec[i].buf);
+			}
+		}
+		pthread_mutex_lock(&jd->lock);
+	} while (result == SUCCESS && drops != jd->drops);
+
+	for (int i = 0; i < nblks && result == SUCCESS; i++)
+	{
+		struct jblk *jb = journal_find(jd, nth_blk(vec, first_blk, i));
+		if (jb != NULL)
+		{
+			memcpy(vec ? vec[i].buf : (char *)buf + i * BLOCK_SIZE, jb->data, BLOCK_SIZE);
+		}
+	}
+	pthread_mutex_unlock(&jd->lock);
+	return result;
+}
+
+/**
+ * To count the number of blocks on the device
+ * @param dev: the block device
+ * @return: the number of blocks in the lower block device
+ */
+static int journal_num_blocks(struct blkdev *dev)
+{
+	struct journal_dev *jd = dev->private;
+	return jd->lower->ops->num_blocks(jd->lower);
+}
+
+/**
+ * To read blocks, with the latest metadata written to the journal.
+ * @param dev: the block device
+ * @param first_blk: index of the block to start reading from
+ * @param nblks: number of blocks to read from the device
+ * @param buf: buffer to store the data
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_read(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	return journal_read_blks(dev->private, NULL, first_blk, nblks, buf);
+}
+
+/**
+ * To read a list of blocks, with the latest metadata written to the
+ * journal.
+ * @param dev: the block device
+ * @param vec: the blocks and their buffers
+ * @param nvec: number of entries in vec
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_readv(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	return journal_read_blks(dev->private, vec, 0, nvec, NULL);
+}
+
+/**
+ * To write data blocks in place, revoking any that were metadata.
+ * @param dev: the block device
+ * @param first_blk: index of the block to start writing to
+ * @param nblks: number of blocks to write
+ * @param buf: buffer holding the data
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_write_data(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct journal_dev *jd = dev->private;
+	journal_revoke(jd, NULL, first_blk, nblks);
+	return jd->lower->ops->write(jd->lower, first_blk, nblks, buf);
+}
+
+/**
+ * To write a list of data blocks in place, revoking any that were
+ * metadata.
+ * @param dev: the block device
+ * @param vec: the blocks and their buffers
+ * @param nvec: number of entries in vec
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_writev(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct journal_dev *jd = dev->private;
+	struct blkdev *lower = jd->lower;
+	journal_revoke(jd, vec, 0, nvec);
+	if (lower->ops->writev != NULL)
+	{
+		return lower->ops->writev(lower, vec, nvec);
+	}
+	for (int i = 0; i < nvec; i++)
+	{
+		int result = lower->ops->write(lower, vec[i].blk, 1, vec[i].buf);
+		if (result != SUCCESS)
+		{
+			return result;
+		}
+	}
+	return SUCCESS;
+}
+
+/**
+ * Commit every transaction ended so far, and wait until the commit is
+ * durable.
+ * @param jd: the journal
+ */
+static void journal_wait_commit(struct journal_dev *jd)
+{
+	pthread_mutex_lock(&jd->lock);
+	long round = jd->round;
+	jd->commit_req = true;
+	pthread_cond_broadcast(&jd->cond);
+	while (jd->done_round < round)
+	{
+		pthread_cond_wait(&jd->cond, &jd->lock);
+	}
+	pthread_mutex_unlock(&jd->lock);
+}
+
+/**
+ * Flush the block device. Commits every transaction ended so far and
+ * flushes the range of the lower device. Must not be called inside a
+ * transaction.
+ * @param dev: the block device
+ * @param first_blk: index of the block to start flushing
+ * @param nblks: number of blocks to flush
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int journal_flush(struct blkdev *dev, int first_blk, int nblks)
+{
+	struct journal_dev *jd = dev->private;
+	journal_wait_commit(jd);
+	return jd->lower->ops->flush(jd->lower, first_blk, nblks);
+}
+
+/**
+ * Make a list of data blocks durable, and then commit every
+ * transaction ended so far. The data is synced first, so a committed
+ * transaction does not map blocks whose data did not reach the disk.
+ * Metadata is made durable by the commit, not by listing it. Must not
+ * be called inside a transaction.
+ * @param dev: the block device
+ * @param blks: the block numbers, in increasing order
+ * @param nblks: the number of blocks
+ * @return SUCCESS if successful, or error from lower device
+ */
+static int journal_sync(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct journal_dev *jd = dev->private;
+	struct blkdev *lower = jd->lower;
+	int result = SUCCESS;
+	if (nblks > 0 && lower->ops->sync != NULL)
+	{
+		result = lower->ops->sync(lower, blks, nblks);
+	}
+	else if (nblks > 0)
+	{
+		result = lower->ops->flush(lower, 0, lower->ops->num_blocks(lower));
+	}
+	if (result == SUCCESS)
+	{
+		journal_wait_commit(jd);
+	}
+	return result;
+}
+
+/**
+ * Start reading blocks of the lower device ahead of their use.
+ * @param dev: the block device
+ * @param blks: the block numbers
+ * @param nblks: the number of blocks
+ * @return: the number of leading blocks accepted
+ */
+static int journal_prefetch(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct journal_dev *jd = dev->private;
+	struct blkdev *lower = jd->lower;
+	return (lower->ops->prefetch != NULL) ? lower->ops->prefetch(lower, blks, nblks) : 0;
+}
+
+/**
+ * Close the journal, committing and checkpointing it, and close the
+ * lower device.
+ * @param dev: the block device
+ */
+static void journal_close(struct blkdev *dev)
+{
+	struct journal_dev *jd = dev->private;
+	pthread_mutex_lock(&jd->lock);
+	jd->stop = true;
+	pthread_cond_broadcast(&jd->cond);
+	pthread_mutex_unlock(&jd->lock);
+	pthread_join(jd->thread, NULL);
+
+	pthread_mutex_lock(&jd->lock);
+	journal_commit(jd);
+	pthread_mutex_unlock(&jd->lock);
+	journal_checkpoint(jd);
+
+	jd->lower->ops->close(jd->lower);
+	for (int i = 0; i < jd->nbuckets; i++)
+	{
+		while (jd->hash[i] != NULL)
+		{
+			journal_drop(jd, jd->hash[i]);
+		}
+	}
+	pthread_mutex_destroy(&jd->lock);
+	pthread_mutex_destroy(&jd->ckpt_lock);
+	pthread_cond_destroy(&jd->cond);
+	free(jd->hash);
+	free(jd->run);
+	free(jd->rev);
+	free(jd);
+	free(dev);
+}
+
+/** Operations on this block device */
+static struct blkdev_ops journal_ops = {
+	.num_blocks = journal_num_blocks,
+	.read = journal_read,
+	.write = journal_write_data,
+	.flush = journal_flush,
+	.close = journal_close,
+	.readv = journal_readv,
+	.writev = journal_writev,
+	.prefetch = journal_prefetch,
+	.sync = journal_sync};
+
+/**
+ * Find the end of a committed transaction in the log.
+ * @param log: the journal region
+ * @param nblks: the number of blocks in the region
+ * @param pos: the block the transaction starts at
+ * @param seq: the sequence number it must have
+ * @param num_blocks: the number of blocks of the lower device
+ * @return: the block after its commit block, or -1 if there is no
+ *   complete transaction at pos
+ */
+static int journal_scan(const char *log, int nblks, int pos, uint32_t seq, int num_blocks)
+{
+	int p = pos;
+	while (p < nblks)
+	{
+		const struct jrec *r = (const struct jrec *)(log + p * BLOCK_SIZE);
+		if (r->seq != seq || (r->magic != JD_MAGIC && r->magic != JR_MAGIC))
+		{
+			break;
+		}
+		if (r->count > JBLKS_PER_DESC)
+		{
+			return -1;
+		}
+		for (uint32_t i = 0; i < r->count; i++)
+		{
+			if (r->blks[i] >= (uint32_t)num_blocks)
+			{
+				return -1;
+			}
+		}
+		p += 1 + (r->magic == JD_MAGIC ? r->count : 0);
+	}
+	if (p >= nblks)
+	{
+		return -1;
+	}
+	const struct jcommit *c = (const struct jcommit *)(log + p * BLOCK_SIZE);
+	if (c->magic != JC_MAGIC || c->seq != seq || c->nblks != (uint32_t)(p - pos) ||
+		c->sum != journal_sum(log + pos * BLOCK_SIZE, p - pos))
+	{
+		return -1;
+	}
+	return p + 1;
+}
+
+/**
+ * Replay the transactions committed in the log, or format the region
+ * if it holds no journal, and leave the log empty.
+ *
+ * Copies of a block are not replayed if a later transaction revoked it.
+ * @param jd: the journal
+ * @return: SUCCESS if successful, or error from lower device
+ */
+static int journal_replay(struct journal_dev *jd)
+{
+	struct blkdev *lower = jd->lower;
+	int num_blocks = lower->ops->num_blocks(lower);
+	char *log = malloc((size_t)jd->nblks * BLOCK_SIZE);
+	if (log == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	int result = lower->ops->read(lower, jd->first_blk, jd->nblks, log);
+	if (result != SUCCESS)
+	{
+		free(log);
+		return result;
+	}
+	const struct jrec *h = (const struct jrec *)log;
+	jd->seq = (h->magic == JH_MAGIC) ? h->seq : 1;
+
+	// find the committed transactions and the revokes in them
+	int end = 1;
+	uint32_t seq = jd->seq;
+	int nrev = 0;
+	struct { int blk; uint32_t seq; } *rev = NULL;
+	for (int next; h->magic == JH_MAGIC && (next = journal_scan(log, jd->nblks, end, seq, num_blocks)) > 0; seq++)
+	{
+		for (int p = end; p < next - 1; p++)
+		{
+			const struct jrec *r = (const struct jrec *)(log + p * BLOCK_SIZE);
+			if (r->magic == JR_MAGIC)
+			{
+				rev = realloc(rev, (nrev + r->count) * sizeof(*rev));
+				for (uint32_t i = 0; i < r->count; i++)
+				{
+					rev[nrev].blk = r->blks[i];
+					rev[nrev++].seq = seq;
+				}
+			}
+			else
+			{
+				p += r->count;
+			}
+		}
+		end = next;
+	}
+
+	// write the blocks home in order
+	seq = jd->seq;
+	for (int p = 1; p < end && result == SUCCESS; p++)
+	{
+		const struct jrec *r = (const struct jrec *)(log + p * BLOCK_SIZE);
+		if (r->magic == JC_MAGIC)
+		{
+			seq++;
+			continue;
+		}
+		if (r->magic != JD_MAGIC)
+		{
+			continue;
+		}
+		for (uint32_t i = 0; i < r->count && result == SUCCESS; i++)
+		{
+			bool revoked = false;
+			for (int k = 0; k < nrev && !revoked; k++)
+			{
+				revoked = (rev[k].blk == (int)r->blks[i] && rev[k].seq > seq);
+			}
+			if (!revoked)
+			{
+				result = lower->ops->write(lower, r->blks[i], 1, log + (p + 1 + i) * BLOCK_SIZE);
+			}
+		}
+		p += r->count;
+	}
+	free(rev);
+	free(log);
+
+	// empty the log
+	if (result == SUCCESS && end > 1)
+	{
+		fprintf(stderr, "journal: replayed %u transactions\n", seq - jd->seq);
+		result = lower->ops->flush(lower, 0, num_blocks);
+	}
+	jd->seq = seq;
+	jd->pos = 1;
+	return (result == SUCCESS) ? journal_write_header(jd) : result;
+}
+
+/**
+ * Create a journaling block device over a region of another device.
+ *
+ * @param lower: the block device holding the journal region
+ * @param first_blk: the first block of the journal region
+ * @param nblks: the number of blocks in the journal region
+ * @param prepare: function called before each commit, or NULL
+ * @return: the block device, or NULL if cannot read or format the journal
+ */
+struct blkdev *journal_create(struct blkdev *lower, int first_blk, int nblks,
+							  void (*prepare)(void))
+{
+	if (lower == NULL || nblks < 8 || first_blk <= 0 ||
+		first_blk + nblks > lower->ops->num_blocks(lower))
+	{
+		return NULL;
+	}
+
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct journal_dev *jd = calloc(1, sizeof(*jd));
+	if (dev == NULL || jd == NULL)
+	{
+		free(dev);
+		free(jd);
+		return NULL;
+	}
+
+	jd->lower = lower;
+	jd->first_blk = first_blk;
+	jd->nblks = nblks;
+	jd->prepare = prepare;
+	jd->done_round = -1;
+	for (jd->nbuckets = 1; jd->nbuckets < nblks; jd->nbuckets <<= 1)
+		;
+	jd->hash = calloc(jd->nbuckets, sizeof(struct jblk *));
+	if (jd->hash == NULL || journal_replay(jd) != SUCCESS)
+	{
+		free(jd->hash);
+		free(jd);
+		free(dev);
+		return NULL;
+	}
+
+	pthread_mutex_init(&jd->lock, NULL);
+	pthread_mutex_init(&jd->ckpt_lock, NULL);
+	pthread_cond_init(&jd->cond, NULL);
+	if (pthread_create(&jd->thread, NULL, journal_thread, jd) != 0)
+	{
+		free(jd->hash);
+		free(jd);
+		free(dev);
+		return NULL;
+	}
+
+	dev->private = jd;
+	dev->ops = &journal_ops;
+	return dev;
+}
+
+/**
+ * Get the counters of a journaling block device.
+ *
+ * @param dev: the block device
+ * @param stats: holder for the counters
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+int journal_stats(struct blkdev *dev, struct journal_stats *stats)
+{
+	struct journal_dev *jd = journal_dev(dev);
+	if (jd == NULL)
+	{
+		return E_UNAVAIL;
+	}
+	pthread_mutex_lock(&jd->lock);
+	*stats = jd->stats;
+	pthread_mutex_unlock(&jd->lock);
+	return SUCCESS;
+}
@@ -0,0 +1,85 @@
+/*
+ * file:        journal.h
+ * description: write-ahead metadata journal stacked on another block device
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "blkdev.h"
+
+/** journal counters */
+struct journal_stats {
+	long handles;	  /* transactions ended by journal_end */
+	long commits;	  /* group commits written to the journal */
+	long blocks;	  /* metadata blocks written to the journal */
+	long revokes;	  /* logged blocks later overwritten as data */
+	long checkpoints; /* times the journal was written back and emptied */
+};
+
+/*
+ * Create a journaling block device over a region of the lower device.
+ * Metadata blocks written with journal_write are collected into the
+ * running transaction, which is committed together with all the other
+ * transactions ended since the last commit: one sequential write to
+ * the journal region followed by one flush of the lower device. Blocks
+ * reach their home locations when a background thread checkpoints the
+ * journal. Reads see the latest metadata written. Plain writes are
+ * data, and go straight to the lower device.
+ *
+ * Transactions committed in the region are replayed first. A region
+ * that does not hold a journal is formatted as an empty one.
+ *
+ * Before each commit, once no transaction is open, prepare is called
+ * to write any metadata the caller holds back. Closing the journal
+ * commits and checkpoints it, and closes the lower device.
+ *
+ * @param lower: the block device holding the journal region
+ * @param first_blk: the first block of the journal region
+ * @param nblks: the number of blocks in the journal region
+ * @param prepare: function called before each commit, or NULL
+ * @return: the block device, or NULL if cannot read or format the journal
+ */
+extern struct blkdev *journal_create(struct blkdev *lower, int first_blk, int nblks,
+									 void (*prepare)(void));
+
+/*
+ * Begin a transaction. All metadata written until the matching
+ * journal_end is committed atomically. Transactions begun again by the
+ * same thread are part of the outer one. Waits while a commit is
+ * collecting the running transaction.
+ *
+ * @param dev: the block device
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+extern int journal_begin(struct blkdev *dev);
+
+/*
+ * End a transaction begun by journal_begin. The transaction is
+ * committed later, by the next group commit.
+ *
+ * @param dev: the block device
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+extern int journal_end(struct blkdev *dev);
+
+/*
+ * Write a metadata block into the running transaction.
+ *
+ * @param dev: the block device
+ * @param blk: the block number
+ * @param buf: the block contents
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+extern int journal_write(struct blkdev *dev, int blk, const void *buf);
+
+/*
+ * Get the counters of a journaling block device.
+ *
+ * @param dev: the block device
+ * @param stats: holder for the counters
+ * @return: SUCCESS, or E_UNAVAIL if dev is not a journaling device
+ */
+extern int journal_stats(struct blkdev *dev, struct journal_stats *stats);
+
+#endif /* JOURNAL_H_ */
@@ -24,7 +24,14 @@ struct stat sb;
 #include <limits.h>
 #include <sys/types.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include "image.h"
+#include "cache.h"
+#include "dcache.h"
+#include "journal.h"
+#include "opstats.h"
+#include "trace.h"
+#include "oprecord.h"
 
 #include "fsx492.h"		/* only for certain constants */
 
@@ -36,13 +43,39 @@ extern char *strdup(const char* str);
  * All functions accessed through operations structure. */
 extern struct fuse_operations fs_ops;
 
+/**
+ * Inode-based operations on the same file system. */
+extern struct fuse_lowlevel_ops fs_ll_ops;
+
+/** Directory entry cache counters from file system. */
+extern void fs_dcache_stats(struct dcache_stats *stats);
+
+/** File layout counters from file system. */
+extern void fs_layout(long *files, long *blocks, long *extents);
+
+/** fsync counters and latency from file system. */
+extern void fs_sync_stats(long *syncs, long *blocks, long *avg_us, long *p50_us, long *p99_us, long *max_us);
+
+/** Size of journal for file system to add to an image without one. */
+extern int fs_journal_blocks;
+
 /**  disk block device */
 struct blkdev *disk;
 
+/** buffer cache device, or NULL if none; the journal may stack above it */
+static struct blkdev *cache_dev;
+
 struct data {
 	char *image_name;
 	int   part;
 	int   cmd_mode;
+	int   cache_blocks;
+	int   mmap_mode;
+	int   aio_depth;
+	int   lowlevel;
+	int   journal_blocks;
+	char *trace_name;
+	char *record_name;
 } _data;
 
 /**
@@ -54,19 +87,40 @@ static void help(){
 	printf("Arguments:\n");
 	printf(" -cmdline : Enter an interactive REPL that provides a filesystem view into the image\n");
 	printf(" -image <name.img> : Use the provided image file that contains the filesystem\n");
+	printf(" -cache <blocks> : Keep up to <blocks> image blocks in a write-back buffer cache\n");
+	printf(" -mmap : Access the image file through a memory mapping\n");
+	printf(" -aio <depth> : Allow up to <depth> image requests in flight at once\n");
+	printf(" -lowlevel : Mount with the inode-based FUSE interface\n");
+	printf(" -journal <blocks> : Add a metadata journal of <blocks> blocks to an image without one\n");
+	printf(" -trace <file> : Record every block request to the image in a trace file\n");
+	printf(" -record <file> : Record every file system operation in <file>, for fsx492-replay\n");
 }
 
 /*
  * See comments in /usr/include/fuse/fuse_opts.h for details of
  * FUSE argument processing.
  *
- *  usage: ./fsx492 [-cmdline] -image test/fsx492.img <directory>
+ *  usage: ./fsx492 [-cmdline | -lowlevel] [-cache blocks] [-mmap | -aio depth] [-journal blocks] [-trace file] [-record file] -image test/fsx492.img <directory>
  *  		[-cmdline cmd]: optional; run the file system in cmdline mode
+ *  		[-cache blocks]: optional; size of buffer cache in blocks
+ *  		[-mmap]: optional; memory-map the image file
+ *  		[-aio depth]: optional; asynchronous image I/O with depth requests in flight
+ *  		[-lowlevel]: optional; mount with the inode-based FUSE interface
+ *  		[-journal blocks]: optional; add a metadata journal to the image
+ *  		[-trace file]: optional; record the block requests to the image in file
+ *  		[-record file]: optional; record the file system operations in file
  *              <directory> - directory to mount it on
  */
 static struct fuse_opt opts[] = {
 	{"-image %s", offsetof(struct data, image_name), 0},
 	{"-cmdline", offsetof(struct data, cmd_mode), 1},
+	{"-cache %d", offsetof(struct data, cache_blocks), 0},
+	{"-mmap", offsetof(struct data, mmap_mode), 1},
+	{"-aio %d", offsetof(struct data, aio_depth), 0},
+	{"-lowlevel", offsetof(struct data, lowlevel), 1},
+	{"-journal %d", offsetof(struct data, journal_blocks), 0},
+	{"-trace %s", offsetof(struct data, trace_name), 0},
+	{"-record %s", offsetof(struct data, record_name), 0},
 	FUSE_OPT_END
 };
 
@@ -266,17 +320,35 @@ static int do_pwd(char *argv[])
 	return 0;
 }
 
-static char lsbuf[DIRENTS_PER_BLK][MAX_PATH]; /** buffer to list directory entries */
+static char (*lsbuf)[MAX_PATH]; /** buffer to list directory entries */
 static int  lsi;  /* current ls index */
+static int  lslen;  /* number of entries in ls buffer */
 
 static void init_ls(void)
 {
 	lsi = 0;
 }
 
+/**
+ * Get the next entry of the ls buffer, growing the buffer
+ * for large directories.
+ */
+static char *next_ls(void)
+{
+	if (lsi == lslen) {
+		lslen = lslen ? 2 * lslen : DIRENTS_PER_BLK;
+		lsbuf = realloc(lsbuf, lslen * MAX_PATH);
+		if (lsbuf == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	return lsbuf[lsi++];
+}
+
 static int filler(void *buf, const char *name, const struct stat *sb, off_t off)
 {
-	sprintf(lsbuf[lsi++], "%s\n", name);
+	sprintf(next_ls(), "%s\n", name);
 	return 0;
 }
 
@@ -331,7 +403,7 @@ static int do_ls0(char *argv[])
 static int dashl_filler(void *buf, const char *name, const struct stat *sb, off_t off)
 {
 	char mode[16], time[26], *lasts;
-	sprintf(lsbuf[lsi++], "%5jd %s %2jd %4d %4d %8jd %s %s\n",
+	sprintf(next_ls(), "%5jd %s %2jd %4d %4d %8jd %s %s\n",
 			sb->st_blocks, strmode(mode, sb->st_mode),
 			sb->st_nlink, sb->st_uid, sb->st_gid, sb->st_size,
 			strtok_r(ctime_r(&sb->st_mtime,time),"\n",&lasts), name);
@@ -629,6 +701,138 @@ static int do_stat(char *argv[])
 	return retval;
 }
 
+/**
+ * Print the layout of files on disk
+ *
+ * @argv unused
+ */
+static int do_layout(char *argv[])
+{
+	long files, blocks, extents;
+	fs_layout(&files, &blocks, &extents);
+	printf("files: %ld\n", files);
+	printf("blocks: %ld\n", blocks);
+	printf("extents: %ld\n", extents);
+	printf("avg extent length: %.2f blocks\n", extents ? (double)blocks / extents : 0.0);
+	return 0;
+}
+
+/**
+ * Print buffer cache and directory entry cache counters
+ *
+ * @argv unused
+ */
+static int do_cachestat(char *argv[])
+{
+	struct cache_stats cs;
+	if (cache_dev == NULL || cache_stats(cache_dev, &cs) != SUCCESS) {
+		printf("buffer cache not enabled (use -cache <blocks>)\n");
+	} else {
+		long lookups = cs.hits + cs.misses;
+		printf("cache hits: %ld\n", cs.hits);
+		printf("cache misses: %ld\n", cs.misses);
+		printf("cache hit ratio: %.1f%%\n", lookups ? 100.0 * cs.hits / lookups : 0.0);
+		printf("cache evictions: %ld\n", cs.evictions);
+		printf("cache writebacks: %ld\n", cs.writebacks);
+		printf("read-ahead blocks: %ld\n", cs.ra_blocks);
+		printf("read-ahead hits: %ld (%.1f%%)\n", cs.ra_hits,
+			   cs.ra_blocks ? 100.0 * cs.ra_hits / cs.ra_blocks : 0.0);
+		printf("read-ahead unused: %ld\n", cs.ra_unused);
+	}
+
+	struct dcache_stats ds;
+	fs_dcache_stats(&ds);
+	long lookups = ds.hits + ds.neg_hits + ds.misses;
+	printf("dcache hits: %ld (%ld negative)\n", ds.hits + ds.neg_hits, ds.neg_hits);
+	printf("dcache misses: %ld\n", ds.misses);
+	printf("dcache hit ratio: %.1f%%\n", lookups ? 100.0 * (ds.hits + ds.neg_hits) / lookups : 0.0);
+	printf("dcache entries: %d of %d\n", ds.entries, ds.size);
+	return 0;
+}
+
+/**
+ * Print metadata journal counters
+ *
+ * @argv unused
+ */
+static int do_journalstat(char *argv[])
+{
+	struct journal_stats js;
+	if (journal_stats(disk, &js) != SUCCESS) {
+		printf("journal not enabled (use -journal <blocks>)\n");
+		return 0;
+	}
+	printf("transactions: %ld\n", js.handles);
+	printf("commits: %ld\n", js.commits);
+	printf("transactions per commit: %.1f\n", js.commits ? (double)js.handles / js.commits : 0.0);
+	printf("blocks logged: %ld\n", js.blocks);
+	printf("blocks revoked: %ld\n", js.revokes);
+	printf("checkpoints: %ld\n", js.checkpoints);
+	return 0;
+}
+
+/**
+ * Make a file or directory durable
+ *
+ * @param argv argv[0] is file or directory name
+ */
+static int do_sync(char *argv[])
+{
+	char path[MAX_PATH];
+	struct stat sb;
+	full_path(argv[0], path);
+	int status = fs_ops.getattr(path, &sb);
+	if (status != 0) {
+		return status;
+	}
+	return S_ISDIR(sb.st_mode) ? fs_ops.fsyncdir(path, 0, NULL) : fs_ops.fsync(path, 0, NULL);
+}
+
+/**
+ * Print fsync counters and latency
+ *
+ * @argv unused
+ */
+static int do_syncstat(char *argv[])
+{
+	long syncs, blocks, avg_us, p50_us, p99_us, max_us;
+	fs_sync_stats(&syncs, &blocks, &avg_us, &p50_us, &p99_us, &max_us);
+	printf("syncs: %ld\n", syncs);
+	printf("blocks per sync: %.1f\n", syncs ? (double)blocks / syncs : 0.0);
+	printf("avg latency: %ld us\n", avg_us);
+	printf("p50 latency: < %ld us\n", p50_us);
+	printf("p99 latency: < %ld us\n", p99_us);
+	printf("max latency: %ld us\n", max_us);
+	return 0;
+}
+
+/**
+ * Print per-operation counters
+ *
+ * @argv unused
+ */
+static int do_stats0(char *argv[])
+{
+	char *text = opstats_report();
+	fputs(text, stdout);
+	free(text);
+	return 0;
+}
+
+/**
+ * Reset per-operation counters
+ *
+ * @argv argv[0] must be "reset"
+ */
+static int do_stats1(char *argv[])
+{
+	if (strcmp(argv[0], "reset") != 0) {
+		return -EINVAL;
+	}
+	opstats_reset();
+	return 0;
+}
+
 /**
  * Set read/write block size
  *
@@ -722,6 +926,13 @@ static struct {
 	{"utime", 1, do_utime, "utime <file> - set modified time to current time"},
 	{"touch", 1, do_touch, "touch <file> - create file or set modified time to current time"},
 	{"stat", 1, do_stat, "stat <file> - print file info"},
+	{"layout", 0, do_layout, "layout - print average extent length of files"},
+	{"cachestat", 0, do_cachestat, "cachestat - print buffer and directory entry cache counters"},
+	{"journalstat", 0, do_journalstat, "journalstat - print metadata journal counters"},
+	{"sync", 1, do_sync, "sync <file> - write a file or directory durably to the image"},
+	{"syncstat", 0, do_syncstat, "syncstat - print fsync counters and latency"},
+	{"stats", 0, do_stats0, "stats - print calls, latency and block I/O of each operation"},
+	{"stats", 1, do_stats1, "stats reset - reset the operation counters"},
 	{0, 0, 0}
 };
 
@@ -813,6 +1024,42 @@ static void fixup(int argc, char *argv[]) {
 	}
 }
 
+/**
+ * Mount the file system with the low-level interface and serve
+ * requests until it is unmounted.
+ *
+ * @param args: the FUSE arguments
+ * @return: 0 if successful, 1 otherwise
+ */
+static int lowlevel_main(struct fuse_args *args)
+{
+	char *mountpoint;
+	int multithreaded, foreground;
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1)
+		return 1;
+
+	int status = 1;
+	struct fuse_chan *ch = fuse_mount(mountpoint, args);
+	if (ch != NULL) {
+		struct fuse_session *se = fuse_lowlevel_new(args, &fs_ll_ops, sizeof(fs_ll_ops), NULL);
+		if (se != NULL) {
+			if (fuse_set_signal_handlers(se) != -1) {
+				fuse_session_add_chan(se, ch);
+				if (fuse_daemonize(foreground) != -1) {
+					status = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+					status = (status == -1) ? 1 : 0;
+				}
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	return status;
+}
+
 int main(int argc, char **argv)
 {
 	fixup(argc, argv);
@@ -838,19 +1085,76 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if ((disk = image_create(file)) == NULL) {
+	if (_data.mmap_mode && _data.aio_depth > 0) {
+		fprintf(stderr, "-mmap and -aio cannot be used together\n");
+		help();
+		exit(1);
+	}
+	if (_data.mmap_mode) {
+		disk = image_mmap_create(file);
+	} else if (_data.aio_depth > 0) {
+		disk = image_aio_create(file, _data.aio_depth);
+	} else {
+		disk = image_create(file);
+	}
+	if (disk == NULL) {
 		fprintf(stderr, "cannot open image file '%s': %s\n", file, strerror(errno));
 		help();
 		exit(1);
 	}
 
+	if (_data.trace_name != NULL) {  /* record requests to the image */
+		struct blkdev *trace = trace_create(disk, _data.trace_name);
+		if (trace == NULL) {
+			fprintf(stderr, "cannot create trace file '%s': %s\n", _data.trace_name, strerror(errno));
+			exit(1);
+		}
+		disk = trace;
+	}
+
+	/* count the I/O reaching the image by operation */
+	if ((disk = opstats_create(disk)) == NULL) {
+		fprintf(stderr, "cannot read superblock of '%s'\n", file);
+		exit(1);
+	}
+	if (_data.record_name != NULL) {  /* record operations, inside the counters */
+		if (_data.lowlevel) {
+			fprintf(stderr, "-record needs the path-based interface, not -lowlevel\n");
+			exit(1);
+		}
+		if (oprecord_wrap(&fs_ops, _data.record_name) < 0) {
+			fprintf(stderr, "cannot create recording '%s': %s\n", _data.record_name, strerror(errno));
+			exit(1);
+		}
+	}
+	opstats_wrap(&fs_ops);
+
+	if (_data.cache_blocks > 0) {  /* stack buffer cache on image */
+		struct blkdev *cache = cache_create(disk, _data.cache_blocks);
+		if (cache == NULL) {
+			fprintf(stderr, "cannot create %d block cache\n", _data.cache_blocks);
+			exit(1);
+		}
+		disk = cache_dev = cache;
+	}
+
+	fs_journal_blocks = _data.journal_blocks;
+
+	int status = 0;
 	if (_data.cmd_mode) {  /* process interactive commands */
 		fs_ops.init(NULL);
 		_blksiz(FS_BLOCK_SIZE);
 		cmdloop();
-		return 0;
+		fs_ops.destroy(NULL);
+	} else if (_data.lowlevel) {
+		/** pass control to fuse, by inode */
+		status = lowlevel_main(&args);
+	} else {
+		/** pass control to fuse */
+		status = fuse_main(args.argc, args.argv, &fs_ops, NULL);
 	}
 
-	/** pass control to fuse */
-	return fuse_main(args.argc, args.argv, &fs_ops, NULL);
+	/* write back cached blocks and close image */
+	disk->ops->close(disk);
+	return status;
 }
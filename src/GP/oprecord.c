@@ -0,0 +1,380 @@
+/*
+ * file:        oprecord.c
+ * description: recording of file system operations for CS492, for replay
+ *
+ * oprecord_wrap replaces each file system operation with a wrapper
+ * that times it and, when it returns, appends a line describing it to
+ * the recording. Lines are formatted by the calling thread and written
+ * under a lock to a buffered stream, so the recording is in the order
+ * the operations returned; the replayer orders them by start time.
+ */
+
+#define FUSE_USE_VERSION 27
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fuse.h>
+
+#include "oprecord.h"
+
+const char *const oprecord_names[N_REC_OPS] = {
+	"getattr", "opendir", "readdir", "releasedir", "mknod", "mkdir", "unlink",
+	"rmdir", "rename", "chmod", "utime", "truncate", "open", "read", "write",
+	"write_buf", "fallocate", "flush", "release", "fsync", "fsyncdir", "statfs"};
+
+/** longest line: the fields, and two paths each escaped to twice its length */
+enum { MAX_LINE = 4 * 4096 + 256 };
+
+/** size of the buffer of the recording stream */
+enum { REC_BUF_SIZE = 1 << 20 };
+
+/** the operations recorded */
+static struct fuse_operations fs;
+
+/** the recording; lock serializes lines */
+static FILE *rec_fp;
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** when recording started */
+static struct timespec rec_start;
+
+/** number of the calling thread, from 1, and the last number given */
+static __thread int rec_tid;
+static int last_tid;
+
+/** timing of an operation */
+struct rec_timer
+{
+	struct timespec start; // when it started
+};
+
+static long ns_since(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+/**
+ * Escape a path for a recording.
+ *
+ * @param out: buffer for at least twice the length of path plus one
+ * @param path: the path
+ * @return: out
+ */
+static char *escape(char *out, const char *path)
+{
+	char *p = out;
+	for (; *path != '\0'; path++)
+	{
+		if (*path == '\t' || *path == '\n' || *path == '\\')
+		{
+			*p++ = '\\';
+			*p++ = *path == '\t' ? 't' : *path == '\n' ? 'n' : '\\';
+		}
+		else
+		{
+			*p++ = *path;
+		}
+	}
+	*p = '\0';
+	return out;
+}
+
+/** the handle in fuse file info, or all ones if none */
+static unsigned long long fh_of(const struct fuse_file_info *fi)
+{
+	return fi != NULL ? fi->fh : (uint64_t)-1;
+}
+
+static void rec_begin(struct rec_timer *t)
+{
+	clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/**
+ * End an operation started by rec_begin and record it.
+ *
+ * @param t: the timing
+ * @param op: the operation
+ * @param res: the result of the operation
+ * @param path: the path it was called with
+ * @param fmt: printf format of the arguments, each preceded by a tab
+ * @return: res
+ */
+static int rec_end(struct rec_timer *t, int op, int res, const char *path, const char *fmt, ...)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (rec_tid == 0)
+		rec_tid = __atomic_add_fetch(&last_tid, 1, __ATOMIC_RELAXED);
+
+	char line[MAX_LINE], epath[2 * 4096 + 1];
+	int len = snprintf(line, sizeof(line), "%ld\t%ld\t%d\t%s\t%d\t%s",
+					   ns_since(&rec_start, &t->start), ns_since(&t->start, &end),
+					   rec_tid, oprecord_names[op], res, escape(epath, path != NULL ? path : ""));
+	va_list args;
+	va_start(args, fmt);
+	len += vsnprintf(line + len, sizeof(line) - len - 1, fmt, args);
+	va_end(args);
+	line[len] = '\n';
+
+	pthread_mutex_lock(&rec_lock);
+	if (rec_fp != NULL)
+		fwrite(line, 1, len + 1, rec_fp);
+	pthread_mutex_unlock(&rec_lock);
+	return res;
+}
+
+/*
+ * Wrappers of the file system operations.
+ */
+
+static void rec_destroy(void *private_data)
+{
+	fs.destroy(private_data);
+	pthread_mutex_lock(&rec_lock);
+	if (fclose(rec_fp) != 0)
+		perror("cannot write recording");
+	rec_fp = NULL;
+	pthread_mutex_unlock(&rec_lock);
+}
+
+static int rec_getattr(const char *path, struct stat *sb)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_GETATTR, fs.getattr(path, sb), path, "");
+}
+
+static int rec_opendir(const char *path, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	int res = fs.opendir(path, fi);
+	return rec_end(&t, REC_OPENDIR, res, path, "\t%llu", fh_of(fi));
+}
+
+static int rec_readdir(const char *path, void *ptr, fuse_fill_dir_t filler, off_t offset,
+					   struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	int res = fs.readdir(path, ptr, filler, offset, fi);
+	return rec_end(&t, REC_READDIR, res, path, "\t%llu", fh_of(fi));
+}
+
+static int rec_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	unsigned long long fh = fh_of(fi);
+	rec_begin(&t);
+	return rec_end(&t, REC_RELEASEDIR, fs.releasedir(path, fi), path, "\t%llu", fh);
+}
+
+static int rec_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_MKNOD, fs.mknod(path, mode, dev), path, "\t%o\t%llu",
+				   (unsigned)mode, (unsigned long long)dev);
+}
+
+static int rec_mkdir(const char *path, mode_t mode)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_MKDIR, fs.mkdir(path, mode), path, "\t%o", (unsigned)mode);
+}
+
+static int rec_unlink(const char *path)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_UNLINK, fs.unlink(path), path, "");
+}
+
+static int rec_rmdir(const char *path)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_RMDIR, fs.rmdir(path), path, "");
+}
+
+static int rec_rename(const char *src_path, const char *dst_path)
+{
+	struct rec_timer t;
+	char edst[2 * 4096 + 1];
+	rec_begin(&t);
+	return rec_end(&t, REC_RENAME, fs.rename(src_path, dst_path), src_path, "\t%s",
+				   escape(edst, dst_path));
+}
+
+static int rec_chmod(const char *path, mode_t mode)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_CHMOD, fs.chmod(path, mode), path, "\t%o", (unsigned)mode);
+}
+
+static int rec_utime(const char *path, struct utimbuf *ut)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	int res = fs.utime(path, ut);
+	if (ut == NULL)
+		return rec_end(&t, REC_UTIME, res, path, "\t-");
+	return rec_end(&t, REC_UTIME, res, path, "\t%lld\t%lld",
+				   (long long)ut->actime, (long long)ut->modtime);
+}
+
+static int rec_truncate(const char *path, off_t len)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_TRUNCATE, fs.truncate(path, len), path, "\t%lld", (long long)len);
+}
+
+static int rec_open(const char *path, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	int res = fs.open(path, fi);
+	return rec_end(&t, REC_OPEN, res, path, "\t%d\t%llu", fi->flags, fh_of(fi));
+}
+
+static int rec_read(const char *path, char *buf, size_t len, off_t offset, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_READ, fs.read(path, buf, len, offset, fi), path, "\t%llu\t%lld\t%zu",
+				   fh_of(fi), (long long)offset, len);
+}
+
+static int rec_write(const char *path, const char *buf, size_t len, off_t offset,
+					 struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_WRITE, fs.write(path, buf, len, offset, fi), path, "\t%llu\t%lld\t%zu",
+				   fh_of(fi), (long long)offset, len);
+}
+
+static int rec_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+						 struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	size_t len = fuse_buf_size(buf);
+	rec_begin(&t);
+	return rec_end(&t, REC_WRITE_BUF, fs.write_buf(path, buf, offset, fi), path, "\t%llu\t%lld\t%zu",
+				   fh_of(fi), (long long)offset, len);
+}
+
+static int rec_fallocate(const char *path, int mode, off_t offset, off_t len,
+						 struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_FALLOCATE, fs.fallocate(path, mode, offset, len, fi), path,
+				   "\t%llu\t%d\t%lld\t%lld", fh_of(fi), mode,
+				   (long long)offset, (long long)len);
+}
+
+static int rec_flush(const char *path, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_FLUSH, fs.flush(path, fi), path, "\t%llu", fh_of(fi));
+}
+
+static int rec_release(const char *path, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	unsigned long long fh = fh_of(fi);
+	rec_begin(&t);
+	return rec_end(&t, REC_RELEASE, fs.release(path, fi), path, "\t%llu", fh);
+}
+
+static int rec_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_FSYNC, fs.fsync(path, datasync, fi), path, "\t%llu\t%d",
+				   fh_of(fi), datasync);
+}
+
+static int rec_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_FSYNCDIR, fs.fsyncdir(path, datasync, fi), path, "\t%llu\t%d",
+				   fh_of(fi), datasync);
+}
+
+static int rec_statfs(const char *path, struct statvfs *st)
+{
+	struct rec_timer t;
+	rec_begin(&t);
+	return rec_end(&t, REC_STATFS, fs.statfs(path, st), path, "");
+}
+
+int oprecord_wrap(struct fuse_operations *ops, const char *file)
+{
+	if ((rec_fp = fopen(file, "w")) == NULL)
+		return -1;
+	setvbuf(rec_fp, NULL, _IOFBF, REC_BUF_SIZE);
+	fprintf(rec_fp, "%s\n", OPRECORD_HEADER);
+	clock_gettime(CLOCK_MONOTONIC, &rec_start);
+
+	fs = *ops;
+	if (fs.destroy != NULL)
+		ops->destroy = rec_destroy;
+	if (fs.getattr != NULL)
+		ops->getattr = rec_getattr;
+	if (fs.opendir != NULL)
+		ops->opendir = rec_opendir;
+	if (fs.readdir != NULL)
+		ops->readdir = rec_readdir;
+	if (fs.releasedir != NULL)
+		ops->releasedir = rec_releasedir;
+	if (fs.mknod != NULL)
+		ops->mknod = rec_mknod;
+	if (fs.mkdir != NULL)
+		ops->mkdir = rec_mkdir;
+	if (fs.unlink != NULL)
+		ops->unlink = rec_unlink;
+	if (fs.rmdir != NULL)
+		ops->rmdir = rec_rmdir;
+	if (fs.rename != NULL)
+		ops->rename = rec_rename;
+	if (fs.chmod != NULL)
+		ops->chmod = rec_chmod;
+	if (fs.utime != NULL)
+		ops->utime = rec_utime;
+	if (fs.truncate != NULL)
+		ops->truncate = rec_truncate;
+	if (fs.open != NULL)
+		ops->open = rec_open;
+	if (fs.read != NULL)
+		ops->read = rec_read;
+	if (fs.write != NULL)
+		ops->write = rec_write;
+	if (fs.write_buf != NULL)
+		ops->write_buf = rec_write_buf;
+	if (fs.fallocate != NULL)
+		ops->fallocate = rec_fallocate;
+	if (fs.flush != NULL)
+		ops->flush = rec_flush;
+	if (fs.release != NULL)
+		ops->release = rec_release;
+	if (fs.fsync != NULL)
+		ops->fsync = rec_fsync;
+	if (fs.fsyncdir != NULL)
+		ops->fsyncdir = rec_fsyncdir;
+	if (fs.statfs != NULL)
+		ops->statfs = rec_statfs;
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * file:        oprecord.h
+ * description: recording of file system operations for CS492, for replay
+ *
+ * A recording is a text file: a header line, then one line per
+ * operation, written when it returns. The fields of a line are
+ * separated by tabs:
+ *
+ *   start_ns  duration_ns  thread  op  result  path  [args...]
+ *
+ * start_ns is from the start of the recording, thread numbers the
+ * calling threads from 1 in the order they first called, and tabs,
+ * newlines and backslashes in paths are escaped as \t, \n and \\.
+ * The arguments of each operation are:
+ *
+ *   getattr, unlink, rmdir, statfs   (none)
+ *   opendir, readdir, releasedir     fh
+ *   mknod                            mode dev
+ *   mkdir, chmod                     mode (octal)
+ *   rename                           new_path
+ *   utime                            atime mtime, or - for now
+ *   truncate                         length
+ *   open                             flags fh
+ *   read, write, write_buf           fh offset length
+ *   fallocate                        fh mode offset length
+ *   flush, release                   fh
+ *   fsync, fsyncdir                  fh datasync
+ *
+ * where fh is the handle the file system returned when the file or
+ * directory was opened. The data read and written is not recorded.
+ */
+
+#ifndef OPRECORD_H_
+#define OPRECORD_H_
+
+struct fuse_operations;
+
+/** first line of a recording */
+#define OPRECORD_HEADER "# fsx492 oprecord 1"
+
+/** recorded operations */
+enum rec_op
+{
+	REC_GETATTR,
+	REC_OPENDIR,
+	REC_READDIR,
+	REC_RELEASEDIR,
+	REC_MKNOD,
+	REC_MKDIR,
+	REC_UNLINK,
+	REC_RMDIR,
+	REC_RENAME,
+	REC_CHMOD,
+	REC_UTIME,
+	REC_TRUNCATE,
+	REC_OPEN,
+	REC_READ,
+	REC_WRITE,
+	REC_WRITE_BUF,
+	REC_FALLOCATE,
+	REC_FLUSH,
+	REC_RELEASE,
+	REC_FSYNC,
+	REC_FSYNCDIR,
+	REC_STATFS,
+	N_REC_OPS
+};
+
+/** names of the operations in a recording */
+extern const char *const oprecord_names[N_REC_OPS];
+
+/*
+ * Record the operations of a file system in a file, by wrapping them
+ * in place. The recording is written when the file system is
+ * destroyed. init and destroy are not recorded.
+ *
+ * @param ops: the operations to record
+ * @param file: the path of the recording, created or truncated
+ * @return: 0 if successful, -1 if cannot create the file
+ */
+extern int oprecord_wrap(struct fuse_operations *ops, const char *file);
+
+#endif /* OPRECORD_H_ */
@@ -0,0 +1,768 @@
+/*
+ * file:        opstats.c
+ * description: per-operation latency and block I/O counters for CS492
+ *
+ * opstats_wrap replaces each file system operation with a wrapper
+ * that records which operation the calling thread is running, times
+ * it and counts it. The block device made by opstats_create charges
+ * each block read or written to the thread's operation and to the
+ * region of the file system holding the block. Counters are updated
+ * with relaxed atomic adds, so the instrumentation takes no locks.
+ *
+ * The wrappers also serve OPSTATS_PATH, a read-only file holding the
+ * report of opstats_report, so the counters can be read on a mounted
+ * file system. It is not in the file system: the file system never
+ * sees operations on it.
+ */
+
+#define FUSE_USE_VERSION 27
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <fuse.h>
+
+#include "blkdev.h"
+#include "fsx492.h"
+#include "opstats.h"
+
+/** instrumented operations */
+enum op
+{
+	OP_BACKGROUND, // I/O outside any operation
+	OP_INIT,
+	OP_DESTROY,
+	OP_GETATTR,
+	OP_OPENDIR,
+	OP_READDIR,
+	OP_RELEASEDIR,
+	OP_MKNOD,
+	OP_MKDIR,
+	OP_UNLINK,
+	OP_RMDIR,
+	OP_RENAME,
+	OP_CHMOD,
+	OP_UTIME,
+	OP_TRUNCATE,
+	OP_OPEN,
+	OP_READ,
+	OP_WRITE,
+	OP_WRITE_BUF,
+	OP_FALLOCATE,
+	OP_FLUSH,
+	OP_RELEASE,
+	OP_FSYNC,
+	OP_FSYNCDIR,
+	OP_STATFS,
+	N_OPS
+};
+
+static const char *op_names[N_OPS] = {
+	"background", "init", "destroy", "getattr", "opendir", "readdir", "releasedir",
+	"mknod", "mkdir", "unlink", "rmdir", "rename", "chmod", "utime", "truncate",
+	"open", "read", "write", "write_buf", "fallocate", "flush", "release",
+	"fsync", "fsyncdir", "statfs"};
+
+/** regions of the file system that blocks are charged to */
+enum region
+{
+	R_SUPER,
+	R_BITMAP,
+	R_INODE,
+	R_JOURNAL,
+	R_DATA,
+	N_REGIONS
+};
+
+/** number of latency buckets: bucket i counts calls under 2^i us */
+enum { LAT_BUCKETS = 24 };
+
+/** counters of an operation */
+struct op_counts
+{
+	long calls;				 // calls
+	long errors;			 // calls returning an error
+	long total_ns;			 // total latency
+	long max_ns;			 // largest latency
+	long hist[LAT_BUCKETS];	 // latency histogram
+	long reads[N_REGIONS];	 // blocks read, by region
+	long writes[N_REGIONS];	 // blocks written, by region
+	long flushes;			 // flush and sync requests
+};
+
+/** counters, indexed by operation */
+static struct op_counts counts[N_OPS];
+
+/** operation the thread is running */
+static __thread int cur_op = OP_BACKGROUND;
+
+/** the operations instrumented */
+static struct fuse_operations fs;
+
+/** first block of each region after the superblock, from the superblock */
+static int inode_start, data_start, journal_start, journal_end;
+
+static void add(long *counter, long n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/** timing of an operation */
+struct op_timer
+{
+	int op;				   // the operation
+	int prev;			   // operation the thread was running before
+	struct timespec start; // when it started
+};
+
+/**
+ * Start an operation: charge the thread's I/O to it and time it.
+ *
+ * @param t: holder for the timing
+ * @param op: the operation
+ */
+static void op_begin(struct op_timer *t, int op)
+{
+	t->op = op;
+	t->prev = cur_op;
+	cur_op = op;
+	clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/**
+ * End an operation started by op_begin and count it.
+ *
+ * @param t: the timing
+ * @param res: the result of the operation
+ * @return: res
+ */
+static int op_end(struct op_timer *t, int res)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long ns = (end.tv_sec - t->start.tv_sec) * 1000000000L + (end.tv_nsec - t->start.tv_nsec);
+	struct op_counts *c = &counts[t->op];
+	add(&c->calls, 1);
+	if (res < 0)
+		add(&c->errors, 1);
+	add(&c->total_ns, ns);
+	long max = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&c->max_ns, &max, ns, true,
+													__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	int bucket = 0;
+	while (bucket < LAT_BUCKETS - 1 && ns >= (1000L << bucket))
+		bucket++;
+	add(&c->hist[bucket], 1);
+	cur_op = t->prev;
+	return res;
+}
+
+/*
+ * Report.
+ */
+
+/**
+ * Get a latency percentile: the upper bound of the histogram bucket
+ * holding it.
+ *
+ * @param c: the counters
+ * @param pct: the percentile
+ * @return: the bound in microseconds, or 0 if no calls
+ */
+static long percentile(const struct op_counts *c, int pct)
+{
+	long calls = 0, n = 0;
+	for (int i = 0; i < LAT_BUCKETS; i++)
+		calls += c->hist[i];
+	for (int i = 0; i < LAT_BUCKETS && calls > 0; i++)
+	{
+		n += c->hist[i];
+		if (n * 100 >= calls * pct)
+			return 1L << i;
+	}
+	return 0;
+}
+
+char *opstats_report(void)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&text, &len);
+	if (fp == NULL)
+		return strdup("");
+	fprintf(fp, "# latency percentiles are bucket bounds (p50_us<N: under N us)\n");
+	fprintf(fp, "# blocks by region: super/bitmap/inode/journal/data\n");
+	for (int op = 0; op < N_OPS; op++)
+	{
+		struct op_counts c;
+		long *src = (long *)&counts[op], *dst = (long *)&c;
+		for (size_t i = 0; i < sizeof(c) / sizeof(long); i++)
+			dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+		long blocks = 0;
+		for (int r = 0; r < N_REGIONS; r++)
+			blocks += c.reads[r] + c.writes[r];
+		if (c.calls == 0 && blocks == 0 && c.flushes == 0)
+			continue;
+		fprintf(fp, "%s calls=%ld errors=%ld", op_names[op], c.calls, c.errors);
+		if (c.calls > 0)
+			fprintf(fp, " avg_us=%.1f p50_us<%ld p99_us<%ld max_us=%.1f", c.total_ns / 1e3 / c.calls,
+					percentile(&c, 50), percentile(&c, 99), c.max_ns / 1e3);
+		fprintf(fp, " reads=%ld/%ld/%ld/%ld/%ld writes=%ld/%ld/%ld/%ld/%ld flushes=%ld\n",
+				c.reads[R_SUPER], c.reads[R_BITMAP], c.reads[R_INODE], c.reads[R_JOURNAL], c.reads[R_DATA],
+				c.writes[R_SUPER], c.writes[R_BITMAP], c.writes[R_INODE], c.writes[R_JOURNAL],
+				c.writes[R_DATA], c.flushes);
+	}
+	fclose(fp);
+	return text;
+}
+
+void opstats_io(long *reads, long *writes, long *flushes)
+{
+	*reads = *writes = *flushes = 0;
+	for (int op = 0; op < N_OPS; op++)
+	{
+		struct op_counts *c = &counts[op];
+		for (int r = 0; r < N_REGIONS; r++)
+		{
+			*reads += __atomic_load_n(&c->reads[r], __ATOMIC_RELAXED);
+			*writes += __atomic_load_n(&c->writes[r], __ATOMIC_RELAXED);
+		}
+		*flushes += __atomic_load_n(&c->flushes, __ATOMIC_RELAXED);
+	}
+}
+
+void opstats_reset(void)
+{
+	long *p = (long *)counts;
+	for (size_t i = 0; i < N_OPS * sizeof(struct op_counts) / sizeof(long); i++)
+		__atomic_store_n(&p[i], 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Counting block device.
+ */
+
+/** definition of counting block device */
+struct opstats_dev
+{
+	struct blkdev *lower;  // counted block device
+	struct blkdev_ops ops; // operations, those of lower that are optional
+};
+
+/**
+ * Find the regions of the file system from its superblock.
+ *
+ * @param sb: the superblock
+ */
+static void read_layout(const struct fs_super *sb)
+{
+	inode_start = 1 + sb->inode_map_sz + sb->block_map_sz;
+	data_start = inode_start + sb->inode_region_sz;
+	journal_start = sb->journal_start;
+	journal_end = sb->journal_start + sb->journal_len;
+}
+
+/**
+ * Get the region of the file system holding a block.
+ *
+ * @param blk: the block number
+ * @return: the region
+ */
+static int region_of(int blk)
+{
+	if (blk == 0)
+		return R_SUPER;
+	if (blk < inode_start)
+		return R_BITMAP;
+	if (blk < data_start)
+		return R_INODE;
+	if (blk >= journal_start && blk < journal_end)
+		return R_JOURNAL;
+	return R_DATA;
+}
+
+/**
+ * Charge blocks read or written to the thread's operation. A write of
+ * the superblock updates the regions, as when a journal is added.
+ *
+ * @param blk: the first block
+ * @param nblks: the number of consecutive blocks
+ * @param buf: the blocks written, or NULL for a read
+ */
+static void count_blks(int blk, int nblks, const void *buf)
+{
+	struct op_counts *c = &counts[cur_op];
+	for (int i = 0; i < nblks; i++)
+	{
+		int r = region_of(blk + i);
+		add(buf != NULL ? &c->writes[r] : &c->reads[r], 1);
+	}
+	if (buf != NULL && blk == 0 && ((const struct fs_super *)buf)->magic == FS_MAGIC)
+		read_layout(buf);
+}
+
+static int opstats_num_blocks(struct blkdev *dev)
+{
+	struct opstats_dev *od = dev->private;
+	return od->lower->ops->num_blocks(od->lower);
+}
+
+static int opstats_read(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct opstats_dev *od = dev->private;
+	count_blks(first_blk, nblks, NULL);
+	return od->lower->ops->read(od->lower, first_blk, nblks, buf);
+}
+
+static int opstats_write(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct opstats_dev *od = dev->private;
+	count_blks(first_blk, nblks, buf);
+	return od->lower->ops->write(od->lower, first_blk, nblks, buf);
+}
+
+static int opstats_flush(struct blkdev *dev, int first_blk, int nblks)
+{
+	struct opstats_dev *od = dev->private;
+	add(&counts[cur_op].flushes, 1);
+	return od->lower->ops->flush(od->lower, first_blk, nblks);
+}
+
+static void opstats_close(struct blkdev *dev)
+{
+	struct opstats_dev *od = dev->private;
+	od->lower->ops->close(od->lower);
+	free(od);
+	free(dev);
+}
+
+static void *opstats_map(struct blkdev *dev, int blk)
+{
+	struct opstats_dev *od = dev->private;
+	return od->lower->ops->map(od->lower, blk);
+}
+
+static int opstats_readv(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct opstats_dev *od = dev->private;
+	for (int i = 0; i < nvec; i++)
+		count_blks(vec[i].blk, 1, NULL);
+	return od->lower->ops->readv(od->lower, vec, nvec);
+}
+
+static int opstats_writev(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct opstats_dev *od = dev->private;
+	for (int i = 0; i < nvec; i++)
+		count_blks(vec[i].blk, 1, vec[i].buf);
+	return od->lower->ops->writev(od->lower, vec, nvec);
+}
+
+static int opstats_submit(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct opstats_dev *od = dev->private;
+	for (int i = 0; i < nreqs; i++)
+		count_blks(reqs[i].first_blk, reqs[i].num_blks, reqs[i].write ? reqs[i].buf : NULL);
+	return od->lower->ops->submit(od->lower, reqs, nreqs);
+}
+
+static int opstats_complete(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct opstats_dev *od = dev->private;
+	return od->lower->ops->complete(od->lower, reqs, nreqs);
+}
+
+static int opstats_prefetch(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct opstats_dev *od = dev->private;
+	return od->lower->ops->prefetch(od->lower, blks, nblks);
+}
+
+static int opstats_fd(struct blkdev *dev)
+{
+	struct opstats_dev *od = dev->private;
+	return od->lower->ops->fd(od->lower);
+}
+
+static int opstats_sync(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct opstats_dev *od = dev->private;
+	add(&counts[cur_op].flushes, 1);
+	return od->lower->ops->sync(od->lower, blks, nblks);
+}
+
+/** Operations on this block device */
+static const struct blkdev_ops opstats_ops = {
+	.num_blocks = opstats_num_blocks,
+	.read = opstats_read,
+	.write = opstats_write,
+	.flush = opstats_flush,
+	.close = opstats_close,
+	.map = opstats_map,
+	.readv = opstats_readv,
+	.writev = opstats_writev,
+	.submit = opstats_submit,
+	.complete = opstats_complete,
+	.prefetch = opstats_prefetch,
+	.fd = opstats_fd,
+	.sync = opstats_sync};
+
+/*
+ * Blocks that bypass the device are not counted: blocks read in place
+ * through map, and file data spliced to and from the image through fd.
+ */
+struct blkdev *opstats_create(struct blkdev *lower)
+{
+	char buf[BLOCK_SIZE];
+	if (lower == NULL || lower->ops->read(lower, 0, 1, buf) != SUCCESS)
+		return NULL;
+	read_layout((const struct fs_super *)buf);
+
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct opstats_dev *od = malloc(sizeof(*od));
+	if (dev == NULL || od == NULL)
+	{
+		free(dev);
+		free(od);
+		return NULL;
+	}
+	od->lower = lower;
+	od->ops = opstats_ops;
+	blkdev_mask_ops(lower->ops, &od->ops);
+	dev->ops = &od->ops;
+	dev->private = od;
+	return dev;
+}
+
+/*
+ * The counters file. An open of it takes a report, freed on release,
+ * whose address is the file handle.
+ */
+
+static bool is_stats(const char *path)
+{
+	return path != NULL && strcmp(path, OPSTATS_PATH) == 0;
+}
+
+static int stats_getattr(struct stat *sb)
+{
+	char *text = opstats_report();
+	memset(sb, 0, sizeof(*sb));
+	sb->st_mode = S_IFREG | 0444;
+	sb->st_nlink = 1;
+	sb->st_uid = getuid();
+	sb->st_gid = getgid();
+	sb->st_size = strlen(text);
+	sb->st_atime = sb->st_mtime = sb->st_ctime = time(NULL);
+	free(text);
+	return 0;
+}
+
+static int stats_open(struct fuse_file_info *fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+	fi->fh = (uint64_t)(uintptr_t)opstats_report();
+	fi->direct_io = 1; // size changes between getattr and read
+	return 0;
+}
+
+static int stats_read(char *buf, size_t len, off_t offset, struct fuse_file_info *fi)
+{
+	const char *text = (const char *)(uintptr_t)fi->fh;
+	size_t size = strlen(text);
+	if ((size_t)offset >= size)
+		return 0;
+	if (len > size - offset)
+		len = size - offset;
+	memcpy(buf, text + offset, len);
+	return len;
+}
+
+/*
+ * Wrappers of the file system operations.
+ */
+
+static void *st_init(struct fuse_conn_info *conn)
+{
+	struct op_timer t;
+	op_begin(&t, OP_INIT);
+	void *res = fs.init(conn);
+	op_end(&t, 0);
+	return res;
+}
+
+static void st_destroy(void *private_data)
+{
+	struct op_timer t;
+	op_begin(&t, OP_DESTROY);
+	fs.destroy(private_data);
+	op_end(&t, 0);
+}
+
+static int st_getattr(const char *path, struct stat *sb)
+{
+	if (is_stats(path))
+		return stats_getattr(sb);
+	struct op_timer t;
+	op_begin(&t, OP_GETATTR);
+	return op_end(&t, fs.getattr(path, sb));
+}
+
+static int st_opendir(const char *path, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return -ENOTDIR;
+	struct op_timer t;
+	op_begin(&t, OP_OPENDIR);
+	return op_end(&t, fs.opendir(path, fi));
+}
+
+static int st_readdir(const char *path, void *ptr, fuse_fill_dir_t filler, off_t offset,
+					  struct fuse_file_info *fi)
+{
+	struct op_timer t;
+	op_begin(&t, OP_READDIR);
+	int res = fs.readdir(path, ptr, filler, offset, fi);
+	if (res == 0 && strcmp(path, "/") == 0)
+	{
+		struct stat sb;
+		stats_getattr(&sb);
+		filler(ptr, OPSTATS_PATH + 1, &sb, 0);
+	}
+	return op_end(&t, res);
+}
+
+static int st_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	struct op_timer t;
+	op_begin(&t, OP_RELEASEDIR);
+	return op_end(&t, fs.releasedir(path, fi));
+}
+
+static int st_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	if (is_stats(path))
+		return -EEXIST;
+	struct op_timer t;
+	op_begin(&t, OP_MKNOD);
+	return op_end(&t, fs.mknod(path, mode, dev));
+}
+
+static int st_mkdir(const char *path, mode_t mode)
+{
+	if (is_stats(path))
+		return -EEXIST;
+	struct op_timer t;
+	op_begin(&t, OP_MKDIR);
+	return op_end(&t, fs.mkdir(path, mode));
+}
+
+static int st_unlink(const char *path)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_UNLINK);
+	return op_end(&t, fs.unlink(path));
+}
+
+static int st_rmdir(const char *path)
+{
+	if (is_stats(path))
+		return -ENOTDIR;
+	struct op_timer t;
+	op_begin(&t, OP_RMDIR);
+	return op_end(&t, fs.rmdir(path));
+}
+
+static int st_rename(const char *src_path, const char *dst_path)
+{
+	if (is_stats(src_path) || is_stats(dst_path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_RENAME);
+	return op_end(&t, fs.rename(src_path, dst_path));
+}
+
+static int st_chmod(const char *path, mode_t mode)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_CHMOD);
+	return op_end(&t, fs.chmod(path, mode));
+}
+
+static int st_utime(const char *path, struct utimbuf *ut)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_UTIME);
+	return op_end(&t, fs.utime(path, ut));
+}
+
+static int st_truncate(const char *path, off_t len)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_TRUNCATE);
+	return op_end(&t, fs.truncate(path, len));
+}
+
+static int st_open(const char *path, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return stats_open(fi);
+	struct op_timer t;
+	op_begin(&t, OP_OPEN);
+	return op_end(&t, fs.open(path, fi));
+}
+
+static int st_read(const char *path, char *buf, size_t len, off_t offset, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return stats_read(buf, len, offset, fi);
+	struct op_timer t;
+	op_begin(&t, OP_READ);
+	return op_end(&t, fs.read(path, buf, len, offset, fi));
+}
+
+static int st_write(const char *path, const char *buf, size_t len, off_t offset,
+					struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_WRITE);
+	return op_end(&t, fs.write(path, buf, len, offset, fi));
+}
+
+static int st_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+						struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_WRITE_BUF);
+	return op_end(&t, fs.write_buf(path, buf, offset, fi));
+}
+
+static int st_fallocate(const char *path, int mode, off_t offset, off_t len,
+						struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return -EACCES;
+	struct op_timer t;
+	op_begin(&t, OP_FALLOCATE);
+	return op_end(&t, fs.fallocate(path, mode, offset, len, fi));
+}
+
+static int st_flush(const char *path, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return 0;
+	struct op_timer t;
+	op_begin(&t, OP_FLUSH);
+	return op_end(&t, fs.flush(path, fi));
+}
+
+static int st_release(const char *path, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+	{
+		free((char *)(uintptr_t)fi->fh);
+		return 0;
+	}
+	struct op_timer t;
+	op_begin(&t, OP_RELEASE);
+	return op_end(&t, fs.release(path, fi));
+}
+
+static int st_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return 0;
+	struct op_timer t;
+	op_begin(&t, OP_FSYNC);
+	return op_end(&t, fs.fsync(path, datasync, fi));
+}
+
+static int st_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	if (is_stats(path))
+		return -ENOTDIR;
+	struct op_timer t;
+	op_begin(&t, OP_FSYNCDIR);
+	return op_end(&t, fs.fsyncdir(path, datasync, fi));
+}
+
+static int st_statfs(const char *path, struct statvfs *st)
+{
+	struct op_timer t;
+	op_begin(&t, OP_STATFS);
+	return op_end(&t, fs.statfs(path, st));
+}
+
+void opstats_wrap(struct fuse_operations *ops)
+{
+	fs = *ops;
+	if (fs.getattr != NULL)
+		ops->getattr = st_getattr;
+	if (fs.open != NULL)
+		ops->open = st_open;
+	if (fs.read != NULL)
+		ops->read = st_read;
+	if (fs.release != NULL)
+		ops->release = st_release;
+	if (fs.readdir != NULL)
+		ops->readdir = st_readdir;
+	if (fs.flush != NULL)
+		ops->flush = st_flush;
+	if (fs.fsync != NULL)
+		ops->fsync = st_fsync;
+	if (fs.init != NULL)
+		ops->init = st_init;
+	if (fs.destroy != NULL)
+		ops->destroy = st_destroy;
+	if (fs.opendir != NULL)
+		ops->opendir = st_opendir;
+	if (fs.releasedir != NULL)
+		ops->releasedir = st_releasedir;
+	if (fs.mknod != NULL)
+		ops->mknod = st_mknod;
+	if (fs.mkdir != NULL)
+		ops->mkdir = st_mkdir;
+	if (fs.unlink != NULL)
+		ops->unlink = st_unlink;
+	if (fs.rmdir != NULL)
+		ops->rmdir = st_rmdir;
+	if (fs.rename != NULL)
+		ops->rename = st_rename;
+	if (fs.chmod != NULL)
+		ops->chmod = st_chmod;
+	if (fs.utime != NULL)
+		ops->utime = st_utime;
+	if (fs.truncate != NULL)
+		ops->truncate = st_truncate;
+	if (fs.write != NULL)
+		ops->write = st_write;
+	if (fs.write_buf != NULL)
+		ops->write_buf = st_write_buf;
+	if (fs.fallocate != NULL)
+		ops->fallocate = st_fallocate;
+	if (fs.fsyncdir != NULL)
+		ops->fsyncdir = st_fsyncdir;
+	if (fs.statfs != NULL)
+		ops->statfs = st_statfs;
+}
@@ -0,0 +1,64 @@
+/*
+ * file:        opstats.h
+ * description: per-operation latency and block I/O counters for CS492
+ */
+
+#ifndef OPSTATS_H_
+#define OPSTATS_H_
+
+#include "blkdev.h"
+
+struct fuse_operations;
+
+/** path of the read-only file holding the counters */
+#define OPSTATS_PATH "/.fsx492_stats"
+
+/*
+ * Instrument the operations of a file system in place. Each operation
+ * is counted and timed, and the blocks read and written while it runs
+ * are charged to it. The operations also provide OPSTATS_PATH, a
+ * read-only file in the root directory whose contents are the
+ * counters as of when it is opened.
+ *
+ * @param ops: the operations to instrument
+ */
+extern void opstats_wrap(struct fuse_operations *ops);
+
+/*
+ * Create a block device that counts the blocks read from and written
+ * to the lower device, by the region of the file system that holds
+ * them (superblock, bitmaps, inodes, journal or data), and the flush
+ * and sync requests, and charges them to the instrumented operation
+ * the calling thread is running.
+ * I/O outside any operation, such as the journal's background commits,
+ * is charged to "background". Stack it directly on the image to count
+ * the I/O that reaches it. Closing the device closes the lower device.
+ *
+ * @param lower: the block device to count
+ * @return: the block device, or NULL if cannot read the superblock
+ */
+extern struct blkdev *opstats_create(struct blkdev *lower);
+
+/*
+ * Format the counters as text, one line per operation used.
+ *
+ * @return: the text, to be freed by the caller
+ */
+extern char *opstats_report(void);
+
+/*
+ * Get the totals over all operations of the blocks read and written
+ * and the flush and sync requests counted by the block device.
+ *
+ * @param reads: holder for the blocks read
+ * @param writes: holder for the blocks written
+ * @param flushes: holder for the flush and sync requests
+ */
+extern void opstats_io(long *reads, long *writes, long *flushes);
+
+/*
+ * Reset all counters to zero.
+ */
+extern void opstats_reset(void);
+
+#endif /* OPSTATS_H_ */
@@ -0,0 +1,677 @@
+/*
+ * file:        bench.c
+ * description: benchmark driver for CS492 file system
+ *
+ * Runs workloads directly against fs_ops, without mounting the file
+ * system, and prints one line of JSON per workload: operations per
+ * second, MB/s, latency percentiles, and the image blocks read and
+ * written per operation. Block I/O is counted by the opstats block
+ * device placed between the image and the buffer cache, so only I/O
+ * that reaches the image is counted; with -mmap, blocks read in place
+ * through the mapping are not counted.
+ *
+ * Each thread works in a directory of its own. Every workload first
+ * sets up what it needs (the file a read workload reads, the files
+ * stat looks up) untimed, then times its operations.
+ *
+ * usage: fsx492-bench [options] image.img [workload ...]
+ *   -t threads   threads running each workload (1)
+ *   -s bytes     size of each read or write (4096)
+ *   -f bytes     size of the file read and written (16 MiB)
+ *   -n count     operations of random, fsync and metadata workloads (1000)
+ *   -d depth     directories in the path of the deep workload (16)
+ *   -c blocks    buffer cache size, 0 for none (256); also -cache
+ *   -mmap        access the image through a memory mapping
+ *   -aio depth   allow up to depth image requests in flight at once
+ *   -j blocks    journal size to add to an image without one (0)
+ *   -r seed      random seed (1)
+ *   -T trace     record the blocks reaching the image in a trace file
+ *
+ * The image backend and cache options are those of fsx492, and each
+ * result names the backend, so runs with different backends can be
+ * compared.
+ *
+ * Workloads, all by default, in this order:
+ *   seqwrite randwrite seqread randread fsync create stat unlink deep bigdir
+ *
+ * The image is modified: run it on a copy.
+ */
+
+#define FUSE_USE_VERSION 27
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <fuse.h>
+
+#include "../fsx492.h"
+#include "../blkdev.h"
+#include "../image.h"
+#include "../cache.h"
+#include "../opstats.h"
+#include "../trace.h"
+
+/** block device used by fs.c */
+struct blkdev *disk;
+
+extern struct fuse_operations fs_ops;
+
+/** size of journal to add to an image without one */
+extern int fs_journal_blocks;
+
+/** benchmark parameters */
+static int nthreads = 1;
+static int io_size = 4096;
+static long file_size = 16L * 1024 * 1024;
+static int count = 1000;
+static int depth = 16;
+static int cache_blocks = 256;
+
+/** image backend: "image", "mmap" or "aio" */
+static const char *backend = "image";
+static int aio_depth;
+
+/** block I/O counted by the opstats device under the cache */
+struct io_counts
+{
+	long reads;	  // blocks read
+	long writes;  // blocks written
+	long flushes; // flush and sync requests
+};
+
+/*
+ * Workloads.
+ */
+
+/** state of a thread running a workload */
+struct worker
+{
+	int id;					// thread number
+	unsigned rnd;			// random state
+	char dir[32];			// directory of the thread
+	char *buf;				// io_size buffer
+	struct fuse_file_info fi; // open file, if any
+	bool open;				// whether fi is open
+	double *lat;			// latency of each operation, in microseconds
+	long nops;				// number of operations timed
+	long bytes;				// bytes read or written
+	struct timespec t0;		// start of the current operation
+};
+
+/**
+ * Stop with an error if a file system operation failed.
+ *
+ * @param what: the operation
+ * @param path: the path it was applied to
+ * @param res: its result
+ */
+static void check(const char *what, const char *path, int res)
+{
+	if (res < 0)
+	{
+		fprintf(stderr, "%s %s: %s\n", what, path, strerror(-res));
+		exit(1);
+	}
+}
+
+/** start timing an operation */
+static void op_start(struct worker *w)
+{
+	clock_gettime(CLOCK_MONOTONIC, &w->t0);
+}
+
+/** record the latency of the operation started by op_start */
+static void op_end(struct worker *w)
+{
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (w->nops % 1024 == 0)
+		w->lat = realloc(w->lat, (w->nops + 1024) * sizeof(double));
+	w->lat[w->nops++] = (t1.tv_sec - w->t0.tv_sec) * 1e6 + (t1.tv_nsec - w->t0.tv_nsec) / 1e3;
+}
+
+/** random offset of an io_size transfer within the file */
+static off_t random_offset(struct worker *w)
+{
+	long slots = file_size / io_size;
+	return (off_t)(rand_r(&w->rnd) % (slots > 0 ? slots : 1)) * io_size;
+}
+
+/** path of the thread's data file */
+static void file_path(struct worker *w, char *path)
+{
+	sprintf(path, "%s/file", w->dir);
+}
+
+/**
+ * Open the thread's data file, writing it first unless it already
+ * has file_size bytes.
+ */
+static void open_file(struct worker *w)
+{
+	char path[64];
+	struct stat sb;
+	file_path(w, path);
+	if (fs_ops.getattr(path, &sb) < 0)
+		check("mknod", path, fs_ops.mknod(path, 0100644, 0));
+	check("open", path, fs_ops.open(path, &w->fi));
+	w->open = true;
+	if (fs_ops.getattr(path, &sb) == 0 && sb.st_size == file_size)
+		return;
+	for (off_t off = 0; off < file_size; off += io_size)
+	{
+		int len = (file_size - off < io_size) ? file_size - off : io_size;
+		check("write", path, fs_ops.write(path, w->buf, len, off, &w->fi));
+	}
+}
+
+/** Create an empty data file, removing any earlier one */
+static void setup_seqwrite(struct worker *w)
+{
+	char path[64];
+	file_path(w, path);
+	fs_ops.unlink(path);
+	check("mknod", path, fs_ops.mknod(path, 0100644, 0));
+	check("open", path, fs_ops.open(path, &w->fi));
+	w->open = true;
+}
+
+/** Write the data file from start to end */
+static void run_seqwrite(struct worker *w)
+{
+	char path[64];
+	file_path(w, path);
+	for (off_t off = 0; off < file_size; off += io_size)
+	{
+		int len = (file_size - off < io_size) ? file_size - off : io_size;
+		op_start(w);
+		check("write", path, fs_ops.write(path, w->buf, len, off, &w->fi));
+		op_end(w);
+		w->bytes += len;
+	}
+}
+
+/** Read the data file from start to end */
+static void run_seqread(struct worker *w)
+{
+	char path[64];
+	file_path(w, path);
+	for (off_t off = 0; off < file_size; off += io_size)
+	{
+		op_start(w);
+		int res = fs_ops.read(path, w->buf, io_size, off, &w->fi);
+		op_end(w);
+		check("read", path, res);
+		w->bytes += res;
+	}
+}
+
+/** Write count blocks of io_size at random offsets of the data file */
+static void run_randwrite(struct worker *w)
+{
+	char path[64];
+	file_path(w, path);
+	for (int i = 0; i < count; i++)
+	{
+		off_t off = random_offset(w);
+		op_start(w);
+		check("write", path, fs_ops.write(path, w->buf, io_size, off, &w->fi));
+		op_end(w);
+		w->bytes += io_size;
+	}
+}
+
+/** Read count blocks of io_size at random offsets of the data file */
+static void run_randread(struct worker *w)
+{
+	char path[64];
+	file_path(w, path);
+	for (int i = 0; i < count; i++)
+	{
+		off_t off = random_offset(w);
+		op_start(w);
+		int res = fs_ops.read(path, w->buf, io_size, off, &w->fi);
+		op_end(w);
+		check("read", path, res);
+		w->bytes += res;
+	}
+}
+
+/** Write io_size at a random offset and sync the file, count times */
+static void run_fsync(struct worker *w)
+{
+	char path[64];
+	file_path(w, path);
+	for (int i = 0; i < count; i++)
+	{
+		off_t off = random_offset(w);
+		op_start(w);
+		check("write", path, fs_ops.write(path, w->buf, io_size, off, &w->fi));
+		check("fsync", path, fs_ops.fsync(path, 0, &w->fi));
+		op_end(w);
+		w->bytes += io_size;
+	}
+}
+
+/** path of the i'th file of the thread's directory of many files */
+static void many_path(struct worker *w, int i, char *path)
+{
+	sprintf(path, "%s/many/f%d", w->dir, i);
+}
+
+/** Make the directory of many files, removing any files in it */
+static void setup_create(struct worker *w)
+{
+	char path[64];
+	sprintf(path, "%s/many", w->dir);
+	fs_ops.mkdir(path, 040755);
+	for (int i = 0; i < count; i++)
+	{
+		many_path(w, i, path);
+		fs_ops.unlink(path);
+	}
+}
+
+/** Make the directory of many files and all its files */
+static void setup_many(struct worker *w)
+{
+	char path[64];
+	sprintf(path, "%s/many", w->dir);
+	fs_ops.mkdir(path, 040755);
+	for (int i = 0; i < count; i++)
+	{
+		many_path(w, i, path);
+		int res = fs_ops.mknod(path, 0100644, 0);
+		if (res != -EEXIST)
+			check("mknod", path, res);
+	}
+}
+
+/** Create count files in one directory */
+static void run_create(struct worker *w)
+{
+	char path[64];
+	for (int i = 0; i < count; i++)
+	{
+		many_path(w, i, path);
+		op_start(w);
+		check("mknod", path, fs_ops.mknod(path, 0100644, 0));
+		op_end(w);
+	}
+}
+
+/** Get the attributes of count random files of one directory */
+static void run_stat(struct worker *w)
+{
+	char path[64];
+	struct stat sb;
+	for (int i = 0; i < count; i++)
+	{
+		many_path(w, rand_r(&w->rnd) % count, path);
+		op_start(w);
+		check("getattr", path, fs_ops.getattr(path, &sb));
+		op_end(w);
+	}
+}
+
+/** Remove all the files of one directory */
+static void run_unlink(struct worker *w)
+{
+	char path[64];
+	for (int i = 0; i < count; i++)
+	{
+		many_path(w, i, path);
+		op_start(w);
+		check("unlink", path, fs_ops.unlink(path));
+		op_end(w);
+	}
+}
+
+/** path of the file at the bottom of the deep directory path */
+static void deep_path(struct worker *w, char *path)
+{
+	int len = sprintf(path, "%s", w->dir);
+	for (int i = 0; i < depth; i++)
+		len += sprintf(path + len, "/d%d", i);
+	strcpy(path + len, "/leaf");
+}
+
+/** Make the deep directory path and the file at its bottom */
+static void setup_deep(struct worker *w)
+{
+	char path[64 + 8 * depth];
+	int len = sprintf(path, "%s", w->dir);
+	for (int i = 0; i < depth; i++)
+	{
+		len += sprintf(path + len, "/d%d", i);
+		int res = fs_ops.mkdir(path, 040755);
+		if (res != -EEXIST)
+			check("mkdir", path, res);
+	}
+	deep_path(w, path);
+	int res = fs_ops.mknod(path, 0100644, 0);
+	if (res != -EEXIST)
+		check("mknod", path, res);
+}
+
+/** Get the attributes of the file at the bottom of the deep path count times */
+static void run_deep(struct worker *w)
+{
+	char path[64 + 8 * depth];
+	struct stat sb;
+	deep_path(w, path);
+	for (int i = 0; i < count; i++)
+	{
+		op_start(w);
+		check("getattr", path, fs_ops.getattr(path, &sb));
+		op_end(w);
+	}
+}
+
+/** number of entries of the big directory per lookup */
+enum { BIGDIR_FACTOR = 10 };
+
+/** Make the big directory, with BIGDIR_FACTOR * count entries */
+static void setup_bigdir(struct worker *w)
+{
+	char path[64];
+	sprintf(path, "%s/big", w->dir);
+	fs_ops.mkdir(path, 040755);
+	for (int i = 0; i < BIGDIR_FACTOR * count; i++)
+	{
+		sprintf(path, "%s/big/entry_%d", w->dir, i);
+		int res = fs_ops.mknod(path, 0100644, 0);
+		if (res != -EEXIST)
+			check("mknod", path, res);
+	}
+}
+
+/** Look up count random names in the big directory, half of them missing */
+static void run_bigdir(struct worker *w)
+{
+	char path[64];
+	struct stat sb;
+	for (int i = 0; i < count; i++)
+	{
+		int n = rand_r(&w->rnd) % (BIGDIR_FACTOR * count);
+		bool miss = rand_r(&w->rnd) % 2;
+		sprintf(path, "%s/big/%s_%d", w->dir, miss ? "missing" : "entry", n);
+		op_start(w);
+		int res = fs_ops.getattr(path, &sb);
+		op_end(w);
+		if (!(miss && res == -ENOENT))
+			check("getattr", path, res);
+	}
+}
+
+/** a workload: untimed setup and timed run of each thread */
+struct workload
+{
+	const char *name;
+	void (*setup)(struct worker *w);
+	void (*run)(struct worker *w);
+};
+
+static const struct workload workloads[] = {
+	{"seqwrite", setup_seqwrite, run_seqwrite},
+	{"randwrite", open_file, run_randwrite},
+	{"seqread", open_file, run_seqread},
+	{"randread", open_file, run_randread},
+	{"fsync", open_file, run_fsync},
+	{"create", setup_create, run_create},
+	{"stat", setup_many, run_stat},
+	{"unlink", setup_many, run_unlink},
+	{"deep", setup_deep, run_deep},
+	{"bigdir", setup_bigdir, run_bigdir},
+};
+
+enum { N_WORKLOADS = sizeof(workloads) / sizeof(workloads[0]) };
+
+/** barriers so all threads are set up before timing starts, and start together */
+static pthread_barrier_t setup_barrier, start_barrier;
+
+/** workload run by the threads */
+static const struct workload *current;
+
+/** thread body: set up, wait for the others, run */
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	if (current->setup != NULL)
+		current->setup(w);
+	pthread_barrier_wait(&setup_barrier);
+	pthread_barrier_wait(&start_barrier);
+	current->run(w);
+	return NULL;
+}
+
+/** Order latencies */
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Get a percentile of sorted latencies.
+ *
+ * @param lat: the latencies, in increasing order
+ * @param n: the number of latencies
+ * @param p: the percentile, 0 to 100
+ * @return the latency
+ */
+static double percentile(const double *lat, long n, double p)
+{
+	if (n == 0)
+		return 0;
+	long i = (long)(p / 100 * n);
+	return lat[i < n ? i : n - 1];
+}
+
+/**
+ * Run a workload on all threads and print its results.
+ *
+ * @param wl: the workload
+ * @param workers: the threads' state
+ */
+static void run_workload(const struct workload *wl, struct worker *workers)
+{
+	current = wl;
+	pthread_barrier_init(&setup_barrier, NULL, nthreads + 1);
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+	for (int i = 0; i < nthreads; i++)
+	{
+		workers[i].nops = workers[i].bytes = 0;
+		pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+	}
+
+	// time from when all threads are set up until the last finishes
+	pthread_barrier_wait(&setup_barrier);
+	struct timespec t0, t1;
+	struct io_counts before, after;
+	opstats_io(&before.reads, &before.writes, &before.flushes);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_barrier_wait(&start_barrier);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	opstats_io(&after.reads, &after.writes, &after.flushes);
+	free(threads);
+	pthread_barrier_destroy(&setup_barrier);
+	pthread_barrier_destroy(&start_barrier);
+
+	// gather latencies and close files
+	long nops = 0, bytes = 0;
+	for (int i = 0; i < nthreads; i++)
+	{
+		nops += workers[i].nops;
+		bytes += workers[i].bytes;
+	}
+	double *lat = malloc((nops + 1) * sizeof(double));
+	nops = 0;
+	for (int i = 0; i < nthreads; i++)
+	{
+		struct worker *w = &workers[i];
+		memcpy(lat + nops, w->lat, w->nops * sizeof(double));
+		nops += w->nops;
+		if (w->open)
+		{
+			char path[64];
+			file_path(w, path);
+			fs_ops.release(path, &w->fi);
+			w->open = false;
+		}
+	}
+	qsort(lat, nops, sizeof(double), cmp_double);
+
+	double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	double per_op = nops ? 1.0 / nops : 0;
+	printf("{\"workload\": \"%s\", \"backend\": \"%s\", \"aio_depth\": %d, \"cache_blocks\": %d, "
+		   "\"threads\": %d, \"ops\": %ld, \"secs\": %.6f, "
+		   "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+		   "\"lat_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+		   "\"blk_reads_per_op\": %.3f, \"blk_writes_per_op\": %.3f, \"flushes\": %ld}\n",
+		   wl->name, backend, aio_depth, cache_blocks, nthreads, nops, secs, secs > 0 ? nops / secs : 0.0,
+		   secs > 0 ? bytes / secs / (1024 * 1024) : 0.0,
+		   percentile(lat, nops, 50), percentile(lat, nops, 90), percentile(lat, nops, 99),
+		   nops ? lat[nops - 1] : 0.0,
+		   (after.reads - before.reads) * per_op, (after.writes - before.writes) * per_op,
+		   after.flushes - before.flushes);
+	fflush(stdout);
+	free(lat);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-s io_size] [-f file_size] [-n count] [-d depth]\n"
+					"       [-c cache_blocks] [-mmap | -aio depth] [-j journal_blocks] [-r seed] [-T trace]\n"
+					"       image.img [workload ...]\n"
+					"workloads:",
+			prog);
+	for (int i = 0; i < N_WORKLOADS; i++)
+		fprintf(stderr, " %s", workloads[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int seed = 1, opt;
+	char *tracefile = NULL;
+	bool mmap_mode = false;
+
+	// the backend and cache options are spelled as for fsx492
+	static const struct option long_opts[] = {
+		{"cache", required_argument, NULL, 'c'},
+		{"mmap", no_argument, NULL, 'm'},
+		{"aio", required_argument, NULL, 'a'},
+		{NULL, 0, NULL, 0}};
+	while ((opt = getopt_long_only(argc, argv, "t:s:f:n:d:c:ma:j:r:T:", long_opts, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 't': nthreads = atoi(optarg); break;
+		case 's': io_size = atoi(optarg); break;
+		case 'f': file_size = atol(optarg); break;
+		case 'n': count = atoi(optarg); break;
+		case 'd': depth = atoi(optarg); break;
+		case 'c': cache_blocks = atoi(optarg); break;
+		case 'm': mmap_mode = true; break;
+		case 'a': aio_depth = atoi(optarg); break;
+		case 'j': fs_journal_blocks = atoi(optarg); break;
+		case 'r': seed = atoi(optarg); break;
+		case 'T': tracefile = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind >= argc || nthreads < 1 || io_size < 1 || count < 1 || depth < 1)
+		usage(argv[0]);
+	if (mmap_mode && aio_depth > 0)
+		usage(argv[0]);
+	backend = mmap_mode ? "mmap" : (aio_depth > 0) ? "aio" : "image";
+
+	// select workloads before opening the image
+	const struct workload *selected[N_WORKLOADS];
+	int nselected = 0;
+	for (int i = optind + 1; i < argc; i++)
+	{
+		int j;
+		for (j = 0; j < N_WORKLOADS && strcmp(argv[i], workloads[j].name) != 0; j++)
+			;
+		if (j == N_WORKLOADS || nselected == N_WORKLOADS)
+			usage(argv[0]);
+		selected[nselected++] = &workloads[j];
+	}
+	if (nselected == 0)
+	{
+		for (int j = 0; j < N_WORKLOADS; j++)
+			selected[nselected++] = &workloads[j];
+	}
+
+	char *image = argv[optind];
+	if (mmap_mode)
+		disk = image_mmap_create(image);
+	else if (aio_depth > 0)
+		disk = image_aio_create(image, aio_depth);
+	else
+		disk = image_create(image);
+	if (disk == NULL)
+	{
+		fprintf(stderr, "cannot open image file '%s': %s\n", image, strerror(errno));
+		exit(1);
+	}
+	if (tracefile != NULL && (disk = trace_create(disk, tracefile)) == NULL)
+	{
+		fprintf(stderr, "cannot create trace file '%s': %s\n", tracefile, strerror(errno));
+		exit(1);
+	}
+	if ((disk = opstats_create(disk)) == NULL)
+	{
+		fprintf(stderr, "cannot read superblock of '%s'\n", image);
+		exit(1);
+	}
+	if (cache_blocks > 0 && (disk = cache_create(disk, cache_blocks)) == NULL)
+	{
+		fprintf(stderr, "cannot create %d block cache\n", cache_blocks);
+		exit(1);
+	}
+	fs_ops.init(NULL);
+
+	int res = fs_ops.mkdir("/bench", 040755);
+	if (res != -EEXIST)
+		check("mkdir", "/bench", res);
+	struct worker *workers = calloc(nthreads, sizeof(struct worker));
+	for (int i = 0; i < nthreads; i++)
+	{
+		struct worker *w = &workers[i];
+		w->id = i;
+		w->rnd = seed * 7919 + i;
+		sprintf(w->dir, "/bench/t%d", i);
+		res = fs_ops.mkdir(w->dir, 040755);
+		if (res != -EEXIST)
+			check("mkdir", w->dir, res);
+		w->buf = malloc(io_size);
+		for (int j = 0; j < io_size; j++)
+			w->buf[j] = (char)(i + j);
+	}
+
+	for (int i = 0; i < nselected; i++)
+		run_workload(selected[i], workers);
+
+	for (int i = 0; i < nthreads; i++)
+	{
+		free(workers[i].buf);
+		free(workers[i].lat);
+	}
+	free(workers);
+	fs_ops.destroy(NULL);
+	disk->ops->close(disk);
+	return 0;
+}
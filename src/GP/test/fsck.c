@@ -0,0 +1,789 @@
+/*
+ * file:        fsck.c
+ * description: checks and repairs a CS492 file system image
+ *
+ * Any journal is replayed first, as a mount would, and the inode map,
+ * block map and inode region are then read into memory in large
+ * sequential batches. The check runs in three passes:
+ *
+ *   1. directories: a pool of threads walks the directory tree from
+ *      the root, claiming each inode an entry refers to in a shared
+ *      atomic bitmap of reachable inodes. Entries that refer to free
+ *      or out of range inodes, or to an inode already claimed, are bad.
+ *   2. blocks: the threads walk the direct, indir_1 and indir_2 trees
+ *      of every reachable inode, claiming each block in a shared atomic
+ *      bitmap. A block claimed twice is a double allocation. Pointers
+ *      outside the data region, or past the end of a file that has no
+ *      preallocated blocks, are bad.
+ *   3. maps: the reachable inodes and the claimed blocks, with the
+ *      metadata and journal regions, are compared with the inode map
+ *      and block map on disk. Allocated inodes that are not reachable
+ *      are orphans; allocated blocks that are not claimed are leaks.
+ *
+ * With -y, problems are repaired: bad entries are cleared, bad
+ * pointers are zeroed, a doubly allocated block is copied to a free
+ * block for each of its owners but the first, orphan inodes are freed,
+ * and the maps are rewritten to match. With -n, the image is opened
+ * read-only and the journal is not replayed.
+ *
+ * usage: fsck.fsx492 [-n | -y] [-t threads] [-v] image.img
+ *   -n           check only, without writing the image
+ *   -y           repair the problems found
+ *   -t threads   worker threads (number of processors)
+ *   -v           report every problem and the time of each pass
+ *
+ * Exit status: 0 if no problems, 1 if all problems were repaired,
+ * 4 if problems remain, 8 if the image could not be checked.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../fsx492.h"
+#include "../blkdev.h"
+#include "../image.h"
+#include "../journal.h"
+
+/** exit status */
+enum { FSCK_OK = 0, FSCK_REPAIRED = 1, FSCK_UNREPAIRED = 4, FSCK_ERROR = 8 };
+
+/** blocks read or written at once */
+enum { BATCH_BLKS = 1024 };
+
+/** problems reported without -v */
+enum { MAX_REPORTED = 50 };
+
+/** inodes checked at a time by a thread in pass 2 */
+enum { INODE_CHUNK = 1024 };
+
+/** options */
+static int repair, readonly, verbose, nthreads;
+
+/** the image */
+static int fd;
+static struct fs_super sb;
+static uint32_t n_inodes, n_blocks, inode_base, data_start, jnl_start, jnl_end;
+
+/** the maps and inode region, as on disk and as repaired */
+static uint8_t *inode_map, *block_map;
+static struct fs_inode *inodes;
+
+/** bitmaps shared by the threads: reachable inodes, claimed and doubly claimed blocks */
+static uint64_t *seen_ino, *seen_blk, *dup_blk;
+
+/** inode blocks changed by repairs, one byte each */
+static uint8_t *inode_blk_dirty;
+
+/** problems found and repaired */
+static long problems, repaired;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Utilities.
+ */
+
+static bool test_bit(const void *map, uint32_t i)
+{
+	return (((const uint8_t *)map)[i / 8] >> (i % 8)) & 1;
+}
+
+static void set_bit(void *map, uint32_t i, bool on)
+{
+	if (on)
+		((uint8_t *)map)[i / 8] |= 1 << (i % 8);
+	else
+		((uint8_t *)map)[i / 8] &= ~(1 << (i % 8));
+}
+
+/**
+ * Set a bit of a shared bitmap.
+ *
+ * @param map: the bitmap
+ * @param i: the bit
+ * @return: true if the bit was already set
+ */
+static bool claim(uint64_t *map, uint32_t i)
+{
+	uint64_t mask = 1ULL << (i % 64);
+	return __atomic_fetch_or(&map[i / 64], mask, __ATOMIC_RELAXED) & mask;
+}
+
+static bool claimed(const uint64_t *map, uint32_t i)
+{
+	return (__atomic_load_n(&map[i / 64], __ATOMIC_RELAXED) >> (i % 64)) & 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Report a problem.
+ *
+ * @param fixed: true if it was repaired
+ * @param fmt: printf format of the description
+ */
+static void problem(bool fixed, const char *fmt, ...)
+{
+	pthread_mutex_lock(&report_lock);
+	if (verbose || problems < MAX_REPORTED)
+	{
+		va_list args;
+		va_start(args, fmt);
+		vprintf(fmt, args);
+		va_end(args);
+		printf(fixed ? " (repaired)\n" : "\n");
+	}
+	else if (problems == MAX_REPORTED)
+	{
+		printf("more problems not listed; use -v to list them all\n");
+	}
+	problems++;
+	if (fixed)
+		repaired++;
+	pthread_mutex_unlock(&report_lock);
+}
+
+/**
+ * Read blocks of the image in batches, exiting if cannot.
+ *
+ * @param blk: the first block
+ * @param nblks: the number of blocks
+ * @param buf: buffer for the blocks
+ */
+static void read_blks(uint32_t blk, uint32_t nblks, void *buf)
+{
+	for (uint32_t i = 0; i < nblks; i += BATCH_BLKS)
+	{
+		size_t len = (size_t)(nblks - i < BATCH_BLKS ? nblks - i : BATCH_BLKS) * FS_BLOCK_SIZE;
+		if (pread(fd, (char *)buf + (size_t)i * FS_BLOCK_SIZE, len,
+				  (off_t)(blk + i) * FS_BLOCK_SIZE) != (ssize_t)len)
+		{
+			fprintf(stderr, "cannot read block %u: %s\n", blk + i, strerror(errno));
+			exit(FSCK_ERROR);
+		}
+	}
+}
+
+/**
+ * Write blocks of the image in batches, exiting if cannot.
+ *
+ * @param blk: the first block
+ * @param nblks: the number of blocks
+ * @param buf: the blocks
+ */
+static void write_blks(uint32_t blk, uint32_t nblks, const void *buf)
+{
+	for (uint32_t i = 0; i < nblks; i += BATCH_BLKS)
+	{
+		size_t len = (size_t)(nblks - i < BATCH_BLKS ? nblks - i : BATCH_BLKS) * FS_BLOCK_SIZE;
+		if (pwrite(fd, (const char *)buf + (size_t)i * FS_BLOCK_SIZE, len,
+				   (off_t)(blk + i) * FS_BLOCK_SIZE) != (ssize_t)len)
+		{
+			fprintf(stderr, "cannot write block %u: %s\n", blk + i, strerror(errno));
+			exit(FSCK_ERROR);
+		}
+	}
+}
+
+/** run fn on nthreads threads, and wait for them */
+static void run_threads(void *(*fn)(void *))
+{
+	pthread_t threads[nthreads];
+	for (int i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, fn, NULL);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Walking the block tree of an inode.
+ */
+
+/** level of a block pointer */
+enum { LEAF, INDIR_1, INDIR_2 };
+
+/**
+ * Function applied to each nonzero block pointer of an inode. It may
+ * change the pointer, but only when repairing.
+ *
+ * @param inum: the inode
+ * @param ptr: the pointer, in the inode or in an indirect block
+ * @param level: LEAF, or the level of the indirect block it points to
+ * @param lblk: the logical block of a leaf, or the first one below an
+ *              indirect block
+ * @param arg: argument given to walk_inode
+ * @return: true to walk the indirect block it points to
+ */
+typedef bool (*visit_fn)(uint32_t inum, uint32_t *ptr, int level, long lblk, void *arg);
+
+/**
+ * Visit the pointers of an indirect block, writing it back if any
+ * changed.
+ */
+static void walk_indir(uint32_t inum, uint32_t blk, int level, long lblk, visit_fn visit, void *arg)
+{
+	uint32_t ptrs[PTRS_PER_BLK];
+	read_blks(blk, 1, ptrs);
+	bool changed = false;
+	long per_ptr = level == INDIR_2 ? PTRS_PER_BLK : 1;
+	for (int i = 0; i < PTRS_PER_BLK; i++)
+	{
+		if (ptrs[i] == 0)
+			continue;
+		uint32_t old = ptrs[i];
+		long l = lblk + i * per_ptr;
+		bool descend = visit(inum, &ptrs[i], level - 1, l, arg);
+		changed |= ptrs[i] != old;
+		if (descend && ptrs[i] != 0 && level == INDIR_2)
+			walk_indir(inum, ptrs[i], INDIR_1, l, visit, arg);
+	}
+	if (changed)
+		write_blks(blk, 1, ptrs);
+}
+
+/**
+ * Visit every nonzero block pointer of an inode, in logical order,
+ * each indirect block before the blocks below it.
+ *
+ * @param inum: the inode
+ * @param visit: function applied to each pointer
+ * @param arg: argument passed to visit
+ */
+static void walk_inode(uint32_t inum, visit_fn visit, void *arg)
+{
+	struct fs_inode *ino = &inodes[inum], before = *ino;
+	for (int i = 0; i < N_DIRECT; i++)
+	{
+		if (ino->direct[i] != 0)
+			visit(inum, &ino->direct[i], LEAF, i, arg);
+	}
+	if (ino->indir_1 != 0 && visit(inum, &ino->indir_1, INDIR_1, N_DIRECT, arg) && ino->indir_1 != 0)
+		walk_indir(inum, ino->indir_1, INDIR_1, N_DIRECT, visit, arg);
+	long lblk2 = N_DIRECT + PTRS_PER_BLK;
+	if (ino->indir_2 != 0 && visit(inum, &ino->indir_2, INDIR_2, lblk2, arg) && ino->indir_2 != 0)
+		walk_indir(inum, ino->indir_2, INDIR_2, lblk2, visit, arg);
+	if (memcmp(&before, ino, sizeof(before)) != 0)
+		inode_blk_dirty[inum / INODES_PER_BLK] = 1;
+}
+
+/** true if a block may be pointed to by an inode */
+static bool in_data_region(uint32_t blk)
+{
+	return blk >= data_start && blk < n_blocks && !(blk >= jnl_start && blk < jnl_end);
+}
+
+/** number of blocks a directory holds entries or index nodes in */
+static long dir_blocks(const struct fs_inode *ino)
+{
+	long n = (ino->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+	return n > 0 ? n : 1;
+}
+
+/*
+ * Pass 1: directories.
+ */
+
+/** directories waiting to be read, and the threads reading one */
+static uint32_t *dir_queue;
+static long dir_head, dir_tail, dir_busy;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dir_cond = PTHREAD_COND_INITIALIZER;
+
+static void dir_push(uint32_t inum)
+{
+	pthread_mutex_lock(&dir_lock);
+	dir_queue[dir_tail++] = inum;
+	pthread_cond_signal(&dir_cond);
+	pthread_mutex_unlock(&dir_lock);
+}
+
+/** the blocks of a directory, by logical block */
+struct dir_blks
+{
+	long n;			// logical blocks
+	uint32_t *blks; // block of each, 0 if none
+};
+
+static bool collect_dir_blk(uint32_t inum, uint32_t *ptr, int level, long lblk, void *arg)
+{
+	struct dir_blks *d = arg;
+	if (!in_data_region(*ptr))
+		return false; // reported by pass 2
+	if (level == LEAF && lblk < d->n)
+		d->blks[lblk] = *ptr;
+	return lblk < d->n;
+}
+
+/**
+ * Check the entries of a directory, claiming the inodes they refer to
+ * and queueing the directories among them.
+ *
+ * @param dir: the directory
+ */
+static void check_dir(uint32_t dir)
+{
+	struct fs_inode *ino = &inodes[dir];
+	struct dir_blks d = {dir_blocks(ino), NULL};
+	d.blks = calloc(d.n, sizeof(uint32_t));
+	walk_inode(dir, collect_dir_blk, &d);
+	bool indexed = ino->flags & FS_INODE_INDEXED;
+
+	for (long l = 0; l < d.n; l++)
+	{
+		union
+		{
+			struct fs_dirent de[DIRENTS_PER_BLK];
+			struct fs_dx_node dx;
+		} buf;
+		if (d.blks[l] == 0 || (indexed && l == 0))
+			continue;
+		read_blks(d.blks[l], 1, &buf);
+		if (indexed && buf.dx.magic == FS_DX_MAGIC)
+			continue;
+		bool changed = false;
+		for (int i = 0; i < DIRENTS_PER_BLK; i++)
+		{
+			struct fs_dirent *de = &buf.de[i];
+			if (!de->valid)
+				continue;
+			uint32_t child = de->inode;
+			const char *why = NULL;
+			if (memchr(de->name, '\0', FS_FILENAME_SIZE) == NULL)
+				why = "has an unterminated name";
+			else if (child <= (uint32_t)sb.root_inode || child >= n_inodes)
+				why = "refers to an invalid inode";
+			else if (inodes[child].mode == 0)
+				why = "refers to a free inode";
+			else if (claim(seen_ino, child))
+				why = "refers to an inode already in a directory";
+			if (why == NULL)
+			{
+				if (S_ISDIR(inodes[child].mode))
+					dir_push(child);
+				continue;
+			}
+			problem(repair, "directory %u: entry '%.*s' %s (inode %u)", dir,
+					FS_FILENAME_SIZE, de->name, why, child);
+			if (repair)
+			{
+				de->valid = 0;
+				changed = true;
+			}
+		}
+		if (changed)
+			write_blks(d.blks[l], 1, &buf);
+	}
+	free(d.blks);
+}
+
+static void *dir_thread(void *unused)
+{
+	pthread_mutex_lock(&dir_lock);
+	for (;;)
+	{
+		while (dir_head == dir_tail && dir_busy > 0)
+			pthread_cond_wait(&dir_cond, &dir_lock);
+		if (dir_head == dir_tail)
+			break;
+		uint32_t dir = dir_queue[dir_head++];
+		dir_busy++;
+		pthread_mutex_unlock(&dir_lock);
+		check_dir(dir);
+		pthread_mutex_lock(&dir_lock);
+		dir_busy--;
+	}
+	pthread_cond_broadcast(&dir_cond);
+	pthread_mutex_unlock(&dir_lock);
+	return NULL;
+}
+
+/*
+ * Pass 2: blocks.
+ */
+
+/** next inode to check */
+static long next_inode;
+
+static bool claim_blk(uint32_t inum, uint32_t *ptr, int level, long lblk, void *arg)
+{
+	const struct fs_inode *ino = &inodes[inum];
+	long end = S_ISDIR(ino->mode) ? dir_blocks(ino) : (ino->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+	const char *what = level == LEAF ? "block" : "indirect block";
+	if (!in_data_region(*ptr))
+	{
+		problem(repair, "inode %u: %s %u is outside the data region", inum, what, *ptr);
+		if (repair)
+			*ptr = 0;
+		return false;
+	}
+	if (lblk >= end && !(ino->flags & FS_INODE_PREALLOC))
+	{
+		problem(repair, "inode %u: %s %u is past the end of the file", inum, what, *ptr);
+		if (repair)
+			*ptr = 0;
+		return false;
+	}
+	if (claim(seen_blk, *ptr))
+	{
+		claim(dup_blk, *ptr);
+		problem(repair, "inode %u: %s %u is also used by another inode", inum, what, *ptr);
+		return false;
+	}
+	return true;
+}
+
+static void *blk_thread(void *unused)
+{
+	long first;
+	while ((first = __atomic_fetch_add(&next_inode, INODE_CHUNK, __ATOMIC_RELAXED)) < n_inodes)
+	{
+		for (long i = first; i < first + INODE_CHUNK && i < n_inodes; i++)
+		{
+			if (!claimed(seen_ino, i))
+				continue;
+			struct fs_inode *ino = &inodes[i];
+			if (!S_ISREG(ino->mode) && !S_ISDIR(ino->mode))
+				problem(false, "inode %ld: bad mode %o", i, ino->mode);
+			if (ino->size < 0)
+				problem(false, "inode %ld: bad size %d", i, ino->size);
+			walk_inode(i, claim_blk, NULL);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Pass 2b, when repairing: copy doubly allocated blocks.
+ */
+
+/** blocks given to an owner, and where the search for a free block resumes */
+static uint64_t *owned_blk;
+static uint32_t next_free;
+
+/**
+ * Allocate a free block for a copy.
+ *
+ * @return: the block, or 0 if none
+ */
+static uint32_t alloc_blk(void)
+{
+	for (; next_free < n_blocks; next_free++)
+	{
+		if (in_data_region(next_free) && !claim(seen_blk, next_free))
+			return next_free++;
+	}
+	return 0;
+}
+
+/**
+ * Give each block to the first inode that points to it, in inode
+ * order, and copy it for any other. A copied indirect block points to
+ * the same blocks as the original, so they are copied in turn.
+ */
+static bool copy_dup(uint32_t inum, uint32_t *ptr, int level, long lblk, void *arg)
+{
+	if (!in_data_region(*ptr) || !claim(owned_blk, *ptr))
+		return level != LEAF;
+	uint32_t copy = alloc_blk();
+	if (copy == 0)
+	{
+		problem(false, "inode %u: no free block to copy block %u to", inum, *ptr);
+		return false;
+	}
+	char buf[FS_BLOCK_SIZE];
+	read_blks(*ptr, 1, buf);
+	write_blks(copy, 1, buf);
+	claim(owned_blk, copy);
+	if (verbose)
+		printf("inode %u: copied block %u to %u\n", inum, *ptr, copy);
+	*ptr = copy;
+	return level != LEAF;
+}
+
+/*
+ * Pass 3: maps.
+ */
+
+/**
+ * Compare the inode map with the reachable inodes. Orphans are freed
+ * when repairing; their blocks were not claimed, so they are leaks.
+ */
+static void check_inode_map(void)
+{
+	for (uint32_t i = 0; i < n_inodes; i++)
+	{
+		bool used = i <= (uint32_t)sb.root_inode || claimed(seen_ino, i);
+		if (used == test_bit(inode_map, i))
+			continue;
+		if (used)
+		{
+			problem(repair, "inode %u: in use but free in the inode map", i);
+		}
+		else
+		{
+			problem(repair, "inode %u: allocated but in no directory", i);
+			if (repair)
+			{
+				memset(&inodes[i], 0, sizeof(struct fs_inode));
+				inode_blk_dirty[i / INODES_PER_BLK] = 1;
+			}
+		}
+		if (repair)
+			set_bit(inode_map, i, used);
+	}
+}
+
+/**
+ * Compare the block map with the blocks that should be in use: the
+ * metadata, the journal and the claimed blocks. Leaks are listed
+ * only with -v, as there can be many.
+ */
+static void check_block_map(void)
+{
+	long leaked = 0, unmarked = 0;
+	for (uint32_t b = 0; b < n_blocks; b++)
+	{
+		bool used = !in_data_region(b) || claimed(seen_blk, b);
+		if (used == test_bit(block_map, b))
+			continue;
+		if (used)
+		{
+			unmarked++;
+			problem(repair, "block %u: in use but free in the block map", b);
+		}
+		else
+		{
+			leaked++;
+			if (verbose)
+				printf("block %u: allocated but not in use\n", b);
+		}
+		if (repair)
+			set_bit(block_map, b, used);
+	}
+	if (leaked > 0)
+		problem(repair, "%ld blocks allocated but not in use", leaked);
+}
+
+/**
+ * Write back the maps and inode blocks that repairs changed.
+ *
+ * @param inode_map0: the inode map as read
+ * @param block_map0: the block map as read
+ */
+static void write_repairs(const uint8_t *inode_map0, const uint8_t *block_map0)
+{
+	uint32_t imap_base = 1, bmap_base = 1 + sb.inode_map_sz;
+	for (uint32_t i = 0; i < sb.inode_map_sz; i++)
+	{
+		size_t off = (size_t)i * FS_BLOCK_SIZE;
+		if (memcmp(inode_map + off, inode_map0 + off, FS_BLOCK_SIZE) != 0)
+			write_blks(imap_base + i, 1, inode_map + off);
+	}
+	for (uint32_t i = 0; i < sb.block_map_sz; i++)
+	{
+		size_t off = (size_t)i * FS_BLOCK_SIZE;
+		if (memcmp(block_map + off, block_map0 + off, FS_BLOCK_SIZE) != 0)
+			write_blks(bmap_base + i, 1, block_map + off);
+	}
+	for (uint32_t i = 0; i < sb.inode_region_sz; i++)
+	{
+		if (inode_blk_dirty[i])
+			write_blks(inode_base + i, 1, &inodes[i * INODES_PER_BLK]);
+	}
+	if (fsync(fd) < 0)
+	{
+		perror("cannot write image");
+		exit(FSCK_ERROR);
+	}
+}
+
+/*
+ * Setup.
+ */
+
+/**
+ * Replay the journal of an image, as a mount would, by opening the
+ * journal over it and closing it.
+ *
+ * @param image: the image file
+ */
+static void replay_journal(char *image)
+{
+	struct blkdev *disk = image_create(image);
+	struct blkdev *journal = disk == NULL ? NULL :
+		journal_create(disk, sb.journal_start, sb.journal_len, NULL);
+	if (journal == NULL)
+	{
+		fprintf(stderr, "%s: cannot open journal\n", image);
+		exit(FSCK_ERROR);
+	}
+	journal->ops->close(journal);
+}
+
+/**
+ * Read and check the superblock.
+ *
+ * @param image: the image file
+ */
+static void read_super(const char *image)
+{
+	struct stat st;
+	read_blks(0, 1, &sb);
+	if (sb.magic != FS_MAGIC)
+	{
+		fprintf(stderr, "%s: not a file system image\n", image);
+		exit(FSCK_ERROR);
+	}
+	n_blocks = sb.num_blocks;
+	n_inodes = sb.inode_region_sz * INODES_PER_BLK;
+	inode_base = 1 + sb.inode_map_sz + sb.block_map_sz;
+	data_start = inode_base + sb.inode_region_sz;
+	jnl_start = sb.journal_start;
+	jnl_end = sb.journal_start + sb.journal_len;
+	if (fstat(fd, &st) < 0 || (off_t)n_blocks * FS_BLOCK_SIZE > st.st_size ||
+		sb.inode_map_sz < (n_inodes + BITS_PER_BLK - 1) / BITS_PER_BLK ||
+		sb.block_map_sz < (n_blocks + BITS_PER_BLK - 1) / BITS_PER_BLK ||
+		data_start >= n_blocks || (sb.journal_len > 0 && (jnl_start < data_start || jnl_end > n_blocks)) ||
+		sb.root_inode == 0 || sb.root_inode >= n_inodes)
+	{
+		fprintf(stderr, "%s: superblock does not describe the image\n", image);
+		exit(FSCK_ERROR);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n | -y] [-t threads] [-v] image.img\n", prog);
+	exit(FSCK_ERROR);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "nyt:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': readonly = 1; break;
+		case 'y': repair = 1; break;
+		case 't': nthreads = atoi(optarg); break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || (readonly && repair) || nthreads < 1)
+		usage(argv[0]);
+	char *image = argv[optind];
+
+	if ((fd = open(image, readonly ? O_RDONLY : O_RDWR)) < 0)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", image, strerror(errno));
+		exit(FSCK_ERROR);
+	}
+	read_super(image);
+	if (sb.journal_len > 0)
+	{
+		if (readonly)
+		{
+			printf("%s: journal not replayed (-n); metadata may be out of date\n", image);
+		}
+		else
+		{
+			close(fd);
+			replay_journal(image);
+			fd = open(image, O_RDWR);
+			read_super(image);
+		}
+	}
+
+	double t0 = now();
+	size_t imap_len = (size_t)sb.inode_map_sz * FS_BLOCK_SIZE;
+	size_t bmap_len = (size_t)sb.block_map_sz * FS_BLOCK_SIZE;
+	inode_map = malloc(imap_len);
+	block_map = malloc(bmap_len);
+	inodes = malloc((size_t)sb.inode_region_sz * FS_BLOCK_SIZE);
+	seen_ino = calloc(n_inodes / 64 + 1, sizeof(uint64_t));
+	seen_blk = calloc(n_blocks / 64 + 1, sizeof(uint64_t));
+	dup_blk = calloc(n_blocks / 64 + 1, sizeof(uint64_t));
+	inode_blk_dirty = calloc(sb.inode_region_sz, 1);
+	dir_queue = malloc(n_inodes * sizeof(uint32_t));
+	if (inode_map == NULL || block_map == NULL || inodes == NULL || seen_ino == NULL ||
+		seen_blk == NULL || dup_blk == NULL || inode_blk_dirty == NULL || dir_queue == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(FSCK_ERROR);
+	}
+	read_blks(1, sb.inode_map_sz, inode_map);
+	read_blks(1 + sb.inode_map_sz, sb.block_map_sz, block_map);
+	read_blks(inode_base, sb.inode_region_sz, inodes);
+	uint8_t *inode_map0 = malloc(imap_len), *block_map0 = malloc(bmap_len);
+	memcpy(inode_map0, inode_map, imap_len);
+	memcpy(block_map0, block_map, bmap_len);
+	double t1 = now();
+
+	if (!S_ISDIR(inodes[sb.root_inode].mode))
+	{
+		fprintf(stderr, "%s: root inode %u is not a directory\n", image, sb.root_inode);
+		exit(FSCK_UNREPAIRED);
+	}
+	claim(seen_ino, sb.root_inode);
+	dir_push(sb.root_inode);
+	run_threads(dir_thread);
+	double t2 = now();
+
+	run_threads(blk_thread);
+	long dups = 0;
+	for (uint32_t b = 0; b < n_blocks; b++)
+		dups += claimed(dup_blk, b);
+	if (repair && dups > 0)
+	{
+		owned_blk = calloc(n_blocks / 64 + 1, sizeof(uint64_t));
+		next_free = data_start;
+		for (uint32_t i = 0; i < n_inodes; i++)
+		{
+			if (claimed(seen_ino, i))
+				walk_inode(i, copy_dup, NULL);
+		}
+		free(owned_blk);
+	}
+	double t3 = now();
+
+	check_inode_map();
+	check_block_map();
+	if (repair && repaired > 0)
+		write_repairs(inode_map0, block_map0);
+	double t4 = now();
+
+	long used_inodes = 0, used_blocks = 0;
+	for (uint32_t i = 0; i < n_inodes; i++)
+		used_inodes += claimed(seen_ino, i);
+	for (uint32_t b = 0; b < n_blocks; b++)
+		used_blocks += !in_data_region(b) || claimed(seen_blk, b);
+	printf("%s: %ld/%u inodes, %ld/%u blocks, %ld problems", image, used_inodes, n_inodes,
+		   used_blocks, n_blocks, problems);
+	if (repair)
+		printf(", %ld repaired", repaired);
+	printf("\n");
+	if (verbose)
+		printf("read metadata %.3f s, directories %.3f s, blocks %.3f s, maps %.3f s, %d threads\n",
+			   t1 - t0, t2 - t1, t3 - t2, t4 - t3, nthreads);
+	close(fd);
+	return problems == 0 ? FSCK_OK : problems == repaired ? FSCK_REPAIRED : FSCK_UNREPAIRED;
+}
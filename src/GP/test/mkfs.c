@@ -0,0 +1,224 @@
+/*
+ * file:        mkfs.c
+ * description: creates an empty CS492 file system image
+ *
+ * Lays out an image of the given size as the superblock, the inode
+ * map, the block map, the inode region and the data region, with an
+ * empty root directory as inode 1 in the first data block, and
+ * optionally a metadata journal after it.
+ *
+ * The image is created with ftruncate, so every block not written is
+ * a hole that reads as zeros. Only the blocks that are not all zeros
+ * are written: the superblock, the first inode map block, the block
+ * map blocks covering the metadata, and the first inode block. The
+ * time to format is the same for any size.
+ *
+ * usage: mkfs.fsx492 [options] image.img size
+ *   size         image size in bytes, with an optional K, M, G or T suffix
+ *   -i inodes    number of inodes, rounded up to fill the last inode block
+ *                (one per 8 blocks, at most 1048576)
+ *   -b bytes     block size; only 1024 is supported
+ *   -j blocks    size of a metadata journal, 0 for none (0)
+ *   -f           overwrite the image if it exists
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../fsx492.h"
+
+/** default inodes: one per INODE_RATIO blocks, at most MAX_DEFAULT_INODES */
+enum { INODE_RATIO = 8, MAX_DEFAULT_INODES = 1 << 20 };
+
+/** smallest journal journal_create accepts */
+enum { MIN_JOURNAL_BLOCKS = 8 };
+
+/**
+ * Parse a size with an optional binary K, M, G or T suffix.
+ *
+ * @param s: the size
+ * @return: the size in bytes, or -1 if malformed
+ */
+static long long parse_size(const char *s)
+{
+	char *end;
+	long long n = strtoll(s, &end, 10);
+	int shift = 0;
+	switch (*end)
+	{
+	case 'k': case 'K': shift = 10; end++; break;
+	case 'm': case 'M': shift = 20; end++; break;
+	case 'g': case 'G': shift = 30; end++; break;
+	case 't': case 'T': shift = 40; end++; break;
+	}
+	if (end == s || *end != '\0' || n < 0 || n > (LLONG_MAX >> shift))
+		return -1;
+	return n << shift;
+}
+
+/**
+ * Write a block of the image, exiting if cannot.
+ *
+ * @param fd: the image
+ * @param blk: the block number
+ * @param buf: the contents of the block
+ */
+static void write_blk(int fd, uint32_t blk, const void *buf)
+{
+	if (pwrite(fd, buf, FS_BLOCK_SIZE, (off_t)blk * FS_BLOCK_SIZE) != FS_BLOCK_SIZE)
+	{
+		perror("cannot write image");
+		exit(1);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i inodes] [-b block_size] [-j journal_blocks] [-f] image.img size\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	long long inodes = 0;
+	int journal_blocks = 0, force = 0, opt;
+	while ((opt = getopt(argc, argv, "i:b:j:f")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i': inodes = atoll(optarg); break;
+		case 'b':
+			if (atoi(optarg) != FS_BLOCK_SIZE)
+			{
+				fprintf(stderr, "only %d byte blocks are supported\n", FS_BLOCK_SIZE);
+				exit(1);
+			}
+			break;
+		case 'j': journal_blocks = atoi(optarg); break;
+		case 'f': force = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 2 || inodes < 0 || journal_blocks < 0)
+		usage(argv[0]);
+	const char *image = argv[optind];
+	long long size = parse_size(argv[optind + 1]);
+	if (size < 0)
+		usage(argv[0]);
+
+	// block numbers are ints in the file system
+	long long num_blocks = size / FS_BLOCK_SIZE;
+	if (num_blocks > INT_MAX)
+	{
+		fprintf(stderr, "image too large: at most %lld bytes\n", (long long)INT_MAX * FS_BLOCK_SIZE);
+		exit(1);
+	}
+	if (inodes == 0)
+	{
+		inodes = num_blocks / INODE_RATIO;
+		if (inodes > MAX_DEFAULT_INODES)
+			inodes = MAX_DEFAULT_INODES;
+	}
+	if (journal_blocks > 0 && journal_blocks < MIN_JOURNAL_BLOCKS)
+	{
+		fprintf(stderr, "journal too small: at least %d blocks\n", MIN_JOURNAL_BLOCKS);
+		exit(1);
+	}
+
+	// inodes 0 (unused) and 1 (root) are always taken; entries hold 30 bit inode numbers
+	if (inodes < 2)
+		inodes = 2;
+	if (inodes >= (1 << 30))
+	{
+		fprintf(stderr, "too many inodes: at most %d\n", (1 << 30) - 1);
+		exit(1);
+	}
+	struct fs_super sb;
+	memset(&sb, 0, sizeof(sb));
+	sb.magic = FS_MAGIC;
+	sb.inode_region_sz = (inodes + INODES_PER_BLK - 1) / INODES_PER_BLK;
+	sb.inode_map_sz = (sb.inode_region_sz * INODES_PER_BLK + BITS_PER_BLK - 1) / BITS_PER_BLK;
+	sb.block_map_sz = (num_blocks + BITS_PER_BLK - 1) / BITS_PER_BLK;
+	sb.num_blocks = num_blocks;
+	sb.root_inode = 1;
+	uint32_t inode_base = 1 + sb.inode_map_sz + sb.block_map_sz;
+	uint32_t root_blk = inode_base + sb.inode_region_sz;
+	if (journal_blocks > 0)
+	{
+		sb.journal_start = root_blk + 1;
+		sb.journal_len = journal_blocks;
+	}
+	long long used = (long long)root_blk + 1 + journal_blocks;
+	if (used >= num_blocks)
+	{
+		fprintf(stderr, "image too small: %lld blocks of metadata in %lld blocks\n", used, num_blocks);
+		exit(1);
+	}
+
+	int fd = open(image, O_WRONLY | O_CREAT | (force ? O_TRUNC : O_EXCL), 0666);
+	if (fd < 0)
+	{
+		fprintf(stderr, "cannot create %s: %s%s\n", image, strerror(errno),
+				errno == EEXIST ? " (use -f to overwrite)" : "");
+		exit(1);
+	}
+	// a truncated file is all holes, which read as zeros
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)num_blocks * FS_BLOCK_SIZE) < 0)
+	{
+		perror("cannot size image");
+		exit(1);
+	}
+
+	write_blk(fd, 0, &sb);
+
+	// inode map: inode 0 is unused and inode 1 is the root
+	uint8_t buf[FS_BLOCK_SIZE];
+	memset(buf, 0, sizeof(buf));
+	buf[0] = 0x3;
+	write_blk(fd, 1, buf);
+
+	// block map: the metadata, the root directory and the journal are in use
+	for (long long b = 0; b < used; b += BITS_PER_BLK)
+	{
+		memset(buf, 0, sizeof(buf));
+		long long n = used - b < BITS_PER_BLK ? used - b : BITS_PER_BLK;
+		memset(buf, 0xff, n / 8);
+		if (n % 8 != 0)
+			buf[n / 8] = (1 << (n % 8)) - 1;
+		write_blk(fd, 1 + sb.inode_map_sz + b / BITS_PER_BLK, buf);
+	}
+
+	// root directory: a single block of entries, all free; the journal
+	// header block is left zero, an empty journal
+	struct fs_inode ino[INODES_PER_BLK];
+	memset(ino, 0, sizeof(ino));
+	ino[1].uid = getuid();
+	ino[1].gid = getgid();
+	ino[1].mode = S_IFDIR | 0777;
+	ino[1].ctime = ino[1].mtime = time(NULL);
+	ino[1].size = FS_BLOCK_SIZE;
+	ino[1].direct[0] = root_blk;
+	write_blk(fd, inode_base, ino);
+
+	if (fsync(fd) < 0 || close(fd) < 0)
+	{
+		perror("cannot write image");
+		exit(1);
+	}
+
+	printf("%s: %lld blocks, %u inodes in %u blocks, maps %u+%u blocks, data from block %u",
+		   image, num_blocks, sb.inode_region_sz * INODES_PER_BLK, sb.inode_region_sz,
+		   sb.inode_map_sz, sb.block_map_sz, root_blk);
+	if (journal_blocks > 0)
+		printf(", journal %d blocks at %u", journal_blocks, sb.journal_start);
+	printf("\n");
+	return 0;
+}
@@ -0,0 +1,724 @@
+/*
+ * file:        replay.c
+ * description: replay of recorded file system operations for CS492
+ *
+ * Re-issues the operations of a recording made with fsx492 -record
+ * against fs_ops of this build, on a fresh copy of an image, and
+ * compares the latency of each kind of operation with the recording
+ * or with the summary of an earlier replay.
+ *
+ * Operations are replayed in the order they started. With one thread
+ * (the default) they are replayed one at a time; with more, each
+ * recorded thread is replayed by one replay thread, in its own order.
+ * Operations are issued as fast as possible, or with -T no earlier
+ * than they were issued in the recording. Handles returned by open
+ * and opendir are mapped to the handles of the replay. The data
+ * written is a fixed pattern, since the recording does not hold it.
+ *
+ * To compare two builds, replay the recording with each, saving the
+ * summary of the first with -o and comparing the second with -b.
+ *
+ * usage: fsx492-replay [options] recording image.img
+ *   -t threads   replay threads (1)
+ *   -T           keep the recorded timing
+ *   -c blocks    buffer cache size, 0 for none (0)
+ *   -j blocks    journal size to add to an image without one (0)
+ *   -k           keep the image copy instead of removing it
+ *   -o file      save the summary of the replay in file
+ *   -b file      compare with the summary of an earlier replay
+ *
+ * The image itself is not modified.
+ */
+
+#define FUSE_USE_VERSION 27
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <fuse.h>
+
+#include "../fsx492.h"
+#include "../blkdev.h"
+#include "../image.h"
+#include "../cache.h"
+#include "../oprecord.h"
+
+/** block device used by fs.c */
+struct blkdev *disk;
+
+extern struct fuse_operations fs_ops;
+
+/** size of journal to add to an image without one */
+extern int fs_journal_blocks;
+
+/** a recorded operation, and how it went in the replay */
+struct rec
+{
+	long start_ns;	 // start, from the start of the recording
+	long dur_ns;	 // recorded latency
+	int tid;		 // recorded thread
+	int op;			 // the operation
+	int res;		 // recorded result
+	char *path;		 // the path
+	char *path2;	 // new path of rename
+	long long a[4];	 // numeric arguments, in recorded order
+	int nargs;		 // number of numeric arguments
+	long rep_ns;	 // replayed latency
+	int rep_res;	 // replayed result
+};
+
+static struct rec *recs;
+static long nrecs;
+
+/** replay parameters */
+static int nthreads = 1;
+static int timed;
+
+/** when the replay started */
+static struct timespec replay_start;
+
+/*
+ * Handle map: the handle each recorded handle of an open file or
+ * directory has in the replay.
+ */
+
+enum { FH_BUCKETS = 1024 };
+
+struct fh_ent
+{
+	unsigned long long rec_fh;	// recorded handle
+	struct fuse_file_info fi;	// file info of the replay
+	struct fh_ent *next;		// next entry in bucket
+};
+
+/** maps of file handles [0] and directory handles [1] */
+static struct fh_ent *fh_map[2][FH_BUCKETS];
+static pthread_mutex_t fh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fh_put(int dir, unsigned long long rec_fh, const struct fuse_file_info *fi)
+{
+	struct fh_ent *e = malloc(sizeof(*e));
+	e->rec_fh = rec_fh;
+	e->fi = *fi;
+	pthread_mutex_lock(&fh_lock);
+	e->next = fh_map[dir][rec_fh % FH_BUCKETS];
+	fh_map[dir][rec_fh % FH_BUCKETS] = e;
+	pthread_mutex_unlock(&fh_lock);
+}
+
+/**
+ * Get the file info for a recorded handle.
+ *
+ * @param dir: 1 for a directory handle, 0 for a file handle
+ * @param rec_fh: the recorded handle, all ones if there was none
+ * @param fi: holder for the file info
+ * @return: fi, or NULL if the operation was called without one
+ */
+static struct fuse_file_info *fh_get(int dir, unsigned long long rec_fh, struct fuse_file_info *fi)
+{
+	if (rec_fh == (unsigned long long)-1)
+		return NULL;
+	memset(fi, 0, sizeof(*fi));
+	fi->fh = (uint64_t)-1;
+	pthread_mutex_lock(&fh_lock);
+	for (struct fh_ent *e = fh_map[dir][rec_fh % FH_BUCKETS]; e != NULL; e = e->next)
+	{
+		if (e->rec_fh == rec_fh)
+		{
+			*fi = e->fi;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fh_lock);
+	return fi;
+}
+
+static void fh_del(int dir, unsigned long long rec_fh)
+{
+	pthread_mutex_lock(&fh_lock);
+	for (struct fh_ent **pe = &fh_map[dir][rec_fh % FH_BUCKETS]; *pe != NULL; pe = &(*pe)->next)
+	{
+		if ((*pe)->rec_fh == rec_fh)
+		{
+			struct fh_ent *e = *pe;
+			*pe = e->next;
+			free(e);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fh_lock);
+}
+
+/*
+ * Reading the recording.
+ */
+
+/** undo the escapes of a recorded path, in place */
+static char *unescape(char *path)
+{
+	char *p = path, *q = path;
+	for (; *p != '\0'; p++)
+	{
+		if (*p == '\\' && p[1] != '\0')
+		{
+			p++;
+			*q++ = *p == 't' ? '\t' : *p == 'n' ? '\n' : *p;
+		}
+		else
+		{
+			*q++ = *p;
+		}
+	}
+	*q = '\0';
+	return path;
+}
+
+/**
+ * Parse a line of a recording.
+ *
+ * @param line: the line, without its newline; modified
+ * @param r: the record to fill in
+ * @return: 0 if successful, -1 if the line is malformed
+ */
+static int parse_rec(char *line, struct rec *r)
+{
+	char *f[12];
+	int nf = 0;
+	while (nf < 12 && (f[nf] = strsep(&line, "\t")) != NULL)
+		nf++;
+	if (nf < 6)
+		return -1;
+	memset(r, 0, sizeof(*r));
+	r->start_ns = atol(f[0]);
+	r->dur_ns = atol(f[1]);
+	r->tid = atoi(f[2]);
+	r->res = atoi(f[4]);
+	for (r->op = 0; r->op < N_REC_OPS && strcmp(f[3], oprecord_names[r->op]) != 0; r->op++)
+		;
+	if (r->op == N_REC_OPS)
+		return -1;
+	r->path = strdup(unescape(f[5]));
+	int first = 6;
+	if (r->op == REC_RENAME)
+	{
+		if (nf < 7)
+			return -1;
+		r->path2 = strdup(unescape(f[6]));
+		first = 7;
+	}
+	// modes are octal, and utime of now has no times
+	int octal = r->op == REC_MKNOD || r->op == REC_MKDIR || r->op == REC_CHMOD;
+	for (int i = first; i < nf && r->nargs < 4; i++)
+	{
+		if (strcmp(f[i], "-") != 0)
+			r->a[r->nargs++] = strtoull(f[i], NULL, octal && i == first ? 8 : 10);
+	}
+	return 0;
+}
+
+static int cmp_start(const void *a, const void *b)
+{
+	const struct rec *x = a, *y = b;
+	return x->start_ns < y->start_ns ? -1 : x->start_ns > y->start_ns;
+}
+
+/**
+ * Read a recording into recs, in order of start.
+ *
+ * @param path: the recording
+ */
+static void read_recording(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	long lineno = 0, max = 0;
+	while ((len = getline(&line, &size, fp)) > 0)
+	{
+		lineno++;
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (lineno == 1)
+		{
+			if (strcmp(line, OPRECORD_HEADER) != 0)
+			{
+				fprintf(stderr, "%s: not a recording\n", path);
+				exit(1);
+			}
+			continue;
+		}
+		if (nrecs == max)
+			recs = realloc(recs, (max = max * 2 + 1024) * sizeof(struct rec));
+		if (parse_rec(line, &recs[nrecs]) < 0)
+		{
+			fprintf(stderr, "%s:%ld: malformed line\n", path, lineno);
+			exit(1);
+		}
+		nrecs++;
+	}
+	free(line);
+	fclose(fp);
+	qsort(recs, nrecs, sizeof(struct rec), cmp_start);
+}
+
+/*
+ * Replay.
+ */
+
+/** readdir filler that discards the entries */
+static int discard_entry(void *ptr, const char *name, const struct stat *sb, off_t off)
+{
+	return 0;
+}
+
+/** buffer of a replay thread for reads and writes */
+struct io_buf
+{
+	char *buf;
+	size_t size;
+};
+
+static char *get_buf(struct io_buf *b, size_t len)
+{
+	if (len > b->size)
+	{
+		b->buf = realloc(b->buf, len);
+		for (size_t i = b->size; i < len; i++)
+			b->buf[i] = (char)i;
+		b->size = len;
+	}
+	return b->buf;
+}
+
+/**
+ * Issue a recorded operation.
+ *
+ * @param r: the operation
+ * @param b: the thread's read and write buffer
+ * @return: its result, or -ENOSYS if this build does not have it
+ */
+static int replay_op(const struct rec *r, struct io_buf *b)
+{
+	struct fuse_file_info fi, *pfi;
+	struct stat sb;
+	struct statvfs sv;
+	struct utimbuf ut;
+	int res;
+
+	switch (r->op)
+	{
+	case REC_GETATTR:
+		return fs_ops.getattr(r->path, &sb);
+	case REC_OPENDIR:
+		if (fs_ops.opendir == NULL)
+			return -ENOSYS;
+		memset(&fi, 0, sizeof(fi));
+		if ((res = fs_ops.opendir(r->path, &fi)) == 0 && r->res == 0)
+			fh_put(1, r->a[0], &fi);
+		return res;
+	case REC_READDIR:
+		return fs_ops.readdir(r->path, NULL, discard_entry, 0, fh_get(1, r->a[0], &fi));
+	case REC_RELEASEDIR:
+		if (fs_ops.releasedir == NULL)
+			return -ENOSYS;
+		res = fs_ops.releasedir(r->path, fh_get(1, r->a[0], &fi));
+		fh_del(1, r->a[0]);
+		return res;
+	case REC_MKNOD:
+		return fs_ops.mknod(r->path, r->a[0], r->a[1]);
+	case REC_MKDIR:
+		return fs_ops.mkdir(r->path, r->a[0]);
+	case REC_UNLINK:
+		return fs_ops.unlink(r->path);
+	case REC_RMDIR:
+		return fs_ops.rmdir(r->path);
+	case REC_RENAME:
+		return fs_ops.rename(r->path, r->path2);
+	case REC_CHMOD:
+		return fs_ops.chmod(r->path, r->a[0]);
+	case REC_UTIME:
+		if (fs_ops.utime == NULL)
+			return -ENOSYS;
+		ut.actime = r->a[0];
+		ut.modtime = r->a[1];
+		return fs_ops.utime(r->path, r->nargs == 2 ? &ut : NULL);
+	case REC_TRUNCATE:
+		return fs_ops.truncate(r->path, r->a[0]);
+	case REC_OPEN:
+		memset(&fi, 0, sizeof(fi));
+		fi.flags = r->a[0];
+		if ((res = fs_ops.open(r->path, &fi)) == 0 && r->res == 0)
+			fh_put(0, r->a[1], &fi);
+		return res;
+	case REC_READ:
+		return fs_ops.read(r->path, get_buf(b, r->a[2]), r->a[2], r->a[1], fh_get(0, r->a[0], &fi));
+	case REC_WRITE_BUF:
+		if (fs_ops.write_buf != NULL)
+		{
+			struct fuse_bufvec bv = FUSE_BUFVEC_INIT(r->a[2]);
+			bv.buf[0].mem = get_buf(b, r->a[2]);
+			return fs_ops.write_buf(r->path, &bv, r->a[1], fh_get(0, r->a[0], &fi));
+		}
+		// fall through to write
+	case REC_WRITE:
+		return fs_ops.write(r->path, get_buf(b, r->a[2]), r->a[2], r->a[1], fh_get(0, r->a[0], &fi));
+	case REC_FALLOCATE:
+		if (fs_ops.fallocate == NULL)
+			return -ENOSYS;
+		return fs_ops.fallocate(r->path, r->a[1], r->a[2], r->a[3], fh_get(0, r->a[0], &fi));
+	case REC_FLUSH:
+		if (fs_ops.flush == NULL)
+			return -ENOSYS;
+		return fs_ops.flush(r->path, fh_get(0, r->a[0], &fi));
+	case REC_RELEASE:
+		if (fs_ops.release == NULL)
+			return -ENOSYS;
+		if ((pfi = fh_get(0, r->a[0], &fi)) == NULL)
+			return -EBADF;
+		res = fs_ops.release(r->path, pfi);
+		fh_del(0, r->a[0]);
+		return res;
+	case REC_FSYNC:
+		if (fs_ops.fsync == NULL)
+			return -ENOSYS;
+		return fs_ops.fsync(r->path, r->a[1], fh_get(0, r->a[0], &fi));
+	case REC_FSYNCDIR:
+		if (fs_ops.fsyncdir == NULL)
+			return -ENOSYS;
+		return fs_ops.fsyncdir(r->path, r->a[1], fh_get(1, r->a[0], &fi));
+	case REC_STATFS:
+		return fs_ops.statfs(r->path, &sv);
+	}
+	return -ENOSYS;
+}
+
+static long ns_since(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+/**
+ * Replay the operations of one replay thread: with one thread all of
+ * them, otherwise those of the recorded threads it is given.
+ *
+ * @param arg: the number of the replay thread
+ */
+static void *replay_thread(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	struct io_buf b = {NULL, 0};
+	for (long i = 0; i < nrecs; i++)
+	{
+		struct rec *r = &recs[i];
+		if (nthreads > 1 && r->tid % nthreads != id)
+			continue;
+		if (timed)
+		{
+			long ns = r->start_ns - recs[0].start_ns;
+			struct timespec at = replay_start;
+			at.tv_sec += ns / 1000000000L;
+			at.tv_nsec += ns % 1000000000L;
+			if (at.tv_nsec >= 1000000000L)
+			{
+				at.tv_sec++;
+				at.tv_nsec -= 1000000000L;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+				;
+		}
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		r->rep_res = replay_op(r, &b);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		r->rep_ns = ns_since(&t0, &t1);
+	}
+	free(b.buf);
+	return NULL;
+}
+
+/*
+ * Report.
+ */
+
+/** latency summary of one kind of operation */
+struct op_summary
+{
+	long n;		   // operations
+	long mean_ns;  // mean latency
+	long p50_ns;   // median latency
+	long p99_ns;   // 99th percentile latency
+};
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Summarize latencies.
+ *
+ * @param lat: the latencies, sorted in place
+ * @param n: the number of latencies
+ * @param s: the summary to fill in
+ */
+static void summarize(long *lat, long n, struct op_summary *s)
+{
+	long sum = 0;
+	qsort(lat, n, sizeof(long), cmp_long);
+	for (long i = 0; i < n; i++)
+		sum += lat[i];
+	s->n = n;
+	s->mean_ns = n > 0 ? sum / n : 0;
+	s->p50_ns = n > 0 ? lat[(n * 50 + 99) / 100 - 1] : 0; // nearest rank
+	s->p99_ns = n > 0 ? lat[(n * 99 + 99) / 100 - 1] : 0;
+}
+
+/**
+ * Read the summary of an earlier replay saved with -o.
+ *
+ * @param path: the summary file
+ * @param ops: the summary of each operation, filled in
+ * @param elapsed_ns: set to the elapsed time of the replay
+ */
+static void read_summary(const char *path, struct op_summary *ops, long *elapsed_ns)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	char name[32];
+	struct op_summary s;
+	while (fscanf(fp, "%31s %ld %ld %ld %ld", name, &s.n, &s.mean_ns, &s.p50_ns, &s.p99_ns) == 5)
+	{
+		if (strcmp(name, "elapsed") == 0)
+			*elapsed_ns = s.mean_ns;
+		for (int op = 0; op < N_REC_OPS; op++)
+		{
+			if (strcmp(name, oprecord_names[op]) == 0)
+				ops[op] = s;
+		}
+	}
+	fclose(fp);
+}
+
+/**
+ * Save the summary of this replay, for -b.
+ *
+ * @param path: the summary file
+ * @param ops: the summary of each operation
+ * @param elapsed_ns: the elapsed time of the replay
+ */
+static void write_summary(const char *path, const struct op_summary *ops, long elapsed_ns)
+{
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "cannot create %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	for (int op = 0; op < N_REC_OPS; op++)
+	{
+		if (ops[op].n > 0)
+			fprintf(fp, "%s %ld %ld %ld %ld\n", oprecord_names[op], ops[op].n, ops[op].mean_ns,
+					ops[op].p50_ns, ops[op].p99_ns);
+	}
+	fprintf(fp, "elapsed %ld %ld 0 0\n", nrecs, elapsed_ns);
+	if (fclose(fp) != 0)
+	{
+		fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+}
+
+static double delta_pct(long before, long after)
+{
+	return before > 0 ? 100.0 * (after - before) / before : 0.0;
+}
+
+/**
+ * Print the latency of each kind of operation before (recorded, or
+ * an earlier replay) and in this replay, with the number of operations
+ * whose result differed from the recorded result.
+ */
+static void report(const char *before_name, const struct op_summary *before,
+				   const struct op_summary *after, const long *mismatches,
+				   long before_elapsed_ns, long after_elapsed_ns)
+{
+	printf("%-10s %8s %11s %11s %8s %11s %11s %8s %10s\n", "op", "count",
+		   "mean_us", "", "delta", "p99_us", "", "delta", "mismatched");
+	printf("%-10s %8s %11s %11s %8s %11s %11s %8s %10s\n", "", "",
+		   before_name, "replay", "", before_name, "replay", "", "");
+	for (int op = 0; op < N_REC_OPS; op++)
+	{
+		if (after[op].n == 0)
+			continue;
+		printf("%-10s %8ld %11.1f %11.1f %+7.1f%% %11.1f %11.1f %+7.1f%% %10ld\n",
+			   oprecord_names[op], after[op].n,
+			   before[op].mean_ns / 1e3, after[op].mean_ns / 1e3,
+			   delta_pct(before[op].mean_ns, after[op].mean_ns),
+			   before[op].p99_ns / 1e3, after[op].p99_ns / 1e3,
+			   delta_pct(before[op].p99_ns, after[op].p99_ns), mismatches[op]);
+	}
+	printf("\n%ld operations: %s %.3f s, replay %.3f s (%+.1f%%)\n", nrecs, before_name,
+		   before_elapsed_ns / 1e9, after_elapsed_ns / 1e9,
+		   delta_pct(before_elapsed_ns, after_elapsed_ns));
+}
+
+/**
+ * Copy an image to a new file beside it.
+ *
+ * @param image: the image file
+ * @return: the path of the copy
+ */
+static char *copy_image(const char *image)
+{
+	size_t len = strlen(image);
+	char *copy = malloc(len + 16);
+	sprintf(copy, "%.*s-replay-XXXXXX.img", (int)(len > 4 ? len - 4 : len), image);
+	int in = open(image, O_RDONLY);
+	int out = in < 0 ? -1 : mkstemps(copy, 4);
+	if (out < 0)
+	{
+		fprintf(stderr, "cannot copy %s: %s\n", image, strerror(errno));
+		exit(1);
+	}
+	char buf[64 * 1024];
+	ssize_t n;
+	while ((n = read(in, buf, sizeof(buf))) > 0)
+	{
+		if (write(out, buf, n) != n)
+			break;
+	}
+	if (n != 0 || close(out) != 0)
+	{
+		fprintf(stderr, "cannot copy %s to %s: %s\n", image, copy, strerror(errno));
+		unlink(copy);
+		exit(1);
+	}
+	close(in);
+	return copy;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-T] [-c cache_blocks] [-j journal_blocks] [-k]\n"
+					"       [-o summary] [-b baseline] recording image.img\n",
+			prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int cache_blocks = 0, keep = 0, opt;
+	char *save = NULL, *baseline = NULL;
+	while ((opt = getopt(argc, argv, "t:Tc:j:ko:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't': nthreads = atoi(optarg); break;
+		case 'T': timed = 1; break;
+		case 'c': cache_blocks = atoi(optarg); break;
+		case 'j': fs_journal_blocks = atoi(optarg); break;
+		case 'k': keep = 1; break;
+		case 'o': save = optarg; break;
+		case 'b': baseline = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 2 || nthreads < 1)
+		usage(argv[0]);
+	read_recording(argv[optind]);
+
+	char *copy = copy_image(argv[optind + 1]);
+	if ((disk = image_create(copy)) == NULL)
+	{
+		fprintf(stderr, "cannot open image file '%s': %s\n", copy, strerror(errno));
+		exit(1);
+	}
+	if (cache_blocks > 0 && (disk = cache_create(disk, cache_blocks)) == NULL)
+	{
+		fprintf(stderr, "cannot create %d block cache\n", cache_blocks);
+		exit(1);
+	}
+	fs_ops.init(NULL);
+
+	pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &replay_start);
+	for (int i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, replay_thread, (void *)(intptr_t)i);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(threads);
+	fs_ops.destroy(NULL);
+	disk->ops->close(disk);
+
+	// summarize the recording and the replay
+	struct op_summary recorded[N_REC_OPS], replayed[N_REC_OPS];
+	long mismatches[N_REC_OPS] = {0}, rec_elapsed = 0;
+	long *rec_lat = malloc((nrecs + 1) * sizeof(long)), *rep_lat = malloc((nrecs + 1) * sizeof(long));
+	for (int op = 0; op < N_REC_OPS; op++)
+	{
+		long n = 0;
+		for (long i = 0; i < nrecs; i++)
+		{
+			if (recs[i].op != op)
+				continue;
+			rec_lat[n] = recs[i].dur_ns;
+			rep_lat[n++] = recs[i].rep_ns;
+			if (recs[i].rep_res != recs[i].res)
+				mismatches[op]++;
+		}
+		summarize(rec_lat, n, &recorded[op]);
+		summarize(rep_lat, n, &replayed[op]);
+	}
+	for (long i = 0; i < nrecs; i++)
+	{
+		if (recs[i].start_ns + recs[i].dur_ns > rec_elapsed)
+			rec_elapsed = recs[i].start_ns + recs[i].dur_ns;
+	}
+	if (nrecs > 0)
+		rec_elapsed -= recs[0].start_ns;
+	long rep_elapsed = ns_since(&replay_start, &end);
+
+	if (save != NULL)
+		write_summary(save, replayed, rep_elapsed);
+	if (baseline != NULL)
+	{
+		struct op_summary base[N_REC_OPS];
+		long base_elapsed = 0;
+		memset(base, 0, sizeof(base));
+		read_summary(baseline, base, &base_elapsed);
+		report("baseline", base, replayed, mismatches, base_elapsed, rep_elapsed);
+	}
+	else
+	{
+		report("recorded", recorded, replayed, mismatches, rec_elapsed, rep_elapsed);
+	}
+
+	if (keep)
+		printf("replayed image: %s\n", copy);
+	else
+		unlink(copy);
+	free(rec_lat);
+	free(rep_lat);
+	free(copy);
+	return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * file:        stress.c
+ * description: concurrency stress test for CS492 file system
+ *
+ * Drives fs_ops from many threads at once. Each thread creates,
+ * writes, reads back, renames and removes files in a directory of its
+ * own and in a directory shared by all threads, while all threads also
+ * read one shared open file. File contents are checked against the
+ * pattern written, and at the end every block must be free again.
+ *
+ * usage: fsx492-stress image.img [threads [iterations [cache_blocks [journal_blocks]]]]
+ *
+ * The image is modified: run it on a copy.
+ */
+
+#define FUSE_USE_VERSION 27
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fuse.h>
+
+#include "../fsx492.h"
+#include "../blkdev.h"
+#include "../image.h"
+#include "../cache.h"
+
+/** block device used by fs.c */
+struct blkdev *disk;
+
+extern struct fuse_operations fs_ops;
+
+/** size of journal to add to an image without one */
+extern int fs_journal_blocks;
+
+/** largest file written, in bytes */
+enum { MAX_FILE = 40 * 1024 };
+
+/** size of the file read by all threads */
+enum { SHARED_SIZE = 64 * 1024 };
+
+/** number of iterations per thread */
+static int iterations = 200;
+
+/** open file read by all threads */
+static struct fuse_file_info shared_fi;
+
+/** number of errors found by all threads */
+static int errors;
+static pthread_mutex_t errors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Report an error found by a thread.
+ *
+ * @param id: the thread number
+ * @param what: description of the error
+ * @param path: the file path
+ * @param res: the result of the operation
+ */
+static void fail(int id, const char *what, const char *path, int res)
+{
+	pthread_mutex_lock(&errors_lock);
+	errors++;
+	fprintf(stderr, "thread %d: %s %s: %d\n", id, what, path, res);
+	pthread_mutex_unlock(&errors_lock);
+}
+
+/**
+ * Get the byte at an offset of the pattern of a file.
+ *
+ * @param seed: the file's pattern seed
+ * @param offset: the offset
+ * @return the byte
+ */
+static char pattern(unsigned seed, long offset)
+{
+	return (char)(seed + offset * 31 + (offset >> 10));
+}
+
+/**
+ * Create a file and write its pattern in chunks of random size. Some
+ * files are synced after they are written.
+ *
+ * @return 0 if successful, or -error number
+ */
+static int write_file(const char *path, unsigned seed, int size, unsigned *rnd)
+{
+	struct fuse_file_info fi = {0};
+	int res = fs_ops.mknod(path, 0100644, 0);
+	if (res == 0)
+		res = fs_ops.open(path, &fi);
+	if (res < 0)
+		return res;
+	char *buf = malloc(size + 1);
+	for (int i = 0; i < size; i++)
+		buf[i] = pattern(seed, i);
+	for (int off = 0; off < size && res >= 0;)
+	{
+		int len = 1 + rand_r(rnd) % 3000;
+		if (len > size - off)
+			len = size - off;
+		res = fs_ops.write(path, buf + off, len, off, &fi);
+		if (res >= 0 && res != len)
+			res = -EIO;
+		off += len;
+	}
+	if (res >= 0 && rand_r(rnd) % 8 == 0)
+		res = fs_ops.fsync(path, 0, &fi);
+	free(buf);
+	fs_ops.release(path, &fi);
+	return res < 0 ? res : 0;
+}
+
+/**
+ * Read a range of a file and check it against the pattern.
+ *
+ * @return 0 if the data matches, or -error number
+ */
+static int check_range(const char *path, struct fuse_file_info *fi, unsigned seed, int offset, int len)
+{
+	char buf[len > 0 ? len : 1];
+	int res = fs_ops.read(path, buf, len, offset, fi);
+	if (res < 0)
+		return res;
+	if (res != len)
+		return -EIO;
+	for (int i = 0; i < len; i++)
+	{
+		if (buf[i] != pattern(seed, offset + i))
+			return -EIO;
+	}
+	return 0;
+}
+
+/**
+ * Open a file and check its size and contents.
+ *
+ * @return 0 if successful, or -error number
+ */
+static int check_file(const char *path, unsigned seed, int size)
+{
+	struct stat sb;
+	int res = fs_ops.getattr(path, &sb);
+	if (res < 0)
+		return res;
+	if (sb.st_size != size)
+		return -EFBIG;
+	struct fuse_file_info fi = {0};
+	if ((res = fs_ops.open(path, &fi)) < 0)
+		return res;
+	res = check_range(path, &fi, seed, 0, size);
+	fs_ops.release(path, &fi);
+	return res;
+}
+
+/** readdir filler that counts entries */
+static int count_entry(void *buf, const char *name, const struct stat *sb, off_t off)
+{
+	(*(int *)buf)++;
+	return 0;
+}
+
+/**
+ * Count the entries of a directory.
+ *
+ * @return the number of entries, or -error number
+ */
+static int count_dir(const char *path)
+{
+	int n = 0;
+	int res = fs_ops.readdir(path, &n, count_entry, 0, NULL);
+	return res < 0 ? res : n;
+}
+
+/**
+ * Work of one thread.
+ *
+ * @param arg: the thread number
+ */
+static void *worker(void *arg)
+{
+	int id = (int)(long)arg;
+	unsigned rnd = id * 7919 + 1;
+	char dir[64], path[96], path2[96];
+	sprintf(dir, "/stress/t%d", id);
+	int res = fs_ops.mkdir(dir, 040755);
+	if (res < 0)
+	{
+		fail(id, "mkdir", dir, res);
+		return NULL;
+	}
+
+	int kept = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		// a file of our own: write, check, rename, check
+		unsigned seed = id * 100003 + i;
+		int size = rand_r(&rnd) % MAX_FILE;
+		sprintf(path, "%s/f%d", dir, i);
+		sprintf(path2, "%s/g%d", dir, i);
+		if ((res = write_file(path, seed, size, &rnd)) < 0)
+			fail(id, "write", path, res);
+		else if ((res = check_file(path, seed, size)) < 0)
+			fail(id, "check", path, res);
+		else if ((res = fs_ops.rename(path, path2)) < 0)
+			fail(id, "rename", path, res);
+		else if ((res = check_file(path2, seed, size)) < 0)
+			fail(id, "check", path2, res);
+		else if (i % 2 == 0 && (res = fs_ops.unlink(path2)) < 0)
+			fail(id, "unlink", path2, res);
+		else if (i % 2 != 0)
+			kept++;
+
+		// a file in the shared directory
+		sprintf(path, "/stress/shared/t%d_%d", id, i);
+		int ssize = rand_r(&rnd) % 4096;
+		if ((res = write_file(path, seed, ssize, &rnd)) < 0)
+			fail(id, "write", path, res);
+		else if ((res = check_file(path, seed, ssize)) < 0)
+			fail(id, "check", path, res);
+		else if (i % 3 == 0 && (res = fs_ops.unlink(path)) < 0)
+			fail(id, "unlink", path, res);
+
+		// the file all threads read
+		int off = rand_r(&rnd) % SHARED_SIZE;
+		int len = rand_r(&rnd) % (SHARED_SIZE - off);
+		if ((res = check_range("/stress/shared_file", &shared_fi, 0, off, len)) < 0)
+			fail(id, "read", "/stress/shared_file", res);
+
+		if (i % 50 == 0 && (res = count_dir("/stress/shared")) < 0)
+			fail(id, "readdir", "/stress/shared", res);
+	}
+
+	if ((res = count_dir(dir)) != kept)
+		fail(id, "entries in", dir, res);
+	return NULL;
+}
+
+/** names collected by readdir */
+struct names
+{
+	int n;
+	char (*name)[FS_FILENAME_SIZE];
+	bool *isdir;
+};
+
+/** readdir filler that collects entries */
+static int collect_entry(void *buf, const char *name, const struct stat *sb, off_t off)
+{
+	struct names *names = buf;
+	names->name = realloc(names->name, (names->n + 1) * sizeof(*names->name));
+	names->isdir = realloc(names->isdir, (names->n + 1) * sizeof(bool));
+	strcpy(names->name[names->n], name);
+	names->isdir[names->n++] = S_ISDIR(sb->st_mode);
+	return 0;
+}
+
+/**
+ * Remove all entries of a directory and the directory. Entries are
+ * collected first: the directory cannot be changed during readdir.
+ *
+ * @param path: the directory path
+ * @return 0 if successful, or -error number
+ */
+static int remove_dir(const char *path)
+{
+	struct names names = {0};
+	int res = fs_ops.readdir(path, &names, collect_entry, 0, NULL);
+	for (int i = 0; i < names.n && res >= 0; i++)
+	{
+		char sub[128];
+		snprintf(sub, sizeof(sub), "%s/%s", path, names.name[i]);
+		res = names.isdir[i] ? remove_dir(sub) : fs_ops.unlink(sub);
+	}
+	free(names.name);
+	free(names.isdir);
+	return res < 0 ? res : fs_ops.rmdir(path);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s image.img [threads [iterations [cache_blocks [journal_blocks]]]]\n", argv[0]);
+		exit(1);
+	}
+	int nthreads = (argc > 2) ? atoi(argv[2]) : 8;
+	iterations = (argc > 3) ? atoi(argv[3]) : iterations;
+	int cache_blocks = (argc > 4) ? atoi(argv[4]) : 256;
+	fs_journal_blocks = (argc > 5) ? atoi(argv[5]) : 0;
+
+	if ((disk = image_create(argv[1])) == NULL)
+	{
+		fprintf(stderr, "cannot open image file '%s': %s\n", argv[1], strerror(errno));
+		exit(1);
+	}
+	if (cache_blocks > 0 && (disk = cache_create(disk, cache_blocks)) == NULL)
+	{
+		fprintf(stderr, "cannot create %d block cache\n", cache_blocks);
+		exit(1);
+	}
+	fs_ops.init(NULL);
+
+	struct statvfs st;
+	fs_ops.statfs("/", &st);
+	long free_before = st.f_bfree;
+
+	// set up the shared directory and the file all threads read
+	unsigned rnd = 1;
+	if (fs_ops.mkdir("/stress", 040755) < 0 || fs_ops.mkdir("/stress/shared", 040755) < 0 ||
+		write_file("/stress/shared_file", 0, SHARED_SIZE, &rnd) < 0 ||
+		fs_ops.open("/stress/shared_file", &shared_fi) < 0)
+	{
+		fprintf(stderr, "cannot create /stress\n");
+		exit(1);
+	}
+
+	pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+	for (long i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	fs_ops.release("/stress/shared_file", &shared_fi);
+
+	// all blocks must be free again once everything is removed
+	int res = remove_dir("/stress");
+	if (res < 0)
+		fail(-1, "remove", "/stress", res);
+	fs_ops.statfs("/", &st);
+	if ((long)st.f_bfree != free_before)
+	{
+		fprintf(stderr, "free blocks: %ld before, %ld after\n", free_before, (long)st.f_bfree);
+		errors++;
+	}
+
+	fs_ops.destroy(NULL);
+	disk->ops->close(disk);
+	printf("stress: %d threads, %d iterations: %s\n", nthreads, iterations,
+		   errors ? "FAILED" : "OK");
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * file:        tracestat.c
+ * description: offline analysis of CS492 block traces
+ *
+ * Reads a trace written by the tracing block device (fsx492 -trace,
+ * fsx492-bench -T) and prints where the I/O went in the file system:
+ * the blocks read and written in each region (superblock, bitmaps,
+ * inodes, journal, data), the read and write amplification, and a
+ * heatmap of each region over time.
+ *
+ * Amplification is the blocks transferred in all regions per block of
+ * file data transferred, so write amplification 1.0 means that no
+ * metadata was written, and each 0.1 above it is one block of bitmap,
+ * inode, directory, indirect or journal writes per ten data blocks.
+ * Directory and indirect blocks are in the data region, and count as
+ * data here.
+ *
+ * usage: fsx492-tracestat [options] trace
+ *   -r rows      time slices in each heatmap (20)
+ *   -c columns   block ranges in each heatmap (64)
+ *   -o ops       operations in the heatmaps: r, w or rw (rw)
+ *   -l           list the records instead
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../fsx492.h"
+#include "../trace.h"
+
+/** regions of the file system */
+enum region
+{
+	R_SUPER,
+	R_BITMAP,
+	R_INODE,
+	R_JOURNAL,
+	R_DATA,
+	N_REGIONS
+};
+
+static const char *region_names[N_REGIONS] = {"super", "bitmap", "inode", "journal", "data"};
+
+static const char *op_names[] = {"read", "write", "flush", "sync", "prefetch"};
+enum { N_OPS = sizeof(op_names) / sizeof(op_names[0]) };
+
+/** layout of the file system, from the trace header */
+static uint32_t num_blocks, inode_start, data_start, journal_start, journal_len;
+
+/** blocks in each region */
+static uint32_t region_len[N_REGIONS];
+
+/** heatmap intensities, lowest to highest */
+static const char shades[] = " .:-=+*#%@";
+
+/**
+ * Find the layout of the file system from the header.
+ *
+ * @param hdr: the trace header
+ * @return: 0 if the header holds a file system, -1 otherwise
+ */
+static int read_layout(const struct trace_header *hdr)
+{
+	struct fs_super sb;
+	memset(&sb, 0, sizeof(sb));
+	memcpy(&sb, hdr->super, sizeof(hdr->super));
+	if (sb.magic != FS_MAGIC)
+		return -1;
+	num_blocks = hdr->num_blocks;
+	inode_start = 1 + sb.inode_map_sz + sb.block_map_sz;
+	data_start = inode_start + sb.inode_region_sz;
+	journal_start = sb.journal_start;
+	journal_len = sb.journal_len;
+	if (data_start + journal_len > num_blocks)
+		return -1;
+	region_len[R_SUPER] = 1;
+	region_len[R_BITMAP] = inode_start - 1;
+	region_len[R_INODE] = data_start - inode_start;
+	region_len[R_JOURNAL] = journal_len;
+	region_len[R_DATA] = num_blocks - data_start - journal_len;
+	return 0;
+}
+
+/**
+ * Get the region holding a block, and the offset of the block in it.
+ * The data region is numbered as if the journal were not in it.
+ *
+ * @param blk: the block number
+ * @param off: set to the offset of the block in its region
+ * @return: the region
+ */
+static int region_of(uint32_t blk, uint32_t *off)
+{
+	if (blk == 0)
+	{
+		*off = 0;
+		return R_SUPER;
+	}
+	if (blk < inode_start)
+	{
+		*off = blk - 1;
+		return R_BITMAP;
+	}
+	if (blk < data_start)
+	{
+		*off = blk - inode_start;
+		return R_INODE;
+	}
+	if (blk >= journal_start && blk < journal_start + journal_len)
+	{
+		*off = blk - journal_start;
+		return R_JOURNAL;
+	}
+	*off = blk - data_start - (blk >= journal_start + journal_len && journal_len > 0 ? journal_len : 0);
+	return R_DATA;
+}
+
+/**
+ * Read a trace file.
+ *
+ * @param path: the trace file
+ * @param hdr: set to the header
+ * @param nrecs: set to the number of records
+ * @return: the records, or exits if cannot read the trace
+ */
+static struct trace_rec *read_trace(const char *path, struct trace_header *hdr, long *nrecs)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	if (fread(hdr, sizeof(*hdr), 1, fp) != 1 || hdr->magic != TRACE_MAGIC)
+	{
+		fprintf(stderr, "%s: not a trace file\n", path);
+		exit(1);
+	}
+	if (hdr->version != TRACE_VERSION || hdr->block_size != FS_BLOCK_SIZE)
+	{
+		fprintf(stderr, "%s: trace version %u with %u byte blocks not supported\n",
+				path, hdr->version, hdr->block_size);
+		exit(1);
+	}
+
+	long n = 0, max = 4096;
+	struct trace_rec *recs = malloc(max * sizeof(*recs));
+	size_t got;
+	while (recs != NULL && (got = fread(&recs[n], sizeof(*recs), max - n, fp)) > 0)
+	{
+		n += got;
+		if (n == max)
+			recs = realloc(recs, (max *= 2) * sizeof(*recs));
+	}
+	if (recs == NULL || ferror(fp))
+	{
+		fprintf(stderr, "cannot read %s: %s\n", path, recs == NULL ? "out of memory" : strerror(errno));
+		exit(1);
+	}
+	fclose(fp);
+	*nrecs = n;
+	return recs;
+}
+
+/**
+ * Print the records, one per line.
+ *
+ * @param recs: the records
+ * @param nrecs: the number of records
+ */
+static void list_trace(const struct trace_rec *recs, long nrecs)
+{
+	for (long i = 0; i < nrecs; i++)
+	{
+		uint32_t op = recs[i].op_n >> TRACE_OP_SHIFT, n = recs[i].op_n & TRACE_N_MASK, off;
+		printf("%12.6f %-8s %8u %6u  %s\n", recs[i].ns / 1e9,
+			   op < N_OPS ? op_names[op] : "?", recs[i].blk, n,
+			   op == TRACE_FLUSH ? "" : region_names[region_of(recs[i].blk, &off)]);
+	}
+}
+
+/**
+ * Print a heatmap of the blocks of one region read or written over
+ * time. Each row is a slice of the trace's duration and each column a
+ * range of the region's blocks; the shade of a cell is the number of
+ * blocks transferred in it, on a log scale from the busiest cell.
+ *
+ * @param r: the region
+ * @param cells: rows * cols counts
+ * @param rows: the number of rows
+ * @param cols: the number of columns
+ * @param duration: seconds covered by the rows
+ */
+static void print_heatmap(int r, const long *cells, int rows, int cols, double duration)
+{
+	long max = 0;
+	for (int i = 0; i < rows * cols; i++)
+		max = cells[i] > max ? cells[i] : max;
+	if (max == 0)
+		return;
+	double per_col = (double)region_len[r] / cols;
+	printf("\n%s: %u blocks, %.1f per column, busiest cell %ld blocks\n",
+		   region_names[r], region_len[r], per_col, max);
+	for (int row = 0; row < rows; row++)
+	{
+		printf("%9.3fs |", duration * row / rows);
+		for (int col = 0; col < cols; col++)
+		{
+			long v = cells[row * cols + col];
+			int shade = v == 0 ? 0 : 1 + (int)(log(v) / log(max + 1) * (sizeof(shades) - 3) + 0.5);
+			putchar(shades[shade]);
+		}
+		printf("|\n");
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-r rows] [-c columns] [-o r|w|rw] [-l] trace\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int rows = 20, cols = 64, list = 0, opt;
+	int show[N_OPS] = {0};
+	show[TRACE_READ] = show[TRACE_WRITE] = 1;
+	while ((opt = getopt(argc, argv, "r:c:o:l")) != -1)
+	{
+		switch (opt)
+		{
+		case 'r': rows = atoi(optarg); break;
+		case 'c': cols = atoi(optarg); break;
+		case 'o':
+			show[TRACE_READ] = strchr(optarg, 'r') != NULL;
+			show[TRACE_WRITE] = strchr(optarg, 'w') != NULL;
+			break;
+		case 'l': list = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || rows < 1 || cols < 1)
+		usage(argv[0]);
+
+	struct trace_header hdr;
+	long nrecs;
+	struct trace_rec *recs = read_trace(argv[optind], &hdr, &nrecs);
+	if (read_layout(&hdr) < 0)
+	{
+		fprintf(stderr, "%s: no file system layout in trace header\n", argv[optind]);
+		exit(1);
+	}
+	if (list)
+	{
+		list_trace(recs, nrecs);
+		return 0;
+	}
+
+	// requests and blocks by operation, and blocks by region
+	long op_reqs[N_OPS] = {0}, op_blks[N_OPS] = {0};
+	long reads[N_REGIONS] = {0}, writes[N_REGIONS] = {0};
+	long touched_r[N_REGIONS] = {0}, touched_w[N_REGIONS] = {0};
+	unsigned char *seen = calloc(num_blocks, 1); // bit 0 read, bit 1 written
+	long *cells[N_REGIONS];
+	int ncols[N_REGIONS];
+	for (int r = 0; r < N_REGIONS; r++)
+	{
+		ncols[r] = region_len[r] < (uint32_t)cols ? (int)region_len[r] : cols;
+		cells[r] = calloc((size_t)rows * (ncols[r] > 0 ? ncols[r] : 1), sizeof(long));
+	}
+	uint64_t end_ns = nrecs > 0 ? recs[nrecs - 1].ns + 1 : 1;
+
+	for (long i = 0; i < nrecs; i++)
+	{
+		uint32_t op = recs[i].op_n >> TRACE_OP_SHIFT, n = recs[i].op_n & TRACE_N_MASK;
+		if (op >= N_OPS)
+			continue;
+		op_reqs[op]++;
+		op_blks[op] += n;
+		if (op != TRACE_READ && op != TRACE_WRITE)
+			continue;
+		int row = (int)(recs[i].ns * rows / end_ns);
+		for (uint32_t blk = recs[i].blk; blk < recs[i].blk + n && blk < num_blocks; blk++)
+		{
+			uint32_t off;
+			int r = region_of(blk, &off);
+			int bit = op == TRACE_READ ? 1 : 2;
+			(op == TRACE_READ ? reads : writes)[r]++;
+			if (!(seen[blk] & bit))
+				(op == TRACE_READ ? touched_r : touched_w)[r]++;
+			seen[blk] |= bit;
+			if (show[op])
+				cells[r][row * ncols[r] + (int)((uint64_t)off * ncols[r] / region_len[r])]++;
+		}
+	}
+
+	double duration = nrecs > 0 ? recs[nrecs - 1].ns / 1e9 : 0;
+	printf("%s: %ld records over %.3f s, %u blocks\n", argv[optind], nrecs, duration, num_blocks);
+	printf("\n%-9s %10s %12s\n", "op", "requests", "blocks");
+	for (int op = 0; op < N_OPS; op++)
+		printf("%-9s %10ld %12ld\n", op_names[op], op_reqs[op], op_blks[op]);
+
+	long total_r = 0, total_w = 0;
+	printf("\n%-9s %10s %12s %12s %12s %12s %9s\n", "region", "blocks",
+		   "read", "distinct", "written", "distinct", "rewrites");
+	for (int r = 0; r < N_REGIONS; r++)
+	{
+		total_r += reads[r];
+		total_w += writes[r];
+		printf("%-9s %10u %12ld %12ld %12ld %12ld %9.2f\n", region_names[r], region_len[r],
+			   reads[r], touched_r[r], writes[r], touched_w[r],
+			   touched_w[r] > 0 ? (double)writes[r] / touched_w[r] : 0.0);
+	}
+
+	printf("\nread amplification:  ");
+	if (reads[R_DATA] > 0)
+		printf("%.3f (%ld blocks read per %ld data blocks)\n",
+			   (double)total_r / reads[R_DATA], total_r, reads[R_DATA]);
+	else
+		printf("- (%ld blocks read, no data blocks)\n", total_r);
+	printf("write amplification: ");
+	if (writes[R_DATA] > 0)
+		printf("%.3f (%ld blocks written per %ld data blocks)\n",
+			   (double)total_w / writes[R_DATA], total_w, writes[R_DATA]);
+	else
+		printf("- (%ld blocks written, no data blocks)\n", total_w);
+	if (writes[R_DATA] > 0)
+		printf("metadata writes per data block: bitmap %.3f, inode %.3f, journal %.3f, super %.3f\n",
+			   (double)writes[R_BITMAP] / writes[R_DATA], (double)writes[R_INODE] / writes[R_DATA],
+			   (double)writes[R_JOURNAL] / writes[R_DATA], (double)writes[R_SUPER] / writes[R_DATA]);
+
+	for (int r = 0; r < N_REGIONS; r++)
+	{
+		if (ncols[r] > 0)
+			print_heatmap(r, cells[r], rows, ncols[r], duration);
+		free(cells[r]);
+	}
+	free(seen);
+	free(recs);
+	return 0;
+}
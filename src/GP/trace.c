@@ -0,0 +1,343 @@
+/*
+ * file:        trace.c
+ * description: block device recording a trace of the requests to another
+ *
+ * Each request is recorded as it is passed down, before the lower
+ * device handles it. Vectored requests are recorded as one record per
+ * run of consecutive blocks, as the lower device would combine them.
+ * The header holds the superblock as last written, so the layout is
+ * that of the file system at the end of the trace, with any journal
+ * added after it started.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "blkdev.h"
+#include "trace.h"
+#include "fsx492.h"
+
+/** number of records buffered before they are written */
+enum { TRACE_BUF_RECS = 4096 };
+
+/** definition of tracing block device */
+struct trace_dev
+{
+	struct blkdev *lower;	 // traced block device
+	struct blkdev_ops ops;	 // operations, those of lower that are optional
+	struct trace_header hdr; // header, rewritten on close
+	FILE *fp;				 // trace file, or NULL once tracing has stopped
+	char *path;				 // path of the trace file
+	struct timespec start;	 // when tracing started
+	struct trace_rec *recs;	 // buffered records
+	int nrecs;				 // number of buffered records
+	pthread_mutex_t lock;	 // protects hdr, fp, recs and nrecs
+};
+
+/**
+ * Write the buffered records to the trace file. The caller holds the
+ * lock. If they cannot be written, tracing stops.
+ * @param td: the tracing device
+ */
+static void trace_write_recs(struct trace_dev *td)
+{
+	if (td->fp != NULL && td->nrecs > 0 &&
+		fwrite(td->recs, sizeof(struct trace_rec), td->nrecs, td->fp) != (size_t)td->nrecs)
+	{
+		fprintf(stderr, "trace: cannot write %s: %s; tracing stopped\n", td->path, strerror(errno));
+		fclose(td->fp);
+		td->fp = NULL;
+	}
+	td->nrecs = 0;
+}
+
+/**
+ * Record a run of blocks.
+ * @param td: the tracing device
+ * @param op: the operation
+ * @param blk: the first block
+ * @param nblks: the number of blocks
+ */
+static void trace_rec(struct trace_dev *td, int op, int blk, int nblks)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&td->lock);
+	if (td->fp != NULL)
+	{
+		struct trace_rec *r = &td->recs[td->nrecs++];
+		r->ns = (now.tv_sec - td->start.tv_sec) * 1000000000ULL + now.tv_nsec - td->start.tv_nsec;
+		r->blk = blk;
+		r->op_n = ((uint32_t)op << TRACE_OP_SHIFT) | ((uint32_t)nblks & TRACE_N_MASK);
+		if (td->nrecs == TRACE_BUF_RECS)
+		{
+			trace_write_recs(td);
+		}
+	}
+	pthread_mutex_unlock(&td->lock);
+}
+
+/**
+ * Keep the superblock fields of the header up to date when block 0 is
+ * written.
+ * @param td: the tracing device
+ * @param blk: the block written
+ * @param buf: the contents of the block
+ */
+static void trace_super(struct trace_dev *td, int blk, const void *buf)
+{
+	if (blk == 0 && ((const struct fs_super *)buf)->magic == FS_MAGIC)
+	{
+		pthread_mutex_lock(&td->lock);
+		memcpy(td->hdr.super, buf, sizeof(td->hdr.super));
+		pthread_mutex_unlock(&td->lock);
+	}
+}
+
+/**
+ * Record a list of blocks as runs of consecutive blocks.
+ * @param td: the tracing device
+ * @param op: the operation
+ * @param blks: the block numbers
+ * @param nblks: the number of blocks
+ */
+static void trace_list(struct trace_dev *td, int op, const int *blks, int nblks)
+{
+	for (int i = 0, n; i < nblks; i += n)
+	{
+		for (n = 1; i + n < nblks && blks[i + n] == blks[i] + n; n++)
+			;
+		trace_rec(td, op, blks[i], n);
+	}
+}
+
+/**
+ * Record a vector of blocks as runs of consecutive blocks.
+ * @param td: the tracing device
+ * @param op: the operation
+ * @param vec: the blocks and buffers
+ * @param nvec: the number of entries in vec
+ */
+static void trace_vec(struct trace_dev *td, int op, const struct blkvec *vec, int nvec)
+{
+	for (int i = 0, n; i < nvec; i += n)
+	{
+		for (n = 1; i + n < nvec && vec[i + n].blk == vec[i].blk + n; n++)
+			;
+		trace_rec(td, op, vec[i].blk, n);
+	}
+}
+
+static int trace_num_blocks(struct blkdev *dev)
+{
+	struct trace_dev *td = dev->private;
+	return td->lower->ops->num_blocks(td->lower);
+}
+
+static int trace_read(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct trace_dev *td = dev->private;
+	trace_rec(td, TRACE_READ, first_blk, nblks);
+	return td->lower->ops->read(td->lower, first_blk, nblks, buf);
+}
+
+static int trace_write(struct blkdev *dev, int first_blk, int nblks, void *buf)
+{
+	struct trace_dev *td = dev->private;
+	trace_rec(td, TRACE_WRITE, first_blk, nblks);
+	trace_super(td, first_blk, buf);
+	return td->lower->ops->write(td->lower, first_blk, nblks, buf);
+}
+
+/**
+ * Flush the block device, and write the buffered records, so the
+ * trace is complete up to the flush.
+ */
+static int trace_flush(struct blkdev *dev, int first_blk, int nblks)
+{
+	struct trace_dev *td = dev->private;
+	trace_rec(td, TRACE_FLUSH, first_blk, nblks);
+	pthread_mutex_lock(&td->lock);
+	trace_write_recs(td);
+	if (td->fp != NULL)
+	{
+		fflush(td->fp);
+	}
+	pthread_mutex_unlock(&td->lock);
+	return td->lower->ops->flush(td->lower, first_blk, nblks);
+}
+
+/**
+ * Close the lower device, then write the remaining records and the
+ * final header, and close the trace file.
+ */
+static void trace_close(struct blkdev *dev)
+{
+	struct trace_dev *td = dev->private;
+	td->lower->ops->close(td->lower);
+	trace_write_recs(td);
+	if (td->fp != NULL && (fseek(td->fp, 0, SEEK_SET) != 0 ||
+						   fwrite(&td->hdr, sizeof(td->hdr), 1, td->fp) != 1 ||
+						   fclose(td->fp) != 0))
+	{
+		fprintf(stderr, "trace: cannot write %s: %s\n", td->path, strerror(errno));
+	}
+	pthread_mutex_destroy(&td->lock);
+	free(td->recs);
+	free(td->path);
+	free(td);
+	free(dev);
+}
+
+static void *trace_map(struct blkdev *dev, int blk)
+{
+	struct trace_dev *td = dev->private;
+	return td->lower->ops->map(td->lower, blk);
+}
+
+static int trace_readv(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct trace_dev *td = dev->private;
+	trace_vec(td, TRACE_READ, vec, nvec);
+	return td->lower->ops->readv(td->lower, vec, nvec);
+}
+
+static int trace_writev(struct blkdev *dev, struct blkvec *vec, int nvec)
+{
+	struct trace_dev *td = dev->private;
+	trace_vec(td, TRACE_WRITE, vec, nvec);
+	for (int i = 0; i < nvec; i++)
+	{
+		trace_super(td, vec[i].blk, vec[i].buf);
+	}
+	return td->lower->ops->writev(td->lower, vec, nvec);
+}
+
+static int trace_submit(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct trace_dev *td = dev->private;
+	for (int i = 0; i < nreqs; i++)
+	{
+		trace_rec(td, reqs[i].write ? TRACE_WRITE : TRACE_READ, reqs[i].first_blk, reqs[i].num_blks);
+		if (reqs[i].write)
+		{
+			trace_super(td, reqs[i].first_blk, reqs[i].buf);
+		}
+	}
+	return td->lower->ops->submit(td->lower, reqs, nreqs);
+}
+
+static int trace_complete(struct blkdev *dev, struct blkreq *reqs, int nreqs)
+{
+	struct trace_dev *td = dev->private;
+	return td->lower->ops->complete(td->lower, reqs, nreqs);
+}
+
+static int trace_prefetch(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct trace_dev *td = dev->private;
+	int n = td->lower->ops->prefetch(td->lower, blks, nblks);
+	trace_list(td, TRACE_PREFETCH, blks, n);
+	return n;
+}
+
+static int trace_fd(struct blkdev *dev)
+{
+	struct trace_dev *td = dev->private;
+	return td->lower->ops->fd(td->lower);
+}
+
+static int trace_sync(struct blkdev *dev, const int *blks, int nblks)
+{
+	struct trace_dev *td = dev->private;
+	trace_list(td, TRACE_SYNC, blks, nblks);
+	return td->lower->ops->sync(td->lower, blks, nblks);
+}
+
+/** Operations on this block device */
+static const struct blkdev_ops trace_ops = {
+	.num_blocks = trace_num_blocks,
+	.read = trace_read,
+	.write = trace_write,
+	.flush = trace_flush,
+	.close = trace_close,
+	.map = trace_map,
+	.readv = trace_readv,
+	.writev = trace_writev,
+	.submit = trace_submit,
+	.complete = trace_complete,
+	.prefetch = trace_prefetch,
+	.fd = trace_fd,
+	.sync = trace_sync};
+
+/**
+ * Create a tracing block device. Blocks read in place through map and
+ * data spliced through fd bypass the device, and are not recorded.
+ *
+ * @param lower: the block device to trace
+ * @param tracefile: the path of the trace file
+ * @return: the block device, or NULL if cannot create the trace file
+ */
+struct blkdev *trace_create(struct blkdev *lower, const char *tracefile)
+{
+	if (lower == NULL)
+	{
+		return NULL;
+	}
+	FILE *fp = fopen(tracefile, "wb");
+	if (fp == NULL)
+	{
+		return NULL;
+	}
+	struct blkdev *dev = malloc(sizeof(*dev));
+	struct trace_dev *td = calloc(1, sizeof(*td));
+	if (dev == NULL || td == NULL ||
+		(td->recs = malloc(TRACE_BUF_RECS * sizeof(struct trace_rec))) == NULL ||
+		(td->path = strdup(tracefile)) == NULL)
+	{
+		if (td != NULL)
+		{
+			free(td->recs);
+		}
+		free(td);
+		free(dev);
+		fclose(fp);
+		return NULL;
+	}
+
+	struct trace_header *hdr = &td->hdr;
+	hdr->magic = TRACE_MAGIC;
+	hdr->version = TRACE_VERSION;
+	hdr->block_size = BLOCK_SIZE;
+	hdr->num_blocks = lower->ops->num_blocks(lower);
+	hdr->start_sec = time(NULL);
+	char sb[BLOCK_SIZE];
+	if (lower->ops->read(lower, 0, 1, sb) == SUCCESS)
+	{
+		memcpy(hdr->super, sb, sizeof(hdr->super));
+	}
+	if (fwrite(hdr, sizeof(*hdr), 1, fp) != 1)
+	{
+		free(td->path);
+		free(td->recs);
+		free(td);
+		free(dev);
+		fclose(fp);
+		return NULL;
+	}
+	td->lower = lower;
+	td->fp = fp;
+	clock_gettime(CLOCK_MONOTONIC, &td->start);
+	pthread_mutex_init(&td->lock, NULL);
+
+	td->ops = trace_ops;
+	blkdev_mask_ops(lower->ops, &td->ops);
+	dev->ops = &td->ops;
+	dev->private = td;
+	return dev;
+}
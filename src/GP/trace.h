@@ -0,0 +1,54 @@
+/*
+ * file:        trace.h
+ * description: block device recording a trace of the requests to another
+ *
+ * A trace file is a trace_header followed by one trace_rec for each
+ * run of consecutive blocks read, written, flushed, synced or
+ * prefetched, in the order the requests were made. Fields are in host
+ * byte order.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include "blkdev.h"
+
+enum { TRACE_MAGIC = 0x54523439, /* "TR49" */ TRACE_VERSION = 1 };
+
+/** operations recorded */
+enum trace_op { TRACE_READ, TRACE_WRITE, TRACE_FLUSH, TRACE_SYNC, TRACE_PREFETCH };
+
+/** trace file header */
+struct trace_header {
+	uint32_t magic;		 /* TRACE_MAGIC */
+	uint32_t version;	 /* TRACE_VERSION */
+	uint32_t block_size; /* bytes per block */
+	uint32_t num_blocks; /* blocks in the device */
+	uint64_t start_sec;	 /* wall clock time of the start, in seconds */
+	uint32_t super[8];	 /* superblock fields, as block 0 was last written */
+};
+
+/** one request, or one run of blocks of a vectored request */
+struct trace_rec {
+	uint64_t ns;	/* nanoseconds since the start */
+	uint32_t blk;	/* first block */
+	uint32_t op_n;	/* operation in the top 4 bits, number of blocks below */
+};
+
+enum { TRACE_OP_SHIFT = 28, TRACE_N_MASK = (1 << TRACE_OP_SHIFT) - 1 };
+
+/*
+ * Create a block device that passes every request to a lower device
+ * and records it in a trace file. Records are buffered, and written
+ * when the buffer fills and when the device is flushed or closed.
+ * Closing the device closes the lower device. If the trace cannot be
+ * written, tracing stops and requests go on.
+ *
+ * @param lower: the block device to trace
+ * @param tracefile: the path of the trace file, created or truncated
+ * @return: the block device, or NULL if cannot create the trace file
+ */
+extern struct blkdev *trace_create(struct blkdev *lower, const char *tracefile);
+
+#endif /* TRACE_H_ */